@@ -0,0 +1,314 @@
+#include "common.h"
+#include "glib.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+
+// Seconds a handshake can take before being counted as failed
+#define AUTH_BENCH_TIMEOUT 10
+
+// Step of a simulated digital engine
+typedef enum {
+  PHASE_CONNECTING,      // Waiting for the TCP connection
+  PHASE_WAITING_ACK,     // ENQ and STX sent, waiting for the ACK of the ENQ
+  PHASE_WAITING_SESSION, // Waiting for the STX reply with the session
+} AUTH_PHASE;
+
+// Handshake in progress
+typedef struct {
+  int fd; // -1 if the slot is free
+  int id; // Id proposed to the central
+  AUTH_PHASE phase;
+  double start; // Moment the phase started, in ms
+  double begin; // Moment the handshake started, in ms
+  AuthBuffer in;
+} Handshake;
+
+// Latencies (ms) of a phase of all the handshakes
+typedef struct {
+  const char *name;
+  double *samples;
+  int count;
+} PhaseLatencies;
+
+Address central;
+int total, concurrency, firstId;
+
+/// @brief Parses the arguments passed to the program. Each handshake proposes a different id, from
+/// first id on, so there can't be more than MAX_TAXIS - first id. By default, all of them are used
+///
+/// @param argc Number of arguments
+/// @param argv Array of arguments
+void checkArguments(int argc, char *argv[]);
+
+/// @brief Gets the current time in milliseconds from an arbitrary point
+///
+/// @return double Current time in milliseconds
+double nowMs();
+
+/// @brief Opens the handshakes against the central, keeping concurrency of them in progress, and
+/// reports the results. Every accepted handshake leaves a connected taxi in the central, whose id is
+/// refused until it's dropped as a stray, so the central must be restarted (or left a few seconds
+/// to catch the strays) before running it again with the same ids
+void runBench();
+
+/// @brief Starts a non-blocking connection to the central
+///
+/// @param epollFd Event loop of the benchmark
+/// @param h Free slot where the handshake is stored
+/// @param id Id proposed to the central
+/// @param slot Index of the slot, used as the tag of its events
+/// @return true The connection is in progress
+/// @return false It couldn't be started
+bool startHandshake(int epollFd, Handshake *h, int id, int slot);
+
+/// @brief Advances a handshake after an event of its socket
+///
+/// @param epollFd Event loop of the benchmark
+/// @param h Handshake whose socket is ready
+/// @param slot Index of the slot
+/// @param latencies Latencies of the connect, ENQ -> ACK and STX -> session phases
+/// @return int 0 if it's still in progress, 1 if the central accepted the id, 2 if it rejected it
+/// and -1 if it failed
+int advanceHandshake(int epollFd, Handshake *h, int slot, PhaseLatencies latencies[3]);
+
+/// @brief Logs the percentiles of a phase
+///
+/// @param latencies Latencies of the phase
+void reportPhase(PhaseLatencies *latencies);
+
+int main(int argc, char *argv[]) {
+  g_log_set_default_handler(log_handler, NULL);
+  checkArguments(argc, argv);
+  runBench();
+  return 0;
+}
+
+void checkArguments(int argc, char *argv[]) {
+  char usage[120];
+
+  sprintf(usage, "Usage: %s <central IP:port> [handshakes] [concurrency] [first id]", argv[0]);
+
+  if (argc < 2) {
+    g_error("%s", usage);
+  }
+
+  if (sscanf(argv[1], "%[^:]:%d", central.ip, &central.port) != 2)
+    g_error("Invalid central address. %s", usage);
+
+  firstId = argc > 4 ? atoi(argv[4]) : 0;
+  total = argc > 2 ? atoi(argv[2]) : MAX_TAXIS - firstId;
+  concurrency = argc > 3 ? atoi(argv[3]) : 1000;
+
+  if (total <= 0 || concurrency <= 0 || firstId < 0) {
+    g_error("%s", usage);
+  }
+
+  if (firstId + total > MAX_TAXIS)
+    g_error("Invalid ids, the last one must be lower than %i. %s", MAX_TAXIS, usage);
+
+  if (concurrency > total)
+    concurrency = total;
+}
+
+double nowMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+bool startHandshake(int epollFd, Handshake *h, int id, int slot) {
+  struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(central.port)};
+  struct epoll_event event = {.events = EPOLLOUT, .data.u32 = slot};
+
+  *h = (Handshake){.fd = -1, .id = id, .phase = PHASE_CONNECTING};
+  h->begin = h->start = nowMs();
+
+  if (inet_pton(AF_INET, central.ip, &address.sin_addr) != 1)
+    g_error("Invalid central IP %s", central.ip);
+
+  h->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (h->fd == -1) {
+    g_warning("Error opening socket: %s", strerror(errno));
+    return false;
+  }
+
+  if ((connect(h->fd, (struct sockaddr *)&address, sizeof(address)) == -1 &&
+       errno != EINPROGRESS) ||
+      epoll_ctl(epollFd, EPOLL_CTL_ADD, h->fd, &event) == -1) {
+    g_warning("Error connecting to central: %s", strerror(errno));
+    close(h->fd);
+    h->fd = -1;
+    return false;
+  }
+
+  return true;
+}
+
+int advanceHandshake(int epollFd, Handshake *h, int slot, PhaseLatencies latencies[3]) {
+  unsigned char buffer[2 * MAX_AUTH_FRAME_SIZE];
+  unsigned char proposal[4] = {h->id, h->id >> 8, h->id >> 16, h->id >> 24};
+  struct epoll_event event = {.events = EPOLLIN, .data.u32 = slot};
+  AuthFrame frame;
+  socklen_t length = sizeof(int);
+  int error = 0, size, status;
+  ssize_t n;
+
+  if (h->phase == PHASE_CONNECTING) {
+    if (getsockopt(h->fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0)
+      return -1;
+    latencies[0].samples[latencies[0].count++] = nowMs() - h->start;
+
+    // Same as a digital engine: ENQ and STX in a single write
+    size = putAuthFrame(buffer, ENQ, NULL, 0);
+    size += putAuthFrame(buffer + size, STX, proposal, sizeof(proposal));
+    h->start = nowMs();
+    if (write(h->fd, buffer, size) != size || epoll_ctl(epollFd, EPOLL_CTL_MOD, h->fd, &event))
+      return -1;
+    h->phase = PHASE_WAITING_ACK;
+    return 0;
+  }
+
+  n = readAuthBuffer(h->fd, &h->in);
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+    return -1;
+
+  while ((status = nextAuthFrame(&h->in, &frame)) == 1) {
+    if (h->phase == PHASE_WAITING_ACK) {
+      if (frame.type != ACK && frame.type != NACK)
+        return -1;
+      // Both phases are measured from the write, since ENQ and STX are sent together
+      latencies[1].samples[latencies[1].count++] = nowMs() - h->start;
+      h->phase = PHASE_WAITING_SESSION;
+      continue;
+    }
+
+    if (frame.type != STX || frame.size != AUTH_STX_REPLY_SIZE)
+      return -1;
+    latencies[2].samples[latencies[2].count++] = nowMs() - h->start;
+
+    size = putAuthFrame(buffer, EOT, NULL, 0);
+    write(h->fd, buffer, size);
+    return frame.payload[0] == ACK ? 1 : 2;
+  }
+
+  return status == -1 ? -1 : 0;
+}
+
+/// @brief Compares two latencies, for qsort
+///
+/// @param a First latency
+/// @param b Second latency
+/// @return int Negative, zero or positive if a is lower, equal or greater than b
+int compareLatencies(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+void reportPhase(PhaseLatencies *latencies) {
+  double *s = latencies->samples;
+  int n = latencies->count;
+
+  if (n == 0) {
+    g_message("%-16s no samples", latencies->name);
+    return;
+  }
+
+  qsort(s, n, sizeof(double), compareLatencies);
+  g_message("%-16s p50 %8.2f ms  p99 %8.2f ms  p999 %8.2f ms  max %8.2f ms", latencies->name,
+            s[(int)(0.5 * (n - 1))], s[(int)(0.99 * (n - 1))], s[(int)(0.999 * (n - 1))],
+            s[n - 1]);
+}
+
+void runBench() {
+  Handshake *handshakes = malloc(concurrency * sizeof(Handshake));
+  struct epoll_event events[64];
+  PhaseLatencies latencies[3] = {
+      {.name = "connect"}, {.name = "ENQ -> ACK"}, {.name = "STX -> session"}};
+  int epollFd = epoll_create1(0);
+  int started = 0, finished = 0, accepted = 0, rejected = 0, failed = 0;
+  int ready, slot, result;
+  double begin, elapsed, lastSweep;
+
+  for (int i = 0; i < 3; i++)
+    latencies[i].samples = malloc(total * sizeof(double));
+  if (!handshakes || !latencies[0].samples || !latencies[1].samples || !latencies[2].samples)
+    g_error("Error allocating memory for %i handshakes", total);
+  if (epollFd == -1)
+    g_error("Error creating the event loop: %s", strerror(errno));
+
+  g_message("Running %i handshakes against %s:%i, %i at a time", total, central.ip, central.port,
+            concurrency);
+
+  begin = lastSweep = nowMs();
+  for (slot = 0; slot < concurrency; slot++) {
+    if (!startHandshake(epollFd, &handshakes[slot], firstId + started++, slot)) {
+      failed++;
+      finished++;
+    }
+  }
+
+  while (finished < total) {
+    ready = epoll_wait(epollFd, events, 64, 1000);
+
+    for (int i = 0; i < ready; i++) {
+      slot = events[i].data.u32;
+      result = advanceHandshake(epollFd, &handshakes[slot], slot, latencies);
+      if (result == 0)
+        continue;
+
+      accepted += result == 1;
+      rejected += result == 2;
+      failed += result == -1;
+      finished++;
+      close(handshakes[slot].fd);
+      handshakes[slot].fd = -1;
+
+      while (started < total && handshakes[slot].fd == -1) {
+        if (!startHandshake(epollFd, &handshakes[slot], firstId + started++, slot)) {
+          failed++;
+          finished++;
+        }
+      }
+    }
+
+    if (nowMs() - lastSweep < 1000)
+      continue;
+    lastSweep = nowMs();
+
+    for (slot = 0; slot < concurrency; slot++) {
+      if (handshakes[slot].fd == -1 ||
+          lastSweep - handshakes[slot].begin < AUTH_BENCH_TIMEOUT * 1000)
+        continue;
+
+      g_warning("Handshake of id %i timed out", handshakes[slot].id);
+      close(handshakes[slot].fd);
+      handshakes[slot].fd = -1;
+      failed++;
+      finished++;
+
+      while (started < total && handshakes[slot].fd == -1) {
+        if (!startHandshake(epollFd, &handshakes[slot], firstId + started++, slot)) {
+          failed++;
+          finished++;
+        }
+      }
+    }
+  }
+
+  elapsed = nowMs() - begin;
+
+  g_message("%i handshakes in %.2f s: %.0f logins/s. Accepted %i, rejected %i, failed %i", total,
+            elapsed / 1000, accepted / (elapsed / 1000), accepted, rejected, failed);
+  for (int i = 0; i < 3; i++) {
+    reportPhase(&latencies[i]);
+    free(latencies[i].samples);
+  }
+
+  close(epollFd);
+  free(handshakes);
+}
@@ -0,0 +1,625 @@
+#include "common.h"
+#include "glib.h"
+#include "matching_module.h"
+#include "occupancy_module.h"
+#include "routing_module.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/// @brief Parses the arguments passed to the program and runs the selected benchmark
+///
+/// @param argc Number of arguments
+/// @param argv Array of arguments
+void checkArguments(int argc, char *argv[]);
+
+/// @brief Gets the current time in milliseconds from an arbitrary point
+///
+/// @return double Current time in milliseconds
+double nowMs();
+
+/// @brief Measures the time the matching engine takes to assign n customers to n taxis placed at
+/// random positions of the map
+///
+/// @param n Number of customers and taxis
+/// @param runs Number of times the assignment is solved
+void benchMatching(int n, int runs);
+
+/// @brief Packs an entity into an int the way the map was encoded before entities were widened to
+/// 64 bits. Coordinates must be below 32. Only kept as a baseline for benchEntities
+///
+/// @param entity Entity to be serialized
+/// @return int Serialized entity
+int serializeEntityLegacy(const Entity *entity);
+
+/// @brief Unpacks an entity packed with serializeEntityLegacy
+///
+/// @param dest Entity where the deserialized entity will be stored
+/// @param entity Serialized entity
+void deserializeEntityLegacy(Entity *dest, int entity);
+
+/// @brief Measures the time it takes to serialize and deserialize n random entities with the
+/// legacy 32 bit packer, with serializeEntity one by one and with the batch functions
+///
+/// @param n Number of entities
+/// @param runs Number of times each encoder goes through the entities
+void benchEntities(int n, int runs);
+
+/// @brief Moves one step towards a destination the way the digital engine did before the routing
+/// module: trying the 8 neighbours and keeping the one with the lowest sphericalDistance. Only
+/// kept as a baseline for benchRouting
+///
+/// @param from Current position
+/// @param to Destination
+/// @return Coordinate Next position
+Coordinate greedyStepLegacy(Coordinate from, Coordinate to);
+
+/// @brief Measures the time it takes to drive n taxis from random positions to random
+/// destinations step by step with the legacy greedy step and with the routing module, first in an
+/// empty map and then with a tenth of the cells blocked
+///
+/// @param n Number of trips
+/// @param runs Number of times each trip is driven
+void benchRouting(int n, int runs);
+
+/// @brief Measures how many cells the planners expand when closures change while n taxis drive to
+/// random destinations: repairing the route incrementally against planning it again from scratch
+///
+/// @param n Number of trips
+/// @param changes Number of cells around the taxi closed before each step. The ones closed before
+/// the previous step are opened again
+void benchClosures(int n, int changes);
+
+/// @brief Measures the time it takes to check the moves of n taxis driving to random destinations
+/// against the occupancy grid and the reservations, and against a scan of every taxi's position
+///
+/// @param n Number of taxis. At most MAX_TAXIS
+/// @param ticks Number of ticks. Every taxi tries to move once per tick
+void benchOccupancy(int n, int ticks);
+
+/// @brief Drives n pairs of taxis whose trips end on the same cell, once refusing every taken
+/// cell and once letting the taxis into their objective even if it's taken (see occupancyAdmits),
+/// and counts how many of them get there
+///
+/// @param n Number of pairs. At most MAX_TAXIS / 2
+/// @param ticks Maximum number of ticks. Every taxi tries to move once per tick
+void benchSharedGoals(int n, int ticks);
+
+int main(int argc, char *argv[]) {
+  g_log_set_default_handler(log_handler, NULL);
+  srand(time(NULL));
+  checkArguments(argc, argv);
+  return 0;
+}
+
+void checkArguments(int argc, char *argv[]) {
+  char usage[120];
+
+  sprintf(usage, "Usage: %s matching|entities|routing|closures|occupancy|sharedgoals [n] [runs]",
+          argv[0]);
+
+  if (argc < 2) {
+    g_error("%s", usage);
+  }
+
+  bool entities = strcmp(argv[1], "entities") == 0;
+  bool sharedGoals = strcmp(argv[1], "sharedgoals") == 0;
+  int n = argc > 2 ? atoi(argv[2]) : entities ? MAP_SIZE : 1000;
+  int runs = argc > 3 ? atoi(argv[3]) : entities ? 100000 : sharedGoals ? 4 * gridSize() : 5;
+
+  if (n <= 0 || runs <= 0) {
+    g_error("%s", usage);
+  }
+
+  if (strcmp(argv[1], "matching") == 0) {
+    benchMatching(n, runs);
+  } else if (entities) {
+    benchEntities(n, runs);
+  } else if (strcmp(argv[1], "routing") == 0) {
+    benchRouting(n, runs);
+  } else if (strcmp(argv[1], "closures") == 0) {
+    benchClosures(n, runs);
+  } else if (strcmp(argv[1], "occupancy") == 0) {
+    benchOccupancy(n, runs);
+  } else if (sharedGoals) {
+    benchSharedGoals(n, runs);
+  } else {
+    g_error("%s", usage);
+  }
+}
+
+double nowMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+void benchMatching(int n, int runs) {
+  Coordinate *customers = malloc(n * sizeof(Coordinate));
+  Coordinate *taxis = malloc(n * sizeof(Coordinate));
+  int *cost = malloc((size_t)n * n * sizeof(int));
+  int *assignment = malloc(n * sizeof(int));
+  double total = 0, worst = 0;
+
+  if (!customers || !taxis || !cost || !assignment)
+    g_error("Error allocating memory for %i x %i", n, n);
+
+  for (int r = 0; r < runs; r++) {
+    for (int i = 0; i < n; i++) {
+      customers[i] = (Coordinate){.x = rand() % gridSize(), .y = rand() % gridSize()};
+      taxis[i] = (Coordinate){.x = rand() % gridSize(), .y = rand() % gridSize()};
+    }
+
+    for (int c = 0; c < n; c++) {
+      for (int t = 0; t < n; t++)
+        cost[c * n + t] = sphericalDistance(&customers[c], &taxis[t]);
+    }
+
+    double start = nowMs();
+    long distance = solveAssignment(n, n, cost, assignment);
+    double elapsed = nowMs() - start;
+
+    total += elapsed;
+    if (elapsed > worst)
+      worst = elapsed;
+    g_message("Run %i: %i x %i solved in %.2f ms (total pickup distance %li)", r + 1, n, n,
+              elapsed, distance);
+  }
+
+  g_message("Matching %i x %i: %.2f ms on average, %.2f ms worst", n, n, total / runs, worst);
+
+  free(customers);
+  free(taxis);
+  free(cost);
+  free(assignment);
+}
+
+int serializeEntityLegacy(const Entity *entity) {
+  int res = 0;
+  res |= (entity->type & 0x07);
+  res |= (entity->status & 0x0F) << 3;
+  res |= (entity->coord.x & 0x1F) << 7;
+  res |= (entity->coord.y & 0x1F) << 12;
+  res |= (entity->id & 0x7F) << 17;
+  res |= ((entity->obj - 'a') & 0x7F) << 24;
+  res |= (entity->carryingCustomer & 0x01) << 31;
+
+  return res;
+}
+
+void deserializeEntityLegacy(Entity *dest, int entity) {
+  dest->type = entity & 0x07;
+  dest->status = (entity >> 3) & 0x0F;
+  dest->coord.x = (entity >> 7) & 0x1F;
+  dest->coord.y = (entity >> 12) & 0x1F;
+  dest->id = (entity >> 17) & 0x7F;
+  dest->obj = ((entity >> 24) & 0x7F) + 'a';
+  dest->carryingCustomer = (entity >> 31) & 0x01;
+}
+
+void benchEntities(int n, int runs) {
+  Entity *entities = malloc(n * sizeof(Entity));
+  Entity *decoded = malloc(n * sizeof(Entity));
+  int *legacy = malloc(n * sizeof(int));
+  int64_t *wide = malloc(n * sizeof(int64_t));
+  double start, legacyMs = 0, singleMs = 0, batchMs = 0;
+  long checksum = 0;
+
+  if (!entities || !decoded || !legacy || !wide)
+    g_error("Error allocating memory for %i entities", n);
+
+  for (int i = 0; i < n; i++) {
+    entities[i] = (Entity){.type = rand() % 3,
+                           .status = rand() % 8,
+                           .coord = {.x = rand() % gridSize(), .y = rand() % gridSize()},
+                           .id = rand() % MAX_TAXIS,
+                           .obj = 'a' + rand() % MAX_CUSTOMERS,
+                           .carryingCustomer = rand() % 2};
+  }
+
+  for (int r = 0; r < runs; r++) {
+    start = nowMs();
+    for (int i = 0; i < n; i++)
+      legacy[i] = serializeEntityLegacy(&entities[i]);
+    for (int i = 0; i < n; i++)
+      deserializeEntityLegacy(&decoded[i], legacy[i]);
+    legacyMs += nowMs() - start;
+    checksum += decoded[r % n].coord.x;
+
+    start = nowMs();
+    for (int i = 0; i < n; i++)
+      wide[i] = serializeEntity(&entities[i]);
+    for (int i = 0; i < n; i++)
+      deserializeEntity(&decoded[i], wide[i]);
+    singleMs += nowMs() - start;
+    checksum += decoded[r % n].coord.x;
+
+    start = nowMs();
+    serializeEntities(entities, wide, n);
+    deserializeEntities(wide, decoded, n);
+    batchMs += nowMs() - start;
+    checksum += decoded[r % n].coord.x;
+  }
+
+  for (int i = 0; i < n; i++) {
+    Entity *a = &entities[i], *b = &decoded[i];
+    if (a->type != b->type || a->status != b->status || a->coord.x != b->coord.x ||
+        a->coord.y != b->coord.y || a->id != b->id || a->obj != b->obj ||
+        a->carryingCustomer != b->carryingCustomer)
+      g_error("Entity %i changed after being serialized and deserialized", i);
+  }
+
+  // Each entity is serialized and deserialized once per run
+  double perEntity = 1000000.0 / ((double)n * runs);
+  g_message("Legacy 32 bit packer: %.2f ns per entity (only valid for maps up to 32x32)",
+            legacyMs * perEntity);
+  g_message("64 bit, one by one:   %.2f ns per entity", singleMs * perEntity);
+  g_message("64 bit, batch:        %.2f ns per entity", batchMs * perEntity);
+  g_debug("Checksum: %li", checksum);
+
+  free(entities);
+  free(decoded);
+  free(legacy);
+  free(wide);
+}
+
+Coordinate greedyStepLegacy(Coordinate from, Coordinate to) {
+  if (from.x == to.x && from.y == to.y)
+    return from;
+
+  int possibleMoves[8][2] = {
+      {1, 1}, {1, 0}, {1, -1}, {0, -1}, {-1, -1}, {-1, 0}, {-1, 1}, {0, 1},
+  };
+
+  Coordinate bestPos = {.x = -1, .y = -1};
+  int bestDistance = INT_MAX;
+  int size = gridSize();
+
+  for (int i = 0; i < 8; i++) {
+    Coordinate newPos = {.x = (from.x + possibleMoves[i][0]) % size,
+                         .y = (from.y + possibleMoves[i][1]) % size};
+
+    if (newPos.x < 0)
+      newPos.x += size;
+
+    if (newPos.y < 0)
+      newPos.y += size;
+
+    int distance = sphericalDistance(&newPos, &to);
+
+    if (distance < bestDistance) {
+      bestDistance = distance;
+      bestPos = newPos;
+    }
+  }
+
+  return bestPos;
+}
+
+/// @brief Drives every trip step by step until its destination
+///
+/// @param from Start of each trip
+/// @param to Destination of each trip
+/// @param n Number of trips
+/// @param routed Whether to use the routing module instead of the legacy greedy step
+/// @param steps Output argument. Steps taken by each trip, -1 if it couldn't reach its destination
+/// @return double Time taken, in ms
+double driveTrips(Coordinate *from, Coordinate *to, int n, bool routed, int *steps) {
+  Route *route = calloc(1, sizeof(Route));
+  Coordinate pos, next;
+  double start = nowMs();
+
+  if (!route)
+    g_error("Error allocating memory for a route");
+
+  for (int i = 0; i < n; i++) {
+    pos = from[i];
+    steps[i] = 0;
+    while (pos.x != to[i].x || pos.y != to[i].y) {
+      next = routed ? routingNextStep(route, pos, to[i]) : greedyStepLegacy(pos, to[i]);
+      if (next.x == pos.x && next.y == pos.y) {
+        steps[i] = -1;
+        break;
+      }
+      pos = next;
+      steps[i]++;
+    }
+  }
+
+  free(route);
+  return nowMs() - start;
+}
+
+void benchRouting(int n, int runs) {
+  Coordinate *from = malloc(n * sizeof(Coordinate));
+  Coordinate *to = malloc(n * sizeof(Coordinate));
+  int *greedySteps = malloc(n * sizeof(int));
+  int *routedSteps = malloc(n * sizeof(int));
+  int size = gridSize(), unreachable = 0, detours = 0, blockedCells = 0;
+  bool tripEnd;
+  Coordinate cell;
+  long totalSteps = 0;
+  double greedyMs = 0, routedMs = 0, blockedMs = 0, start;
+
+  if (!from || !to || !greedySteps || !routedSteps)
+    g_error("Error allocating memory for %i trips", n);
+
+  for (int i = 0; i < n; i++) {
+    from[i] = (Coordinate){.x = rand() % size, .y = rand() % size};
+    to[i] = (Coordinate){.x = rand() % size, .y = rand() % size};
+  }
+
+  start = nowMs();
+  initRouting();
+  g_message("Next hop tables of a %ix%i map built in %.2f ms", size, size, nowMs() - start);
+
+  for (int r = 0; r < runs; r++) {
+    greedyMs += driveTrips(from, to, n, false, greedySteps);
+    routedMs += driveTrips(from, to, n, true, routedSteps);
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (greedySteps[i] != routedSteps[i] || routedSteps[i] != routingEta(from[i], to[i]))
+      g_error("Trip %i took %i steps with the greedy step, %i routed and the ETA was %i", i,
+              greedySteps[i], routedSteps[i], routingEta(from[i], to[i]));
+    totalSteps += routedSteps[i];
+  }
+
+  // Up to a tenth of the map, leaving the ends of the trips free
+  for (int i = 0; i < ROUTING_MAX_BLOCKED && i < size * size / 10; i++) {
+    cell = (Coordinate){.x = rand() % size, .y = rand() % size};
+    tripEnd = false;
+    for (int j = 0; j < n && !tripEnd; j++) {
+      tripEnd = (cell.x == from[j].x && cell.y == from[j].y) ||
+                (cell.x == to[j].x && cell.y == to[j].y);
+    }
+    if (!tripEnd && !routingIsBlocked(cell) && routingSetBlocked(cell, true))
+      blockedCells++;
+  }
+
+  for (int r = 0; r < runs; r++)
+    blockedMs += driveTrips(from, to, n, true, routedSteps);
+
+  for (int i = 0; i < n; i++) {
+    unreachable += routedSteps[i] == -1;
+    detours += routedSteps[i] > greedySteps[i];
+  }
+
+  // Each step is taken once per run
+  double perStep = 1000000.0 / ((double)totalSteps * runs);
+  g_message("%i trips of %.1f steps on average in a %ix%i map", n, (double)totalSteps / n, size,
+            size);
+  g_message("Legacy greedy step:      %.2f ns per step", greedyMs * perStep);
+  g_message("Next hop table:          %.2f ns per step", routedMs * perStep);
+  g_message("A* around %i blocked cells: %.2f ns per step (%i trips with detours, %i unreachable)",
+            blockedCells, blockedMs * perStep, detours, unreachable);
+
+  routingClearBlocked();
+  free(from);
+  free(to);
+  free(greedySteps);
+  free(routedSteps);
+}
+
+void benchClosures(int n, int changes) {
+  Route *route = calloc(1, sizeof(Route));
+  Coordinate *closed = malloc(changes * sizeof(Coordinate));
+  RoutingStats before, after;
+  Coordinate from, to, cell;
+  int size = gridSize(), radius = 8, steps;
+  long updates = 0;
+  unsigned long repaired = 0, scratch = 0;
+  double repairMs = 0, scratchMs = 0, start;
+
+  if (!route || !closed)
+    g_error("Error allocating memory for a route");
+
+  // Half of the capacity at most, so there's room for the closures
+  routingClearBlocked();
+  for (int i = 0; i < ROUTING_MAX_BLOCKED / 2 && i < size * size / 10; i++)
+    routingSetBlocked((Coordinate){.x = rand() % size, .y = rand() % size}, true);
+
+  for (int t = 0; t < n; t++) {
+    from = (Coordinate){.x = rand() % size, .y = rand() % size};
+    to = (Coordinate){.x = rand() % size, .y = rand() % size};
+    routingSetBlocked(from, false);
+    routingSetBlocked(to, false);
+    from = routingNextStep(route, from, to);
+
+    for (steps = 0; (from.x != to.x || from.y != to.y) && steps < 4 * size; steps++) {
+      // Short incidents around the taxi, which are the ones that may change its route
+      for (int i = 0; i < changes; i++) {
+        if (steps > 0)
+          routingSetBlocked(closed[i], false);
+        closed[i] = (Coordinate){.x = (from.x + rand() % (2 * radius + 1) - radius + size) % size,
+                                 .y = (from.y + rand() % (2 * radius + 1) - radius + size) % size};
+        if ((closed[i].x != from.x || closed[i].y != from.y) &&
+            (closed[i].x != to.x || closed[i].y != to.y))
+          routingSetBlocked(closed[i], true);
+      }
+
+      getRoutingStats(&before);
+      start = nowMs();
+      routingFindPath(from, to, NULL, 0);
+      scratchMs += nowMs() - start;
+      getRoutingStats(&after);
+      scratch += after.planExpanded - before.planExpanded;
+
+      start = nowMs();
+      cell = routingNextStep(route, from, to);
+      repairMs += nowMs() - start;
+      getRoutingStats(&before);
+      repaired += before.repairExpanded - after.repairExpanded;
+      updates++;
+
+      if (cell.x == from.x && cell.y == from.y)
+        break;
+      from = cell;
+    }
+
+    for (int i = 0; i < changes && steps > 0; i++)
+      routingSetBlocked(closed[i], false);
+  }
+
+  g_message("%li closure updates of %i cells closed and opened during %i trips in a %ix%i map",
+            updates, changes, n, size, size);
+  g_message("Planning from scratch (A*):  %.1f cells expanded per update, %.3f ms",
+            (double)scratch / updates, scratchMs / updates);
+  g_message("Repairing (D* Lite):         %.1f cells expanded per update, %.3f ms",
+            (double)repaired / updates, repairMs / updates);
+
+  routingClearBlocked();
+  routingFreeRoute(route);
+  free(route);
+  free(closed);
+}
+
+void benchOccupancy(int n, int ticks) {
+  static OccupancyGrid grid;
+  static ReservationTable reservations;
+  static Coordinate pos[MAX_TAXIS], goal[MAX_TAXIS];
+  static int waits[MAX_TAXIS];
+  Coordinate next, after;
+  int size = gridSize(), owner;
+  long moves, refused;
+  double start, elapsed;
+  bool taken;
+
+  if (n > MAX_TAXIS) {
+    g_message("There can't be more than %i taxis", MAX_TAXIS);
+    n = MAX_TAXIS;
+  }
+
+  // The same trips are driven with both checks
+  for (int pass = 0; pass < 2; pass++) {
+    srand(n);
+    initOccupancyGrid(&grid);
+    initReservationTable(&reservations);
+    for (int i = 0; i < n; i++) {
+      pos[i] = (Coordinate){.x = rand() % size, .y = rand() % size};
+      goal[i] = (Coordinate){.x = rand() % size, .y = rand() % size};
+      waits[i] = 0;
+      occupancySet(&grid, i, pos[i]);
+    }
+
+    moves = refused = 0;
+    start = nowMs();
+    for (long tick = 0; tick < ticks; tick++) {
+      for (int i = 0; i < n; i++) {
+        if ((pos[i].x == goal[i].x && pos[i].y == goal[i].y) || waits[i] > 3) {
+          goal[i] = (Coordinate){.x = rand() % size, .y = rand() % size};
+          waits[i] = 0;
+        }
+
+        // The taxi sends the step after this one too, for the reservation
+        next = routingNextHop(pos[i], goal[i]);
+        after = routingNextHop(next, goal[i]);
+        if (pass == 0) {
+          owner = reservationOwner(&reservations, next, tick);
+          taken = occupancyTaken(&grid, next) || (owner != -1 && owner != i);
+        } else {
+          taken = false;
+          for (int j = 0; j < n && !taken; j++)
+            taken = j != i && pos[j].x == next.x && pos[j].y == next.y;
+        }
+
+        moves++;
+        if (taken) {
+          refused++;
+          waits[i]++;
+          continue;
+        }
+
+        waits[i] = 0;
+        pos[i] = next;
+        if (pass == 0) {
+          occupancySet(&grid, i, next);
+          reserveCell(&reservations, i, after, tick, tick + 2);
+        }
+      }
+    }
+    elapsed = nowMs() - start;
+
+    if (pass == 0)
+      g_message("%li moves of %i taxis in a %ix%i map, %li refused", moves, n, size, size, refused);
+    g_message("%s %.1f ns per move", pass == 0 ? "Occupancy grid and reservations:" :
+                                                 "Scanning every taxi:            ",
+              elapsed * 1000000 / moves);
+  }
+
+  freeOccupancyGrid(&grid);
+}
+
+void benchSharedGoals(int n, int ticks) {
+  static OccupancyGrid grid;
+  static ReservationTable reservations;
+  static Coordinate pos[MAX_TAXIS], goal[MAX_TAXIS];
+  static int waits[MAX_TAXIS];
+  Coordinate next, after;
+  int size = gridSize(), arrived;
+  long tick;
+
+  if (n > MAX_TAXIS / 2) {
+    g_message("There can't be more than %i pairs of taxis", MAX_TAXIS / 2);
+    n = MAX_TAXIS / 2;
+  }
+
+  // The same trips are driven with both rules
+  for (int pass = 0; pass < 2; pass++) {
+    srand(n);
+    initOccupancyGrid(&grid);
+    initReservationTable(&reservations);
+    for (int i = 0; i < 2 * n; i++) {
+      pos[i] = (Coordinate){.x = rand() % size, .y = rand() % size};
+      // Both taxis of a pair go to the same cell
+      goal[i] = i % 2 ? goal[i - 1] : (Coordinate){.x = rand() % size, .y = rand() % size};
+      waits[i] = 0;
+      occupancySet(&grid, i, pos[i]);
+    }
+
+    arrived = 0;
+    for (tick = 0; tick < ticks && arrived < 2 * n; tick++) {
+      arrived = 0;
+      for (int i = 0; i < 2 * n; i++) {
+        if (pos[i].x == goal[i].x && pos[i].y == goal[i].y) {
+          // The taxi stays there, idle
+          releaseCell(&reservations, i);
+          arrived++;
+          continue;
+        }
+
+        // A taxi that has waited too long steps aside, so head-on encounters don't last forever
+        next = routingNextHop(pos[i], goal[i]);
+        if (waits[i] > 3) {
+          next.x = (pos[i].x + rand() % 3 - 1 + size) % size;
+          next.y = (pos[i].y + rand() % 3 - 1 + size) % size;
+        }
+        after = routingNextHop(next, goal[i]);
+
+        if ((next.x == pos[i].x && next.y == pos[i].y) ||
+            !occupancyAdmits(&grid, &reservations, i, next, pass == 0 ? NULL : &goal[i], tick)) {
+          waits[i]++;
+          continue;
+        }
+
+        waits[i] = 0;
+        pos[i] = next;
+        occupancySet(&grid, i, next);
+        if (next.x != goal[i].x || next.y != goal[i].y)
+          reserveCell(&reservations, i, after, tick, tick + 2);
+        else
+          releaseCell(&reservations, i);
+      }
+    }
+
+    g_message("%s %i of %i taxis reached their objective in %li ticks",
+              pass == 0 ? "Refusing every taken cell:" : "Letting in the objective: ", arrived,
+              2 * n, tick);
+    if (pass == 1 && arrived < 2 * n)
+      g_warning("%i taxis never reached their objective", 2 * n - arrived);
+  }
+
+  freeOccupancyGrid(&grid);
+}
@@ -3,6 +3,7 @@
 #include "kafka_module.h"
 #include "ncurses_common.h"
 #include "ncurses_gui.h"
+#include "resume_module.h"
 #include "socket_module.h"
 #include <mysql/mysql.h>
 #include <ncurses.h>
@@ -13,7 +14,7 @@ char *fileName = "res/locations.csv";
 
 // Whether to start a new session and restart the database
 static bool RESET_DB = false;
-char session[UUID_LENGTH];
+uuid_t session;
 
 Address kafka, db;
 // Pipe to the process that will handle the ncurses gui
@@ -67,6 +68,8 @@ int main(int argc, char *argv[]) {
 
   initConnection(&conn);
   initSession(conn);
+  // Before forking, so the socket process can read the snapshots of the state
+  initResume();
 
   pid_t gui_pid = fork();
   if (gui_pid != 0) {
@@ -165,7 +168,7 @@ void readFile(MYSQL *conn) {
     g_error("Error opening file %s", fileName);
   }
 
-  char line[10];
+  char line[32];
   int x, y;
   char id;
   char query[200];
@@ -175,9 +178,9 @@ void readFile(MYSQL *conn) {
     g_warning("Error reseting database: %s", mysql_error(conn));
   }
 
-  while (fgets(line, 10, file) != NULL) {
-    if (sscanf(line, "%c,%d,%d", &id, &x, &y) != 3 || x < 1 || x > 20 || y < 1 || y > 20 ||
-        id < 'A' || id > 'Z')
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (sscanf(line, "%c,%d,%d", &id, &x, &y) != 3 || x < 1 || x > gridSize() || y < 1 ||
+        y > gridSize() || id < 'A' || id > 'Z')
       g_warning("Invalid location. Skipping to the next one");
     x--;
     y--;
@@ -212,10 +215,12 @@ void getEnvVars() {
 
 void initSession(MYSQL *conn) {
   if (RESET_DB) {
-    generate_unique_id(session);
+    char id[UUID_LENGTH];
+    generate_unique_id(id);
+    uuid_parse(id, session);
     char query[100];
     mysql_query(conn, "DELETE FROM session");
-    sprintf(query, "INSERT INTO session (id) VALUES ('%s')", session);
+    sprintf(query, "INSERT INTO session (id) VALUES ('%s')", id);
     if (mysql_query(conn, query)) {
       g_error("Error initializing session: %s", mysql_error(conn));
     }
@@ -232,6 +237,8 @@ void initSession(MYSQL *conn) {
     if (row[0] == NULL) {
       g_error("Session not found");
     }
-    strcpy(session, row[0]);
+    if (uuid_parse(row[0], session) != 0) {
+      g_error("Invalid session id: %s", row[0]);
+    }
   }
 }
@@ -10,13 +10,12 @@ static Address kafka;
 static rd_kafka_t *producer;
 static rd_kafka_t *consumer;
 static Request request;
-static Response response;
 
 // Customer variables
 static char id;
 static Coordinate pos;
 
-void sendRequest() { sendEvent(producer, "requests", &request, sizeof(request)); }
+void sendRequest() { sendRequestEvent(producer, &request); }
 
 /// @brief Prints a random filler message while waiting to ask for the next service
 void printRandomFillerMessage();
@@ -60,13 +59,13 @@ int main(int argc, char *argv[]) {
   checkArguments(argc, argv, fileName);
   readFile(fileName, services);
 
+  // Every thread uses the same producer and consumer (see sharedKafkaUser)
   sprintf(kafkaId, "customer-%c-producer", id);
-  producer = createKafkaUser(&kafka, RD_KAFKA_PRODUCER, kafkaId);
+  producer = sharedKafkaUser(&kafka, RD_KAFKA_PRODUCER, kafkaId);
   sprintf(kafkaId, "customer-%c-consumer", id);
+  consumer = sharedKafkaUser(&kafka, RD_KAFKA_CONSUMER, kafkaId);
 
-  consumer = createKafkaUser(&kafka, RD_KAFKA_CONSUMER, kafkaId);
-
-  subscribeToTopics(&consumer, (const char *[]){"customer_responses"}, 1);
+  assignResponses(&consumer, "customer_responses", id);
 
   // Wait for metadata to load
   g_message("Loading...");
@@ -89,6 +88,8 @@ int main(int argc, char *argv[]) {
 
   request.subject = REQUEST_DISCONNECT_CUSTOMER;
   sendRequest();
+  // The ping thread keeps using the producer until the process exits, so it's only flushed
+  flushEvents(producer);
 
   g_message("Exiting...");
   return 0;
@@ -118,8 +119,8 @@ void checkArguments(int argc, char *argv[], char *fileName) {
   if (sscanf(argv[5], "%i", &pos.y) != 1)
     g_error("Invalid y. %s", usage);
 
-  if (pos.x < 1 || pos.y < 1 || pos.x > 20 || pos.y > 20)
-    g_error("Invalid position. Must be between 1 and 20. %s", usage);
+  if (pos.x < 1 || pos.y < 1 || pos.x > gridSize() || pos.y > gridSize())
+    g_error("Invalid position. Must be between 1 and %i. %s", gridSize(), usage);
 
   pos.x--;
   pos.y--;
@@ -156,20 +157,21 @@ void readFile(char *fileName, char *services) {
 }
 
 void connectToCentral() {
-  rd_kafka_t *auth_consumer = createKafkaUser(&kafka, RD_KAFKA_CONSUMER, NULL);
-  subscribeToTopics(&auth_consumer, (const char *[]){"customer_responses"}, 1);
-
-  rd_kafka_message_t *msg = NULL;
+  MessageView response = {.msg = NULL};
+  rd_kafka_message_t *msg;
+  char uniqueId[UUID_LENGTH];
   request.subject = REQUEST_NEW_CUSTOMER;
   request.id = id;
   request.coord = pos;
+  // The session isn't known yet, the central accepts new customers from any session
+  uuid_clear(request.session);
   g_message("Sending request for connection");
   generate_unique_id(request.data);
   sendRequest();
 
   g_message("Waiting for confirmation");
-  for (int i = 0;;) {
-    if (!(msg = rd_kafka_consumer_poll(auth_consumer, 1000))) {
+  for (int i = 0;; closeMessageView(&response)) {
+    if (!(msg = rd_kafka_consumer_poll(consumer, 1000))) {
       i++;
       if (i == 5)
         g_error("Couldn't connect to central");
@@ -179,17 +181,23 @@ void connectToCentral() {
 
     if (msg->err) {
       g_warning("Error: %s", rd_kafka_message_errstr(msg));
+      rd_kafka_message_destroy(msg);
       continue;
     }
 
-    memcpy(&response, msg->payload, sizeof(response));
+    if (!openMessageView(&response, msg)) {
+      g_debug("Malformed message received");
+      continue;
+    }
 
-    if (response.id != id || strcmp(response.data, request.data) != 0 ||
+    if (!isAddressedTo(response.msg, id) || response.id != id ||
         (response.subject != CRESPONSE_CONFIRMATION && response.subject != CRESPONSE_ERROR)) {
-      // g_debug("Id received: %c", response.id);
-      // g_debug("Subject received: %i", response.subject);
-      // g_debug("Unique id received: %s", response.data);
-      // g_debug("Unique id: %s", request.data);
+      g_debug("Message not for us");
+      continue;
+    }
+
+    viewUuid(&response, uniqueId);
+    if (strcmp(uniqueId, request.data) != 0) {
       g_debug("Message not for us");
       continue;
     }
@@ -197,37 +205,30 @@ void connectToCentral() {
     if (response.subject == CRESPONSE_ERROR)
       g_error("Central rejected the connection");
 
-    memcpy(request.session, response.session, UUID_LENGTH);
+    viewSession(&response, request.session);
+    closeMessageView(&response);
     g_message("Central accepted the connection");
     break;
   }
 }
 
 void askService(char service) {
-  rd_kafka_message_t *msg = NULL;
+  MessageView response = {.msg = NULL};
   request.subject = REQUEST_ASK_FOR_SERVICE;
   request.data[0] = service;
 
-  sendEvent(producer, "requests", &request, sizeof(request));
+  sendRequest();
 
   while (true) {
-    if (msg != NULL)
-      rd_kafka_message_destroy(msg);
-    if (!(msg = poll_wrapper(consumer, 1000)))
-      continue;
-
-    memcpy(&response, msg->payload, sizeof(response));
-
-    if (response.id != id)
+    closeMessageView(&response);
+    if (!openMessageView(&response, poll_wrapper(consumer, 1000)) ||
+        !isAddressedTo(response.msg, id) || response.id != id)
       continue;
 
     switch (response.subject) {
-    case CRESPONSE_SERVICE_ACCEPTED: {
-      int taxiId;
-      memcpy(&taxiId, response.data, sizeof(int));
-      g_message("Service accepted. Taxi %i is coming for you", taxiId);
+    case CRESPONSE_SERVICE_ACCEPTED:
+      g_message("Service accepted. Taxi %i is coming for you", viewInt(&response));
       break;
-    }
     case CRESPONSE_TAXI_RESUMED:
       g_message("Taxi can move again. Resuming service...");
       break;
@@ -237,30 +238,25 @@ void askService(char service) {
       break;
 
     case CRESPONSE_TAXI_DISCONNECTED: {
-      int taxiId;
-      Coordinate coord;
-      memcpy(&taxiId, response.data, sizeof(int));
-      memcpy(&coord, response.data + sizeof(int), sizeof(Coordinate));
+      Coordinate coord = viewCoord(&response);
       g_message("Taxi %i can't continue the service. You have been left in "
                 "[%i, %i] waiting for a new service.",
-                taxiId, coord.x + 1, coord.y + 1);
+                viewInt(&response), coord.x + 1, coord.y + 1);
       break;
     }
 
     case CRESPONSE_SERVICE_DENIED:
-      if (response.data[0] == true)
+      if (viewChar(&response) == true)
         g_message("There aren't any available taxis! You've been added to queue");
       else
         g_error("Service denied");
       break;
-    case CRESPONSE_PICKED_UP: {
-      int taxiId;
-      memcpy(&taxiId, response.data, sizeof(int));
-      g_message("Taxi %i has picked you up", taxiId);
+    case CRESPONSE_PICKED_UP:
+      g_message("Taxi %i has picked you up", viewInt(&response));
       break;
-    }
     case CRESPONSE_SERVICE_COMPLETED:
       g_message("We've arrived to %c", service);
+      closeMessageView(&response);
       return;
     default:
       g_debug("Unhandled subject: %i", response.subject);
@@ -282,15 +278,14 @@ void printRandomFillerMessage() {
 }
 
 void *ping(void *session) {
-  rd_kafka_t *localProducer = createKafkaUser(&kafka, RD_KAFKA_PRODUCER, "customer-ping-producer");
   Request request;
   request.subject = PING_CUSTOMER;
-  memcpy(request.session, session, UUID_LENGTH);
+  uuid_copy(request.session, session);
   request.id = id;
 
   while (true) {
     g_debug("Sending PING");
-    sendEvent(localProducer, "requests", &request, sizeof(Request));
+    sendRequestEvent(producer, &request);
     usleep(PING_CADENCE * 1000 * 1000);
   }
 }
\ No newline at end of file
@@ -1,36 +1,32 @@
 #include "EC_DE_ncurses_gui.h"
 #include "common.h"
 #include "glib.h"
+#include "routing_module.h"
+#include "taxi_module.h"
 #include <bits/pthreadtypes.h>
 #include <librdkafka/rdkafka.h>
 #include <pthread.h>
+#include <stdio.h>
 #include <string.h>
 
 // Connection parameters
 const int COURTESY_TIME = 1500;
+// File where the resumption token of the taxi is kept between runs
+#define RESUME_TOKEN_FILE "taxi_%i.token"
 Address central, kafka;
 int listenPort;
 
 // Connection related variables
-Response response;
-char session[UUID_LENGTH];
 int id;
 
 // Connection with the GUI
 int gui_pipe[2];
 
 // Taxi parameters
-bool orderedToStop = true; // Doesn't include when stopped because of sensor
-bool canMove = false;      // Whether it's possible to move (e.g. sensor connected)
-bool stopProgram = false;  // When the program is supposed to stop
+Taxi taxi;                // Position, orders and route. pos is guarded by pos_mut, the rest by mut
+bool stopProgram = false; // When the program is supposed to stop
 bool sensorConnected = false;
-Coordinate pos = {.x = 0, .y = 0};       // Where's the taxi
-Coordinate objective = {.x = 0, .y = 0}; // Where the taxi is going towards
-IMPORTANCE importance;                   // Importance of the inconvenience detected by the sensor
-SUBJECT lastOrder = -1;    // Last order sent from the central. START_SERVICE is considered a GOTO
-Coordinate lastOrderCoord; // Coordinate of the last order (if it's a GOTO or a CHANGE_POSITION)
-char service = -1;         // Client that is currently serving the taxi
-bool lastOrderCompleted = false; // Whether the last order has been completed or not
+IMPORTANCE importance; // Importance of the inconvenience detected by the sensor
 int reason; // Reason of the inconvenience detected by the sensor. It's an index for the
             // inconveniences array in common.h/common.c
 
@@ -62,12 +58,19 @@ void *connectToSensor();
 /// @return false The program should end
 bool communicateWithSensor(int sensorSocket, rd_kafka_t *producer, Request *request);
 
-/// @brief Handles kafka communications with the central
+/// @brief Handles kafka communications with the central. It's the only thread that polls the
+/// consumer of the process, so it reads the closures too
 ///
 /// @return void* Returns NULL always. It just exists to fill the required signature for a thread
 /// intended function
 void *connectToCentral();
 
+/// @brief Keeps the blocked cells of the routing module up to date with the cells closed by the
+/// central
+///
+/// @param msg Message of the closures topic. It's destroyed
+void updateClosures(rd_kafka_message_t *msg);
+
 /// @brief Moves (if possible) the taxi to the next step. This function is dependent of the sensor
 /// handler thread as it's continuously waiting the signal it to continue moving.
 ///
@@ -81,14 +84,22 @@ void *run();
 /// @return bool Value of the global variable
 bool getGlobal(bool *global);
 
-/// @brief Calculates the distance between two coordinates taking into account that the map is
-/// spherical (e.g. (0, 0) is next to (19, 19) the same way it is to (1, 1))
-int sphericalDistance(Coordinate *a, Coordinate *b);
+/// @brief Moves the taxi one step towards its objective, around the blocked cells (see stepTaxi),
+/// and logs the work done by the routing module
+///
+/// @param request Output argument. Move to be sent to the central
+/// @return true The taxi has reached its objective
+/// @return false Otherwise
+bool nextStep(Request *request);
 
-/// @brief Moves the taxi (changes pos) towards objective
-void nextStep();
+/// @brief Goes back to where the central says the taxi is after it has refused a move because
+/// there was another taxi in the cell (see refuseMove)
+///
+/// @param current Position of the taxi according to the central
+/// @param reroute Whether to go around the cell instead of waiting for it to be free
+void refusedMove(Coordinate current, bool reroute);
 
-/// @brief Wrapper for sendEvent. Doesn't do anything else, just used because of readability
+/// @brief Wrapper for sendRequestEvent. Doesn't do anything else, just used because of readability
 ///
 /// @param producer Kafka producer used to send the requests to the central
 /// @param request Request to be sent to the central
@@ -97,6 +108,24 @@ void sendRequest(rd_kafka_t *producer, Request *request);
 /// @brief Carries through the process of authentication with the central via socket
 void authenticate();
 
+/// @brief Logs the taxi in again from scratch after the central has refused its login (see
+/// loginRefused). The socket decides again whether the id is available, so the digital engine
+/// exits if another one is using it
+void logInAgain();
+
+/// @brief Reads the token given by the central at a previous login, if there's one
+///
+/// @param token Output argument. Token of the previous login
+/// @return true The token has been read
+/// @return false There isn't any, so the taxi must log in from scratch
+bool loadResumeToken(unsigned char *token);
+
+/// @brief Stores the resumption token given by the central, so the taxi can log in faster if it
+/// restarts
+///
+/// @param token Token to be stored
+void saveResumeToken(const unsigned char *token);
+
 /// @brief Intended to be executed by a separate thread or process. Continuously pings the central
 /// to inform that the taxi is still active
 void *ping();
@@ -109,6 +138,7 @@ int main(int argc, char *argv[]) {
   pthread_t thread_central;
   pthread_t thread_run;
   pthread_t ping_thread;
+  char kafkaId[50];
 
   pipe(gui_pipe);
 
@@ -129,6 +159,13 @@ int main(int argc, char *argv[]) {
   g_log_set_default_handler(ncurses_log_handler, (int[]){-1, gui_pipe[1]});
 
   checkArguments(argc, argv);
+  initTaxi(&taxi, id);
+
+  // Every thread uses the same producer and consumer (see sharedKafkaUser)
+  sprintf(kafkaId, "taxi-%d-producer", id);
+  sharedKafkaUser(&kafka, RD_KAFKA_PRODUCER, kafkaId);
+  sprintf(kafkaId, "taxi-%d-consumer", id);
+  sharedKafkaUser(&kafka, RD_KAFKA_CONSUMER, kafkaId);
 
   updateInfo();
 
@@ -154,6 +191,7 @@ int main(int argc, char *argv[]) {
   pthread_join(thread_run, NULL);
   pthread_join(thread_sensor, NULL);
   pthread_join(ping_thread, NULL);
+  destroySharedKafkaUsers();
 
   pthread_mutex_destroy(&mut);
   pthread_mutex_destroy(&pos_mut);
@@ -173,14 +211,14 @@ void updateInfo() {
   pthread_mutex_lock(&mut);
   buffer[offset++] = PGUI_UPDATE_INFO;
 
-  memcpy(buffer + offset, &pos, sizeof(Coordinate));
+  memcpy(buffer + offset, &taxi.pos, sizeof(Coordinate));
   offset += sizeof(Coordinate);
-  memcpy(buffer + offset, &objective, sizeof(Coordinate));
+  memcpy(buffer + offset, &taxi.objective, sizeof(Coordinate));
   offset += sizeof(Coordinate);
 
-  buffer[offset++] = service;
-  buffer[offset++] = orderedToStop;
-  buffer[offset++] = canMove;
+  buffer[offset++] = taxi.service;
+  buffer[offset++] = taxi.orderedToStop;
+  buffer[offset++] = taxi.canMove;
 
   memcpy(buffer + offset, &importance, sizeof(IMPORTANCE));
   offset += sizeof(IMPORTANCE);
@@ -189,12 +227,12 @@ void updateInfo() {
 
   buffer[offset++] = sensorConnected;
 
-  memcpy(buffer + offset, &lastOrder, sizeof(SUBJECT));
+  memcpy(buffer + offset, &taxi.lastOrder, sizeof(SUBJECT));
   offset += sizeof(SUBJECT);
-  memcpy(buffer + offset, &lastOrderCoord, sizeof(Coordinate));
+  memcpy(buffer + offset, &taxi.lastOrderCoord, sizeof(Coordinate));
   offset += sizeof(Coordinate);
 
-  buffer[offset++] = lastOrderCompleted;
+  buffer[offset++] = taxi.lastOrderCompleted;
   pthread_mutex_unlock(&mut);
 
   write(gui_pipe[1], buffer, BUFFER_SIZE);
@@ -228,8 +266,8 @@ void checkArguments(int argc, char *argv[]) {
   if (kafka.port < 1 || kafka.port > 65535)
     g_error("Invalid kafka port, must be between 0 and 65535. %s", usage);
 
-  if (id < 0 || id > 99)
-    g_error("Invalid id, must be between 0 and 99. %s", usage);
+  if (id < 0 || id >= MAX_TAXIS)
+    g_error("Invalid id, must be between 0 and %i. %s", MAX_TAXIS - 1, usage);
 }
 
 bool getGlobal(bool *global) {
@@ -240,86 +278,81 @@ bool getGlobal(bool *global) {
 }
 
 void *connectToCentral() {
-  char kafkaId[50];
-  sprintf(kafkaId, "taxi-%d-consumer", id);
-  rd_kafka_t *consumer = createKafkaUser(&kafka, RD_KAFKA_CONSUMER, kafkaId);
-  sprintf(kafkaId, "taxi-%d-central-producer", id);
-  rd_kafka_t *producer = createKafkaUser(&kafka, RD_KAFKA_PRODUCER, kafkaId);
-  rd_kafka_message_t *msg = NULL;
-  subscribeToTopics(&consumer, (const char *[]){"taxi_responses"}, 1);
+  rd_kafka_t *consumer = sharedKafkaUser(&kafka, RD_KAFKA_CONSUMER, NULL);
+  rd_kafka_t *producer = sharedKafkaUser(&kafka, RD_KAFKA_PRODUCER, NULL);
+  MessageView response = {.msg = NULL};
+  rd_kafka_message_t *msg;
+  assignResponses(&consumer, "taxi_responses", id);
+  assignResponses(&consumer, "closures", CLOSURES_PARTITION);
   Request request;
   pthread_mutex_lock(&mut);
-  strcpy(request.session, session);
+  uuid_copy(request.session, taxi.session);
   request.id = id;
   pthread_mutex_unlock(&mut);
 
   while (!getGlobal(&stopProgram)) {
-    if (msg != NULL)
-      rd_kafka_message_destroy(msg);
-    if (!(msg = poll_wrapper(consumer, 1000)))
+    closeMessageView(&response);
+    if ((msg = poll_wrapper(consumer, 1000)) == NULL)
+      continue;
+
+    if (strcmp(rd_kafka_topic_name(msg->rkt), "closures") == 0) {
+      updateClosures(msg);
       continue;
+    }
 
-    memcpy(&response, msg->payload, sizeof(response));
+    if (!openMessageView(&response, msg) || !isAddressedTo(response.msg, id))
+      continue;
+
+    if (response.id != id || !viewSessionIs(&response, taxi.session))
+      continue;
+
+    if (response.subject == TRESPONSE_LOG_IN_AGAIN) {
+      if (loginRefused(&taxi, &response))
+        logInAgain();
+      continue;
+    }
 
-    if (response.id != id || strcmp(session, response.session) != 0)
+    if (response.subject == TRESPONSE_WAIT || response.subject == TRESPONSE_REROUTE) {
+      refusedMove(viewCoord(&response), response.subject == TRESPONSE_REROUTE);
+      updateInfo();
       continue;
+    }
+
+    pthread_mutex_lock(&mut);
+    pthread_mutex_lock(&pos_mut);
+    if (followOrder(&taxi, &response)) {
+      request.subject = REQUEST_TAXI_CANT_MOVE_REMINDER;
+      sendRequest(producer, &request);
+    }
+    pthread_mutex_unlock(&pos_mut);
+    pthread_mutex_unlock(&mut);
 
     switch (response.subject) {
     case TRESPONSE_START_SERVICE:
-      service = response.data[sizeof(Coordinate)];
-      // Fallthrough intended
     case TRESPONSE_GOTO:
-      pthread_mutex_lock(&mut);
-      lastOrderCompleted = false;
-      orderedToStop = false;
-      if (!canMove) {
-        request.subject = REQUEST_TAXI_CANT_MOVE_REMINDER;
-        sendRequest(producer, &request);
-      }
-      memcpy(&objective, response.data, sizeof(Coordinate));
-      lastOrderCoord = objective;
-      lastOrder = TRESPONSE_GOTO;
-      pthread_mutex_unlock(&mut);
-
-      g_message("Central ordered to move to [%i, %i]", objective.x + 1, objective.y + 1);
+      g_message("Central ordered to move to [%i, %i]", taxi.objective.x + 1,
+                taxi.objective.y + 1);
       updateInfo();
       sleep(1); // Give time to central to process the request
       break;
 
     case TRESPONSE_STOP:
-      pthread_mutex_lock(&mut);
-      orderedToStop = true;
-      lastOrder = TRESPONSE_STOP;
-      pthread_mutex_unlock(&mut);
       g_message("Central ordered to stop");
       updateInfo();
       break;
 
     case TRESPONSE_CONTINUE:
-      pthread_mutex_lock(&mut);
-      lastOrder = TRESPONSE_CONTINUE;
-      orderedToStop = false;
-      if (!canMove) {
-        request.subject = REQUEST_TAXI_CANT_MOVE_REMINDER;
-        sendRequest(producer, &request);
-      }
-      pthread_mutex_unlock(&mut);
       g_message("Central ordered to continue");
       updateInfo();
       break;
 
     case TRESPONSE_CHANGE_POSITION:
-      pthread_mutex_lock(&pos_mut);
-      memcpy(&pos, response.data, sizeof(Coordinate));
-      lastOrder = TRESPONSE_CHANGE_POSITION;
-      lastOrderCoord = pos;
-      pthread_mutex_unlock(&pos_mut);
-      g_message("Central ordered to change position to [%i, %i]", pos.x + 1, pos.y + 1);
+      g_message("Central ordered to change position to [%i, %i]", taxi.pos.x + 1,
+                taxi.pos.y + 1);
       updateInfo();
       break;
 
     case TRESPONSE_SERVICE_COMPLETED:
-      service = -1;
       updateInfo();
       break;
 
@@ -328,21 +361,17 @@ void *connectToCentral() {
     }
   }
 
-  rd_kafka_consumer_poll(consumer, 100);
-  rd_kafka_consumer_close(consumer);
-  rd_kafka_destroy(consumer);
+  closeMessageView(&response);
 
   g_debug("Central exiting...");
   return NULL;
 }
 
 void *connectToSensor() {
-  int server = openSocket(listenPort);
+  int server = openSocket(listenPort, 4);
   int sensorSocket;
   char buffer[BUFFER_SIZE];
-  char kafkaId[50];
-  sprintf(kafkaId, "taxi-%d-sensor-producer", id);
-  rd_kafka_t *producer = createKafkaUser(&kafka, RD_KAFKA_PRODUCER, kafkaId);
+  rd_kafka_t *producer = sharedKafkaUser(&kafka, RD_KAFKA_PRODUCER, NULL);
   Request request;
 
   pthread_mutex_lock(&mut);
@@ -351,7 +380,7 @@ void *connectToSensor() {
   pthread_mutex_unlock(&mut);
 
   pthread_mutex_lock(&mut);
-  strcpy(request.session, session);
+  uuid_copy(request.session, taxi.session);
   request.id = id;
   pthread_mutex_unlock(&mut);
 
@@ -386,14 +415,15 @@ void *connectToSensor() {
     if (!communicateWithSensor(sensorSocket, producer, &request)) {
       close(sensorSocket);
       close(server);
+      flushEvents(producer);
       g_debug("Sensor exiting...");
       return NULL;
     }
 
     pthread_mutex_lock(&mut);
     sensorConnected = false;
-    if (canMove) {
-      canMove = false;
+    if (taxi.canMove) {
+      taxi.canMove = false;
       request.subject = REQUEST_TAXI_CANT_MOVE;
       sendRequest(producer, &request);
     }
@@ -430,9 +460,9 @@ bool communicateWithSensor(int sensorSocket, rd_kafka_t *producer, Request *requ
     }
 
     pthread_mutex_lock(&mut);
-    if (buffer[1] != canMove) {
-      canMove = buffer[1];
-      request->subject = canMove ? REQUEST_TAXI_CAN_MOVE : REQUEST_TAXI_CANT_MOVE;
+    if (buffer[1] != taxi.canMove) {
+      taxi.canMove = buffer[1];
+      request->subject = taxi.canMove ? REQUEST_TAXI_CAN_MOVE : REQUEST_TAXI_CANT_MOVE;
       sendRequest(producer, request);
     }
     memcpy(&importance, buffer + 3, sizeof(IMPORTANCE));
@@ -454,15 +484,15 @@ bool communicateWithSensor(int sensorSocket, rd_kafka_t *producer, Request *requ
     }
 
     buffer[0] = STX;
-    buffer[1] = orderedToStop;
+    buffer[1] = taxi.orderedToStop;
     write(sensorSocket, buffer, BUFFER_SIZE);
     pthread_mutex_unlock(&mut);
     updateInfo();
 
-    if (canMove && !getGlobal(&orderedToStop)) {
+    if (taxi.canMove && !getGlobal(&taxi.orderedToStop)) {
       pthread_cond_signal(&cond);
       printedMsg = false;
-    } else if (!canMove && !printedMsg) {
+    } else if (!taxi.canMove && !printedMsg) {
       g_warning("Cannot move: %s", inconveniences[importance][reason]);
       printedMsg = true;
     }
@@ -472,12 +502,11 @@ bool communicateWithSensor(int sensorSocket, rd_kafka_t *producer, Request *requ
 }
 
 void *run() {
-  char kafkaId[50];
-  sprintf(kafkaId, "taxi-%d-run-producer", id);
-  rd_kafka_t *producer = createKafkaUser(&kafka, RD_KAFKA_PRODUCER, kafkaId);
+  rd_kafka_t *producer = sharedKafkaUser(&kafka, RD_KAFKA_PRODUCER, NULL);
   Request request;
+  bool arrived;
   pthread_mutex_lock(&mut);
-  strcpy(request.session, session);
+  uuid_copy(request.session, taxi.session);
   request.id = id;
   pthread_mutex_unlock(&mut);
 
@@ -489,23 +518,12 @@ void *run() {
     if (getGlobal(&stopProgram))
       break;
 
-    pthread_mutex_lock(&pos_mut);
-    nextStep();
-    g_message("Moving to [%i, %i]", pos.x + 1, pos.y + 1);
-    request.subject = REQUEST_TAXI_MOVE;
-    request.coord = pos;
+    arrived = nextStep(&request);
+    g_message("Moving to [%i, %i]", request.coord.x + 1, request.coord.y + 1);
     sendRequest(producer, &request);
 
-    bool arrived = pos.x == objective.x && pos.y == objective.y;
-    pthread_mutex_unlock(&pos_mut);
-
     if (arrived) {
       g_message("Destination reached. Stopping...");
-      pthread_mutex_lock(&mut);
-      orderedToStop = true;
-      lastOrderCompleted = true;
-      pthread_mutex_unlock(&mut);
-
       request.subject = REQUEST_DESTINATION_REACHED;
       sendRequest(producer, &request);
     }
@@ -517,47 +535,60 @@ void *run() {
   return NULL;
 }
 
-int min(int a, int b) { return a < b ? a : b; }
-
-int sphericalDistance(Coordinate *a, Coordinate *b) {
-  return min(abs(a->x - b->x), 20 - abs(a->x - b->x)) +
-         min(abs(a->y - b->y), 20 - abs(a->y - b->y));
-}
+void updateClosures(rd_kafka_message_t *msg) {
+  static ClosureSet closures;
+  bool valid = decodeClosures(&closures, msg->payload, msg->len);
+  int changes;
 
-void nextStep() {
-  if (pos.x == objective.x && pos.y == objective.y)
+  rd_kafka_message_destroy(msg);
+  if (!valid || uuid_compare(closures.session, taxi.session) != 0)
     return;
 
-  int possibleMoves[8][2] = {
-      {1, 1}, {1, 0}, {1, -1}, {0, -1}, {-1, -1}, {-1, 0}, {-1, 1}, {0, 1},
-  };
-
-  Coordinate bestPos = {.x = -1, .y = -1};
-  int bestDistance = INT_MAX;
+  // Only the cells that differ are changed, so the route is repaired around them
+  changes = routingReplaceBlocked(closures.cells, closures.count);
+  if (changes > 0)
+    g_message("Closures updated: %i cells closed, %i changed", closures.count, changes);
+}
 
-  for (int i = 0; i < 8; i++) {
-    Coordinate newPos = {.x = (pos.x + possibleMoves[i][0]) % 20,
-                         .y = (pos.y + possibleMoves[i][1]) % 20};
+bool nextStep(Request *request) {
+  RoutingStats before, after;
+  bool arrived;
 
-    if (newPos.x < 0)
-      newPos.x += 20;
+  pthread_mutex_lock(&mut);
+  pthread_mutex_lock(&pos_mut);
+  getRoutingStats(&before);
+  arrived = stepTaxi(&taxi, request);
+  getRoutingStats(&after);
+  pthread_mutex_unlock(&pos_mut);
+  pthread_mutex_unlock(&mut);
 
-    if (newPos.y < 0)
-      newPos.y += 20;
+  if (after.repairs != before.repairs)
+    g_message("Route repaired around the closures: %lu cells expanded (%.1f per repair on average)",
+              after.lastRepairExpanded, (double)after.repairExpanded / after.repairs);
+  else if (after.plans != before.plans)
+    g_debug("Route planned: %lu cells expanded", after.planExpanded - before.planExpanded);
 
-    int distance = sphericalDistance(&newPos, &objective);
+  return arrived;
+}
 
-    if (distance < bestDistance) {
-      bestDistance = distance;
-      bestPos = newPos;
-    }
-  }
+void refusedMove(Coordinate current, bool reroute) {
+  pthread_mutex_lock(&mut);
+  pthread_mutex_lock(&pos_mut);
+  Coordinate refused = taxi.pos;
+  reroute = refuseMove(&taxi, current, reroute);
+  pthread_mutex_unlock(&pos_mut);
+  pthread_mutex_unlock(&mut);
 
-  pos = bestPos;
+  if (reroute)
+    g_message("[%i, %i] is still taken by another taxi. Going around it", refused.x + 1,
+              refused.y + 1);
+  else
+    g_message("[%i, %i] is taken by another taxi. Waiting at [%i, %i]", refused.x + 1,
+              refused.y + 1, current.x + 1, current.y + 1);
 }
 
 void sendRequest(rd_kafka_t *producer, Request *request) {
-  sendEvent(producer, "requests", request, sizeof(Request));
+  sendRequestEvent(producer, request);
 }
 
 void authenticate() {
@@ -565,117 +596,79 @@ void authenticate() {
   pthread_cond_wait(&socket_bound_cond, &mut);
   pthread_mutex_unlock(&mut);
 
-  char buffer[BUFFER_SIZE] = {0};
-  int socket = connectToServer(&central);
-
-#define auth_error(format, ...)                                                                    \
-  buffer[0] = EOT;                                                                                 \
-  write(socket, buffer, BUFFER_SIZE);                                                              \
-  close(socket);                                                                                   \
-  g_error(format, ##__VA_ARGS__);
-
-#define auth_warning(msg, n)                                                                       \
-  {                                                                                                \
-    if (i == n) {                                                                                  \
-      auth_error(msg ". Try limit reached");                                                       \
-    }                                                                                              \
-    g_warning(msg ". Retrying...");                                                                \
-    continue;                                                                                      \
-  }
-
-  if (socket == -1) {
-    auth_error("Error connecting to central");
-  }
-
-  for (int i = 0; i < 5; i++) {
-    buffer[0] = ENQ;
-    g_debug("Sending ENQ");
-    if (!write(socket, buffer, BUFFER_SIZE)) {
-      auth_warning("Error writing to central", 4);
-    }
-
-    g_debug("Waiting for response");
-    if (!read(socket, buffer, BUFFER_SIZE)) {
-      auth_warning("Error reading from central", 4);
-    }
-
-    if (buffer[0] == ACK) {
-      g_debug("Received ACK");
-      break;
-    }
-
-    if (buffer[0] == NACK) {
-      g_debug("Received NACK");
-      auth_warning("Connection refused", 4);
-    } else {
-      g_debug("Received unknown message: %i", buffer[1]);
-      auth_error("Unknown message received.");
-    }
-
-    sleep(1);
-  }
-
-  for (int i = 0; i < 3; i++) {
-    buffer[0] = STX;
-    memcpy(buffer + 1, &id, sizeof(id));
-    buffer[BUFFER_SIZE - 1] = ETX;
-
-    g_debug("Sending STX");
-    if (!write(socket, buffer, BUFFER_SIZE)) {
-      auth_warning("Error writing to central", 2);
-    }
+  unsigned char token[RESUME_TOKEN_SIZE], newToken[RESUME_TOKEN_SIZE];
+  bool resumed;
+  const char *error;
+
+  // The other threads don't use the taxi until it's logged in
+  error = authenticateTaxi(&taxi, &central, loadResumeToken(token) ? token : NULL, newToken,
+                           &resumed);
+  if (error != NULL)
+    g_error("Authentication failed. %s", error);
+
+  saveResumeToken(newToken);
+  if (resumed)
+    g_message("Session resumed at [%i, %i]. ID: %i", taxi.pos.x + 1, taxi.pos.y + 1, id);
+  else
+    g_message("Authentication successful. ID assigned: %i", id);
+  updateInfo();
+}
 
-    g_debug("Waiting for response");
-    if (!read(socket, buffer, BUFFER_SIZE)) {
-      auth_warning("Error reading from central", 2);
-    }
+void logInAgain() {
+  unsigned char newToken[RESUME_TOKEN_SIZE];
+  const char *error;
 
-    if (buffer[0] != STX || buffer[2 + UUID_LENGTH] != ETX) {
-      g_debug("Etx or stx issue");
-      auth_warning("Invalid message received", 2);
-    }
+  g_warning("The central refused the login. Logging in again...");
 
-    int lrc = 0;
-    for (int i = 0; i < 2 + UUID_LENGTH + 1; i++) {
-      lrc ^= buffer[i];
-    }
-    if (lrc != buffer[2 + UUID_LENGTH + 1]) {
-      g_debug("lrc issue");
-      auth_warning("Invalid message received", 2);
-    }
+  // The session of the central stays the same, only the token changes
+  pthread_mutex_lock(&mut);
+  error = authenticateTaxi(&taxi, &central, NULL, newToken, NULL);
+  pthread_mutex_unlock(&mut);
+  if (error != NULL)
+    g_error("Authentication failed. %s", error);
 
-    if (buffer[1] == ACK) {
-      g_debug("Received ACK");
-      g_message("Authentication successful. ID assigned: %i", id);
-      memcpy(session, buffer + 2, UUID_LENGTH);
-      break;
-    }
+  saveResumeToken(newToken);
+  g_message("Authentication successful. ID assigned: %i", id);
+  updateInfo();
+}
 
-    if (buffer[1] != NACK) {
-      g_debug("Content issue");
-      auth_warning("Invalid message received", 2);
-    }
+bool loadResumeToken(unsigned char *token) {
+  char path[50];
+  int size;
+  FILE *file;
+
+  sprintf(path, RESUME_TOKEN_FILE, id);
+  file = fopen(path, "rb");
+  if (file == NULL)
+    return false;
+  size = fread(token, 1, RESUME_TOKEN_SIZE, file);
+  fclose(file);
+  return size == RESUME_TOKEN_SIZE;
+}
 
-    auth_error("Authentication failed. Id %i is already in use", id);
-    break;
-  }
+void saveResumeToken(const unsigned char *token) {
+  char path[50];
+  FILE *file;
 
-  buffer[0] = EOT;
-  write(socket, buffer, BUFFER_SIZE);
-  close(socket);
+  sprintf(path, RESUME_TOKEN_FILE, id);
+  file = fopen(path, "wb");
+  if (file == NULL || fwrite(token, 1, RESUME_TOKEN_SIZE, file) != RESUME_TOKEN_SIZE)
+    g_warning("Couldn't store the resumption token in %s", path);
+  if (file != NULL)
+    fclose(file);
 }
 
 void *ping() {
-  rd_kafka_t *localProducer = createKafkaUser(&kafka, RD_KAFKA_PRODUCER, "customer-ping-producer");
+  rd_kafka_t *producer = sharedKafkaUser(&kafka, RD_KAFKA_PRODUCER, NULL);
   Request request;
   pthread_mutex_lock(&mut);
-  strcpy(request.session, session);
+  uuid_copy(request.session, taxi.session);
   request.subject = PING_TAXI;
   request.id = id;
   pthread_mutex_unlock(&mut);
 
   while (!getGlobal(&stopProgram)) {
-    sendEvent(localProducer, "requests", &request, sizeof(Request));
+    sendRequestEvent(producer, &request);
     usleep(PING_CADENCE * 1000 * 1000);
   }
 
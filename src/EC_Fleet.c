@@ -0,0 +1,414 @@
+#include "common.h"
+#include "glib.h"
+#include "routing_module.h"
+#include "taxi_module.h"
+#include <librdkafka/rdkafka.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Number of taxis logged in at once
+#define FLEET_AUTH_THREADS 32
+// Duration (ms) of a tick. Each taxi moves at most once per tick, the same as a digital engine does
+// with each state sent by its sensor
+#define FLEET_TICK_MS 1000
+// Seconds between the reports of the traffic of the fleet
+#define FLEET_REPORT_PERIOD 10
+// Maximum number of ticks an incident reported by a synthetic sensor lasts
+#define MAX_INCIDENT_TICKS 5
+
+// Taxi driven by the simulator instead of by its own digital engine and sensor
+typedef struct {
+  Taxi taxi;
+  bool loggedIn;
+  int incident; // Ticks left until the synthetic sensor lets the taxi move again, 0 if none
+} VirtualTaxi;
+
+// Traffic of the fleet since the last report
+typedef struct {
+  unsigned long moves;     // Moves sent
+  unsigned long arrivals;  // Objectives reached
+  unsigned long orders;    // Orders received
+  unsigned long waits;     // Moves refused because another taxi was in the cell
+  unsigned long reroutes;  // Refused moves that made the taxi go around the cell
+  unsigned long incidents; // Incidents reported by the synthetic sensors
+} FleetStats;
+
+Address central, kafka;
+int fleetSize, firstId;
+int incidentRate; // Incidents per 1000 ticks of each taxi
+
+VirtualTaxi *fleet;
+rd_kafka_t *producer; // Shared by the whole fleet
+uuid_t session; // Session of the central, the same for every taxi
+FleetStats stats;
+int nextLogin = 0; // Next taxi to be logged in
+pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
+
+/// @brief Parses the arguments passed to the program
+///
+/// @param argc Number of arguments
+/// @param argv Array of arguments
+void checkArguments(int argc, char *argv[]);
+
+/// @brief Gets the current time in milliseconds from an arbitrary point
+///
+/// @return double Current time in milliseconds
+double nowMs();
+
+/// @brief Intended to be executed by a separate thread. Logs the whole fleet in the central,
+/// FLEET_AUTH_THREADS taxis at a time, while the fleet is already running. The taxis that can't log
+/// in are left out of the simulation
+///
+/// @return void* Returns NULL always. It just exists to fill the required signature for a thread
+/// intended function
+void *logInFleet();
+
+/// @brief Intended to be executed by a separate thread. Logs in taxis until there are none left.
+/// Each one pings the central as soon as it's logged in, so it isn't taken for a stray while the
+/// rest of the fleet logs in
+///
+/// @return void* Returns NULL always. It just exists to fill the required signature for a thread
+/// intended function
+void *logInTaxis();
+
+/// @brief Intended to be executed by a separate thread. Hands the orders of the central to the
+/// taxis they're addressed to. The consumer of the process reads the responses of the whole fleet
+/// and the closures
+///
+/// @return void* Returns NULL always. It just exists to fill the required signature for a thread
+/// intended function
+void *followResponses();
+
+/// @brief Keeps the blocked cells of the routing module, shared by the whole fleet, up to date
+/// with the cells closed by the central
+///
+/// @param msg Message of the closures topic. It's destroyed
+void updateClosures(rd_kafka_message_t *msg);
+
+/// @brief Updates the state the sensor of a taxi would send. Incidents start at random,
+/// incidentRate times per 1000 ticks, and last up to MAX_INCIDENT_TICKS
+///
+/// @param v Taxi whose sensor is simulated
+/// @return true Whether the taxi can move has changed, so the central must be told
+/// @return false Otherwise
+bool synthesizeSensor(VirtualTaxi *v);
+
+/// @brief Runs the fleet, a tick every FLEET_TICK_MS: the synthetic sensors are updated, the taxis
+/// that can move take a step and every taxi pings the central each PING_CADENCE seconds. Only the
+/// taxis already logged in are simulated. Never returns
+void runFleet();
+
+/// @brief Logs the traffic of the fleet since the last report and resets it
+///
+/// @param seconds Seconds since the last report
+/// @param tickMs Duration of the latest tick
+void reportFleet(double seconds, double tickMs);
+
+int main(int argc, char *argv[]) {
+  pthread_t responsesThread, loginThread;
+  rd_kafka_t *consumer;
+
+  g_log_set_default_handler(log_handler, NULL);
+  srand(time(NULL));
+  checkArguments(argc, argv);
+
+  fleet = calloc(fleetSize, sizeof(VirtualTaxi));
+  if (fleet == NULL)
+    g_error("Error allocating memory for %i taxis", fleetSize);
+
+  // Each taxi plans its route with A*, instead of keeping a planner the size of the map
+  for (int i = 0; i < fleetSize; i++) {
+    fleet[i].taxi.route.lightweight = true;
+    initTaxi(&fleet[i].taxi, firstId + i);
+  }
+
+  // The central starts waiting for the pings of each taxi and may send it orders as soon as it
+  // logs in, so everything must be running before the first login
+  producer = sharedKafkaUser(&kafka, RD_KAFKA_PRODUCER, "fleet-producer");
+  consumer = sharedKafkaUser(&kafka, RD_KAFKA_CONSUMER, "fleet-consumer");
+  assignResponseRange(&consumer, "taxi_responses", firstId, fleetSize);
+  assignResponses(&consumer, "closures", CLOSURES_PARTITION);
+  pthread_create(&responsesThread, NULL, followResponses, NULL);
+  pthread_create(&loginThread, NULL, logInFleet, NULL);
+  runFleet();
+
+  return 0;
+}
+
+void checkArguments(int argc, char *argv[]) {
+  char usage[150];
+
+  sprintf(usage, "Usage: %s <central IP:port> <kafka IP:port> [taxis] [first id] [incidents]",
+          argv[0]);
+
+  if (argc < 3)
+    g_error("%s", usage);
+
+  if (sscanf(argv[1], "%[^:]:%d", central.ip, &central.port) != 2)
+    g_error("Invalid central address. %s", usage);
+
+  if (sscanf(argv[2], "%[^:]:%d", kafka.ip, &kafka.port) != 2)
+    g_error("Invalid kafka address. %s", usage);
+
+  fleetSize = argc > 3 ? atoi(argv[3]) : 1000;
+  firstId = argc > 4 ? atoi(argv[4]) : 0;
+  incidentRate = argc > 5 ? atoi(argv[5]) : 5;
+
+  if (fleetSize <= 0 || firstId < 0 || incidentRate < 0 || incidentRate > 1000)
+    g_error("%s", usage);
+
+  if (firstId + fleetSize > MAX_TAXIS)
+    g_error("Invalid ids, the last one must be lower than %i. %s", MAX_TAXIS, usage);
+}
+
+double nowMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+void *logInFleet() {
+  pthread_t threads[FLEET_AUTH_THREADS];
+  double begin = nowMs();
+  int loggedIn = 0;
+
+  g_message("Logging in %i taxis (ids %i to %i)", fleetSize, firstId, firstId + fleetSize - 1);
+
+  for (int i = 0; i < FLEET_AUTH_THREADS; i++)
+    pthread_create(&threads[i], NULL, logInTaxis, NULL);
+  for (int i = 0; i < FLEET_AUTH_THREADS; i++)
+    pthread_join(threads[i], NULL);
+
+  pthread_mutex_lock(&mut);
+  for (int i = 0; i < fleetSize; i++)
+    loggedIn += fleet[i].loggedIn;
+  pthread_mutex_unlock(&mut);
+
+  if (loggedIn == 0)
+    g_error("No taxi could log in");
+
+  g_message("%i taxis logged in in %.2f s, %i failed", loggedIn, (nowMs() - begin) / 1000,
+            fleetSize - loggedIn);
+  return NULL;
+}
+
+void *logInTaxis() {
+  VirtualTaxi *v;
+  Request ping = {.subject = PING_TAXI};
+  const char *error;
+
+  while (true) {
+    pthread_mutex_lock(&mut);
+    v = nextLogin < fleetSize ? &fleet[nextLogin++] : NULL;
+    pthread_mutex_unlock(&mut);
+
+    if (v == NULL)
+      return NULL;
+
+    // A taxi isn't simulated until it's logged in, so it isn't locked meanwhile
+    error = authenticateTaxi(&v->taxi, &central, NULL, NULL, NULL);
+    if (error != NULL) {
+      g_warning("Taxi %i couldn't log in: %s", v->taxi.id, error);
+      continue;
+    }
+
+    ping.id = v->taxi.id;
+    uuid_copy(ping.session, v->taxi.session);
+    sendRequestEvent(producer, &ping);
+
+    pthread_mutex_lock(&mut);
+    v->loggedIn = true;
+    uuid_copy(session, v->taxi.session);
+    pthread_mutex_unlock(&mut);
+  }
+}
+
+void *followResponses() {
+  rd_kafka_t *consumer = sharedKafkaUser(&kafka, RD_KAFKA_CONSUMER, "fleet-consumer");
+  rd_kafka_message_t *msgs[CONSUME_BATCH_SIZE];
+  MessageView response;
+  VirtualTaxi *v;
+  Request request;
+  bool remind;
+  int read;
+
+  while (true) {
+    read = consumeBatch(consumer, 1000, msgs, CONSUME_BATCH_SIZE);
+
+    for (int i = 0; i < read; i++) {
+      if (strcmp(rd_kafka_topic_name(msgs[i]->rkt), "closures") == 0) {
+        updateClosures(msgs[i]);
+        continue;
+      }
+
+      if (!openMessageView(&response, msgs[i]))
+        continue;
+
+      // The partitions may be shared with taxis that aren't part of the fleet
+      if (response.id < firstId || response.id >= firstId + fleetSize ||
+          !isAddressedTo(response.msg, response.id)) {
+        closeMessageView(&response);
+        continue;
+      }
+
+      v = &fleet[response.id - firstId];
+      remind = false;
+
+      pthread_mutex_lock(&mut);
+      if (v->loggedIn && viewSessionIs(&response, v->taxi.session)) {
+        if (response.subject == TRESPONSE_LOG_IN_AGAIN) {
+          // A refused taxi is left out, the same as the ones that couldn't log in. The refusals of
+          // other logins with the same id are ignored
+          if (loginRefused(&v->taxi, &response)) {
+            g_warning("The central refused the login of taxi %i, leaving it out", v->taxi.id);
+            v->loggedIn = false;
+          }
+        } else if (response.subject == TRESPONSE_WAIT || response.subject == TRESPONSE_REROUTE) {
+          stats.waits++;
+          stats.reroutes +=
+              refuseMove(&v->taxi, viewCoord(&response), response.subject == TRESPONSE_REROUTE);
+        } else {
+          stats.orders++;
+          remind = followOrder(&v->taxi, &response);
+        }
+      }
+      pthread_mutex_unlock(&mut);
+
+      if (remind) {
+        request.subject = REQUEST_TAXI_CANT_MOVE_REMINDER;
+        request.id = v->taxi.id;
+        uuid_copy(request.session, v->taxi.session);
+        sendRequestEvent(producer, &request);
+      }
+
+      closeMessageView(&response);
+    }
+  }
+
+  return NULL;
+}
+
+void updateClosures(rd_kafka_message_t *msg) {
+  static ClosureSet closures;
+  bool valid = decodeClosures(&closures, msg->payload, msg->len);
+  int changes;
+
+  rd_kafka_message_destroy(msg);
+
+  // The session is set by the first taxi that logs in, which may happen meanwhile
+  pthread_mutex_lock(&mut);
+  valid = valid && uuid_compare(closures.session, session) == 0;
+  pthread_mutex_unlock(&mut);
+
+  if (!valid)
+    return;
+
+  // The routing module is shared, so this is done once for the whole fleet
+  changes = routingReplaceBlocked(closures.cells, closures.count);
+  if (changes > 0)
+    g_message("Closures updated: %i cells closed, %i changed", closures.count, changes);
+}
+
+bool synthesizeSensor(VirtualTaxi *v) {
+  bool canMove;
+
+  if (v->incident > 0) {
+    v->incident--;
+  } else if (rand() % 1000 < incidentRate) {
+    v->incident = 1 + rand() % MAX_INCIDENT_TICKS;
+    stats.incidents++;
+  }
+
+  canMove = v->incident == 0;
+  if (canMove == v->taxi.canMove)
+    return false;
+
+  v->taxi.canMove = canMove;
+  return true;
+}
+
+void runFleet() {
+  int pingTicks = PING_CADENCE * 1000 / FLEET_TICK_MS;
+  double next = nowMs(), lastReport = next, tickStart;
+  struct timespec wakeUp;
+  Request sensor, move;
+  VirtualTaxi *v;
+  bool sensorChanged, moved, arrived;
+
+  g_message("Simulating %i taxis, a tick every %i ms", fleetSize, FLEET_TICK_MS);
+
+  for (long tick = 0;; tick++) {
+    tickStart = nowMs();
+
+    for (int i = 0; i < fleetSize; i++) {
+      v = &fleet[i];
+
+      pthread_mutex_lock(&mut);
+      if (!v->loggedIn) {
+        pthread_mutex_unlock(&mut);
+        continue;
+      }
+
+      sensor.id = move.id = v->taxi.id;
+      uuid_copy(sensor.session, v->taxi.session);
+      uuid_copy(move.session, v->taxi.session);
+      sensorChanged = synthesizeSensor(v);
+      sensor.subject = v->taxi.canMove ? REQUEST_TAXI_CAN_MOVE : REQUEST_TAXI_CANT_MOVE;
+      moved = v->taxi.canMove && !v->taxi.orderedToStop;
+      arrived = moved && stepTaxi(&v->taxi, &move);
+      stats.moves += moved;
+      stats.arrivals += arrived;
+      pthread_mutex_unlock(&mut);
+
+      if (sensorChanged)
+        sendRequestEvent(producer, &sensor);
+
+      if (moved)
+        sendRequestEvent(producer, &move);
+
+      if (arrived) {
+        move.subject = REQUEST_DESTINATION_REACHED;
+        sendRequestEvent(producer, &move);
+      }
+
+      if (pingTicks <= 1 || tick % pingTicks == 0) {
+        sensor.subject = PING_TAXI;
+        sendRequestEvent(producer, &sensor);
+      }
+    }
+
+    if (nowMs() - lastReport >= FLEET_REPORT_PERIOD * 1000) {
+      reportFleet((nowMs() - lastReport) / 1000, nowMs() - tickStart);
+      lastReport = nowMs();
+    }
+
+    next += FLEET_TICK_MS;
+    if (nowMs() > next) {
+      g_warning("Tick %li took %.0f ms, longer than %i ms", tick, nowMs() - tickStart,
+                FLEET_TICK_MS);
+      next = nowMs();
+      continue;
+    }
+
+    wakeUp.tv_sec = (time_t)(next / 1000);
+    wakeUp.tv_nsec = (long)((next - wakeUp.tv_sec * 1000.0) * 1000000);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeUp, NULL);
+  }
+}
+
+void reportFleet(double seconds, double tickMs) {
+  FleetStats current;
+
+  pthread_mutex_lock(&mut);
+  current = stats;
+  memset(&stats, 0, sizeof(FleetStats));
+  pthread_mutex_unlock(&mut);
+
+  g_message("%.0f moves/s, %.0f orders/s, %lu objectives reached, %lu moves refused (%lu "
+            "rerouted), %lu incidents. Last tick: %.1f ms",
+            current.moves / seconds, current.orders / seconds, current.arrivals, current.waits,
+            current.reroutes, current.incidents, tickMs);
+}
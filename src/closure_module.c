@@ -0,0 +1,75 @@
+#include "closure_module.h"
+#include "common.h"
+#include "glib.h"
+#include "routing_module.h"
+#include <librdkafka/rdkafka.h>
+#include <pthread.h>
+#include <time.h>
+
+extern uuid_t session;
+
+static rd_kafka_t *producer;
+static ClosureSet closures;
+static bool changed = false;
+
+static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+/// @brief Publishes the current closed cells and increases the sequence number. The mutex must be
+/// held
+void sendClosures() {
+  static unsigned char frame[MAX_CLOSURES_FRAME_SIZE];
+
+  closures.count = routingGetBlocked(closures.cells, MAX_CLOSED_CELLS);
+  uuid_copy(closures.session, session);
+  sendEvent(producer, "closures", CLOSURES_PARTITION, CLOSURES_MESSAGE_KEY, frame,
+            encodeClosures(&closures, frame));
+  closures.seq++;
+}
+
+/// @brief Function intended to be executed by a separate thread. Publishes the closed cells when
+/// they change and every CLOSURES_PERIOD seconds
+///
+/// @return void* Returns NULL always
+void *runClosurePublisher() {
+  struct timespec wakeUp;
+
+  pthread_mutex_lock(&mut);
+  while (true) {
+    clock_gettime(CLOCK_REALTIME, &wakeUp);
+    wakeUp.tv_sec += CLOSURES_PERIOD;
+    while (!changed && pthread_cond_timedwait(&cond, &mut, &wakeUp) == 0)
+      ;
+
+    changed = false;
+    sendClosures();
+  }
+
+  return NULL;
+}
+
+void startClosurePublisher(rd_kafka_t *closuresProducer) {
+  pthread_t thread;
+
+  producer = closuresProducer;
+  pthread_create(&thread, NULL, runClosurePublisher, NULL);
+  pthread_detach(thread);
+}
+
+bool toggleClosure(Coordinate cell) {
+  bool closed;
+
+  pthread_mutex_lock(&mut);
+  closed = !routingIsBlocked(cell);
+  if (!routingSetBlocked(cell, closed)) {
+    pthread_mutex_unlock(&mut);
+    return false;
+  }
+
+  changed = true;
+  pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&mut);
+
+  g_message("Cell [%i, %i] %s", cell.x + 1, cell.y + 1, closed ? "closed" : "opened again");
+  return true;
+}
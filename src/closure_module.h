@@ -0,0 +1,25 @@
+#ifndef CLOSURE_MODULE_H
+#define CLOSURE_MODULE_H
+
+#include "common.h"
+
+/// @brief Starts the thread that publishes the closed cells through the closures topic.
+///
+/// The closed cells are kept as the blocked cells of the routing module, so the ETAs calculated by
+/// the central take them into account. The whole set is published right after every change and
+/// every CLOSURES_PERIOD seconds, so the digital engines that have just started get it too. Each
+/// digital engine compares it with the set it had, so its route is only repaired around the cells
+/// that changed.
+///
+/// @param producer Kafka producer that will send the sets
+void startClosurePublisher(rd_kafka_t *producer);
+
+/// @brief Closes a cell to the taxis, or opens it again if it was closed. Thread safe. It doesn't
+/// check whether the taxis need the cell, see stateCheckClosure
+///
+/// @param cell Cell to be changed
+/// @return true The cell has been changed
+/// @return false It's outside the map or there are already MAX_CLOSED_CELLS closed cells
+bool toggleClosure(Coordinate cell);
+
+#endif
@@ -1,7 +1,10 @@
 #include "common.h"
 #include "glib.h"
 #include <librdkafka/rdkafka.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
@@ -127,7 +130,7 @@ void cleanUpSocket(int status, void *s) {
     close(*(int *)s);
 }
 
-int openSocket(int port) {
+int openSocket(int port, int backlog) {
   struct sockaddr_in server;
   int s = socket(AF_INET, SOCK_STREAM, 0);
   int opt = 1;
@@ -155,7 +158,7 @@ int openSocket(int port) {
 
   g_message("Socket bound");
 
-  if (listen(s, 4) == -1) {
+  if (listen(s, backlog) == -1) {
     close(s);
     s = -1;
     g_error("Error listening.");
@@ -191,10 +194,133 @@ int connectToServer(Address *serverAddress) {
   return s;
 }
 
+int tryConnect(const Address *serverAddress, int timeout) {
+  struct sockaddr_in server;
+  struct timeval limit = {.tv_sec = timeout / 1000, .tv_usec = timeout % 1000 * 1000};
+  int s = socket(AF_INET, SOCK_STREAM, 0);
+
+  if (s == -1)
+    return -1;
+
+  // The send timeout also bounds connect()
+  if (setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit)) == -1 ||
+      setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &limit, sizeof(limit)) == -1) {
+    close(s);
+    return -1;
+  }
+
+  server.sin_addr.s_addr = inet_addr(serverAddress->ip);
+  server.sin_family = AF_INET;
+  server.sin_port = htons(serverAddress->port);
+
+  if (connect(s, (struct sockaddr *)&server, sizeof(server)) == -1) {
+    close(s);
+    return -1;
+  }
+
+  return s;
+}
+
+int putAuthFrame(unsigned char *dest, char type, const void *payload, int size) {
+  unsigned char lrc = type;
+
+  dest[0] = size + 2;
+  dest[1] = type;
+  memcpy(dest + 2, payload, size);
+  for (int i = 0; i < size; i++)
+    lrc ^= dest[2 + i];
+  dest[2 + size] = lrc;
+
+  return size + AUTH_FRAME_OVERHEAD;
+}
+
+ssize_t readAuthBuffer(int fd, AuthBuffer *buffer) {
+  ssize_t n;
+
+  memmove(buffer->data, buffer->data + buffer->start, buffer->end - buffer->start);
+  buffer->end -= buffer->start;
+  buffer->start = 0;
+
+  n = read(fd, buffer->data + buffer->end, AUTH_BUFFER_SIZE - buffer->end);
+  if (n > 0)
+    buffer->end += n;
+  return n;
+}
+
+int peekAuthFrame(const AuthBuffer *buffer) {
+  const unsigned char *frame = buffer->data + buffer->start;
+  int available = buffer->end - buffer->start;
+  unsigned char lrc = 0;
+
+  if (available < 1)
+    return 0;
+  if (frame[0] < AUTH_FRAME_OVERHEAD - 1 || frame[0] > MAX_AUTH_FRAME_SIZE - 1)
+    return -1;
+  if (available < frame[0] + 1)
+    return 0;
+
+  for (int i = 1; i < frame[0]; i++)
+    lrc ^= frame[i];
+  return lrc == frame[frame[0]] ? 1 : -1;
+}
+
+int nextAuthFrame(AuthBuffer *buffer, AuthFrame *frame) {
+  const unsigned char *data = buffer->data + buffer->start;
+  int status = peekAuthFrame(buffer);
+
+  if (status != 1)
+    return status;
+
+  frame->type = data[1];
+  frame->payload = data + 2;
+  frame->size = data[0] - 2;
+  buffer->start += data[0] + 1;
+  return 1;
+}
+
+bool readAuthFrame(int fd, AuthBuffer *buffer, AuthFrame *frame) {
+  int status;
+
+  while ((status = nextAuthFrame(buffer, frame)) == 0) {
+    if (readAuthBuffer(fd, buffer) <= 0)
+      return false;
+  }
+
+  return status == 1;
+}
+
 #define SET_CONFIG(conf, key, value, errstr)                                                       \
   if (rd_kafka_conf_set(conf, key, value, errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK)             \
     g_error("Error configuring Kafka: %s", errstr);
 
+/// @brief Gets the value of an environment variable
+///
+/// @param name Name of the variable
+/// @param defaultValue Value returned if the variable isn't set
+/// @return const char* Value of the variable or defaultValue
+const char *getenvOr(const char *name, const char *defaultValue) {
+  const char *value = getenv(name);
+  return value != NULL && value[0] != '\0' ? value : defaultValue;
+}
+
+/// @brief Delivery report callback of the producers. Called from rd_kafka_poll once per message
+/// when it has been delivered or has permanently failed. Runs the DeliveryNotice of the message, if
+/// any
+///
+/// @param user Kafka producer
+/// @param msg Message delivered
+/// @param opaque Unused
+void deliveryReport(rd_kafka_t *user, const rd_kafka_message_t *msg, void *opaque) {
+  DeliveryNotice *notice = msg->_private;
+
+  if (msg->err)
+    g_warning("Failed to deliver message to topic %s: %s", rd_kafka_topic_name(msg->rkt),
+              rd_kafka_err2str(msg->err));
+
+  if (notice != NULL)
+    notice->onDelivery(notice->context, msg->err);
+}
+
 rd_kafka_t *createKafkaUser(Address *serverAddress, rd_kafka_type_t type, char *id) {
   rd_kafka_conf_t *conf;
   rd_kafka_t *user;
@@ -224,6 +350,12 @@ rd_kafka_t *createKafkaUser(Address *serverAddress, rd_kafka_type_t type, char *
     SET_CONFIG(conf, "group.id", id, errstr);
     SET_CONFIG(conf, "session.timeout.ms", "6000", errstr);
     SET_CONFIG(conf, "max.poll.interval.ms", "6000", errstr);
+  } else {
+    SET_CONFIG(conf, "linger.ms", getenvOr("KAFKA_LINGER_MS", KAFKA_LINGER_MS), errstr);
+    SET_CONFIG(conf, "batch.num.messages", getenvOr("KAFKA_BATCH_SIZE", KAFKA_BATCH_SIZE), errstr);
+    SET_CONFIG(conf, "queue.buffering.max.messages",
+               getenvOr("KAFKA_QUEUE_SIZE", KAFKA_QUEUE_SIZE), errstr);
+    rd_kafka_conf_set_dr_msg_cb(conf, deliveryReport);
   }
 
   user = rd_kafka_new(type, conf, errstr, sizeof(errstr));
@@ -240,6 +372,41 @@ rd_kafka_t *createKafkaUser(Address *serverAddress, rd_kafka_type_t type, char *
   return user;
 }
 
+// Kafka clients shared by the threads of the process, indexed by type (see sharedKafkaUser)
+static rd_kafka_t *sharedUsers[2];
+static pthread_mutex_t sharedUsersMut = PTHREAD_MUTEX_INITIALIZER;
+
+rd_kafka_t *sharedKafkaUser(Address *server, rd_kafka_type_t type, char *id) {
+  rd_kafka_t *user;
+
+  pthread_mutex_lock(&sharedUsersMut);
+  if (sharedUsers[type] == NULL) {
+    sharedUsers[type] = createKafkaUser(server, type, id);
+    g_debug("Kafka %s shared by the process created",
+            type == RD_KAFKA_PRODUCER ? "producer" : "consumer");
+  }
+  user = sharedUsers[type];
+  pthread_mutex_unlock(&sharedUsersMut);
+
+  return user;
+}
+
+void destroySharedKafkaUsers() {
+  pthread_mutex_lock(&sharedUsersMut);
+  if (sharedUsers[RD_KAFKA_PRODUCER] != NULL) {
+    flushEvents(sharedUsers[RD_KAFKA_PRODUCER]);
+    rd_kafka_destroy(sharedUsers[RD_KAFKA_PRODUCER]);
+  }
+
+  if (sharedUsers[RD_KAFKA_CONSUMER] != NULL) {
+    rd_kafka_consumer_close(sharedUsers[RD_KAFKA_CONSUMER]);
+    rd_kafka_destroy(sharedUsers[RD_KAFKA_CONSUMER]);
+  }
+
+  sharedUsers[RD_KAFKA_PRODUCER] = sharedUsers[RD_KAFKA_CONSUMER] = NULL;
+  pthread_mutex_unlock(&sharedUsersMut);
+}
+
 void subscribeToTopics(rd_kafka_t **consumer, const char **topics, int topicsCount) {
   rd_kafka_topic_partition_list_t *subscription = rd_kafka_topic_partition_list_new(topicsCount);
   rd_kafka_resp_err_t err;
@@ -266,32 +433,227 @@ void subscribeToTopics(rd_kafka_t **consumer, const char **topics, int topicsCou
   }
 }
 
-void sendEvent(rd_kafka_t *producer, const char *topic, void *value, size_t valueSize) {
+// Number of partitions of the topics already queried by topicPartitions
+#define MAX_CACHED_TOPICS 8
+static struct {
+  char name[50];
+  int partitions;
+} cachedTopics[MAX_CACHED_TOPICS];
+static int cachedTopicsCount = 0;
+static pthread_mutex_t cachedTopicsMut = PTHREAD_MUTEX_INITIALIZER;
+
+int topicPartitions(rd_kafka_t *rk, const char *topic) {
+  const rd_kafka_metadata_t *metadata;
+  int partitions = 1;
+
+  pthread_mutex_lock(&cachedTopicsMut);
+  for (int i = 0; i < cachedTopicsCount; i++) {
+    if (strcmp(cachedTopics[i].name, topic) == 0) {
+      partitions = cachedTopics[i].partitions;
+      pthread_mutex_unlock(&cachedTopicsMut);
+      return partitions;
+    }
+  }
+
+  rd_kafka_topic_t *rkt = rd_kafka_topic_new(rk, topic, NULL);
+  rd_kafka_resp_err_t err = rd_kafka_metadata(rk, 0, rkt, &metadata, KAFKA_FLUSH_TIMEOUT);
+
+  if (err) {
+    g_warning("Error reading the partitions of %s: %s", topic, rd_kafka_err2str(err));
+  } else {
+    if (metadata->topic_cnt == 1 && metadata->topics[0].partition_cnt > 0)
+      partitions = metadata->topics[0].partition_cnt;
+    rd_kafka_metadata_destroy(metadata);
+  }
+  rd_kafka_topic_destroy(rkt);
+
+  // A failed query isn't cached so it's retried
+  if (!err && cachedTopicsCount < MAX_CACHED_TOPICS) {
+    strncpy(cachedTopics[cachedTopicsCount].name, topic, sizeof(cachedTopics[0].name) - 1);
+    cachedTopics[cachedTopicsCount].partitions = partitions;
+    cachedTopicsCount++;
+  }
+  pthread_mutex_unlock(&cachedTopicsMut);
+
+  g_debug("Topic %s has %i partitions", topic, partitions);
+  return partitions;
+}
+
+int responsePartition(rd_kafka_t *rk, const char *topic, int id) {
+  return (unsigned int)id % topicPartitions(rk, topic);
+}
+
+void assignResponses(rd_kafka_t **consumer, const char *topic, int id) {
+  rd_kafka_topic_partition_list_t *assignment;
+  int partition = responsePartition(*consumer, topic, id);
+  rd_kafka_resp_err_t err;
+
+  // A shared consumer may already read other topics
+  if (rd_kafka_assignment(*consumer, &assignment) != RD_KAFKA_RESP_ERR_NO_ERROR)
+    assignment = rd_kafka_topic_partition_list_new(1);
+  rd_kafka_topic_partition_list_add(assignment, topic, partition);
+
+  err = rd_kafka_assign(*consumer, assignment);
+  rd_kafka_topic_partition_list_destroy(assignment);
+  if (err) {
+    rd_kafka_destroy(*consumer);
+    g_error("Failed to assign partition %i of %s: %s", partition, topic, rd_kafka_err2str(err));
+  }
+
+  g_debug("Reading partition %i of %s", partition, topic);
+}
+
+void assignResponseRange(rd_kafka_t **consumer, const char *topic, int firstId, int count) {
+  int partitions = topicPartitions(*consumer, topic);
+  rd_kafka_topic_partition_list_t *assignment;
+  rd_kafka_resp_err_t err;
+
+  // Consecutive ids go to consecutive partitions, so there are no duplicates
+  if (count > partitions)
+    count = partitions;
+
+  if (rd_kafka_assignment(*consumer, &assignment) != RD_KAFKA_RESP_ERR_NO_ERROR)
+    assignment = rd_kafka_topic_partition_list_new(count);
+  for (int i = 0; i < count; i++)
+    rd_kafka_topic_partition_list_add(assignment, topic,
+                                      responsePartition(*consumer, topic, firstId + i));
+
+  err = rd_kafka_assign(*consumer, assignment);
+  rd_kafka_topic_partition_list_destroy(assignment);
+  if (err) {
+    rd_kafka_destroy(*consumer);
+    g_error("Failed to assign the partitions of %s: %s", topic, rd_kafka_err2str(err));
+  }
+
+  g_debug("Reading %i partitions of %s", count, topic);
+}
+
+bool isAddressedTo(const rd_kafka_message_t *msg, int id) {
+  char key[MESSAGE_KEY_LENGTH];
+  int length = snprintf(key, MESSAGE_KEY_LENGTH, "%i", id);
+
+  return msg->key_len == (size_t)length && memcmp(msg->key, key, length) == 0;
+}
+
+void sendEvent(rd_kafka_t *producer, const char *topic, int partition, const char *key,
+               void *value, size_t valueSize) {
+  sendEventNotify(producer, topic, partition, key, value, valueSize, NULL);
+}
+
+void sendEventNotify(rd_kafka_t *producer, const char *topic, int partition, const char *key,
+                     void *value, size_t valueSize, DeliveryNotice *notice) {
   rd_kafka_resp_err_t err;
-  char key[20];
-  sprintf(key, "%li", time(NULL));
 
   if (producer == NULL)
     g_error("Producer is NULL");
 
-  err = rd_kafka_producev(
-      producer, RD_KAFKA_V_TOPIC(topic), RD_KAFKA_V_MSGFLAGS(RD_KAFKA_MSG_F_COPY),
-      RD_KAFKA_V_KEY(key, strlen(key)), // Ensure key is not NULL
-      RD_KAFKA_V_VALUE(value, valueSize), RD_KAFKA_V_OPAQUE(NULL), RD_KAFKA_V_END);
+  while ((err = rd_kafka_producev(
+              producer, RD_KAFKA_V_TOPIC(topic), RD_KAFKA_V_PARTITION(partition),
+              RD_KAFKA_V_MSGFLAGS(RD_KAFKA_MSG_F_COPY), RD_KAFKA_V_KEY(key, strlen(key)),
+              RD_KAFKA_V_VALUE(value, valueSize), RD_KAFKA_V_OPAQUE(notice), RD_KAFKA_V_END)) ==
+         RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+    // Backpressure: wait for some messages to be delivered to make room in the queue
+    g_debug("Outbound queue full. Waiting for deliveries...");
+    rd_kafka_poll(producer, 100);
+  }
 
   if (err) {
     g_error("Failed to produce to topic %s: %s", topic, rd_kafka_err2str(err));
   }
 
-  rd_kafka_poll(producer, 100);
+  // Serve the delivery reports without blocking
+  rd_kafka_poll(producer, 0);
+}
+
+void flushEvents(rd_kafka_t *producer) {
+  if (producer == NULL)
+    return;
 
-  rd_kafka_flush(producer, 5 * 1000);
+  rd_kafka_flush(producer, KAFKA_FLUSH_TIMEOUT);
 
   if (rd_kafka_outq_len(producer) > 0) {
-    g_error("The message was not delivered.");
+    g_warning("%i messages were not delivered", rd_kafka_outq_len(producer));
+  }
+}
+
+ENTITY_TYPE requestEntity(SUBJECT subject) {
+  switch (subject) {
+  case REQUEST_NEW_CUSTOMER:
+  case REQUEST_DISCONNECT_CUSTOMER:
+  case STRAY_CUSTOMER:
+  case PING_CUSTOMER:
+  case REQUEST_ASK_FOR_SERVICE:
+    return ENTITY_CUSTOMER;
+  default:
+    return ENTITY_TAXI;
+  }
+}
+
+void requestKey(const Request *request, char *key) {
+  if (requestEntity(request->subject) == ENTITY_CUSTOMER)
+    snprintf(key, MESSAGE_KEY_LENGTH, "c%c", request->id);
+  else
+    snprintf(key, MESSAGE_KEY_LENGTH, "t%i", request->id);
+}
+
+// Times to live read from the environment (see messageTtl)
+static int defaultTtl, pingTtl, moveTtl;
+static pthread_once_t ttlsLoaded = PTHREAD_ONCE_INIT;
+
+/// @brief Reads the times to live from the environment. Called once by messageTtl
+void loadTtls() {
+  defaultTtl = atoi(getenvOr("MESSAGE_TTL", "0"));
+  pingTtl = atoi(getenvOr("PING_TTL", "0"));
+  moveTtl = atoi(getenvOr("MOVE_TTL", "0"));
+
+  if (defaultTtl <= 0)
+    defaultTtl = MESSAGE_TTL;
+  if (pingTtl <= 0)
+    pingTtl = PING_TTL;
+  if (moveTtl <= 0)
+    moveTtl = MOVE_TTL;
+}
+
+int messageTtl(SUBJECT subject) {
+  pthread_once(&ttlsLoaded, loadTtls);
+
+  switch (subject) {
+  case PING_TAXI:
+  case PING_CUSTOMER:
+    return pingTtl;
+  case REQUEST_TAXI_MOVE:
+    return moveTtl;
+  default:
+    return defaultTtl;
   }
 }
 
+/// @brief Checks whether a message has waited in kafka longer than its time to live. Messages
+/// without a timestamp are never considered expired
+///
+/// @param msg Message received
+/// @return true The message must be discarded
+/// @return false Otherwise
+bool isExpired(const rd_kafka_message_t *msg) {
+  rd_kafka_timestamp_type_t type;
+  int64_t timestamp = rd_kafka_message_timestamp(msg, &type);
+  struct timespec now;
+
+  // Every message starts with the version and the subject (see encodeRequest)
+  if (timestamp < 0 || msg->len < 2)
+    return false;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  int64_t age = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000 - timestamp;
+  SUBJECT subject = ((const unsigned char *)msg->payload)[1];
+
+  if (age <= (int64_t)messageTtl(subject) * 1000)
+    return false;
+
+  g_debug("Message too old: sent %li ms ago", (long)age);
+  return true;
+}
+
 rd_kafka_message_t *poll_wrapper(rd_kafka_t *rk, int timeout_ms) {
   rd_kafka_message_t *msg = rd_kafka_consumer_poll(rk, timeout_ms);
 
@@ -305,46 +667,563 @@ rd_kafka_message_t *poll_wrapper(rd_kafka_t *rk, int timeout_ms) {
     return NULL;
   }
 
-  long now = time(NULL);
-  if (now - atol(msg->key) > 10 * 60) {
-    g_debug("Message too old: sent %li seconds ago", now - atol(msg->key));
+  if (isExpired(msg)) {
+    rd_kafka_message_destroy(msg);
     return NULL;
   }
 
   return msg;
 }
 
-int serializeEntity(Entity *user) {
-  int mask1 = 0x01;
-  int mask3 = 0x07;
-  int mask4 = 0x0F;
-  int mask5 = 0x1F;
-  int mask7 = 0x7F;
-
-  int res = 0;
-  res |= (user->type & mask3);
-  res |= (user->status & mask4) << 3;
-  res |= (user->coord.x & mask5) << 7;
-  res |= (user->coord.y & mask5) << 12;
-  res |= (user->id & mask7) << 17;
-  res |= ((user->obj - 'a') & mask7) << 24;
-  res |= (user->carryingCustomer & mask1) << 31;
-
-  return res;
-}
-
-void deserializeEntity(Entity *dest, int user) {
-  int mask1 = 0x01;
-  int mask3 = 0x07;
-  int mask4 = 0x0F;
-  int mask5 = 0x1F;
-  int mask7 = 0x7F;
-
-  dest->type = user & mask3;
-  dest->status = (user >> 3) & mask4;
-  dest->coord.x = (user >> 7) & mask5;
-  dest->coord.y = (user >> 12) & mask5;
-  dest->id = (user >> 17) & mask7;
-  dest->obj = ((user >> 24) & mask7) + 'a';
-  dest->carryingCustomer = (user >> 31) & mask1;
-}
\ No newline at end of file
+int gridSize() {
+  static int size = 0;
+
+  if (size == 0) {
+    char *sizeEnv = getenv("GRID_SIZE");
+    int value = sizeEnv != NULL ? atoi(sizeEnv) : DEFAULT_GRID_SIZE;
+
+    if (value < 1 || value > MAX_GRID_SIZE)
+      g_error("Invalid GRID_SIZE: must be between 1 and %i", MAX_GRID_SIZE);
+    size = value;
+  }
+
+  return size;
+}
+
+bool isInsideGrid(Coordinate coord) {
+  int size = gridSize();
+  return coord.x >= 0 && coord.x < size && coord.y >= 0 && coord.y < size;
+}
+
+int sphericalDistance(Coordinate *a, Coordinate *b) {
+  int size = gridSize();
+  int dx = abs(a->x - b->x);
+  int dy = abs(a->y - b->y);
+
+  return (dx < size - dx ? dx : size - dx) + (dy < size - dy ? dy : size - dy);
+}
+
+int consumeBatch(rd_kafka_t *rk, int timeout_ms, rd_kafka_message_t **msgs, int max) {
+  rd_kafka_queue_t *queue = rd_kafka_queue_get_consumer(rk);
+  ssize_t read = rd_kafka_consume_batch_queue(queue, timeout_ms, msgs, max);
+  rd_kafka_queue_destroy(queue);
+  int count = 0;
+
+  if (read < 0) {
+    g_warning("Error consuming batch: %s", rd_kafka_err2str(rd_kafka_last_error()));
+    return 0;
+  }
+
+  if (read == 0) {
+    g_debug("Nothing read");
+    return 0;
+  }
+
+  for (int i = 0; i < read; i++) {
+    rd_kafka_message_t *msg = msgs[i];
+
+    if (msg->err) {
+      g_warning("Error: %s", rd_kafka_message_errstr(msg));
+      rd_kafka_message_destroy(msg);
+      continue;
+    }
+
+    if (isExpired(msg)) {
+      rd_kafka_message_destroy(msg);
+      continue;
+    }
+
+    msgs[count++] = msg;
+  }
+
+  return count;
+}
+
+// Masks and offsets of the fields of a serialized entity
+#define ENTITY_TYPE_OFFSET 0
+#define ENTITY_STATUS_OFFSET 3
+#define ENTITY_CARRYING_OFFSET 7
+#define ENTITY_OBJ_OFFSET 8
+#define ENTITY_ID_OFFSET 16
+#define ENTITY_X_OFFSET 28
+#define ENTITY_Y_OFFSET (ENTITY_X_OFFSET + COORD_BITS)
+#define ENTITY_ID_MASK 0xFFF
+#define ENTITY_COORD_MASK ((1 << COORD_BITS) - 1)
+
+int64_t serializeEntity(const Entity *entity) {
+  uint64_t res = 0;
+  res |= (uint64_t)(entity->type & 0x07) << ENTITY_TYPE_OFFSET;
+  res |= (uint64_t)(entity->status & 0x0F) << ENTITY_STATUS_OFFSET;
+  res |= (uint64_t)(entity->carryingCustomer & 0x01) << ENTITY_CARRYING_OFFSET;
+  res |= (uint64_t)(unsigned char)entity->obj << ENTITY_OBJ_OFFSET;
+  res |= (uint64_t)(entity->id & ENTITY_ID_MASK) << ENTITY_ID_OFFSET;
+  res |= (uint64_t)(entity->coord.x & ENTITY_COORD_MASK) << ENTITY_X_OFFSET;
+  res |= (uint64_t)(entity->coord.y & ENTITY_COORD_MASK) << ENTITY_Y_OFFSET;
+
+  return (int64_t)res;
+}
+
+void deserializeEntity(Entity *dest, int64_t entity) {
+  uint64_t value = (uint64_t)entity;
+
+  dest->type = (value >> ENTITY_TYPE_OFFSET) & 0x07;
+  dest->status = (value >> ENTITY_STATUS_OFFSET) & 0x0F;
+  dest->carryingCustomer = (value >> ENTITY_CARRYING_OFFSET) & 0x01;
+  dest->obj = (char)((value >> ENTITY_OBJ_OFFSET) & 0xFF);
+  dest->id = (value >> ENTITY_ID_OFFSET) & ENTITY_ID_MASK;
+  dest->coord.x = (value >> ENTITY_X_OFFSET) & ENTITY_COORD_MASK;
+  dest->coord.y = (value >> ENTITY_Y_OFFSET) & ENTITY_COORD_MASK;
+}
+
+void serializeEntities(const Entity *entities, int64_t *dest, int count) {
+  for (int i = 0; i < count; i++)
+    dest[i] = serializeEntity(&entities[i]);
+}
+
+void deserializeEntities(const int64_t *entities, Entity *dest, int count) {
+  for (int i = 0; i < count; i++)
+    deserializeEntity(&dest[i], entities[i]);
+}
+
+int mapSlot(ENTITY_TYPE type, int id) {
+  switch (type) {
+  case ENTITY_LOCATION:
+    return (id >= 'A' && id - 'A' < MAX_LOCATIONS) ? id - 'A' : -1;
+  case ENTITY_CUSTOMER:
+    return (id >= 'a' && id - 'a' < MAX_CUSTOMERS) ? MAX_LOCATIONS + id - 'a' : -1;
+  case ENTITY_TAXI:
+    return (id >= 0 && id < MAX_TAXIS) ? MAX_LOCATIONS + MAX_CUSTOMERS + id : -1;
+  default:
+    return -1;
+  }
+}
+
+bool applyMapUpdate(int64_t map[MAP_SIZE], long *seq, const MapView *update) {
+  if (update->subject == MRESPONSE_MAP_KEYFRAME) {
+    for (int i = 0; i < MAP_SIZE; i++)
+      map[i] = EMPTY_SLOT;
+  } else if (update->subject != MRESPONSE_MAP_DELTA) {
+    return false;
+  } else if (*seq == -1 || update->seq != (unsigned int)(*seq + 1)) {
+    // A delta has been lost. Wait until the next keyframe
+    *seq = -1;
+    return false;
+  }
+
+  for (int i = 0; i < update->count; i++) {
+    MapChange change = mapViewChange(update, i);
+    if (change.slot < MAP_SIZE)
+      map[change.slot] = change.entity;
+  }
+
+  *seq = update->seq;
+  return true;
+}
+
+/// @brief Gets the fields carried by a subject
+///
+/// @param subject Subject of the message
+/// @return PAYLOAD_KIND Fields carried
+PAYLOAD_KIND payloadKind(SUBJECT subject) {
+  switch (subject) {
+  case REQUEST_NEW_CUSTOMER:
+    return PAYLOAD_COORD_UUID;
+  case REQUEST_TAXI_MOVE:
+    return PAYLOAD_TWO_COORDS;
+  case ORDER_GOTO:
+  case ORDER_TOGGLE_CLOSURE:
+  case TRESPONSE_GOTO:
+  case TRESPONSE_CHANGE_POSITION:
+  case TRESPONSE_WAIT:
+  case TRESPONSE_REROUTE:
+    return PAYLOAD_COORD;
+  case REQUEST_ASK_FOR_SERVICE:
+  case CRESPONSE_SERVICE_DENIED:
+    return PAYLOAD_CHAR;
+  case CRESPONSE_CONFIRMATION:
+  case CRESPONSE_ERROR:
+    return PAYLOAD_UUID;
+  case REQUEST_NEW_TAXI:
+  case REQUEST_TAXI_RECONNECT:
+  case REQUEST_TAXI_RESUME:
+  case CRESPONSE_SERVICE_ACCEPTED:
+  case CRESPONSE_PICKED_UP:
+  case TRESPONSE_LOG_IN_AGAIN:
+    return PAYLOAD_INT;
+  case CRESPONSE_TAXI_DISCONNECTED:
+    return PAYLOAD_INT_COORD;
+  case TRESPONSE_START_SERVICE:
+    return PAYLOAD_COORD_CHAR;
+  default:
+    return PAYLOAD_NONE;
+  }
+}
+
+unsigned char *putInt(unsigned char *dest, int64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++)
+    dest[i] = (value >> (8 * i)) & 0xFF;
+  return dest + bytes;
+}
+
+int64_t getInt(const unsigned char *src, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; i++)
+    value |= (uint64_t)src[i] << (8 * i);
+  if (bytes < 8 && (value >> (8 * bytes - 1)) & 1)
+    value |= ~(uint64_t)0 << (8 * bytes);
+  return (int64_t)value;
+}
+
+/// @brief Writes the header of a message
+///
+/// @param frame Message being encoded
+/// @param subject Subject of the message
+/// @param session Session id
+/// @return unsigned char* Position after the header
+unsigned char *putHeader(unsigned char *frame, SUBJECT subject, const uuid_t session) {
+  frame[0] = PROTOCOL_VERSION;
+  frame[1] = subject;
+  memcpy(frame + 2, session, SESSION_LENGTH);
+  return frame + FRAME_HEADER_SIZE;
+}
+
+/// @brief Gets the size of the fields carried by a subject
+///
+/// @param kind Fields carried
+/// @return size_t Size in bytes
+size_t payloadSize(PAYLOAD_KIND kind) {
+  switch (kind) {
+  case PAYLOAD_CHAR:
+    return 1;
+  case PAYLOAD_INT:
+    return 4;
+  case PAYLOAD_COORD:
+    return 8;
+  case PAYLOAD_COORD_CHAR:
+    return 9;
+  case PAYLOAD_INT_COORD:
+    return 12;
+  case PAYLOAD_UUID:
+    return SESSION_LENGTH;
+  case PAYLOAD_COORD_UUID:
+    return 8 + SESSION_LENGTH;
+  case PAYLOAD_TWO_COORDS:
+    return 16;
+  default:
+    return 0;
+  }
+}
+
+/// @brief Writes a coordinate
+///
+/// @param dest Where to write it
+/// @param coord Coordinate to be written
+/// @return unsigned char* Position after the coordinate
+unsigned char *putCoord(unsigned char *dest, Coordinate coord) {
+  dest = putInt(dest, coord.x, 4);
+  return putInt(dest, coord.y, 4);
+}
+
+/// @brief Reads a coordinate
+///
+/// @param src Where to read it from
+/// @return Coordinate Coordinate read
+Coordinate getCoord(const unsigned char *src) {
+  return (Coordinate){.x = getInt(src, 4), .y = getInt(src + 4, 4)};
+}
+
+/// @brief Writes a unique id generated by generate_unique_id in binary
+///
+/// @param dest Where to write it
+/// @param id Unique id as a string
+/// @return unsigned char* Position after the unique id
+unsigned char *putUuid(unsigned char *dest, const char *id) {
+  uuid_t binary;
+  char terminated[UUID_LENGTH];
+
+  memcpy(terminated, id, UUID_LENGTH - 1);
+  terminated[UUID_LENGTH - 1] = '\0';
+  if (uuid_parse(terminated, binary) != 0)
+    uuid_clear(binary);
+
+  memcpy(dest, binary, SESSION_LENGTH);
+  return dest + SESSION_LENGTH;
+}
+
+size_t encodeRequest(const Request *request, unsigned char *frame) {
+  unsigned char *p = putHeader(frame, request->subject, request->session);
+  Coordinate second;
+  int value;
+
+  p = putInt(p, request->id, 4);
+
+  switch (payloadKind(request->subject)) {
+  case PAYLOAD_INT:
+    memcpy(&value, request->data, sizeof(int));
+    p = putInt(p, value, 4);
+    break;
+  case PAYLOAD_COORD:
+    p = putCoord(p, request->coord);
+    break;
+  case PAYLOAD_TWO_COORDS:
+    memcpy(&second, request->data, sizeof(Coordinate));
+    p = putCoord(p, request->coord);
+    p = putCoord(p, second);
+    break;
+  case PAYLOAD_COORD_UUID:
+    p = putCoord(p, request->coord);
+    p = putUuid(p, request->data);
+    break;
+  case PAYLOAD_CHAR:
+    *p++ = request->data[0];
+    break;
+  default:
+    break;
+  }
+
+  return p - frame;
+}
+
+bool viewFrame(MessageView *view, const void *frame, size_t len) {
+  const unsigned char *bytes = frame;
+
+  view->msg = NULL;
+  if (len < FRAME_HEADER_SIZE + 4 || bytes[0] != PROTOCOL_VERSION)
+    return false;
+
+  view->frame = bytes;
+  view->subject = bytes[1];
+  view->kind = payloadKind(view->subject);
+  view->id = getInt(bytes + FRAME_HEADER_SIZE, 4);
+  view->payload = bytes + FRAME_HEADER_SIZE + 4;
+
+  if (len < FRAME_HEADER_SIZE + 4 + payloadSize(view->kind))
+    return false;
+
+  // Coordinates are used as indexes, they can't be trusted
+  bool hasCoord = view->kind == PAYLOAD_COORD || view->kind == PAYLOAD_COORD_CHAR ||
+                  view->kind == PAYLOAD_INT_COORD || view->kind == PAYLOAD_COORD_UUID ||
+                  view->kind == PAYLOAD_TWO_COORDS;
+  return (!hasCoord || isInsideGrid(viewCoord(view))) &&
+         (view->kind != PAYLOAD_TWO_COORDS || isInsideGrid(viewSecondCoord(view)));
+}
+
+bool openMessageView(MessageView *view, rd_kafka_message_t *msg) {
+  view->msg = NULL;
+  if (msg == NULL)
+    return false;
+
+  if (!viewFrame(view, msg->payload, msg->len)) {
+    rd_kafka_message_destroy(msg);
+    return false;
+  }
+
+  view->msg = msg;
+  return true;
+}
+
+void closeMessageView(MessageView *view) {
+  if (view->msg != NULL)
+    rd_kafka_message_destroy(view->msg);
+  view->msg = NULL;
+}
+
+bool viewSessionIs(const MessageView *view, const uuid_t session) {
+  return memcmp(view->frame + 2, session, SESSION_LENGTH) == 0;
+}
+
+void viewSession(const MessageView *view, uuid_t dest) {
+  memcpy(dest, view->frame + 2, SESSION_LENGTH);
+}
+
+Coordinate viewCoord(const MessageView *view) {
+  return getCoord(view->payload + (view->kind == PAYLOAD_INT_COORD ? 4 : 0));
+}
+
+Coordinate viewSecondCoord(const MessageView *view) { return getCoord(view->payload + 8); }
+
+char viewChar(const MessageView *view) {
+  return view->payload[view->kind == PAYLOAD_COORD_CHAR ? 8 : 0];
+}
+
+int viewInt(const MessageView *view) { return getInt(view->payload, 4); }
+
+void viewUuid(const MessageView *view, char *dest) {
+  uuid_unparse(view->payload + (view->kind == PAYLOAD_COORD_UUID ? 8 : 0), dest);
+}
+
+void requestFromView(const MessageView *view, Request *request) {
+  Coordinate second;
+  int value;
+
+  request->subject = view->subject;
+  request->id = view->id;
+  viewSession(view, request->session);
+
+  switch (view->kind) {
+  case PAYLOAD_INT:
+    value = viewInt(view);
+    memcpy(request->data, &value, sizeof(int));
+    break;
+  case PAYLOAD_COORD:
+    request->coord = viewCoord(view);
+    break;
+  case PAYLOAD_TWO_COORDS:
+    request->coord = viewCoord(view);
+    second = viewSecondCoord(view);
+    memcpy(request->data, &second, sizeof(Coordinate));
+    break;
+  case PAYLOAD_COORD_UUID:
+    request->coord = viewCoord(view);
+    viewUuid(view, request->data);
+    break;
+  case PAYLOAD_CHAR:
+    request->data[0] = viewChar(view);
+    break;
+  default:
+    break;
+  }
+}
+
+size_t encodeResponse(const Response *response, unsigned char *frame) {
+  unsigned char *p = putHeader(frame, response->subject, response->session);
+  Coordinate coord;
+  int value;
+
+  p = putInt(p, response->id, 4);
+
+  // In memory, the fields are stored one after the other in data
+  switch (payloadKind(response->subject)) {
+  case PAYLOAD_CHAR:
+    *p++ = response->data[0];
+    break;
+  case PAYLOAD_INT:
+    memcpy(&value, response->data, sizeof(int));
+    p = putInt(p, value, 4);
+    break;
+  case PAYLOAD_COORD:
+  case PAYLOAD_COORD_CHAR:
+    memcpy(&coord, response->data, sizeof(Coordinate));
+    p = putCoord(p, coord);
+    if (payloadKind(response->subject) == PAYLOAD_COORD_CHAR)
+      *p++ = response->data[sizeof(Coordinate)];
+    break;
+  case PAYLOAD_INT_COORD:
+    memcpy(&value, response->data, sizeof(int));
+    memcpy(&coord, response->data + sizeof(int), sizeof(Coordinate));
+    p = putInt(p, value, 4);
+    p = putCoord(p, coord);
+    break;
+  case PAYLOAD_UUID:
+    p = putUuid(p, response->data);
+    break;
+  default:
+    break;
+  }
+
+  return p - frame;
+}
+
+size_t encodeMapUpdate(const MapUpdate *update, unsigned char *frame) {
+  unsigned char *p = putHeader(frame, update->subject, update->session);
+  p = putInt(p, update->seq, 4);
+  p = putInt(p, update->count, 2);
+
+  for (int i = 0; i < update->count; i++) {
+    p = putInt(p, update->changes[i].slot, 2);
+    p = putInt(p, update->changes[i].entity, 8);
+  }
+
+  return p - frame;
+}
+
+size_t encodeClosures(const ClosureSet *set, unsigned char *frame) {
+  unsigned char *p = putHeader(frame, RRESPONSE_CLOSURES, set->session);
+  p = putInt(p, set->seq, 4);
+  p = putInt(p, set->count, 2);
+
+  for (int i = 0; i < set->count; i++)
+    p = putCoord(p, set->cells[i]);
+
+  return p - frame;
+}
+
+bool decodeClosures(ClosureSet *dest, const void *frame, size_t len) {
+  const unsigned char *bytes = frame;
+
+  if (len < FRAME_HEADER_SIZE + 6 || bytes[0] != PROTOCOL_VERSION || bytes[1] != RRESPONSE_CLOSURES)
+    return false;
+
+  memcpy(dest->session, bytes + 2, SESSION_LENGTH);
+  dest->seq = getInt(bytes + FRAME_HEADER_SIZE, 4) & 0xFFFFFFFF;
+  dest->count = getInt(bytes + FRAME_HEADER_SIZE + 4, 2) & 0xFFFF;
+
+  if (dest->count > MAX_CLOSED_CELLS || len < FRAME_HEADER_SIZE + 6 + (size_t)dest->count * 8)
+    return false;
+
+  for (int i = 0; i < dest->count; i++)
+    dest->cells[i] = getCoord(bytes + FRAME_HEADER_SIZE + 6 + i * 8);
+
+  return true;
+}
+
+bool openMapView(MapView *view, rd_kafka_message_t *msg) {
+  view->msg = NULL;
+  if (msg == NULL)
+    return false;
+
+  const unsigned char *bytes = msg->payload;
+  size_t len = msg->len;
+
+  if (len < FRAME_HEADER_SIZE + 6 || bytes[0] != PROTOCOL_VERSION) {
+    rd_kafka_message_destroy(msg);
+    return false;
+  }
+
+  view->subject = bytes[1];
+  view->seq = getInt(bytes + FRAME_HEADER_SIZE, 4) & 0xFFFFFFFF;
+  view->count = getInt(bytes + FRAME_HEADER_SIZE + 4, 2) & 0xFFFF;
+  view->changes = bytes + FRAME_HEADER_SIZE + 6;
+
+  if (view->count > MAP_SIZE || len < FRAME_HEADER_SIZE + 6 + (size_t)view->count * 10) {
+    rd_kafka_message_destroy(msg);
+    return false;
+  }
+
+  view->msg = msg;
+  return true;
+}
+
+void closeMapView(MapView *view) {
+  if (view->msg != NULL)
+    rd_kafka_message_destroy(view->msg);
+  view->msg = NULL;
+}
+
+MapChange mapViewChange(const MapView *view, int i) {
+  const unsigned char *change = view->changes + i * 10;
+  return (MapChange){.slot = getInt(change, 2) & 0xFFFF, .entity = getInt(change + 2, 8)};
+}
+
+void sendRequestEvent(rd_kafka_t *producer, const Request *request) {
+  sendRequestEventNotify(producer, request, NULL);
+}
+
+void sendRequestEventNotify(rd_kafka_t *producer, const Request *request, DeliveryNotice *notice) {
+  unsigned char frame[MAX_FRAME_SIZE];
+  char key[MESSAGE_KEY_LENGTH];
+
+  requestKey(request, key);
+  sendEventNotify(producer, "requests", RD_KAFKA_PARTITION_UA, key, frame,
+                  encodeRequest(request, frame), notice);
+}
+
+void sendResponseEvent(rd_kafka_t *producer, const char *topic, const Response *response) {
+  unsigned char frame[MAX_FRAME_SIZE];
+  char key[MESSAGE_KEY_LENGTH];
+
+  // Every response of a topic is addressed to the same type of entity, so the id is enough
+  snprintf(key, MESSAGE_KEY_LENGTH, "%i", response->id);
+  sendEvent(producer, topic, responsePartition(producer, topic, response->id), key, frame,
+            encodeResponse(response, frame));
+}
@@ -7,6 +7,7 @@
 #include <mysql/mysql.h>
 #include <netinet/in.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -21,11 +22,61 @@
 #define EOT 0x04
 #define STX 0x02
 #define ETX 0x03
+#define RESUME 0x11 // Login with the token of a previous one
+
+// Authentication frames are a size byte (bytes that follow it), the type of the message (one of the
+// constants above), its payload and the LRC of the type and the payload. Several frames can be sent
+// in a single write
+#define AUTH_FRAME_OVERHEAD 3
+#define MAX_AUTH_FRAME_SIZE 96
+// Capacity of an AuthBuffer. Enough for a few pipelined frames
+#define AUTH_BUFFER_SIZE 256
+
+// Token given to a taxi when it logs in. While the central keeps running, the taxi can log in again
+// by sending it in a RESUME frame instead of ENQ and STX. It holds the id of the taxi (4 bytes),
+// its generation (4), its expiration time (8) and the HMAC-SHA256 of them and the session (32)
+#define RESUME_TOKEN_SIZE 48
+// Payload of the reply to STX: ACK or NACK, the session and a resumption token (zeroed if rejected)
+#define AUTH_STX_REPLY_SIZE (1 + SESSION_LENGTH + RESUME_TOKEN_SIZE)
+// Payload of the reply to RESUME: the same as STX followed by the position of the taxi, whether it
+// has an objective (1 byte) and the objective. Coordinates are two int32. Only NACK if rejected
+#define AUTH_RESUME_REPLY_SIZE (AUTH_STX_REPLY_SIZE + 17)
 
 // Constants used in communication
 #define BUFFER_SIZE 300
-#define GRID_SIZE 20 // map dimensions
-#define MAP_SIZE 160 // size of the array used in communications to store the map
+
+// Default side of the map. It can be changed with the GRID_SIZE environment variable, which must
+// be the same for every component (see gridSize)
+#define DEFAULT_GRID_SIZE 20
+// Bits used by each coordinate in a serialized entity
+#define COORD_BITS 18
+// Maximum side of the map
+#define MAX_GRID_SIZE (1 << COORD_BITS)
+
+// Capacity of the map for each entity type. Taxi ids go from 0 to MAX_TAXIS - 1 and must fit in the
+// 12 bits of the id of a serialized entity (see serializeEntity)
+#define MAX_TAXIS 4096
+#define MAX_CUSTOMERS 30
+#define MAX_LOCATIONS 30
+// Size of the array used in communications to store the map. Each entity has a fixed slot in it:
+// locations first, then customers and then taxis
+#define MAP_SIZE (MAX_LOCATIONS + MAX_CUSTOMERS + MAX_TAXIS)
+// Value of a map slot not occupied by any entity. It's not a valid serialized entity as its type
+// bits are out of range
+#define EMPTY_SLOT ((int64_t)-1)
+
+// Number of map deltas sent between two consecutive keyframes
+#define MAP_KEYFRAME_INTERVAL 50
+// In seconds, maximum time between two consecutive keyframes
+#define MAP_KEYFRAME_PERIOD 5
+
+// Default maximum number of map frames published per second
+#define MAP_MAX_FPS 10
+
+// Maximum number of cells closed to the taxis at once (e.g. because of an incident)
+#define MAX_CLOSED_CELLS 4096
+// In seconds, maximum time between two consecutive publications of the closed cells
+#define CLOSURES_PERIOD 5
 
 // Parameters used in the database connection
 #define DB_NAME "db"
@@ -37,6 +88,22 @@
 // Length of the session id
 #define UUID_LENGTH 37
 
+// Length of the binary session id
+#define SESSION_LENGTH ((int)sizeof(uuid_t))
+
+// Version of the format of the messages exchanged through kafka. Messages with a different
+// version are discarded
+#define PROTOCOL_VERSION 6
+
+// Size of the header of every message: version, subject and session
+#define FRAME_HEADER_SIZE (2 + SESSION_LENGTH)
+// Maximum size of an encoded request or response
+#define MAX_FRAME_SIZE 64
+// Maximum size of an encoded map update
+#define MAX_MAP_FRAME_SIZE (FRAME_HEADER_SIZE + 6 + MAP_SIZE * 10)
+// Maximum size of an encoded set of closed cells
+#define MAX_CLOSURES_FRAME_SIZE (FRAME_HEADER_SIZE + 6 + MAX_CLOSED_CELLS * 8)
+
 // Inconvenience messages
 extern const char *inconveniences[4][INCONVENIENCES_COUNT];
 
@@ -49,6 +116,49 @@ extern const char *inconveniences[4][INCONVENIENCES_COUNT];
 // In seconds, time the server will wait between strays checks
 #define PING_GRACE_TIME 2
 
+// In milliseconds, maximum time a change of the central's state takes to be stored in the database
+#define PERSIST_INTERVAL 200
+
+// Duration (ms) of a tick of the timing wheel used to detect strays
+#define STRAY_TICK_MS 250
+
+// Default producer batching settings. They can be overridden with the environment variables of
+// the same name (see createKafkaUser)
+#define KAFKA_LINGER_MS "5"
+#define KAFKA_BATCH_SIZE "10000"
+#define KAFKA_QUEUE_SIZE "100000"
+
+// Maximum number of threads handling the requests in the central. By default, as many as cores
+// (overridable with the CENTRAL_WORKERS environment variable)
+#define MAX_WORKERS 16
+
+// Capacity of the queue of each worker. The central stops reading requests while it's full
+#define WORKER_QUEUE_SIZE 1024
+
+// Maximum number of requests the central reads at once
+#define CONSUME_BATCH_SIZE 500
+
+// Time (ms) that flushEvents waits for the pending messages to be delivered
+#define KAFKA_FLUSH_TIMEOUT 5000
+
+// In seconds, default age after which a received message is discarded (env MESSAGE_TTL)
+#define MESSAGE_TTL 600
+// In seconds, age after which a ping is discarded (env PING_TTL). An older ping wouldn't prevent
+// its sender from being considered a stray anyway
+#define PING_TTL (USER_GRACE_TIME + PING_GRACE_TIME)
+// In seconds, age after which a taxi movement is discarded (env MOVE_TTL). Newer ones will follow
+#define MOVE_TTL 30
+
+// Maximum length of the key of a message
+#define MESSAGE_KEY_LENGTH 16
+// Key of the map updates. They all share it so they're kept in order
+#define MAP_MESSAGE_KEY "map"
+// Key of the sets of closed cells, for the same reason
+#define CLOSURES_MESSAGE_KEY "closures"
+// Partition of the closures topic the sets of closed cells are produced to and read from. They're
+// a single stream every taxi reads, so it doesn't depend on how many partitions the topic has
+#define CLOSURES_PARTITION 0
+
 // Macro used to store the result of a query
 #define store_result_wrapper(result)                                                               \
   result = mysql_store_result(conn);                                                               \
@@ -86,6 +196,7 @@ typedef enum {
   ORDER_GOTO,
   ORDER_STOP,
   ORDER_CONTINUE,
+  ORDER_TOGGLE_CLOSURE, // Closes a cell to the taxis, or opens it again if it was closed
 
   // Emitted by a thread of the central that checks continuously if there are
   // any customers or taxis that haven't sent any ping
@@ -98,9 +209,10 @@ typedef enum {
 
   // Emitted by the different components of the system to inform
   // the central of any event that may affect the system
-  REQUEST_NEW_TAXI,
+  REQUEST_NEW_TAXI, // The logins carry the generation of the token given to the taxi
   REQUEST_NEW_CUSTOMER,
   REQUEST_TAXI_RECONNECT,
+  REQUEST_TAXI_RESUME, // Reconnection with a resumption token. The taxi already knows its position
   REQUEST_DESTINATION_REACHED,
   REQUEST_ASK_FOR_SERVICE,
   REQUEST_TAXI_MOVE,
@@ -113,7 +225,8 @@ typedef enum {
 
   // Emitted by the central as a response to a request.
   // The prefix indicates the adressee of the message:
-  // C-Customer, T-Taxi, M-Map (directed to the GUI handlers)
+  // C-Customer, T-Taxi, M-Map (directed to the GUI handlers), R-Road closures (directed to the
+  // digital engines)
   CRESPONSE_SERVICE_ACCEPTED,
   CRESPONSE_SERVICE_DENIED,
   CRESPONSE_ERROR,
@@ -130,8 +243,16 @@ typedef enum {
   TRESPONSE_CHANGE_POSITION,
   TRESPONSE_SERVICE_COMPLETED,
   TRESPONSE_START_SERVICE,
+  TRESPONSE_WAIT,    // The move was refused because the cell is taken. Carries where the taxi is
+  TRESPONSE_REROUTE, // Same, but the taxi must go around the cell instead of waiting for it
+  // The central refused a login the socket had accepted. Carries the generation of the token given
+  // at that login (see RESUME_TOKEN_SIZE), so only the digital engine that got it logs in again
+  TRESPONSE_LOG_IN_AGAIN,
+
+  MRESPONSE_MAP_KEYFRAME, // Full state of the map
+  MRESPONSE_MAP_DELTA,    // Slots that changed since the previous update
 
-  MRESPONSE_MAP_UPDATE,
+  RRESPONSE_CLOSURES, // Every closed cell
 } SUBJECT;
 
 // Defines the importance of the inconvenience detected by a sensor
@@ -164,21 +285,89 @@ typedef struct {
   Coordinate coord;          // Position of the author (may be unused)
   int id;                    // Identification of the author
   char data[UUID_LENGTH];    // Extra data, depending on the subject
-  char session[UUID_LENGTH]; // Session id of the system, restarted each time the system restarts.
-                             // Its possition as last in the struct is relevant, don't change it
+  uuid_t session;            // Session id of the system, restarted each time the system restarts
 } Request;
 
 // Represents a message sent by the central to a user
 typedef struct {
   SUBJECT subject;           // Purpose of the message
-  int map[MAP_SIZE];         // 100 (taxis) + 30 (customers) + 30 (locations)
-                             // Represents the state of the map
-  char id;                   // Identification of the addressee
+  int id;                    // Identification of the addressee
   char data[UUID_LENGTH];    // Extra data, depending on the subject
-  char session[UUID_LENGTH]; // Session id of the system, restarted each time the system restarts.
-                             // Its possition as last in the struct is relevant, don't change it
+  uuid_t session;            // Session id of the system, restarted each time the system restarts
 } Response;
 
+// Represents the change of a single slot of the map
+typedef struct {
+  int slot;       // Position of the entity in the map array
+  int64_t entity; // Serialized entity or EMPTY_SLOT if the entity has been removed
+} MapChange;
+
+// Represents an update of the map sent by the central to the GUI handlers. Only the first `count`
+// changes are sent, so its size depends on how many entities changed (see encodeMapUpdate)
+typedef struct {
+  SUBJECT subject;             // MRESPONSE_MAP_KEYFRAME or MRESPONSE_MAP_DELTA
+  unsigned int seq;            // Increased by one with each update. Used to detect lost deltas
+  int count;                   // Number of changes
+  uuid_t session;              // Session id of the system
+  MapChange changes[MAP_SIZE]; // Keyframes contain every non empty slot
+} MapUpdate;
+
+// Represents the cells closed to the taxis, sent by the central to the digital engines. The whole
+// set is sent each time, so a digital engine only needs the latest one (see encodeClosures)
+typedef struct {
+  unsigned int seq;                   // Increased by one with each publication
+  int count;                          // Number of closed cells
+  uuid_t session;                     // Session id of the system
+  Coordinate cells[MAX_CLOSED_CELLS]; // Only the first count are sent
+} ClosureSet;
+
+// Fields carried by each subject, besides the header and the id
+typedef enum {
+  PAYLOAD_NONE,
+  PAYLOAD_CHAR,       // A single char (e.g. destination)
+  PAYLOAD_INT,        // An int (e.g. taxi id)
+  PAYLOAD_COORD,      // A coordinate
+  PAYLOAD_COORD_CHAR, // A coordinate followed by a char
+  PAYLOAD_INT_COORD,  // An int followed by a coordinate
+  PAYLOAD_UUID,       // A unique id, sent in binary
+  PAYLOAD_COORD_UUID, // A coordinate followed by a unique id
+  PAYLOAD_TWO_COORDS, // Two coordinates. In a request, the second one is stored in data
+} PAYLOAD_KIND;
+
+// Read-only view over a request or a response received from kafka. The fields are read in place
+// from the payload, which is validated once when the view is opened (see openMessageView)
+typedef struct {
+  rd_kafka_message_t *msg;      // Message viewed. Destroyed by closeMessageView
+  const unsigned char *frame;   // Encoded message (see encodeRequest)
+  SUBJECT subject;              // Subject of the message
+  PAYLOAD_KIND kind;            // Fields carried by the subject
+  int id;                       // Id of the entity the message is about
+  const unsigned char *payload; // Fields carried by the subject, read them with the accessors
+} MessageView;
+
+// Read-only view over a map update received from kafka (see openMapView)
+typedef struct {
+  rd_kafka_message_t *msg;      // Message viewed. Destroyed by closeMapView
+  SUBJECT subject;              // MRESPONSE_MAP_KEYFRAME or MRESPONSE_MAP_DELTA
+  unsigned int seq;             // Sequence number of the update
+  int count;                    // Number of changes
+  const unsigned char *changes; // Encoded changes, read them with mapViewChange
+} MapView;
+
+// Authentication frame read from an AuthBuffer
+typedef struct {
+  char type;                    // ENQ, STX, ACK, NACK or EOT
+  const unsigned char *payload; // Points into the buffer, valid until it's read into again
+  int size;                     // Size of the payload
+} AuthFrame;
+
+// Bytes received from an authentication socket, which may contain several frames or partial ones
+typedef struct {
+  unsigned char data[AUTH_BUFFER_SIZE];
+  int start; // First byte not consumed
+  int end;   // End of the bytes received
+} AuthBuffer;
+
 // Function used to handle the logging of the components if ncurses is not being used
 void log_handler(const gchar *log_domain, GLogLevelFlags log_level, const gchar *message,
                  gpointer user_data);
@@ -186,8 +375,10 @@ void log_handler(const gchar *log_domain, GLogLevelFlags log_level, const gchar
 /// @brief Configures and opens a socket ready to accept connections
 ///
 /// @param port Port to be used
+/// @param backlog Maximum number of connections waiting to be accepted. The kernel caps it at
+/// SOMAXCONN
 /// @return int Socket descriptor
-int openSocket(int port);
+int openSocket(int port, int backlog);
 
 /// @brief Connects to a server's socket
 ///
@@ -195,6 +386,69 @@ int openSocket(int port);
 /// @return int Socket descriptor
 int connectToServer(Address *server);
 
+/// @brief Connects to a server's socket without exiting on failure, unlike connectToServer. It
+/// doesn't log either, so it can be used for every login of a fleet
+///
+/// @param server Address of the server
+/// @param timeout Maximum time (ms) each connect, read or write on the socket can block
+/// @return int Socket descriptor, or -1 if it couldn't connect
+int tryConnect(const Address *server, int timeout);
+
+/// @brief Writes a little endian integer
+///
+/// @param dest Where to write it
+/// @param value Value to be written
+/// @param bytes Number of bytes to write
+/// @return unsigned char* Position after the written integer
+unsigned char *putInt(unsigned char *dest, int64_t value, int bytes);
+
+/// @brief Reads a little endian integer
+///
+/// @param src Where to read it from
+/// @param bytes Number of bytes to read
+/// @return int64_t Value read, sign extended
+int64_t getInt(const unsigned char *src, int bytes);
+
+/// @brief Appends an authentication frame to a buffer
+///
+/// @param dest Where to write the frame. It needs AUTH_FRAME_OVERHEAD + size bytes
+/// @param type Type of the message
+/// @param payload Payload of the message, NULL if size is 0
+/// @param size Size of the payload. At most MAX_AUTH_FRAME_SIZE - AUTH_FRAME_OVERHEAD
+/// @return int Bytes written
+int putAuthFrame(unsigned char *dest, char type, const void *payload, int size);
+
+/// @brief Reads from a socket into an authentication buffer, after discarding the frames already
+/// consumed
+///
+/// @param fd Socket to read from
+/// @param buffer Buffer to read into
+/// @return ssize_t Result of read
+ssize_t readAuthBuffer(int fd, AuthBuffer *buffer);
+
+/// @brief Checks whether there's a whole frame at the start of an authentication buffer
+///
+/// @param buffer Buffer to be checked
+/// @return int 1 if there's a valid frame, 0 if it's incomplete and -1 if it's invalid (wrong size
+/// or LRC). A stream with an invalid frame can't be recovered, so it should be closed
+int peekAuthFrame(const AuthBuffer *buffer);
+
+/// @brief Takes the first frame of an authentication buffer
+///
+/// @param buffer Buffer to read from
+/// @param frame Output argument. Frame read. Its payload points into the buffer
+/// @return int Same as peekAuthFrame. The frame is only consumed if it's 1
+int nextAuthFrame(AuthBuffer *buffer, AuthFrame *frame);
+
+/// @brief Reads a frame from a blocking socket, waiting for the rest of it if it's split
+///
+/// @param fd Socket to read from
+/// @param buffer Buffer used for the socket. Frames received together are kept for the next calls
+/// @param frame Output argument. Frame read
+/// @return true A valid frame was read
+/// @return false The socket was closed, failed or sent an invalid frame
+bool readAuthFrame(int fd, AuthBuffer *buffer, AuthFrame *frame);
+
 /// @brief Generates a unique id
 ///
 /// @param id Unique id, 37 bytes long (including the null terminator)
@@ -208,6 +462,21 @@ void generate_unique_id(char id[UUID_LENGTH]);
 /// @return rd_kafka_t* Kafka user
 rd_kafka_t *createKafkaUser(Address *server, rd_kafka_type_t type, char *id);
 
+/// @brief Gets the Kafka consumer or producer shared by every thread of the process, creating it
+/// the first time. Each client brings its own threads and broker connections, so a process needs
+/// no more than one of each type. Producers are thread safe. The consumer must be polled from a
+/// single thread, which dispatches the messages of every topic it reads
+///
+/// @param server Address of the kafka server. Only used when the client is created
+/// @param type Type of the user (consumer or producer)
+/// @param id Unique id of the user. Only used when the client is created. NULL for a random one
+/// @return rd_kafka_t* Kafka user
+rd_kafka_t *sharedKafkaUser(Address *server, rd_kafka_type_t type, char *id);
+
+/// @brief Flushes the shared producer, closes the shared consumer and destroys both (see
+/// sharedKafkaUser). Intended to be called once every thread has stopped using them
+void destroySharedKafkaUsers();
+
 /// @brief Subscribes a kafka consumer to a list of topics
 ///
 /// @param consumer Kafka consumer
@@ -215,35 +484,355 @@ rd_kafka_t *createKafkaUser(Address *server, rd_kafka_type_t type, char *id);
 /// @param topicsCount Number of topics in the list
 void subscribeToTopics(rd_kafka_t **consumer, const char **topics, int topicsCount);
 
+/// @brief Gets the number of partitions of a topic from the broker. The result is cached, so only
+/// the first call for each topic blocks
+///
+/// @param rk Kafka producer or consumer
+/// @param topic Name of the topic
+/// @return int Number of partitions, 1 if it couldn't be read
+int topicPartitions(rd_kafka_t *rk, const char *topic);
+
+/// @brief Gets the partition where the responses addressed to an entity are sent. Each taxi and
+/// each customer always uses the same one, so they only have to read it (see assignResponses)
+///
+/// @param rk Kafka producer or consumer
+/// @param topic Response topic
+/// @param id Id of the entity the responses are addressed to
+/// @return int Partition of the topic
+int responsePartition(rd_kafka_t *rk, const char *topic, int id);
+
+/// @brief Makes a consumer read the partition of a response topic where the responses addressed to
+/// an entity are sent, instead of subscribing to the whole topic. It's added to the partitions the
+/// consumer already reads, so it must be called before the consumer is polled
+///
+/// @param consumer Kafka consumer
+/// @param topic Response topic
+/// @param id Id of the entity
+void assignResponses(rd_kafka_t **consumer, const char *topic, int id);
+
+/// @brief Same as assignResponses, but for a range of consecutive ids. It reads one partition per
+/// id, or the whole topic if there are more ids than partitions
+///
+/// @param consumer Kafka consumer
+/// @param topic Response topic
+/// @param firstId First id of the range
+/// @param count Number of ids
+void assignResponseRange(rd_kafka_t **consumer, const char *topic, int firstId, int count);
+
+/// @brief Checks whether a response is addressed to an entity by looking at its key, so the
+/// responses to other entities sharing the partition can be skipped without decoding them
+///
+/// @param msg Message received
+/// @param id Id of the entity
+/// @return true The response is addressed to the entity
+/// @return false Otherwise
+bool isAddressedTo(const rd_kafka_message_t *msg, int id);
+
+// Notification attached to a message, run by the delivery report once the message has been
+// delivered or has permanently failed. Useful to wait for a message without flushing the producer
+typedef struct {
+  void (*onDelivery)(void *context, rd_kafka_resp_err_t err);
+  void *context;
+} DeliveryNotice;
+
 /// @brief Sends an event to a kafka topic
 ///
+/// The event is only enqueued, so the function returns without waiting for the broker. The
+/// messages are sent in batches in the background and the failed deliveries are logged by the
+/// delivery report callback. If the outbound queue is full, it blocks until there's room again.
+///
+/// Messages with the same key go to the same partition, so they are read in the same order they
+/// were sent. Keys should identify the entity the message is about (see requestKey).
+///
 /// @param producer Kafka producer that will send the event
 /// @param topic Topic to send the event to
+/// @param partition Partition to send the event to, or RD_KAFKA_PARTITION_UA to choose it by key
+/// @param key Key of the event
 /// @param value Value to send
 /// @param valueSize Size of the value
-void sendEvent(rd_kafka_t *producer, const char *topic, void *value, size_t valueSize);
+void sendEvent(rd_kafka_t *producer, const char *topic, int partition, const char *key,
+               void *value, size_t valueSize);
+
+/// @brief Same as sendEvent, but notifies when the event has been delivered. The notification runs
+/// in the thread that polls the producer, so it mustn't block
+///
+/// @param producer Kafka producer that will send the event
+/// @param topic Topic to send the event to
+/// @param partition Partition to send the event to, or RD_KAFKA_PARTITION_UA to choose it by key
+/// @param key Key of the event
+/// @param value Value to send
+/// @param valueSize Size of the value
+/// @param notice Notification run on delivery. It must stay valid until then. NULL for none
+void sendEventNotify(rd_kafka_t *producer, const char *topic, int partition, const char *key,
+                     void *value, size_t valueSize, DeliveryNotice *notice);
+
+/// @brief Gets the entity a request is about. Orders are about taxis
+///
+/// @param subject Subject of the request
+/// @return ENTITY_TYPE ENTITY_CUSTOMER or ENTITY_TAXI
+ENTITY_TYPE requestEntity(SUBJECT subject);
+
+/// @brief Builds the kafka key of a request, which identifies its entity (e.g. "t12" or "ca")
+///
+/// @param request Request to be sent
+/// @param key Output argument. Capacity of MESSAGE_KEY_LENGTH
+void requestKey(const Request *request, char *key);
+
+/// @brief Gets how long a message can wait in kafka before being discarded
+///
+/// @param subject Subject of the message
+/// @return int Time to live in seconds
+int messageTtl(SUBJECT subject);
+
+/// @brief Waits until every event enqueued by a producer has been delivered (or KAFKA_FLUSH_TIMEOUT
+/// expires). Intended to be called before exiting or destroying the producer
+///
+/// @param producer Kafka producer to be flushed
+void flushEvents(rd_kafka_t *producer);
 
-/// @brief Polls a message discarding the ones that are older than the determined time
+/// @brief Polls a message discarding the ones that are older than their time to live (see
+/// messageTtl). The age is taken from the timestamp of the message
 ///
 /// @param rk Kafka consumer
 /// @param timeout_ms Timeout in milliseconds
 /// @return rd_kafka_message_t* Message or NULL if there is no message or it's too old
 rd_kafka_message_t *poll_wrapper(rd_kafka_t *rk, int timeout_ms);
 
-/// @brief Serializes an entity into an int. It takes advantage of the fact that not all the size of
-/// the fields is used (e.g. Coordinates values should be in the range [0, 19]). If these
-/// presuppositions change, this function will need to be updated
+/// @brief Gets the side of the map. It's read once from the GRID_SIZE environment variable,
+/// defaulting to DEFAULT_GRID_SIZE. Exits if it's not in the range [1, MAX_GRID_SIZE]
+///
+/// @return int Side of the map
+int gridSize();
+
+/// @brief Checks whether a coordinate is inside the map
+///
+/// @param coord Coordinate to be checked
+/// @return true Both values are in the range [0, gridSize())
+/// @return false Otherwise
+bool isInsideGrid(Coordinate coord);
+
+/// @brief Calculates the distance between two coordinates taking into account that the map is
+/// spherical (e.g. (0, 0) is next to (19, 19) the same way it is to (1, 1) in a 20x20 map)
+///
+/// @param a First coordinate
+/// @param b Second coordinate
+/// @return int Number of steps between them
+int sphericalDistance(Coordinate *a, Coordinate *b);
+
+/// @brief Consumes up to max messages at once, discarding the same messages as poll_wrapper
+///
+/// @param rk Kafka consumer
+/// @param timeout_ms Maximum time to wait for the first message
+/// @param msgs Output argument. Messages read. They must be destroyed by the caller
+/// @param max Capacity of msgs
+/// @return int Number of messages stored in msgs
+int consumeBatch(rd_kafka_t *rk, int timeout_ms, rd_kafka_message_t **msgs, int max);
+
+/// @brief Serializes an entity into a 64 bit integer. From the lowest bit: type (3 bits), status
+/// (4), carryingCustomer (1), obj (8), id (12), x (COORD_BITS) and y (COORD_BITS)
 ///
 /// @param entity Entity to be serialized
-/// @return int Serialized entity
-int serializeEntity(Entity *entity);
+/// @return int64_t Serialized entity
+int64_t serializeEntity(const Entity *entity);
 
-/// @brief Deserializes an entity from an int. It takes advantage of the fact that not all the size
-/// of the fields is used (e.g. Coordinates values should be in the range [0, 19]). If these
-/// presuppositions change, this function will need to be updated
+/// @brief Deserializes an entity serialized with serializeEntity
 ///
 /// @param dest Entity where the deserialized entity will be stored
 /// @param entity Serialized entity
-void deserializeEntity(Entity *dest, int entity);
+void deserializeEntity(Entity *dest, int64_t entity);
+
+/// @brief Serializes several entities at once (see serializeEntity)
+///
+/// @param entities Entities to be serialized
+/// @param dest Output argument. Serialized entities. Capacity of count
+/// @param count Number of entities
+void serializeEntities(const Entity *entities, int64_t *dest, int count);
+
+/// @brief Deserializes several entities at once (see serializeEntities). EMPTY_SLOT values are
+/// deserialized too, so the caller must skip them
+///
+/// @param entities Serialized entities
+/// @param dest Output argument. Deserialized entities. Capacity of count
+/// @param count Number of entities
+void deserializeEntities(const int64_t *entities, Entity *dest, int count);
+
+/// @brief Gets the slot of the map array reserved for an entity
+///
+/// @param type Type of the entity
+/// @param id Id of the entity (a char if the entity is not a taxi)
+/// @return int Slot of the entity or -1 if the id is out of range
+int mapSlot(ENTITY_TYPE type, int id);
+
+/// @brief Applies a map update received from the central to a local copy of the map. Keyframes
+/// are always applied. Deltas are only applied if no previous update has been lost, otherwise
+/// they're discarded until the next keyframe arrives
+///
+/// @param map Local copy of the map
+/// @param seq Input/output argument. Sequence number of the last update applied, or -1 if the map
+/// isn't synchronized yet
+/// @param update Update received (see openMapView)
+/// @return true The update has been applied
+/// @return false The update isn't a map update or a previous delta was lost
+bool applyMapUpdate(int64_t map[MAP_SIZE], long *seq, const MapView *update);
+
+/// @brief Encodes a request into the format sent through kafka.
+///
+/// Every message starts with a header (version byte, subject byte and binary session id) followed
+/// by the id of the entity and the fields used by the subject only (e.g. a ping carries no
+/// payload, a move carries just the coordinate). All the integers are little endian.
+///
+/// @param request Request to be encoded
+/// @param frame Output argument. Encoded message. Capacity of MAX_FRAME_SIZE
+/// @return size_t Size of the encoded message
+size_t encodeRequest(const Request *request, unsigned char *frame);
+
+/// @brief Encodes a response into the format sent through kafka (see encodeRequest)
+///
+/// @param response Response to be encoded
+/// @param frame Output argument. Encoded message. Capacity of MAX_FRAME_SIZE
+/// @return size_t Size of the encoded message
+size_t encodeResponse(const Response *response, unsigned char *frame);
+
+/// @brief Encodes a map update into the format sent through kafka. After the header go the sequence
+/// number, the number of changes and the changes (slot and serialized entity)
+///
+/// @param update Update to be encoded
+/// @param frame Output argument. Encoded message. Capacity of MAX_MAP_FRAME_SIZE
+/// @return size_t Size of the encoded message
+size_t encodeMapUpdate(const MapUpdate *update, unsigned char *frame);
+
+/// @brief Encodes a set of closed cells into the format sent through kafka. After the header go
+/// the sequence number, the number of cells and the cells (two int32 each)
+///
+/// @param set Set to be encoded
+/// @param frame Output argument. Encoded message. Capacity of MAX_CLOSURES_FRAME_SIZE
+/// @return size_t Size of the encoded message
+size_t encodeClosures(const ClosureSet *set, unsigned char *frame);
+
+/// @brief Decodes a set of closed cells, checking its version, its subject and that it's long
+/// enough for all its cells
+///
+/// @param dest Output argument. Decoded set
+/// @param frame Encoded message
+/// @param len Size of the message
+/// @return true The set is valid
+/// @return false The message is malformed or has a different version
+bool decodeClosures(ClosureSet *dest, const void *frame, size_t len);
+
+/// @brief Opens a view over an encoded request or response, checking its version and that it's
+/// long enough for the fields of its subject. The frame must outlive the view
+///
+/// @param view Output argument. View over the frame
+/// @param frame Encoded message
+/// @param len Size of the message
+/// @return true The message is valid
+/// @return false The message is malformed, has a different version or a coordinate out of the map
+bool viewFrame(MessageView *view, const void *frame, size_t len);
+
+/// @brief Opens a view over a request or a response received from kafka (see viewFrame). The view
+/// takes ownership of the message: it's destroyed right away if it isn't valid or by
+/// closeMessageView otherwise
+///
+/// @param view Output argument. View over the message
+/// @param msg Message received. It may be NULL
+/// @return true The message is valid
+/// @return false The message is NULL or isn't valid
+bool openMessageView(MessageView *view, rd_kafka_message_t *msg);
+
+/// @brief Closes a view, destroying its message. Nothing happens if it's already closed
+///
+/// @param view View to be closed
+void closeMessageView(MessageView *view);
+
+/// @brief Checks whether a message belongs to a session
+///
+/// @param view View over the message
+/// @param session Session id
+/// @return true The session of the message is the given one
+/// @return false Otherwise
+bool viewSessionIs(const MessageView *view, const uuid_t session);
+
+/// @brief Reads the session of a message
+///
+/// @param view View over the message
+/// @param dest Output argument. Session id
+void viewSession(const MessageView *view, uuid_t dest);
+
+/// @brief Reads the coordinate of a message. Only valid if its subject carries one
+///
+/// @param view View over the message
+/// @return Coordinate Coordinate carried
+Coordinate viewCoord(const MessageView *view);
+
+/// @brief Reads the second coordinate of a message. Only valid if its subject carries two
+///
+/// @param view View over the message
+/// @return Coordinate Second coordinate carried
+Coordinate viewSecondCoord(const MessageView *view);
+
+/// @brief Reads the char of a message. Only valid if its subject carries one
+///
+/// @param view View over the message
+/// @return char Char carried
+char viewChar(const MessageView *view);
+
+/// @brief Reads the int of a message. Only valid if its subject carries one
+///
+/// @param view View over the message
+/// @return int Int carried
+int viewInt(const MessageView *view);
+
+/// @brief Reads the unique id of a message as a string. Only valid if its subject carries one
+///
+/// @param view View over the message
+/// @param dest Output argument. Unique id. Capacity of UUID_LENGTH
+void viewUuid(const MessageView *view, char *dest);
+
+/// @brief Copies the fields of a request into a struct, so it can outlive its message
+///
+/// @param view View over the request
+/// @param request Output argument. Request
+void requestFromView(const MessageView *view, Request *request);
+
+/// @brief Opens a view over a map update received from kafka, checking its version and that it's
+/// long enough for all its changes. The view takes ownership of the message (see openMessageView)
+///
+/// @param view Output argument. View over the update
+/// @param msg Message received. It may be NULL
+/// @return true The update is valid
+/// @return false The message is NULL or isn't a valid update
+bool openMapView(MapView *view, rd_kafka_message_t *msg);
+
+/// @brief Closes a map view, destroying its message. Nothing happens if it's already closed
+///
+/// @param view View to be closed
+void closeMapView(MapView *view);
+
+/// @brief Reads a change of a map update in place
+///
+/// @param view View over the update
+/// @param i Index of the change, lower than view->count
+/// @return MapChange Change read
+MapChange mapViewChange(const MapView *view, int i);
+
+/// @brief Encodes a request and sends it to the requests topic
+///
+/// @param producer Kafka producer that will send the request
+/// @param request Request to be sent
+void sendRequestEvent(rd_kafka_t *producer, const Request *request);
+
+/// @brief Encodes a request and sends it to the requests topic, notifying when it's delivered
+///
+/// @param producer Kafka producer that will send the request
+/// @param request Request to be sent
+/// @param notice Notification run on delivery (see sendEventNotify)
+void sendRequestEventNotify(rd_kafka_t *producer, const Request *request, DeliveryNotice *notice);
+
+/// @brief Encodes a response and sends it to a topic
+///
+/// @param producer Kafka producer that will send the response
+/// @param topic Topic to send the response to
+/// @param response Response to be sent
+void sendResponseEvent(rd_kafka_t *producer, const char *topic, const Response *response);
 
 #endif
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "data_structures.h"
 #include "common.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -15,6 +16,7 @@ void initTable(Table *table, Coordinate start, char *title, char **headers, int
   table->title = title;
   table->length = 1;
   table->rows_num = 0;
+  table->hidden_rows = 0;
   table->col_lengths = malloc(sizeof(int) * headers_num);
   table->err_color = err_color;
 
@@ -26,6 +28,8 @@ void initTable(Table *table, Coordinate start, char *title, char **headers, int
 
 void printTable(Table *table, WINDOW *win) {
   int currentLine = 0;
+  int shown = table->rows_num, hidden = table->hidden_rows;
+  char more[MAX_COL_LEN];
 
   mvwaddch(win, table->start.y, table->start.x, ACS_ULCORNER);
   for (int i = 0; i < table->length - 2; i++) {
@@ -67,7 +71,15 @@ void printTable(Table *table, WINDOW *win) {
   }
   currentLine++;
 
-  for (int i = 0; i < table->rows_num; i++) {
+  // Rows that fit between the headers and the bottom border. If some are left out, the last one
+  // says how many
+  int room = getmaxy(win) - table->start.y - currentLine - 1;
+  if (shown > room || hidden > 0) {
+    shown = shown < room - 1 ? shown : (room > 1 ? room - 1 : 0);
+    hidden += table->rows_num - shown;
+  }
+
+  for (int i = 0; i < shown; i++) {
     int last = 0;
     mvwaddch(win, table->start.y + currentLine, table->start.x, ACS_VLINE);
     for (int j = 0; j < table->cols_num; j++) {
@@ -87,6 +99,15 @@ void printTable(Table *table, WINDOW *win) {
     currentLine++;
   }
 
+  if (hidden > 0) {
+    snprintf(more, sizeof(more), "+%i more", hidden);
+    mvwaddch(win, table->start.y + currentLine, table->start.x, ACS_VLINE);
+    mvwaddch(win, table->start.y + currentLine, table->start.x + table->length - 1, ACS_VLINE);
+    mvwaddstr(win, table->start.y + currentLine,
+              table->start.x + (table->length - strlen(more)) / 2, more);
+    currentLine++;
+  }
+
   mvwaddch(win, table->start.y + currentLine, table->start.x, ACS_LLCORNER);
   for (int i = 0; i < table->length - 2; i++) {
     waddch(win, ACS_HLINE);
@@ -98,6 +119,11 @@ void printTable(Table *table, WINDOW *win) {
 }
 
 void addRow(Table *table, const char **row, bool status) {
+  if (table->rows_num >= MAX_ROWS) {
+    table->hidden_rows++;
+    return;
+  }
+
   for (int i = 0; i < table->cols_num; i++) {
     strncpy(table->rows[table->rows_num][i], row[i], MAX_COL_LEN - 1);
     table->rows[table->rows_num][i][MAX_COL_LEN - 1] = '\0';
@@ -106,7 +132,10 @@ void addRow(Table *table, const char **row, bool status) {
   table->rows_num++;
 }
 
-void emptyTable(Table *table) { table->rows_num = 0; }
+void emptyTable(Table *table) {
+  table->rows_num = 0;
+  table->hidden_rows = 0;
+}
 
 void destroyTable(Table *table) { free(table->col_lengths); }
 
@@ -155,4 +184,241 @@ void enqueue(Queue *queue, void *element) {
 
   memcpy(queue->elements[queue->tail], element, BUFFER_SIZE);
   queue->tail = (queue->tail + 1) % QUEUE_SIZE;
-}
\ No newline at end of file
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//// Spatial index
+////////////////////////////////////////////////////////////////////////////////////
+
+void initSpatialIndex(SpatialIndex *index) {
+  int size = gridSize();
+
+  index->bucketSize = (size + SPATIAL_MAX_BUCKETS - 1) / SPATIAL_MAX_BUCKETS;
+  if (index->bucketSize < SPATIAL_BUCKET_SIZE)
+    index->bucketSize = SPATIAL_BUCKET_SIZE;
+  index->buckets = (size + index->bucketSize - 1) / index->bucketSize;
+  index->slack = index->buckets * index->bucketSize - size;
+
+  for (int i = 0; i < SPATIAL_MAX_BUCKETS; i++) {
+    for (int j = 0; j < SPATIAL_MAX_BUCKETS; j++)
+      index->heads[i][j] = -1;
+  }
+
+  for (int i = 0; i < MAX_TAXIS; i++) {
+    index->next[i] = -1;
+    index->prev[i] = -1;
+    index->present[i] = false;
+  }
+
+  index->count = 0;
+}
+
+/// @brief Gets the bucket list a position belongs to
+///
+/// @param index Spatial index
+/// @param coord Position
+/// @return int* Head of the list of the bucket
+int *bucketOf(SpatialIndex *index, Coordinate coord) {
+  return &index->heads[coord.x / index->bucketSize][coord.y / index->bucketSize];
+}
+
+void spatialRemove(SpatialIndex *index, int taxiId) {
+  if (taxiId < 0 || taxiId >= MAX_TAXIS || !index->present[taxiId])
+    return;
+
+  int next = index->next[taxiId];
+  int prev = index->prev[taxiId];
+
+  if (prev != -1)
+    index->next[prev] = next;
+  else
+    *bucketOf(index, index->coords[taxiId]) = next;
+
+  if (next != -1)
+    index->prev[next] = prev;
+
+  index->next[taxiId] = -1;
+  index->prev[taxiId] = -1;
+  index->present[taxiId] = false;
+  index->count--;
+}
+
+void spatialSet(SpatialIndex *index, int taxiId, Coordinate coord) {
+  if (taxiId < 0 || taxiId >= MAX_TAXIS)
+    return;
+
+  if (index->present[taxiId]) {
+    // Moving inside the same bucket doesn't change the lists
+    if (bucketOf(index, index->coords[taxiId]) == bucketOf(index, coord)) {
+      index->coords[taxiId] = coord;
+      return;
+    }
+    spatialRemove(index, taxiId);
+  }
+
+  int *head = bucketOf(index, coord);
+  index->coords[taxiId] = coord;
+  index->prev[taxiId] = -1;
+  index->next[taxiId] = *head;
+  if (*head != -1)
+    index->prev[*head] = taxiId;
+  *head = taxiId;
+  index->present[taxiId] = true;
+  index->count++;
+}
+
+int spatialNearest(SpatialIndex *index, Coordinate coord, int k, int *ids) {
+  bool visited[SPATIAL_MAX_BUCKETS][SPATIAL_MAX_BUCKETS] = {{false}};
+  int distances[MAX_TAXIS];
+  int found = 0;
+  int buckets = index->buckets;
+  int cx = coord.x / index->bucketSize;
+  int cy = coord.y / index->bucketSize;
+
+  if (k > MAX_TAXIS)
+    k = MAX_TAXIS;
+  if (k <= 0)
+    return 0;
+
+  // Buckets are visited in rings around the one of the point. Any taxi in the ring r is at least
+  // (r - 1) * bucketSize + 1 cells away (minus the cells missing in the last bucket, if the way
+  // wraps around the map), so the search stops once the k taxis found are closer than that
+  for (int r = 0; r <= buckets / 2; r++) {
+    if (r > 0 && found == k &&
+        distances[k - 1] < (r - 1) * index->bucketSize + 1 - index->slack)
+      break;
+
+    for (int dx = -r; dx <= r; dx++) {
+      for (int dy = -r; dy <= r; dy++) {
+        if (abs(dx) != r && abs(dy) != r)
+          continue;
+
+        int bx = ((cx + dx) % buckets + buckets) % buckets;
+        int by = ((cy + dy) % buckets + buckets) % buckets;
+        if (visited[bx][by])
+          continue;
+        visited[bx][by] = true;
+
+        for (int id = index->heads[bx][by]; id != -1; id = index->next[id]) {
+          int distance = sphericalDistance(&coord, &index->coords[id]);
+
+          if (found == k && (distance > distances[k - 1] ||
+                             (distance == distances[k - 1] && id > ids[k - 1])))
+            continue;
+
+          // Insertion into the sorted results
+          int i = found < k ? found++ : k - 1;
+          while (i > 0 && (distances[i - 1] > distance ||
+                           (distances[i - 1] == distance && ids[i - 1] > id))) {
+            distances[i] = distances[i - 1];
+            ids[i] = ids[i - 1];
+            i--;
+          }
+          distances[i] = distance;
+          ids[i] = id;
+        }
+      }
+    }
+  }
+
+  return found;
+}
+
+int spatialIds(const SpatialIndex *index, int *ids) {
+  int count = 0;
+
+  for (int bx = 0; bx < index->buckets; bx++) {
+    for (int by = 0; by < index->buckets; by++) {
+      for (int id = index->heads[bx][by]; id != -1; id = index->next[id])
+        ids[count++] = id;
+    }
+  }
+
+  return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//// Timing wheel
+////////////////////////////////////////////////////////////////////////////////////
+
+void initTimingWheel(TimingWheel *wheel, long now) {
+  for (int i = 0; i < WHEEL_SLOTS; i++)
+    wheel->heads[i] = -1;
+
+  for (int i = 0; i < WHEEL_CAPACITY; i++) {
+    wheel->next[i] = -1;
+    wheel->prev[i] = -1;
+    wheel->armed[i] = false;
+  }
+
+  wheel->current = now;
+}
+
+void wheelCancel(TimingWheel *wheel, int key) {
+  if (key < 0 || key >= WHEEL_CAPACITY || !wheel->armed[key])
+    return;
+
+  int next = wheel->next[key];
+  int prev = wheel->prev[key];
+
+  if (prev != -1)
+    wheel->next[prev] = next;
+  else
+    wheel->heads[wheel->deadlines[key] % WHEEL_SLOTS] = next;
+
+  if (next != -1)
+    wheel->prev[next] = prev;
+
+  wheel->next[key] = -1;
+  wheel->prev[key] = -1;
+  wheel->armed[key] = false;
+}
+
+void wheelSchedule(TimingWheel *wheel, int key, long deadline) {
+  if (key < 0 || key >= WHEEL_CAPACITY)
+    return;
+
+  wheelCancel(wheel, key);
+
+  // Deadlines already passed expire in the next tick
+  if (deadline <= wheel->current)
+    deadline = wheel->current + 1;
+
+  int *head = &wheel->heads[deadline % WHEEL_SLOTS];
+  wheel->deadlines[key] = deadline;
+  wheel->prev[key] = -1;
+  wheel->next[key] = *head;
+  if (*head != -1)
+    wheel->prev[*head] = key;
+  *head = key;
+  wheel->armed[key] = true;
+}
+
+int wheelAdvance(TimingWheel *wheel, long now, int *expired) {
+  int count = 0;
+
+  if (now <= wheel->current)
+    return 0;
+
+  // If more than a lap has passed, every slot has to be visited once
+  long ticks = now - wheel->current < WHEEL_SLOTS ? now - wheel->current : WHEEL_SLOTS;
+
+  for (long tick = wheel->current + 1; tick <= wheel->current + ticks; tick++) {
+    int key = wheel->heads[tick % WHEEL_SLOTS];
+
+    while (key != -1) {
+      int next = wheel->next[key];
+
+      // Timers of later laps stay in the slot
+      if (wheel->deadlines[key] <= now) {
+        wheelCancel(wheel, key);
+        expired[count++] = key;
+      }
+
+      key = next;
+    }
+  }
+
+  wheel->current = now;
+  return count;
+}
@@ -25,6 +25,7 @@ typedef struct TABLE {
   Coordinate start; // Represents the top left corner of the table
   int cols_num;
   int rows_num;
+  int hidden_rows; // Rows that didn't fit in the table. They're counted in a "+N more" row
   int length;
 
   char *title; // Title of the table, will be printed above the headers as a "combined cell"
@@ -49,13 +50,15 @@ typedef struct TABLE {
 void initTable(Table *table, Coordinate start, char *title, char **headers, int headers_num,
                int err_color);
 
-/// @brief Prints a table in a ncurses window
+/// @brief Prints a table in a ncurses window. If there are more rows than the ones that fit in
+/// the window (or in the table), the last line says how many are left out
 ///
 /// @param table Table to be printed
 /// @param win Window in which the table will be printed
 void printTable(Table *table, WINDOW *win);
 
-/// @brief Adds a row to a table
+/// @brief Adds a row to a table. If the table already has MAX_ROWS rows, it's only counted as
+/// hidden
 ///
 /// @param table Table to which the row will be added
 /// @param row Array of strings that will be used as row's content
@@ -126,4 +129,113 @@ bool dequeue(Queue *queue, void *element);
 /// @param element Pointer to the element to be pushed
 void enqueue(Queue *queue, void *element);
 
-#endif
\ No newline at end of file
+//////////////////////////////////////////////////////////////////////////////////////
+/// SPATIAL INDEX                                                                  ///
+//////////////////////////////////////////////////////////////////////////////////////
+
+// Minimum side of the square buckets the map is divided into. Bigger maps use bigger buckets so
+// there are at most SPATIAL_MAX_BUCKETS per row
+#define SPATIAL_BUCKET_SIZE 5
+// Maximum number of buckets per row and per column
+#define SPATIAL_MAX_BUCKETS 32
+
+// Index of taxis by position. The map is divided into buckets and every bucket keeps a linked
+// list of the taxis inside it, so the nearest taxis to a point can be found by only looking at
+// the buckets around it
+typedef struct {
+  int heads[SPATIAL_MAX_BUCKETS][SPATIAL_MAX_BUCKETS]; // First taxi of each bucket, -1 if empty
+  int next[MAX_TAXIS];                  // Next taxi in the same bucket, -1 if last
+  int prev[MAX_TAXIS];                  // Previous taxi in the same bucket, -1 if first
+  Coordinate coords[MAX_TAXIS];         // Position of each indexed taxi
+  bool present[MAX_TAXIS];              // Whether each taxi is indexed
+  int count;                            // Number of taxis indexed
+  int bucketSize;                       // Side of the buckets
+  int buckets;                          // Buckets per row and per column
+  int slack;                            // Cells missing in the last bucket of each row
+} SpatialIndex;
+
+/// @brief Initializes an empty spatial index for the current map size (see gridSize)
+///
+/// @param index Index to be initialized
+void initSpatialIndex(SpatialIndex *index);
+
+/// @brief Adds a taxi to the index or updates its position if it was already indexed
+///
+/// @param index Index to be updated
+/// @param taxiId Taxi to be indexed
+/// @param coord Position of the taxi
+void spatialSet(SpatialIndex *index, int taxiId, Coordinate coord);
+
+/// @brief Removes a taxi from the index. Nothing happens if it wasn't indexed
+///
+/// @param index Index to be updated
+/// @param taxiId Taxi to be removed
+void spatialRemove(SpatialIndex *index, int taxiId);
+
+/// @brief Finds the k taxis nearest to a point, using the same metric as sphericalDistance. Ties
+/// are broken by the lowest id
+///
+/// @param index Index to be queried
+/// @param coord Point of reference
+/// @param k Maximum number of taxis to be returned
+/// @param ids Output argument. Taxis found, sorted from nearest to furthest. Capacity of k
+/// @return int Number of taxis found (k or less, if there aren't enough indexed)
+int spatialNearest(SpatialIndex *index, Coordinate coord, int k, int *ids);
+
+/// @brief Gets every taxi indexed. Only the lists of the buckets are walked, so it takes time
+/// proportional to the taxis indexed rather than to MAX_TAXIS
+///
+/// @param index Index to be queried
+/// @param ids Output argument. Taxis indexed, grouped by bucket. Capacity of index->count
+/// @return int Number of taxis indexed
+int spatialIds(const SpatialIndex *index, int *ids);
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// TIMING WHEEL                                                                   ///
+//////////////////////////////////////////////////////////////////////////////////////
+
+// Number of slots of the wheel. Each slot holds the timers that expire in its tick (or in a later
+// lap of the wheel)
+#define WHEEL_SLOTS 64
+// Maximum number of timers. Every taxi and every customer has its own
+#define WHEEL_CAPACITY (MAX_TAXIS + MAX_CUSTOMERS)
+
+// Hashed timing wheel. Time is measured in ticks. Scheduling, rescheduling and cancelling a timer
+// are O(1) and advancing the wheel only visits the slots of the ticks that have passed
+typedef struct {
+  int heads[WHEEL_SLOTS];          // First timer of each slot, -1 if it's empty
+  int next[WHEEL_CAPACITY];        // Next timer in the same slot, -1 if last
+  int prev[WHEEL_CAPACITY];        // Previous timer in the same slot, -1 if first
+  long deadlines[WHEEL_CAPACITY];  // Tick in which each timer expires
+  bool armed[WHEEL_CAPACITY];      // Whether each timer is scheduled
+  long current;                    // Last tick processed
+} TimingWheel;
+
+/// @brief Initializes a timing wheel without any timers
+///
+/// @param wheel Wheel to be initialized
+/// @param now Current tick
+void initTimingWheel(TimingWheel *wheel, long now);
+
+/// @brief Schedules a timer, replacing its previous deadline if it was already scheduled
+///
+/// @param wheel Wheel to be updated
+/// @param key Timer to be scheduled, from 0 to WHEEL_CAPACITY - 1
+/// @param deadline Tick in which the timer will expire
+void wheelSchedule(TimingWheel *wheel, int key, long deadline);
+
+/// @brief Cancels a timer. Nothing happens if it wasn't scheduled
+///
+/// @param wheel Wheel to be updated
+/// @param key Timer to be cancelled
+void wheelCancel(TimingWheel *wheel, int key);
+
+/// @brief Advances the wheel up to the current tick, removing the timers that have expired
+///
+/// @param wheel Wheel to be advanced
+/// @param now Current tick
+/// @param expired Output argument. Timers that have expired. Capacity of WHEEL_CAPACITY
+/// @return int Number of timers expired
+int wheelAdvance(TimingWheel *wheel, long now, int *expired);
+
+#endif
@@ -1,8 +1,15 @@
 #include "kafka_module.h"
+#include "closure_module.h"
 #include "common.h"
+#include "data_structures.h"
 #include "glib.h"
+#include "map_module.h"
+#include "persistence_module.h"
+#include "routing_module.h"
+#include "state_module.h"
 #include <librdkafka/rdkafka.h>
 #include <mysql/mysql.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,735 +17,867 @@
 #include <time.h>
 #include <unistd.h>
 
-enum RESPONSE_TOPICS { RESPONSE_CUSTOMER, RESPONSE_TAXI, RESPONSE_MAP };
+enum RESPONSE_TOPICS { RESPONSE_CUSTOMER, RESPONSE_TAXI };
 
 extern Address db, kafka;
-extern char session[UUID_LENGTH];
+extern uuid_t session;
 
 static rd_kafka_t *producer;
 static rd_kafka_t *consumer;
-static MYSQL *conn;
-static Response response;
+// Each worker builds its responses in its own buffer
+static _Thread_local Response response;
+
+// Queue of requests handled by a single thread. Every request about the same entity goes to the
+// same worker, so they are handled in the order they arrived
+typedef struct {
+  Request queue[WORKER_QUEUE_SIZE];
+  int head;
+  int count;
+  pthread_mutex_t mut;
+  pthread_cond_t notEmpty;
+  pthread_cond_t notFull;
+} Worker;
+
+static Worker workers[MAX_WORKERS];
+static int workersCount;
+
+// Requests dispatched to the workers that haven't been handled yet
+static int inFlight = 0;
+static pthread_mutex_t inFlightMut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drainedCond = PTHREAD_COND_INITIALIZER;
+
+// Whether the map has changed since it was last published, and version of the last map built.
+// Protected by the state lock
+static bool mapChanged = false;
+static unsigned long mapVersion = 0;
+// Whether the queue has to be matched with the available taxis. Protected by the state lock
+static bool queueChanged = false;
+
+// Timers of the taxis and customers. They are refreshed every time a message of the entity is
+// received and it's considered a stray when its timer expires. Only used by the reader thread
+static TimingWheel strays;
+
+// Number of different keys returned by shardKey
+#define SHARD_KEYS (MAX_TAXIS + 256)
 
 void respond(enum RESPONSE_TOPICS topic) {
-  char *topicName = (topic == RESPONSE_CUSTOMER) ? "customer_responses"
-                    : (topic == RESPONSE_TAXI)   ? "taxi_responses"
-                                                 : "map_responses";
-  loadMap();
-  sendEvent(producer, topicName, &response, sizeof(response));
+  char *topicName = (topic == RESPONSE_CUSTOMER) ? "customer_responses" : "taxi_responses";
+  sendResponseEvent(producer, topicName, &response);
 }
 
-void startKafkaServer() {
-  Request request;
-  rd_kafka_message_t *msg = NULL;
+void updateMap() {
+  lockState();
+  mapChanged = true;
+  unlockState();
+}
 
-  pthread_t thread;
-  pthread_create(&thread, NULL, checkStrays, NULL);
-  pthread_detach(thread);
+void publishPendingMap() {
+  int64_t map[MAP_SIZE];
+  unsigned long version = 0;
 
-  init();
-
-  memcpy(response.session, session, UUID_LENGTH);
-  response.subject = MRESPONSE_MAP_UPDATE;
-  respond(RESPONSE_MAP);
-  g_message("Sent initial map to responses topic");
+  lockState();
+  if (mapChanged) {
+    stateLoadMap(map);
+    version = ++mapVersion;
+    mapChanged = false;
+  }
+  unlockState();
 
-  while (true) {
-    if (msg != NULL)
-      rd_kafka_message_destroy(msg);
-    if (!(msg = poll_wrapper(consumer, 1000)))
-      continue;
+  // Handed over without the state lock. The version lets the publisher drop an older map that
+  // arrives after a newer one
+  if (version != 0)
+    publishMap(map, version);
+}
 
-    memcpy(&request, msg->payload, sizeof(Request));
+/// @brief Gets the key used to shard a request among the workers. Requests about the same entity
+/// get the same key, so they are handled in order
+///
+/// @param request Request to be dispatched
+/// @return int Key of the entity the request is about
+int shardKey(Request *request) {
+  if (requestEntity(request->subject) == ENTITY_CUSTOMER)
+    return MAX_TAXIS + (unsigned char)request->id;
+  return request->id;
+}
 
-    if (strcmp(session, request.session) != 0 && request.subject != REQUEST_NEW_CUSTOMER) {
-      g_debug("Message from a past session received");
-      continue;
-    }
+/// @brief Adds a request to the queue of a worker. Blocks while the queue is full
+///
+/// @param worker Worker that will handle the request
+/// @param request Request to be enqueued
+void enqueueRequest(Worker *worker, Request *request) {
+  pthread_mutex_lock(&worker->mut);
+  while (worker->count == WORKER_QUEUE_SIZE)
+    pthread_cond_wait(&worker->notFull, &worker->mut);
+
+  pthread_mutex_lock(&inFlightMut);
+  inFlight++;
+  pthread_mutex_unlock(&inFlightMut);
+
+  worker->queue[(worker->head + worker->count) % WORKER_QUEUE_SIZE] = *request;
+  worker->count++;
+  pthread_cond_signal(&worker->notEmpty);
+  pthread_mutex_unlock(&worker->mut);
+}
 
-    switch (request.subject) {
-    case REQUEST_NEW_TAXI:
-      g_message("New taxi registered. Updating the map...");
-      response.subject = MRESPONSE_MAP_UPDATE;
-      respond(RESPONSE_MAP);
+/// @brief Function intended to be executed by a separate thread. Handles the requests of its queue
+/// in order
+///
+/// @param args Worker whose queue will be handled
+/// @return void* Returns NULL always
+void *runWorker(void *args) {
+  Worker *worker = args;
+  Request request;
 
-      checkQueue();
-      break;
+  uuid_copy(response.session, session);
 
-    case REQUEST_NEW_CUSTOMER:
-      insertCustomer(&request);
-      break;
+  while (true) {
+    pthread_mutex_lock(&worker->mut);
+    while (worker->count == 0)
+      pthread_cond_wait(&worker->notEmpty, &worker->mut);
 
-    case REQUEST_TAXI_RECONNECT:
-      resumePosition(&request);
-      refreshTaxiInstructions(&request, true);
-      break;
+    request = worker->queue[worker->head];
+    worker->head = (worker->head + 1) % WORKER_QUEUE_SIZE;
+    worker->count--;
+    pthread_cond_signal(&worker->notFull);
+    pthread_mutex_unlock(&worker->mut);
 
-    case REQUEST_TAXI_FATAL_ERROR:
-    case REQUEST_DISCONNECT_TAXI:
-    case STRAY_TAXI:
-      disconnectTaxi(&request);
-      break;
+    handleRequest(&request);
 
-    case REQUEST_DISCONNECT_CUSTOMER:
-    case STRAY_CUSTOMER:
-      disconnectCustomer(&request);
-      break;
+    pthread_mutex_lock(&inFlightMut);
+    if (--inFlight == 0)
+      pthread_cond_signal(&drainedCond);
+    pthread_mutex_unlock(&inFlightMut);
+  }
 
-    case PING_CUSTOMER:
-    case PING_TAXI:
-      refreshLastUpdate(&request);
-      break;
+  return NULL;
+}
 
-    case REQUEST_ASK_FOR_SERVICE:
-      processServiceRequest(&request);
-      break;
+/// @brief Blocks until the workers have handled every request dispatched to them
+void waitForWorkers() {
+  pthread_mutex_lock(&inFlightMut);
+  while (inFlight > 0)
+    pthread_cond_wait(&drainedCond, &inFlightMut);
+  pthread_mutex_unlock(&inFlightMut);
+}
 
-    case REQUEST_DESTINATION_REACHED:
-      refreshTaxiInstructions(&request, false);
-      break;
+/// @brief Removes the requests of a batch that are superseded by a later one of the same entity:
+/// every ping but the last one and the moves followed by another move with no other request of
+/// the taxi in between
+///
+/// @param requests Requests of the batch, in the order they were read. They are compacted in place
+/// @param count Number of requests
+/// @return int Number of requests left
+int coalesceRequests(Request *requests, int count) {
+  bool laterMove[SHARD_KEYS] = {false};
+  bool laterPing[SHARD_KEYS] = {false};
+  bool keep[CONSUME_BATCH_SIZE];
+  int kept = 0;
+
+  for (int i = count - 1; i >= 0; i--) {
+    int key = shardKey(&requests[i]);
+    keep[i] = true;
+
+    if (key < 0 || key >= SHARD_KEYS)
+      continue;
 
+    switch (requests[i].subject) {
     case REQUEST_TAXI_MOVE:
-      moveTaxi(&request);
-      break;
-
-    case REQUEST_TAXI_CANT_MOVE:
-    case REQUEST_TAXI_CAN_MOVE:
-      setTaxiCanMove(request.id, request.subject == REQUEST_TAXI_CAN_MOVE);
+      keep[i] = !laterMove[key];
+      laterMove[key] = true;
       break;
 
-    case REQUEST_TAXI_CANT_MOVE_REMINDER:
-      g_message("Taxi %i should be moving but it's currently unable to. "
-                "Waiting until its error gets solved...",
-                request.id);
-      break;
-
-    case ORDER_GOTO:
-    case ORDER_STOP:
-    case ORDER_CONTINUE:
-      sendOrder(&request);
+    case PING_TAXI:
+    case PING_CUSTOMER:
+      keep[i] = !laterPing[key];
+      laterPing[key] = true;
       break;
 
     default:
-      g_debug("Unhandled subject: %i", request.subject);
+      laterMove[key] = false;
       break;
     }
   }
+
+  for (int i = 0; i < count; i++) {
+    if (keep[i])
+      requests[kept++] = requests[i];
+  }
+
+  if (kept < count)
+    g_debug("Coalesced %i of %i requests", count - kept, count);
+
+  return kept;
 }
 
-void init() {
-  char kafkaId[50];
-  sprintf(kafkaId, "central-producer");
-  producer = createKafkaUser(&kafka, RD_KAFKA_PRODUCER, kafkaId);
-  sprintf(kafkaId, "central-consumer");
-  consumer = createKafkaUser(&kafka, RD_KAFKA_CONSUMER, kafkaId);
+/// @brief Gets the current tick of the strays timing wheel
+///
+/// @return long Current tick
+long currentTick() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1000 + now.tv_nsec / 1000000) / STRAY_TICK_MS;
+}
 
-  subscribeToTopics(&consumer, (const char *[]){"requests"}, 1);
+/// @brief Gets the timer of the entity that has sent a request
+///
+/// @param request Request received
+/// @return int Key of the timer or -1 if the request hasn't been sent by a taxi or a customer
+int strayKey(Request *request) {
+  switch (request->subject) {
+  case ORDER_GOTO:
+  case ORDER_STOP:
+  case ORDER_CONTINUE:
+  case ORDER_TOGGLE_CLOSURE:
+  case STRAY_TAXI:
+  case STRAY_CUSTOMER:
+    return -1;
+  default:
+    break;
+  }
 
-  mysql_library_init(0, NULL, NULL);
-  conn = mysql_init(NULL);
+  int key = shardKey(request);
 
-  if (!mysql_real_connect(conn, db.ip, "root", DB_PASSWORD, DB_NAME, db.port, NULL,
-                          CLIENT_MULTI_STATEMENTS)) {
-    mysql_close(conn);
-    g_error("Error connecting to database");
+  if (key >= MAX_TAXIS) {
+    int customer = key - MAX_TAXIS - 'a';
+    return customer >= 0 && customer < MAX_CUSTOMERS ? MAX_TAXIS + customer : -1;
   }
 
-  signal(SIGINT, cleanUp);
+  return key >= 0 ? key : -1;
 }
 
-void loadMap() {
-  MYSQL_RES *r_locations = NULL;
-  MYSQL_RES *r_customers = NULL;
-  MYSQL_RES *r_taxis = NULL;
-  MYSQL_ROW row;
-  int index = 0;
-  Entity user;
+/// @brief Refreshes the timer of the entity that has sent a request, or cancels it if the entity
+/// is leaving the system
+///
+/// @param request Request received
+void trackEntity(Request *request) {
+  int key = strayKey(request);
 
-  g_debug("Query: CALL LoadMap()");
-  if (mysql_query(conn, "CALL LoadMap()")) {
-    g_warning("Error loading map: %s", mysql_error(conn));
+  if (key == -1)
     return;
+
+  switch (request->subject) {
+  case REQUEST_DISCONNECT_TAXI:
+  case REQUEST_TAXI_FATAL_ERROR:
+  case REQUEST_DISCONNECT_CUSTOMER:
+    wheelCancel(&strays, key);
+    break;
+  default:
+    wheelSchedule(&strays, key, currentTick() + USER_GRACE_TIME * 1000 / STRAY_TICK_MS);
+    break;
+  }
+}
+
+/// @brief Starts the timers of the entities loaded from the database. They are given some extra
+/// time to send their first ping
+void trackLoadedEntities() {
+  int taxiIds[MAX_TAXIS], taxiCount, customerCount;
+  char customerIds[MAX_CUSTOMERS];
+  long deadline = currentTick() + (USER_GRACE_TIME + PING_GRACE_TIME) * 1000 / STRAY_TICK_MS;
+
+  initTimingWheel(&strays, currentTick());
+  stateGetConnected(taxiIds, &taxiCount, customerIds, &customerCount);
+
+  for (int i = 0; i < taxiCount; i++)
+    wheelSchedule(&strays, taxiIds[i], deadline);
+  for (int i = 0; i < customerCount; i++)
+    wheelSchedule(&strays, MAX_TAXIS + customerIds[i] - 'a', deadline);
+}
+
+/// @brief Turns the expired timers into stray requests. Customers who are being served by a taxi
+/// aren't considered strays, their timers are restarted instead
+///
+/// @param dest Output argument. Stray requests. Capacity of WHEEL_CAPACITY
+/// @return int Number of stray requests
+int collectStrays(Request *dest) {
+  int expired[WHEEL_CAPACITY];
+  long now = currentTick();
+  int count = 0;
+  int expiredCount = wheelAdvance(&strays, now, expired);
+
+  for (int i = 0; i < expiredCount; i++) {
+    Request *request = &dest[count];
+    bool isTaxi = expired[i] < MAX_TAXIS;
+
+    request->subject = isTaxi ? STRAY_TAXI : STRAY_CUSTOMER;
+    request->id = isTaxi ? expired[i] : 'a' + expired[i] - MAX_TAXIS;
+
+    if (!isTaxi && stateIsCustomerServed(request->id)) {
+      wheelSchedule(&strays, expired[i], now + USER_GRACE_TIME * 1000 / STRAY_TICK_MS);
+      continue;
+    }
+
+    g_debug("Caught a stray: %i", request->id);
+    uuid_copy(request->session, session);
+    count++;
+  }
+
+  return count;
+}
+
+void startKafkaServer() {
+  static Request requests[CONSUME_BATCH_SIZE + WHEEL_CAPACITY];
+  rd_kafka_message_t *msgs[CONSUME_BATCH_SIZE];
+
+  pthread_t thread;
+
+  init();
+
+  uuid_copy(response.session, session);
+  updateMap();
+  publishPendingMap();
+  g_message("Sent initial map to responses topic");
+
+  char *workersEnv = getenv("CENTRAL_WORKERS");
+  workersCount = workersEnv != NULL ? atoi(workersEnv) : sysconf(_SC_NPROCESSORS_ONLN);
+  if (workersCount < 1)
+    workersCount = 1;
+  if (workersCount > MAX_WORKERS)
+    workersCount = MAX_WORKERS;
+
+  for (int i = 0; i < workersCount; i++) {
+    pthread_mutex_init(&workers[i].mut, NULL);
+    pthread_cond_init(&workers[i].notEmpty, NULL);
+    pthread_cond_init(&workers[i].notFull, NULL);
+    pthread_create(&thread, NULL, runWorker, &workers[i]);
+    pthread_detach(thread);
   }
+  g_message("Dispatching requests among %i workers", workersCount);
 
-  store_result_wrapper(r_locations);
-  store_result_wrapper(r_customers);
-  store_result_wrapper(r_taxis);
+  trackLoadedEntities();
+
+  while (true) {
+    int read = consumeBatch(consumer, STRAY_TICK_MS, msgs, CONSUME_BATCH_SIZE);
+    int count = 0;
 
-  user.type = ENTITY_LOCATION;
-  while ((row = mysql_fetch_row(r_locations))) {
-    user.id = row[0][0];
-    user.coord.x = atoi(row[1]);
-    user.coord.y = atoi(row[2]);
+    for (int i = 0; i < read; i++) {
+      MessageView view;
+
+      if (!openMessageView(&view, msgs[i])) {
+        g_warning("Malformed request received");
+        continue;
+      }
+
+      // The session is checked in place, only the requests that will be handled are copied
+      if (!viewSessionIs(&view, session) && view.subject != REQUEST_NEW_CUSTOMER) {
+        g_debug("Message from a past session received");
+        closeMessageView(&view);
+        continue;
+      }
 
-    response.map[index] = serializeEntity(&user);
-    index++;
+      Request *request = &requests[count];
+      memset(request, 0, sizeof(Request));
+      requestFromView(&view, request);
+      closeMessageView(&view);
+
+      trackEntity(request);
+      count++;
+    }
+
+    count = coalesceRequests(requests, count);
+    count += collectStrays(requests + count);
+
+    if (count == 0)
+      continue;
+
+    for (int i = 0; i < count; i++)
+      enqueueRequest(&workers[(unsigned int)shardKey(&requests[i]) % workersCount], &requests[i]);
+
+    // The whole batch results in a single matching, a single map update and a single database
+    // transaction
+    waitForWorkers();
+    matchQueue();
+    publishPendingMap();
+    requestPersist();
   }
+}
 
-  user.type = ENTITY_CUSTOMER;
-  while ((row = mysql_fetch_row(r_customers))) {
-    user.id = row[0][0];
-    user.coord.x = atoi(row[1]);
-    user.coord.y = atoi(row[2]);
-    user.obj = row[3] ? row[3][0] : -1;
-    user.status = (row[3] == NULL ? STATUS_CUSTOMER_OTHER
-                   : atoi(row[4]) ? STATUS_CUSTOMER_IN_QUEUE
-                   : atoi(row[5]) ? STATUS_CUSTOMER_IN_TAXI
-                                  : STATUS_CUSTOMER_WAITING_TAXI);
+void handleRequest(Request *request) {
+  switch (request->subject) {
+  case REQUEST_NEW_TAXI:
+    if (!connectTaxi(request))
+      break;
+    g_message("New taxi registered. Updating the map...");
+    updateMap();
 
-    response.map[index] = serializeEntity(&user);
-    index++;
+    checkQueue();
+    break;
+
+  case REQUEST_NEW_CUSTOMER:
+    insertCustomer(request);
+    break;
+
+  case REQUEST_TAXI_RECONNECT:
+    if (!connectTaxi(request))
+      break;
+    resumePosition(request);
+    refreshTaxiInstructions(request, true);
+    break;
+
+  case REQUEST_TAXI_RESUME:
+    g_message("Taxi %i resumed its session", request->id);
+    if (!connectTaxi(request))
+      break;
+    refreshTaxiInstructions(request, true);
+    break;
+
+  case REQUEST_TAXI_FATAL_ERROR:
+  case REQUEST_DISCONNECT_TAXI:
+  case STRAY_TAXI:
+    disconnectTaxi(request);
+    break;
+
+  case REQUEST_DISCONNECT_CUSTOMER:
+  case STRAY_CUSTOMER:
+    disconnectCustomer(request);
+    break;
+
+  case PING_CUSTOMER:
+  case PING_TAXI:
+    refreshLastUpdate(request);
+    break;
+
+  case REQUEST_ASK_FOR_SERVICE:
+    processServiceRequest(request);
+    break;
+
+  case REQUEST_DESTINATION_REACHED:
+    refreshTaxiInstructions(request, false);
+    break;
+
+  case REQUEST_TAXI_MOVE:
+    moveTaxi(request);
+    break;
+
+  case REQUEST_TAXI_CANT_MOVE:
+  case REQUEST_TAXI_CAN_MOVE:
+    setTaxiCanMove(request->id, request->subject == REQUEST_TAXI_CAN_MOVE);
+    break;
+
+  case REQUEST_TAXI_CANT_MOVE_REMINDER:
+    g_message("Taxi %i should be moving but it's currently unable to. "
+              "Waiting until its error gets solved...",
+              request->id);
+    break;
+
+  case ORDER_GOTO:
+  case ORDER_STOP:
+  case ORDER_CONTINUE:
+    sendOrder(request);
+    break;
+
+  case ORDER_TOGGLE_CLOSURE:
+    changeClosure(request);
+    break;
+
+  default:
+    g_debug("Unhandled subject: %i", request->subject);
+    break;
   }
+}
+
+void init() {
+  char kafkaId[50];
+  sprintf(kafkaId, "central-producer");
+  producer = createKafkaUser(&kafka, RD_KAFKA_PRODUCER, kafkaId);
+  sprintf(kafkaId, "central-consumer");
+  consumer = createKafkaUser(&kafka, RD_KAFKA_CONSUMER, kafkaId);
+
+  subscribeToTopics(&consumer, (const char *[]){"requests"}, 1);
+  startMapPublisher(producer);
+  startClosurePublisher(producer);
 
-  user.type = ENTITY_TAXI;
-  while ((row = mysql_fetch_row(r_taxis))) {
-    user.id = atoi(row[0]);
-    user.coord.x = atoi(row[1]);
-    user.coord.y = atoi(row[2]);
-    user.obj = row[3] ? row[3][0] : -1;
-    user.status = (!atoi(row[6])  ? STATUS_TAXI_DISCONNECTED
-                   : atoi(row[4]) ? STATUS_TAXI_MOVING
-                   : atoi(row[7]) ? STATUS_TAXI_STOPPED
-                                  : STATUS_TAXI_CANT_MOVE);
-    user.carryingCustomer = atoi(row[5]);
+  mysql_library_init(0, NULL, NULL);
+  MYSQL *conn = mysql_init(NULL);
 
-    response.map[index] = serializeEntity(&user);
-    index++;
+  if (!mysql_real_connect(conn, db.ip, "root", DB_PASSWORD, DB_NAME, db.port, NULL,
+                          CLIENT_MULTI_STATEMENTS)) {
+    mysql_close(conn);
+    g_error("Error connecting to database");
   }
 
-  response.map[index] = 0;
+  loadState(conn);
+  startPersistence(conn);
 
-  mysql_free_result(r_locations);
-  mysql_free_result(r_customers);
-  mysql_free_result(r_taxis);
+  signal(SIGINT, cleanUp);
 }
 
 void cleanUp() {
+  flushPersistence();
+
+  flushEvents(producer);
   rd_kafka_destroy(producer);
   rd_kafka_destroy(consumer);
+}
 
-  mysql_close(conn);
-  mysql_library_end();
+bool connectTaxi(Request *request) {
+  const char *error = request->subject == REQUEST_TAXI_RESUME ? stateResumeTaxi(request->id)
+                                                              : stateConnectTaxi(request->id);
+
+  if (error != NULL) {
+    g_warning("Error connecting taxi %i: %s", request->id, error);
+    // The socket module has already let the digital engine in, so it's told to log in again
+    response.subject = TRESPONSE_LOG_IN_AGAIN;
+    response.id = request->id;
+    memcpy(response.data, request->data, sizeof(int));
+    respond(RESPONSE_TAXI);
+    return false;
+  }
+  return true;
 }
 
 void moveTaxi(Request *request) {
-  MYSQL_RES *err_result = NULL;
-  MYSQL_ROW row;
-  char query[200];
+  Coordinate next, current;
+  MOVE_RESULT result;
+  const char *error;
 
-  sprintf(query, "CALL MoveTaxi(%i, %i, %i)", request->id, request->coord.x, request->coord.y);
+  memcpy(&next, request->data, sizeof(Coordinate));
+  error = stateMoveTaxi(request->id, request->coord, next, &result, &current);
 
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
+  if (error != NULL) {
+    g_warning("Error moving taxi %i: %s", request->id, error);
     return;
   }
 
-  store_result_wrapper(err_result);
-  row = mysql_fetch_row(err_result);
-
-  if (row[0] != NULL) {
-    g_warning("Error moving taxi %i: %s", request->id, row[0]);
-  } else {
-    g_message("Taxi %d moved to [%i, %i]", request->id, request->coord.x + 1, request->coord.y + 1);
-
-    response.subject = MRESPONSE_MAP_UPDATE;
-    respond(RESPONSE_MAP);
+  if (result != MOVE_ACCEPTED) {
+    g_message("Taxi %d can't move to [%i, %i], %s. Ordering it to %s", request->id,
+              request->coord.x + 1, request->coord.y + 1,
+              result == MOVE_CLOSED ? "the cell is closed" : "there's another taxi",
+              result == MOVE_WAIT ? "wait" : "go around it");
+    response.subject = result == MOVE_WAIT ? TRESPONSE_WAIT : TRESPONSE_REROUTE;
+    response.id = request->id;
+    memcpy(response.data, &current, sizeof(Coordinate));
+    respond(RESPONSE_TAXI);
+    return;
   }
 
-  mysql_free_result(err_result);
-
-  // sprintf(query, "UPDATE taxis SET x = %i, y = %i WHERE id = %i",
-  //         request->coord.x, request->coord.y, request->id);
-  // g_debug("Query: %s", query);
-  // if (mysql_query(conn, query) || mysql_affected_rows(conn) == 0) {
-  //   g_warning("Error updating taxi %i: %s", request->id, mysql_error(conn));
-  //   return;
-  // }
-
-  // g_message("Taxi %d moved to [%i, %i]", request->id, request->coord.x + 1,
-  //           request->coord.y + 1);
-
-  // response.subject = MRESPONSE_MAP_UPDATE;
-  // ();
-  // respond(RESPONSE_MAP);
+  g_message("Taxi %d moved to [%i, %i]", request->id, request->coord.x + 1, request->coord.y + 1);
+  updateMap();
 }
 
 void insertCustomer(Request *request) {
-  MYSQL_RES *result = NULL;
-  MYSQL_ROW row;
-  char query[200];
-  sprintf(query, "CALL InsertCustomer('%c', %i, %i)", request->id, request->coord.x,
-          request->coord.y);
+  const char *error = stateInsertCustomer(request->id, request->coord);
   response.id = request->id;
   strcpy(response.data, request->data);
 
-  g_debug("Query: %s", query);
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
-    return;
-  }
-
-  store_result_wrapper(result);
-  row = mysql_fetch_row(result);
-  if (row[0] == NULL) {
+  if (error == NULL) {
     g_message("Inserted customer '%c'", request->id);
     response.subject = CRESPONSE_CONFIRMATION;
 
     respond(RESPONSE_CUSTOMER);
+    updateMap();
   } else {
-    g_warning("Error inserting customer '%c': %s", request->id, row[0]);
+    g_warning("Error inserting customer '%c': %s", request->id, error);
     response.subject = CRESPONSE_ERROR;
     respond(RESPONSE_CUSTOMER);
   }
 
   g_debug("Unique id: %s", response.data);
-
-  mysql_free_result(result);
 }
 
 void processServiceRequest(Request *request) {
-  MYSQL_RES *err_result = NULL;
-  MYSQL_RES *result = NULL;
-  MYSQL_RES *queue_result = NULL;
-  MYSQL_ROW row;
   char destination = request->data[0];
   char customerId = request->id;
-  char query[200];
+  Coordinate customerCoord;
+  int taxiId;
+  const char *error = stateAssignTaxi(customerId, destination, &taxiId, &customerCoord);
 
-  sprintf(query, "CALL AssignTaxi('%c', '%c')", customerId, destination);
-
-  g_debug("Query: %s", query);
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
-    return;
-  }
-
-  store_result_wrapper(err_result);
-  row = mysql_fetch_row(err_result);
-
-  if (row[0] != NULL) {
-    g_warning("Error assigning taxi to customer '%c': %s", customerId, row[0]);
+  if (error != NULL) {
+    g_warning("Error assigning taxi to customer '%c': %s", customerId, error);
     response.subject = CRESPONSE_SERVICE_DENIED;
     response.id = customerId;
     response.data[0] = false;
     respond(RESPONSE_CUSTOMER);
-  } else {
-    store_result_wrapper(result);
-    row = mysql_fetch_row(result);
-
-    if (row[0] == NULL) {
-      g_message("There aren't any available taxis. Adding customer '%c' to queue", customerId);
-
-      sprintf(query, "CALL AddToQueue('%c')", customerId);
-      g_debug("Query: %s", query);
-      if (mysql_query(conn, query)) {
-        g_warning("Error executing query %s: %s", query, mysql_error(conn));
-        return;
-      }
-
-      store_result_wrapper(queue_result);
-      row = mysql_fetch_row(queue_result);
+    return;
+  }
 
-      response.subject = CRESPONSE_SERVICE_DENIED;
-      response.id = customerId;
+  if (taxiId == -1) {
+    g_message("There aren't any available taxis. Adding customer '%c' to queue", customerId);
 
-      if (row[0] != NULL) {
-        g_warning("Error adding customer '%c' to queue: %s", customerId, row[0]);
-        response.data[0] = false;
-        respond(RESPONSE_CUSTOMER);
-        return;
-      }
+    error = stateAddToQueue(customerId);
+    response.subject = CRESPONSE_SERVICE_DENIED;
+    response.id = customerId;
 
-      response.data[0] = true;
+    if (error != NULL) {
+      g_warning("Error adding customer '%c' to queue: %s", customerId, error);
+      response.data[0] = false;
       respond(RESPONSE_CUSTOMER);
       return;
     }
 
-    g_message("Service accepted. Taxi %s assigned to customer '%c'", row[2], customerId);
+    response.data[0] = true;
+    respond(RESPONSE_CUSTOMER);
+    updateMap();
+    return;
+  }
 
-    response.subject = CRESPONSE_SERVICE_ACCEPTED;
-    response.id = customerId;
+  notifyAssignment(customerId, taxiId, customerCoord);
+}
 
-    Coordinate customerCoord = {.x = atoi(row[0]), .y = atoi(row[1])};
-    int taxiId = atoi(row[2]);
+void notifyAssignment(char customerId, int taxiId, Coordinate customerCoord) {
+  Coordinate taxiCoord;
+  int eta = -1;
 
-    memcpy(response.data, &taxiId, sizeof(int));
+  g_message("Service accepted. Taxi %i assigned to customer '%c'", taxiId, customerId);
 
-    respond(RESPONSE_CUSTOMER);
+  response.subject = CRESPONSE_SERVICE_ACCEPTED;
+  response.id = customerId;
+  memcpy(response.data, &taxiId, sizeof(int));
 
-    response.subject = TRESPONSE_START_SERVICE;
-    response.id = taxiId;
-    memcpy(response.data, &customerCoord, sizeof(Coordinate));
-    response.data[sizeof(Coordinate)] = customerId;
-    g_message("Ordering taxi %i to go to [%i, %i]", taxiId, customerCoord.x + 1,
-              customerCoord.y + 1);
-    respond(RESPONSE_TAXI);
-  }
+  respond(RESPONSE_CUSTOMER);
 
-  mysql_free_result(err_result);
-  mysql_free_result(result);
+  response.subject = TRESPONSE_START_SERVICE;
+  response.id = taxiId;
+  memcpy(response.data, &customerCoord, sizeof(Coordinate));
+  response.data[sizeof(Coordinate)] = customerId;
+  if (stateGetTaxiPosition(taxiId, &taxiCoord) == NULL)
+    eta = routingEta(taxiCoord, customerCoord);
+  g_message("Ordering taxi %i to go to [%i, %i] (ETA: %i steps)", taxiId, customerCoord.x + 1,
+            customerCoord.y + 1, eta);
+  respond(RESPONSE_TAXI);
+  updateMap();
 }
 
 void refreshTaxiInstructions(Request *request, bool reconnected) {
-  MYSQL_RES *err_result = NULL;
-  MYSQL_RES *result = NULL;
-  MYSQL_ROW row;
-  char query[200];
+  TAXI_STATUS status;
+  Coordinate coord;
+  const char *error = stateGetTaxiStatus(request->id, &status, &coord);
 
-  sprintf(query, "CALL GetTaxiStatus(%i)", request->id);
-
-  g_debug("Query: %s", query);
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
+  if (error != NULL) {
+    g_warning("Error getting taxi status: %s", error);
     return;
   }
 
-  store_result_wrapper(err_result);
-  row = mysql_fetch_row(err_result);
-
-  if (row[0] != NULL) {
-    g_warning("Error getting taxi status: %s", row[0]);
-  } else {
-    store_result_wrapper(result);
-    row = mysql_fetch_row(result);
-    int status = atoi(row[0]);
-
-    if (status == 0 || status == 3) {
-      if (!reconnected) {
-        g_message("Taxi %i has arrived to [%i, %i]", request->id, atoi(row[1]) + 1,
-                  atoi(row[2]) + 1);
-      }
-      if (status == 0) {
-        response.subject = MRESPONSE_MAP_UPDATE;
-
-        respond(RESPONSE_MAP);
-        sprintf(query, "UPDATE taxis SET available = TRUE WHERE id = %i", request->id);
-        if (mysql_query(conn, query)) {
-          g_warning("Error executing query %s: %s", query, mysql_error(conn));
-          return;
-        }
-        checkQueue();
-      } else {
-        Coordinate coord = {.x = atoi(row[1]), .y = atoi(row[2])};
-        g_message("Taxi will resume its service by going to [%i, %i]", coord.x + 1, coord.y + 1);
-        response.subject = TRESPONSE_GOTO;
-        memcpy(response.data, &coord, sizeof(Coordinate));
-        respond(RESPONSE_TAXI);
-      }
-    } else if (status == 1) {
-      pickUpCustomer(request);
+  if (status == TAXI_STATUS_FREE || status == TAXI_STATUS_IN_SERVICE) {
+    if (!reconnected) {
+      g_message("Taxi %i has arrived to [%i, %i]", request->id, coord.x + 1, coord.y + 1);
+    }
+    if (status == TAXI_STATUS_FREE) {
+      stateSetTaxiAvailable(request->id, true);
+      updateMap();
+      checkQueue();
     } else {
-      completeService(request);
+      g_message("Taxi will resume its service by going to [%i, %i]", coord.x + 1, coord.y + 1);
+      response.subject = TRESPONSE_GOTO;
+      response.id = request->id;
+      memcpy(response.data, &coord, sizeof(Coordinate));
+      respond(RESPONSE_TAXI);
     }
+  } else if (status == TAXI_STATUS_PICKING_UP) {
+    pickUpCustomer(request);
+  } else {
+    completeService(request);
   }
-
-  mysql_free_result(err_result);
-  mysql_free_result(result);
 }
 
 void pickUpCustomer(Request *request) {
-  MYSQL_RES *err_result = NULL;
-  MYSQL_RES *result = NULL;
-  MYSQL_ROW row;
-  char query[200];
-
-  sprintf(query, "CALL PickUpCustomer(%i)", request->id);
+  char customerId, destination;
+  Coordinate locationCoord;
+  const char *error = statePickUpCustomer(request->id, &customerId, &destination, &locationCoord);
 
-  g_debug("Query: %s", query);
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
+  if (error != NULL) {
+    g_warning("Error picking up taxi %i's customer: %s", request->id, error);
     return;
   }
 
-  store_result_wrapper(err_result);
-  row = mysql_fetch_row(err_result);
+  g_message("Customer '%c' picked up by taxi %i. They are now going towards "
+            "location %c",
+            customerId, request->id, destination);
 
-  if (row[0] != NULL) {
-    g_warning("Error picking up taxi %i's customer: %s", request->id, row[0]);
-  } else {
-    store_result_wrapper(result);
-    row = mysql_fetch_row(result);
-    g_message("Customer '%s' picked up by taxi %i. They are now going towards "
-              "location %s",
-              row[0], request->id, row[1]);
-
-    response.subject = CRESPONSE_PICKED_UP;
-    response.id = row[0][0];
-    memcpy(response.data, &request->id, sizeof(int));
-
-    respond(RESPONSE_CUSTOMER);
+  response.subject = CRESPONSE_PICKED_UP;
+  response.id = customerId;
+  memcpy(response.data, &request->id, sizeof(int));
 
-    Coordinate locationCoord = {.x = atoi(row[2]), .y = atoi(row[3])};
-    response.subject = TRESPONSE_GOTO;
-    response.id = request->id;
-    memcpy(response.data, &locationCoord, sizeof(Coordinate));
-    respond(RESPONSE_TAXI);
-  }
+  respond(RESPONSE_CUSTOMER);
 
-  mysql_free_result(err_result);
-  mysql_free_result(result);
+  response.subject = TRESPONSE_GOTO;
+  response.id = request->id;
+  memcpy(response.data, &locationCoord, sizeof(Coordinate));
+  respond(RESPONSE_TAXI);
+  updateMap();
 }
 
 void completeService(Request *request) {
-  MYSQL_RES *err_result = NULL;
-  MYSQL_RES *result = NULL;
-  MYSQL_ROW row;
-  char query[200];
+  char customerId, destination;
+  Coordinate coord;
+  const char *error = stateCompleteService(request->id, &customerId, &destination, &coord);
 
-  sprintf(query, "CALL CompleteService(%i)", request->id);
-
-  g_debug("Query: %s", query);
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
+  if (error != NULL) {
+    g_warning("Error completing taxi %i's service: %s", request->id, error);
     return;
   }
 
-  store_result_wrapper(err_result);
-  row = mysql_fetch_row(err_result);
-
-  if (row[0] != NULL) {
-    g_warning("Error picking up taxi %i's customer: %s", request->id, row[0]);
-  } else {
-    store_result_wrapper(result);
-    row = mysql_fetch_row(result);
-    g_message("Customer '%s' service has been completed. Taxi %i left the customer "
-              "on the location %s [%i, %i] and is now available",
-              row[0], request->id, row[1], atoi(row[2]) + 1, atoi(row[3]) + 1);
-
-    response.subject = CRESPONSE_SERVICE_COMPLETED;
-    response.id = row[0][0];
-    respond(RESPONSE_CUSTOMER);
+  g_message("Customer '%c' service has been completed. Taxi %i left the customer "
+            "on the location %c [%i, %i] and is now available",
+            customerId, request->id, destination, coord.x + 1, coord.y + 1);
 
-    response.subject = TRESPONSE_SERVICE_COMPLETED;
-    response.id = request->id;
-    respond(RESPONSE_TAXI);
+  response.subject = CRESPONSE_SERVICE_COMPLETED;
+  response.id = customerId;
+  respond(RESPONSE_CUSTOMER);
 
-    checkQueue();
-  }
+  response.subject = TRESPONSE_SERVICE_COMPLETED;
+  response.id = request->id;
+  respond(RESPONSE_TAXI);
+  updateMap();
 
-  mysql_free_result(err_result);
-  mysql_free_result(result);
+  checkQueue();
 }
 
 void checkQueue() {
-  MYSQL_RES *result = NULL;
-  MYSQL_ROW row;
-  char query[200];
-
-  sprintf(query, "CALL GetCustomerFromQueue()");
-  g_debug("Query: %s", query);
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
-    return;
-  }
+  lockState();
+  queueChanged = true;
+  unlockState();
+}
+
+void matchQueue() {
+  Assignment assignments[MAX_CUSTOMERS];
 
-  store_result_wrapper(result);
-  row = mysql_fetch_row(result);
+  lockState();
+  bool pending = queueChanged;
+  queueChanged = false;
+  unlockState();
 
-  if (row[0] == NULL) {
-    g_message("There aren't any customers in queue");
+  if (!pending)
+    return;
+
+  int count = stateMatchQueue(assignments);
+  if (count == 0) {
+    g_message("There aren't any customers in queue that can be served");
     return;
   }
 
-  Request request;
-  request.subject = REQUEST_ASK_FOR_SERVICE;
-  request.id = row[0][0];
-  request.data[0] = row[1][0];
-  processServiceRequest(&request);
+  for (int i = 0; i < count; i++)
+    notifyAssignment(assignments[i].customerId, assignments[i].taxiId,
+                     assignments[i].customerCoord);
 }
 
 void disconnectCustomer(Request *request) {
-  char query[200];
+  const char *error = stateDisconnectCustomer(request->id);
 
-  sprintf(query, "DELETE FROM customers WHERE id = '%c'", request->id);
-
-  g_debug("Query: %s", query);
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
-    return;
-  }
-
-  if (mysql_affected_rows(conn) == 0) {
-    g_warning("Error disconnecting customer '%c': No rows affected", request->id);
+  if (error != NULL) {
+    g_warning("Error disconnecting customer '%c': %s", request->id, error);
     return;
   }
 
   g_message("Customer '%c' disconnected", request->id);
-  response.subject = MRESPONSE_MAP_UPDATE;
-
-  respond(RESPONSE_MAP);
+  updateMap();
 }
 
 void disconnectTaxi(Request *request) {
-  MYSQL_RES *err_result = NULL;
-  MYSQL_RES *result = NULL;
-  MYSQL_ROW row;
-  char query[200];
-
-  sprintf(query, "CALL DisconnectTaxi(%i)", request->id);
+  char customerId;
+  Coordinate coord;
+  const char *error = stateDisconnectTaxi(request->id, &customerId, &coord);
 
-  g_debug("Query: %s", query);
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
+  if (error != NULL) {
+    g_warning("Error disconnecting taxi %i: %s", request->id, error);
     return;
   }
 
-  store_result_wrapper(err_result);
-  row = mysql_fetch_row(err_result);
+  g_message("Taxi %i disconnected", request->id);
+  updateMap();
 
-  if (row[0] != NULL) {
-    g_warning("Error disconnecting taxi %i: %s", request->id, row[0]);
-  } else {
-    store_result_wrapper(result);
-    row = mysql_fetch_row(result);
-
-    g_message("Taxi %i disconnected", request->id);
-    response.subject = MRESPONSE_MAP_UPDATE;
-    respond(RESPONSE_MAP);
-
-    if (row[0] != NULL) {
-      int customerId = atoi(row[0]);
-      Coordinate coord = {.x = atoi(row[1]), .y = atoi(row[2])};
-      response.subject = CRESPONSE_TAXI_DISCONNECTED;
-      response.id = customerId;
-      memcpy(response.data, &request->id, sizeof(int));
-      memcpy(response.data + sizeof(int), &coord, sizeof(Coordinate));
-      respond(RESPONSE_CUSTOMER);
-    }
-
-    checkQueue();
+  if (customerId != NO_ID) {
+    response.subject = CRESPONSE_TAXI_DISCONNECTED;
+    response.id = customerId;
+    memcpy(response.data, &request->id, sizeof(int));
+    memcpy(response.data + sizeof(int), &coord, sizeof(Coordinate));
+    respond(RESPONSE_CUSTOMER);
   }
 
-  mysql_free_result(err_result);
-  mysql_free_result(result);
+  checkQueue();
 }
 
 void sendOrder(Request *request) {
-  char query[200];
+  const char *error;
+  char customerId;
   response.id = request->id;
+
   if (request->subject == ORDER_GOTO) {
-    response.subject = TRESPONSE_GOTO;
-    sprintf(query, "UPDATE taxis SET available = FALSE WHERE id = %i", request->id);
-    if (mysql_query(conn, query)) {
-      g_warning("Error executing query %s: %s", query, mysql_error(conn));
+    if (routingIsBlocked(request->coord)) {
+      g_warning("Error sending order to taxi %i: [%i, %i] is closed", request->id,
+                request->coord.x + 1, request->coord.y + 1);
+      return;
+    }
+
+    if ((error = stateSetTaxiAvailable(request->id, false)) != NULL) {
+      g_warning("Error sending order to taxi %i: %s", request->id, error);
       return;
     }
 
+    response.subject = TRESPONSE_GOTO;
     memcpy(response.data, &request->coord, sizeof(Coordinate));
     respond(RESPONSE_TAXI);
     g_message("Sent order to taxi %i to go to [%i, %i]", request->id, request->coord.x + 1,
               request->coord.y + 1);
   }
 
-  MYSQL_RES *err_result = NULL;
-  MYSQL_RES *result = NULL;
-  MYSQL_ROW row;
-
-  sprintf(query, "CALL ChangeMotion(%i, %i)", request->id,
-          request->subject == ORDER_STOP ? false : true);
-
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
-    return;
-  }
-
-  store_result_wrapper(err_result);
-  row = mysql_fetch_row(err_result);
+  error = stateChangeMotion(request->id, request->subject != ORDER_STOP);
+  if (error == NULL)
+    error = stateGetTaxiCustomer(request->id, &customerId);
 
-  sprintf(query, "SELECT customer FROM taxis WHERE id = %i", request->id);
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
+  if (error != NULL) {
+    g_warning("Error changing motion: %s", error);
     return;
   }
 
-  store_result_wrapper(result);
-  row = mysql_fetch_row(result);
-
-  if (row[0] != NULL) {
+  if (customerId != NO_ID) {
     response.subject =
-        request->subject == ORDER_STOP ? CRESPONSE_TAXI_RESUMED : CRESPONSE_TAXI_STOPPED;
-    response.id = row[0][0];
+        request->subject == ORDER_STOP ? CRESPONSE_TAXI_STOPPED : CRESPONSE_TAXI_RESUMED;
+    response.id = customerId;
     respond(RESPONSE_CUSTOMER);
   }
 
-  if (row[0] != NULL) {
-    g_warning("Error changing motion: %s", row[0]);
-  } else {
-    response.subject = request->subject == ORDER_STOP ? TRESPONSE_STOP : TRESPONSE_CONTINUE;
-    loadMap();
-    respond(RESPONSE_TAXI);
-    g_message("Sent order to taxi %i to %s", request->id,
-              request->subject == ORDER_STOP ? "stop" : "continue moving");
-  }
-
-  mysql_free_result(err_result);
-  mysql_free_result(result);
+  response.subject = request->subject == ORDER_STOP ? TRESPONSE_STOP : TRESPONSE_CONTINUE;
+  response.id = request->id;
+  respond(RESPONSE_TAXI);
+  updateMap();
+  g_message("Sent order to taxi %i to %s", request->id,
+            request->subject == ORDER_STOP ? "stop" : "continue moving");
 }
 
-void resumePosition(Request *request) {
-  MYSQL_RES *result = NULL;
-  MYSQL_ROW row;
-  char query[200];
+void changeClosure(Request *request) {
+  const char *error = NULL;
 
-  sprintf(query, "SELECT x, y FROM taxis WHERE id = %i", request->id);
+  // Nothing can be placed in the cell between the check and the closure
+  lockState();
+  if (!routingIsBlocked(request->coord))
+    error = stateCheckClosure(request->coord);
+  if (error == NULL)
+    toggleClosure(request->coord);
+  unlockState();
 
-  g_debug("Query: %s", query);
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
-    return;
-  }
+  if (error != NULL)
+    g_warning("Can't close [%i, %i]: %s", request->coord.x + 1, request->coord.y + 1, error);
+}
 
-  store_result_wrapper(result);
-  if (mysql_num_rows(result) == 0) {
-    g_warning("Error resuming position of taxi %i: Taxi not found", request->id);
-    return;
-  }
-  row = mysql_fetch_row(result);
+void resumePosition(Request *request) {
+  Coordinate coord;
+  const char *error = stateGetTaxiPosition(request->id, &coord);
 
-  if (row[0] == NULL) {
-    g_warning("Error resuming position of taxi %i", request->id);
-  } else {
-    Coordinate coord = {.x = atoi(row[0]), .y = atoi(row[1])};
-    g_message("Taxi %i resumed its service from [%i, %i]", request->id, coord.x + 1, coord.y + 1);
-    response.id = request->id;
-    response.subject = TRESPONSE_CHANGE_POSITION;
-    memcpy(response.data, &coord, sizeof(Coordinate));
-    g_message("Ordering taxi to resume its position");
-    respond(RESPONSE_TAXI);
+  if (error != NULL) {
+    g_warning("Error resuming position of taxi %i: %s", request->id, error);
+    return;
   }
 
-  mysql_free_result(result);
+  g_message("Taxi %i resumed its service from [%i, %i]", request->id, coord.x + 1, coord.y + 1);
+  response.id = request->id;
+  response.subject = TRESPONSE_CHANGE_POSITION;
+  memcpy(response.data, &coord, sizeof(Coordinate));
+  g_message("Ordering taxi to resume its position");
+  respond(RESPONSE_TAXI);
 }
 
 void setTaxiCanMove(int taxiId, bool canMove) {
-  MYSQL_RES *result = NULL;
-  MYSQL_ROW row;
-  char query[200];
-
-  sprintf(query, "UPDATE taxis SET can_move = %i WHERE id = %i", canMove, taxiId);
-  g_debug("Query: %s", query);
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
-    return;
-  }
-
-  if (mysql_affected_rows(conn) == 0) {
-    g_warning("Error updating taxi %i", taxiId);
-    return;
-  }
+  char customerId;
+  const char *error = stateSetTaxiCanMove(taxiId, canMove, &customerId);
 
-  sprintf(query, "SELECT customer FROM taxis WHERE id = %i", taxiId);
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
+  if (error != NULL) {
+    g_warning("Error updating taxi %i: %s", taxiId, error);
     return;
   }
 
-  store_result_wrapper(result);
-  row = mysql_fetch_row(result);
-
-  if (row[0] != NULL) {
+  if (customerId != NO_ID) {
     response.subject = canMove ? CRESPONSE_TAXI_RESUMED : CRESPONSE_TAXI_STOPPED;
-    response.id = row[0][0];
+    response.id = customerId;
     respond(RESPONSE_CUSTOMER);
   }
 
@@ -748,78 +887,10 @@ void setTaxiCanMove(int taxiId, bool canMove) {
     g_message("Taxi %i suffered an error and can't move", taxiId);
   }
 
-  response.subject = MRESPONSE_MAP_UPDATE;
-  respond(RESPONSE_MAP);
-
-  mysql_free_result(result);
-}
-
-void *checkStrays() {
-  MYSQL *localConn = mysql_init(NULL);
-  MYSQL_RES *result = NULL;
-  MYSQL_ROW row;
-  rd_kafka_t *producer = createKafkaUser(&kafka, RD_KAFKA_PRODUCER, "central-stray-check-producer");
-  Request request;
-  memcpy(request.session, session, UUID_LENGTH);
-
-  bool resetDb = strcmp(getenv("RESET_DB"), "true") == 0;
-
-  // Give some time to the server to process the pings
-  if (!resetDb) {
-    usleep(PING_GRACE_TIME * 1000 * 1000);
-  }
-
-  g_debug("Connecting to database");
-
-  if (!mysql_real_connect(localConn, db.ip, "root", DB_PASSWORD, DB_NAME, db.port, NULL,
-                          CLIENT_MULTI_STATEMENTS)) {
-    mysql_close(localConn);
-    g_warning("Error connecting to database. Strays check will be disabled");
-    return NULL;
-  }
-
-  g_debug("Connected to database");
-
-  while (true) {
-    usleep(USER_GRACE_TIME * 0.5 * 1000 * 1000);
-    char query[200];
-
-    sprintf(query, "CALL CheckStrays(%i)", USER_GRACE_TIME);
-    if (mysql_query(localConn, query)) {
-      g_warning("Error executing query %s: %s", query, mysql_error(localConn));
-      continue;
-    }
-
-    for (int i = 0; i < 2; i++) {
-      result = mysql_store_result(localConn);
-      mysql_next_result(localConn);
-
-      while ((row = mysql_fetch_row(result))) {
-        g_debug("Cathed a stray: %s", row[1]);
-        request.subject = atoi(row[0]) ? STRAY_TAXI : STRAY_CUSTOMER;
-        request.id = request.subject == STRAY_TAXI ? atoi(row[1]) : row[1][0];
-        sendEvent(producer, "requests", &request, sizeof(Request));
-      }
-
-      mysql_free_result(result);
-    }
-  }
-
-  return NULL;
+  updateMap();
 }
 
 void refreshLastUpdate(Request *request) {
-  char query[200];
-
-  if (request->subject == PING_CUSTOMER) {
-    sprintf(query, "UPDATE customers SET last_update = NOW() WHERE id = '%c'", request->id);
-  } else {
-    sprintf(query, "UPDATE taxis SET last_update = NOW() WHERE id = %i", request->id);
-  }
-
-  g_debug("Query: %s", query);
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
-    return;
-  }
-}
\ No newline at end of file
+  stateRefreshLastUpdate(request->subject == PING_CUSTOMER ? ENTITY_CUSTOMER : ENTITY_TAXI,
+                         request->id);
+}
@@ -6,27 +6,52 @@
 
 /// @brief Entry point of the kafka module
 ///
-/// This module handles the communications with the kafka server.
-/// As these are most of the communications, this is the core of the central and the module which
-/// handles the majority of the database operations.
+/// This module handles the communications with the kafka server. The requests are read in batches
+/// by a single thread, which drops the ones superseded by a later request of the same batch
+/// (intermediate moves and pings) and dispatches the rest to a pool of workers, sharded by the
+/// taxi or customer they are about. Once the batch has been handled, the map is published and the
+/// changes are persisted only once. The reader also keeps a timer per taxi and customer, refreshed
+/// with each of their messages, and dispatches a stray request when one of them expires.
+/// As these are most of the communications, this is the core of the central. The requests are
+/// answered from the in-memory state (see state_module.h), which is stored in the database
+/// asynchronously by the persistence module.
 void startKafkaServer();
 
-/// @brief Loads the map from the database
-void loadMap();
+/// @brief Handles a request read from the requests topic
+///
+/// @param request Request to be handled
+void handleRequest(Request *request);
+
+/// @brief Marks the map as changed, so it's published once the current batch has been handled
+void updateMap();
+
+/// @brief Builds the map from the in-memory state and publishes the changes to the GUI handlers, if
+/// it has changed since the last time
+void publishPendingMap();
 
 /// @brief Initializes the kafka module
 ///
-/// This includes initializing the kafka consumer and producer, as well as the database connection
-/// and the necessary variables to control the flux of the different threads.
+/// This includes initializing the kafka consumer and producer, as well as rebuilding the state
+/// from the database and starting its persistence.
 void init();
 
 /// @brief Disposes any resource that needs to be disposed.
 /// Intended to be called when the program is exiting.
 void cleanUp();
 
-/// @brief Stores the movement of a taxi in the database
+/// @brief Registers a taxi that has been authenticated by the socket module. If it can't, the
+/// digital engine is told with TRESPONSE_LOG_IN_AGAIN
 ///
 /// @param request Request containing the necessary information to perform the movement
+/// @return true The taxi is connected
+/// @return false It couldn't be connected (e.g. another digital engine is using its id)
+bool connectTaxi(Request *request);
+
+/// @brief Stores the movement of a taxi. If the cell is taken or reserved by another taxi, the
+/// move is refused and the taxi is told to wait where it was or to go around the cell
+///
+/// @param request Request containing the necessary information to perform the movement: the new
+/// position and, in data, the next cell of the taxi's route
 void moveTaxi(Request *request);
 
 /// @brief Introduces a new customer into the system
@@ -64,16 +89,33 @@ void pickUpCustomer(Request *request);
 /// @param request Request containing the necessary information to perform the movement
 void completeService(Request *request);
 
-/// @brief Checks if there are any customers in the queue. If so, it assigns a taxi to the client
-/// that has been longer in the queue, if possible
+/// @brief Marks the queue as changed (e.g. a taxi has become available), so it's matched once the
+/// current batch has been handled
 void checkQueue();
 
+/// @brief Assigns the queued customers to the available taxis at once (see stateMatchQueue) and
+/// informs them, if the queue has changed since the last time. Called once per batch
+void matchQueue();
+
+/// @brief Informs a customer and a taxi that the taxi has been assigned to the customer
+///
+/// @param customerId Customer to be served
+/// @param taxiId Taxi assigned
+/// @param customerCoord Position of the customer
+void notifyAssignment(char customerId, int taxiId, Coordinate customerCoord);
+
 /// @brief Sends an order to a taxi. These are the orders that the user has selected through the
-/// ncurses GUI
+/// ncurses GUI. A taxi can't be sent to a closed cell
 ///
 /// @param request Request containing the necessary information to perform the movement
 void sendOrder(Request *request);
 
+/// @brief Closes a cell, or opens it again, as the user has selected through the ncurses GUI. The
+/// cells the taxis must reach can't be closed (see stateCheckClosure)
+///
+/// @param request Request containing the cell
+void changeClosure(Request *request);
+
 /// @brief Tries to assign a taxi to a customer. If it succeeds, it returns true, otherwise false
 ///
 /// @param customerId Customer to be assigned
@@ -93,23 +135,15 @@ void disconnectCustomer(Request *request);
 /// @param request Request containing the necessary information to perform the movement
 void disconnectTaxi(Request *request);
 
-/// @brief Stores whether a taxi can move or not in the database
+/// @brief Stores whether a taxi can move or not
 ///
 /// @param taxiId Taxi to be updated
 /// @param canMove Whether the taxi can move or not
 void setTaxiCanMove(int taxiId, bool canMove);
 
-/// @brief Updates a taxi or customer's last update time in the database
+/// @brief Updates a taxi or customer's last update time
 ///
 /// @param request Request containing the necessary information to perform the movement
 void refreshLastUpdate(Request *request);
 
-/// @brief Function intended to be executed by a separate thread or process. Continuously checks
-/// for strays (taxi or customers that haven't shown signs of life for a while) and sends a kafka
-/// message to the central to take action
-///
-/// @return void* Returns NULL always. It just exists to fill the required signature for a thread
-/// intended function
-void *checkStrays();
-
 #endif
\ No newline at end of file
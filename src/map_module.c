@@ -0,0 +1,255 @@
+#include "map_module.h"
+#include "common.h"
+#include "glib.h"
+#include <librdkafka/rdkafka.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern uuid_t session;
+
+static rd_kafka_t *producer;
+
+static int64_t published[MAP_SIZE];
+static bool initialized = false;
+static unsigned int seq = 0;
+static int deltasSinceKeyframe = 0;
+static time_t lastKeyframe = 0;
+static MapUpdate update;
+
+// Newest map received and not published yet
+static int64_t latest[MAP_SIZE];
+static unsigned long latestVersion = 0;
+static bool latestPending = false;
+static bool structuralPending = false;
+
+// Minimum time (ms) between two frames
+static long frameInterval;
+static struct timespec lastFrame;
+
+static MapPublisherStats stats;
+
+static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+/// @brief Encodes the changes stored in the update and increases the sequence number
+///
+/// @param frame Output argument. Encoded update. Capacity of MAX_MAP_FRAME_SIZE
+/// @return int Size of the frame
+int encodeUpdate(unsigned char *frame) {
+  update.seq = seq++;
+  uuid_copy(update.session, session);
+  stats.published++;
+  return encodeMapUpdate(&update, frame);
+}
+
+/// @brief Encodes the full state of the last published map
+///
+/// @param frame Output argument. Encoded keyframe. Capacity of MAX_MAP_FRAME_SIZE
+/// @return int Size of the frame
+int encodeKeyframe(unsigned char *frame) {
+  int size;
+
+  update.subject = MRESPONSE_MAP_KEYFRAME;
+  update.count = 0;
+
+  for (int i = 0; i < MAP_SIZE; i++) {
+    if (published[i] == EMPTY_SLOT)
+      continue;
+    update.changes[update.count].slot = i;
+    update.changes[update.count].entity = published[i];
+    update.count++;
+  }
+
+  size = encodeUpdate(frame);
+  deltasSinceKeyframe = 0;
+  lastKeyframe = time(NULL);
+  g_debug("Publishing map keyframe %u (%i entities). Frames published: %lu, suppressed: %lu",
+          update.seq, update.count, stats.published, stats.suppressed);
+  return size;
+}
+
+/// @brief Encodes the newest map received, as a delta or as a keyframe if it's due. It becomes the
+/// last published map
+///
+/// @param frame Output argument. Encoded update. Capacity of MAX_MAP_FRAME_SIZE
+/// @return int Size of the frame, 0 if nothing has changed
+int encodeLatest(unsigned char *frame) {
+  int size;
+
+  if (!initialized) {
+    memcpy(published, latest, sizeof(published));
+    initialized = true;
+    return encodeKeyframe(frame);
+  }
+
+  update.subject = MRESPONSE_MAP_DELTA;
+  update.count = 0;
+
+  for (int i = 0; i < MAP_SIZE; i++) {
+    if (published[i] == latest[i])
+      continue;
+    published[i] = latest[i];
+    update.changes[update.count].slot = i;
+    update.changes[update.count].entity = latest[i];
+    update.count++;
+  }
+
+  if (update.count == 0)
+    return 0;
+
+  if (deltasSinceKeyframe >= MAP_KEYFRAME_INTERVAL ||
+      time(NULL) - lastKeyframe >= MAP_KEYFRAME_PERIOD)
+    return encodeKeyframe(frame);
+
+  size = encodeUpdate(frame);
+  deltasSinceKeyframe++;
+  g_debug("Publishing map delta %u (%i changes)", update.seq, update.count);
+  return size;
+}
+
+/// @brief Sends a frame without holding the lock of the publisher, so a slow broker doesn't block
+/// the threads handing maps over. Frames are only sent by the publisher thread, so they keep the
+/// order of their sequence numbers
+///
+/// @param frame Encoded update
+/// @param size Size of the frame. Nothing is sent if it's 0
+void sendFrame(unsigned char *frame, int size) {
+  if (size == 0)
+    return;
+
+  pthread_mutex_unlock(&mut);
+  sendEvent(producer, "map_responses", RD_KAFKA_PARTITION_UA, MAP_MESSAGE_KEY, frame, size);
+  pthread_mutex_lock(&mut);
+}
+
+/// @brief Checks whether the differences between two entities must be published right away: an
+/// entity has appeared or disappeared, or its status has changed. Movements aren't structural
+///
+/// @param before Serialized entity as it was published
+/// @param after Serialized entity as it is now
+/// @return true The change is structural
+/// @return false Otherwise
+bool isStructuralChange(int64_t before, int64_t after) {
+  Entity a, b;
+
+  if (before == after)
+    return false;
+  if (before == EMPTY_SLOT || after == EMPTY_SLOT)
+    return true;
+
+  deserializeEntity(&a, before);
+  deserializeEntity(&b, after);
+  return a.status != b.status || a.carryingCustomer != b.carryingCustomer || a.obj != b.obj;
+}
+
+/// @brief Adds some milliseconds to a time
+///
+/// @param time Time to be increased
+/// @param ms Milliseconds to add
+/// @return struct timespec Resulting time
+struct timespec addMs(struct timespec time, long ms) {
+  time.tv_sec += ms / 1000;
+  time.tv_nsec += (ms % 1000) * 1000000;
+  if (time.tv_nsec >= 1000000000) {
+    time.tv_sec++;
+    time.tv_nsec -= 1000000000;
+  }
+  return time;
+}
+
+/// @brief Checks whether a time has already passed
+///
+/// @param time Time to be checked
+/// @return true It's in the past
+/// @return false It's in the future
+bool hasPassed(struct timespec time) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return now.tv_sec > time.tv_sec || (now.tv_sec == time.tv_sec && now.tv_nsec >= time.tv_nsec);
+}
+
+/// @brief Function intended to be executed by a separate thread. Publishes the newest map received
+/// at most once every frameInterval, or right away if the change is structural. It also sends the
+/// periodic keyframes
+///
+/// @return void* Returns NULL always
+void *runPublisher() {
+  unsigned char frame[MAX_MAP_FRAME_SIZE];
+  struct timespec wakeUp;
+
+  pthread_mutex_lock(&mut);
+  while (true) {
+    if (!latestPending) {
+      clock_gettime(CLOCK_REALTIME, &wakeUp);
+      wakeUp = addMs(wakeUp, 1000);
+      pthread_cond_timedwait(&cond, &mut, &wakeUp);
+
+      if (initialized && !latestPending && time(NULL) - lastKeyframe >= MAP_KEYFRAME_PERIOD)
+        sendFrame(frame, encodeKeyframe(frame));
+      continue;
+    }
+
+    wakeUp = addMs(lastFrame, frameInterval);
+    if (!structuralPending && !hasPassed(wakeUp)) {
+      pthread_cond_timedwait(&cond, &mut, &wakeUp);
+      continue;
+    }
+
+    latestPending = false;
+    structuralPending = false;
+    clock_gettime(CLOCK_REALTIME, &lastFrame);
+    sendFrame(frame, encodeLatest(frame));
+  }
+
+  return NULL;
+}
+
+void startMapPublisher(rd_kafka_t *mapProducer) {
+  pthread_t thread;
+  char *maxFpsEnv = getenv("MAP_MAX_FPS");
+  int maxFps = maxFpsEnv != NULL ? atoi(maxFpsEnv) : MAP_MAX_FPS;
+
+  if (maxFps < 1)
+    maxFps = MAP_MAX_FPS;
+
+  producer = mapProducer;
+  frameInterval = 1000 / maxFps;
+
+  pthread_create(&thread, NULL, runPublisher, NULL);
+  pthread_detach(thread);
+  g_message("Publishing the map at most %i times per second", maxFps);
+}
+
+void publishMap(int64_t map[MAP_SIZE], unsigned long version) {
+  pthread_mutex_lock(&mut);
+
+  // A newer map has been handed over first
+  if (version <= latestVersion) {
+    stats.suppressed++;
+    pthread_mutex_unlock(&mut);
+    return;
+  }
+
+  if (latestPending)
+    stats.suppressed++;
+
+  for (int i = 0; i < MAP_SIZE && !structuralPending; i++) {
+    if (!initialized || isStructuralChange(published[i], map[i]))
+      structuralPending = true;
+  }
+
+  memcpy(latest, map, sizeof(latest));
+  latestVersion = version;
+  latestPending = true;
+
+  pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&mut);
+}
+
+void getMapPublisherStats(MapPublisherStats *dest) {
+  pthread_mutex_lock(&mut);
+  *dest = stats;
+  pthread_mutex_unlock(&mut);
+}
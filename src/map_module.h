@@ -0,0 +1,41 @@
+#ifndef MAP_MODULE_H
+#define MAP_MODULE_H
+
+#include "common.h"
+
+// Counters of the map publisher
+typedef struct {
+  unsigned long published;  // Frames sent (deltas and keyframes)
+  unsigned long suppressed; // Maps replaced by a newer one before being published
+} MapPublisherStats;
+
+/// @brief Starts the thread that publishes the map through the map_responses topic.
+///
+/// This module keeps a copy of the last published map and only sends the slots that changed since
+/// then (a delta). Every MAP_KEYFRAME_INTERVAL deltas, or if MAP_KEYFRAME_PERIOD seconds have
+/// passed since the last one, the full state of the map is sent instead (a keyframe) so the GUI
+/// handlers that lost a delta or have just started can rebuild the map. Nothing is sent if the map
+/// hasn't changed.
+///
+/// Frames are sent at most MAP_MAX_FPS times per second (overridable with the environment variable
+/// of the same name). If several maps are received in between, only the newest one is published.
+/// Structural changes (an entity appears, disappears or changes its status) are published right
+/// away.
+///
+/// @param producer Kafka producer that will send the updates
+void startMapPublisher(rd_kafka_t *producer);
+
+/// @brief Hands the current state of the map to the publisher. It doesn't wait for the broker.
+/// Thread safe
+///
+/// @param map Current state of the map
+/// @param version Version of the state the map was built from. Maps with a version lower than or
+/// equal to the newest one received are dropped, so the caller doesn't need to hold the state lock
+void publishMap(int64_t map[MAP_SIZE], unsigned long version);
+
+/// @brief Gets the counters of the publisher. Thread safe
+///
+/// @param dest Output argument. Current counters
+void getMapPublisherStats(MapPublisherStats *dest);
+
+#endif
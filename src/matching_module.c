@@ -0,0 +1,100 @@
+#include "matching_module.h"
+#include "glib.h"
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+long solveAssignment(int rows, int cols, const int *cost, int *assignment) {
+  // The algorithm needs n <= m, so the matrix is transposed if there are more rows than columns
+  bool transposed = rows > cols;
+  int n = transposed ? cols : rows;
+  int m = transposed ? rows : cols;
+  long total = 0;
+
+  for (int i = 0; i < rows; i++)
+    assignment[i] = -1;
+
+  if (n == 0)
+    return 0;
+
+  // 1-indexed as in the classic formulation. p[j] is the row matched with column j (0 if none)
+  long *u = calloc(n + 1, sizeof(long));
+  long *v = calloc(m + 1, sizeof(long));
+  long *minv = malloc((m + 1) * sizeof(long));
+  int *p = calloc(m + 1, sizeof(int));
+  int *way = calloc(m + 1, sizeof(int));
+  bool *used = malloc((m + 1) * sizeof(bool));
+
+  if (!u || !v || !minv || !p || !way || !used)
+    g_error("Error allocating memory for the assignment of %i x %i", rows, cols);
+
+  for (int i = 1; i <= n; i++) {
+    int j0 = 0;
+    p[0] = i;
+
+    for (int j = 0; j <= m; j++) {
+      minv[j] = LONG_MAX;
+      used[j] = false;
+    }
+
+    // Grow an alternating path from row i until it reaches a free column
+    do {
+      int i0 = p[j0], j1 = 0;
+      long delta = LONG_MAX;
+      used[j0] = true;
+
+      for (int j = 1; j <= m; j++) {
+        if (used[j])
+          continue;
+
+        long c = transposed ? cost[(j - 1) * cols + (i0 - 1)] : cost[(i0 - 1) * cols + (j - 1)];
+        long cur = c - u[i0] - v[j];
+        if (cur < minv[j]) {
+          minv[j] = cur;
+          way[j] = j0;
+        }
+        if (minv[j] < delta) {
+          delta = minv[j];
+          j1 = j;
+        }
+      }
+
+      for (int j = 0; j <= m; j++) {
+        if (used[j]) {
+          u[p[j]] += delta;
+          v[j] -= delta;
+        } else {
+          minv[j] -= delta;
+        }
+      }
+
+      j0 = j1;
+    } while (p[j0] != 0);
+
+    // Flip the path
+    do {
+      int j1 = way[j0];
+      p[j0] = p[j1];
+      j0 = j1;
+    } while (j0 != 0);
+  }
+
+  for (int j = 1; j <= m; j++) {
+    if (p[j] == 0)
+      continue;
+
+    int row = transposed ? j - 1 : p[j] - 1;
+    int col = transposed ? p[j] - 1 : j - 1;
+    assignment[row] = col;
+    total += cost[row * cols + col];
+  }
+
+  free(u);
+  free(v);
+  free(minv);
+  free(p);
+  free(way);
+  free(used);
+
+  return total;
+}
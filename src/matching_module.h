@@ -0,0 +1,18 @@
+#ifndef MATCHING_MODULE_H
+#define MATCHING_MODULE_H
+
+/// @brief Solves the assignment problem: pairs rows with columns so that every row (or every
+/// column, if there are fewer) gets a different partner and the total cost is minimal.
+///
+/// It uses the Hungarian algorithm with potentials, which is O(n^2 * m) being n the smallest
+/// dimension and m the largest one.
+///
+/// @param rows Number of rows (e.g. customers)
+/// @param cols Number of columns (e.g. taxis)
+/// @param cost Matrix of rows x cols costs, stored by rows. They must be non negative
+/// @param assignment Output argument. Column assigned to each row, -1 if the row is left without
+/// partner. Capacity of rows
+/// @return long Total cost of the assignment
+long solveAssignment(int rows, int cols, const int *cost, int *assignment);
+
+#endif
@@ -18,7 +18,8 @@
 WINDOW *top_box, *menu_box;
 WINDOW *menu_win, *top_win, *bottom_win, *table_win;
 extern Address kafka;
-int map[MAP_SIZE] = {0};
+extern uuid_t session;
+int64_t map[MAP_SIZE];
 pthread_mutex_t mut;
 pid_t processes[5];
 int processCount = 0;
@@ -54,6 +55,9 @@ void ncursesInit() {
 
   pthread_mutex_init(&mut, NULL);
 
+  for (int i = 0; i < MAP_SIZE; i++)
+    map[i] = EMPTY_SLOT;
+
   q_top = newQueue();
   q_bottom = newQueue();
 
@@ -137,16 +141,14 @@ void ncursesGui(int p) {
 }
 
 void *readMap() {
-  Response response;
-  response.map[0] = 0;
+  long seq = -1;
+  MapView update = {.msg = NULL};
   rd_kafka_message_t *msg = NULL;
   rd_kafka_t *consumer = createKafkaUser(&kafka, RD_KAFKA_CONSUMER, "central-ncurses-gui-consumer");
-  subscribeToTopics(&consumer,
-                    (const char *[]){"taxi_responses", "customer_responses", "map_responses"}, 3);
+  subscribeToTopics(&consumer, (const char *[]){"map_responses"}, 1);
 
   while (true) {
-    if (msg != NULL)
-      rd_kafka_message_destroy(msg);
+    closeMapView(&update);
     msg = rd_kafka_consumer_poll(consumer, 1000);
 
     if (!msg) {
@@ -165,13 +167,24 @@ void *readMap() {
       buffer[1] = PASTEL_ORANGE;
       sprintf(buffer + 2, "WARNING: Error: %s\n", rd_kafka_message_errstr(msg));
       enqueue(q_top, buffer);
+      rd_kafka_message_destroy(msg);
       continue;
     }
 
-    memcpy(&response, msg->payload, sizeof(response));
+    // The update is applied straight from the payload, which is destroyed in the next iteration
+    if (!openMapView(&update, msg))
+      continue;
+
     pthread_mutex_lock(&mut);
-    memcpy(map, response.map, sizeof(map));
+    bool applied = applyMapUpdate(map, &seq, &update);
     pthread_mutex_unlock(&mut);
+
+    if (!applied && seq == -1 && getenv("G_MESSAGES_DEBUG") != NULL) {
+      char buffer[BUFFER_SIZE];
+      buffer[1] = PASTEL_MAGENTA;
+      strcpy(buffer + 2, "Debug: Map out of sync, waiting for the next keyframe\n");
+      enqueue(q_top, buffer);
+    }
   }
 
   return NULL;
@@ -209,31 +222,33 @@ void handleInput(int c) {
                                            (selectedAction != 0 && selectedOption == 1))) {
       showErrorMsg = 0;
       for (int i = 0; i < 2; i++)
-        if (selectedTaxi[i] == -1)
+        if (selectedTaxi[i] == -1 && selectedAction != 4)
           showErrorMsg = 1;
       for (int i = 0; i < 4; i++)
-        if (selectedCoord[i] == -1 && selectedAction == 0)
+        if (selectedCoord[i] == -1 && (selectedAction == 0 || selectedAction == 4))
           showErrorMsg = 1;
-      if (selectedCoord[0] * 10 + selectedCoord[1] > 20 ||
-          selectedCoord[2] * 10 + selectedCoord[3] > 20)
+      if (selectedCoord[0] * 10 + selectedCoord[1] > gridSize() ||
+          selectedCoord[2] * 10 + selectedCoord[3] > gridSize())
         showErrorMsg = 2;
 
       if (showErrorMsg == 0) {
         request.subject = selectedAction == 0   ? ORDER_GOTO
                           : selectedAction == 1 ? ORDER_GOTO
                           : selectedAction == 2 ? ORDER_STOP
-                                                : ORDER_CONTINUE;
+                          : selectedAction == 3 ? ORDER_CONTINUE
+                                                : ORDER_TOGGLE_CLOSURE;
 
-        if (selectedAction == 0) {
+        if (selectedAction == 0 || selectedAction == 4) {
           request.coord.x = selectedCoord[0] * 10 + selectedCoord[1] - 1;
           request.coord.y = selectedCoord[2] * 10 + selectedCoord[3] - 1;
         } else if (selectedAction == 1) {
           request.coord.x = 0;
           request.coord.y = 0;
         }
-        request.id = selectedTaxi[0] * 10 + selectedTaxi[1];
+        request.id = selectedAction == 4 ? 0 : selectedTaxi[0] * 10 + selectedTaxi[1];
 
-        sendEvent(producer, "requests", &request, sizeof(request));
+        uuid_copy(request.session, session);
+        sendRequestEvent(producer, &request);
         showOptions = false;
         for (int i = 0; i < 2; i++)
           selectedTaxi[i] = -1;
@@ -241,7 +256,14 @@ void handleInput(int c) {
           selectedCoord[i] = -1;
       }
     } else if (c >= '0' && c <= '9') {
-      if (selectedOption == 0) {
+      if (selectedOption == 0 && selectedAction == 4) {
+        for (int i = 0; i < 4; i++) {
+          if (selectedCoord[i] == -1) {
+            selectedCoord[i] = c - '0';
+            break;
+          }
+        }
+      } else if (selectedOption == 0) {
         for (int i = 0; i < 2; i++) {
           if (selectedTaxi[i] == -1) {
             selectedTaxi[i] = c - '0';
@@ -257,7 +279,14 @@ void handleInput(int c) {
         }
       }
     } else if (c == KEY_BACKSPACE) {
-      if (selectedOption == 0) {
+      if (selectedOption == 0 && selectedAction == 4) {
+        for (int i = 3; i >= 0; i--) {
+          if (selectedCoord[i] != -1) {
+            selectedCoord[i] = -1;
+            break;
+          }
+        }
+      } else if (selectedOption == 0) {
         for (int i = 1; i >= 0; i--) {
           if (selectedTaxi[i] != -1) {
             selectedTaxi[i] = -1;
@@ -275,9 +304,9 @@ void handleInput(int c) {
     }
   } else {
     if (c == KEY_DOWN || c == 's') {
-      selectedAction = (selectedAction + 1) % 4;
+      selectedAction = (selectedAction + 1) % 5;
     } else if (c == KEY_UP || c == 'w') {
-      selectedAction = (selectedAction + 3) % 4;
+      selectedAction = (selectedAction + 4) % 5;
     } else if (c == ' ' || c == '\n') {
       selectedOption = 0;
       showOptions = true;
@@ -317,7 +346,8 @@ void printLogs() {
 }
 
 void printTableView() {
-  int localMap[MAP_SIZE];
+  int64_t localMap[MAP_SIZE];
+  Entity entities[MAP_SIZE];
   Table locs, customers, taxis;
   char status[100];
   strcpy(status + STATUS_MARGIN, "Status");
@@ -345,12 +375,15 @@ void printTableView() {
   memcpy(localMap, map, sizeof(localMap));
   pthread_mutex_unlock(&mut);
 
-  char id[4];
+  char id[12];
   char coord[30];
   char obj[2];
-  for (int i = 0; map[i] != 0; i++) {
-    Entity entity;
-    deserializeEntity(&entity, map[i]);
+  deserializeEntities(localMap, entities, MAP_SIZE);
+  for (int i = 0; i < MAP_SIZE; i++) {
+    if (localMap[i] == EMPTY_SLOT)
+      continue;
+
+    Entity entity = entities[i];
     sprintf(coord, "[%02i, %02i]", entity.coord.x + 1, entity.coord.y + 1);
     sprintf(id, "%c", entity.id);
 
@@ -394,7 +427,7 @@ void printMenu() {
   mvwaddstr(menu_win, 1, 1, "VIEWS");
   mvwaddstr(menu_win, 6, 1, "ACTIONS");
   if (showOptions)
-    mvwaddstr(menu_win, 12, 1, "OPTIONS");
+    mvwaddstr(menu_win, 13, 1, "OPTIONS");
   wattroff(menu_win, A_BOLD);
 
   mvwprintw(menu_win, 2, 1, "[%c] Logs", selectedView == 0 ? 'X' : ' ');
@@ -407,28 +440,37 @@ void printMenu() {
             (selectedAction == 2 && showOptions) ? '>' : ' ');
   mvwprintw(menu_win, 10, 1, " %c%c Continue", selectedAction == 3 ? '>' : ' ',
             (selectedAction == 3 && showOptions) ? '>' : ' ');
+  mvwprintw(menu_win, 11, 1, " %c%c Close/open cell", selectedAction == 4 ? '>' : ' ',
+            (selectedAction == 4 && showOptions) ? '>' : ' ');
   if (showOptions) {
-    mvwprintw(menu_win, 13, 1, " %c  Taxi: %c%c", selectedOption == 0 ? '>' : ' ',
-              selectedTaxi[0] == -1 ? '_' : selectedTaxi[0] + '0',
-              selectedTaxi[1] == -1 ? '_' : selectedTaxi[1] + '0');
-    if (selectedAction == 0) {
-      mvwprintw(menu_win, 14, 1, " %c  Coordinate: [%c%c, %c%c]", selectedOption == 1 ? '>' : ' ',
+    // The closure action has no taxi, its coordinate takes the first row
+    int coordRow = selectedAction == 4 ? 14 : 15;
+
+    if (selectedAction != 4) {
+      mvwprintw(menu_win, 14, 1, " %c  Taxi: %c%c", selectedOption == 0 ? '>' : ' ',
+                selectedTaxi[0] == -1 ? '_' : selectedTaxi[0] + '0',
+                selectedTaxi[1] == -1 ? '_' : selectedTaxi[1] + '0');
+    }
+    if (selectedAction == 0 || selectedAction == 4) {
+      mvwprintw(menu_win, coordRow, 1, " %c  Coordinate: [%c%c, %c%c]",
+                selectedOption == coordRow - 14 ? '>' : ' ',
                 selectedCoord[0] == -1 ? '_' : selectedCoord[0] + '0',
                 selectedCoord[1] == -1 ? '_' : selectedCoord[1] + '0',
                 selectedCoord[2] == -1 ? '_' : selectedCoord[2] + '0',
                 selectedCoord[3] == -1 ? '_' : selectedCoord[3] + '0');
-      mvwprintw(menu_win, 15, 1, " %c  Execute ", selectedOption == 2 ? '>' : ' ');
+      mvwprintw(menu_win, coordRow + 1, 1, " %c  Execute ",
+                selectedOption == coordRow - 13 ? '>' : ' ');
       if (showErrorMsg) {
         wattron(menu_win, COLOR_PAIR(PASTEL_RED));
-        mvwprintw(menu_win, 18, 1,
+        mvwprintw(menu_win, coordRow + 4, 1,
                   showErrorMsg == 1 ? "Fill the required fields" : "Invalid coordinate");
         wattroff(menu_win, COLOR_PAIR(PASTEL_RED));
       }
     } else {
-      mvwprintw(menu_win, 14, 1, " %c  Execute ", selectedOption == 1 ? '>' : ' ');
+      mvwprintw(menu_win, 15, 1, " %c  Execute ", selectedOption == 1 ? '>' : ' ');
       if (showErrorMsg) {
         wattron(menu_win, COLOR_PAIR(PASTEL_RED));
-        mvwprintw(menu_win, 17, 1, "Fill the required fields");
+        mvwprintw(menu_win, 18, 1, "Fill the required fields");
         wattroff(menu_win, COLOR_PAIR(PASTEL_RED));
       }
     }
@@ -440,7 +482,7 @@ void printMenu() {
 
   mvwaddstr(menu_win, getmaxy(menu_win) - 1, 1, "(Press 'q' to exit)");
   if (showOptions)
-    mvwaddstr(menu_win, selectedAction == 0 ? 16 : 15, 1, "(Press 'b' to cancel)");
+    mvwaddstr(menu_win, selectedAction == 0 ? 17 : 16, 1, "(Press 'b' to cancel)");
   wattroff(menu_win, A_DIM);
 
   wrefresh(menu_win);
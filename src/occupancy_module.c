@@ -0,0 +1,250 @@
+#include "occupancy_module.h"
+#include "common.h"
+#include "glib.h"
+#include <stdlib.h>
+#include <string.h>
+
+/// @brief Gets the slot where the search of a key starts
+///
+/// @param key Key to be hashed. Never 0
+/// @return int Slot of the hash table
+int homeSlot(int64_t key) {
+  // The high half of the hash is scaled to the capacity, which is cheaper than a modulo
+  return ((uint64_t)key * 0x9E3779B97F4A7C15ULL >> 32) * OCCUPANCY_SLOTS >> 32;
+}
+
+/// @brief Finds a key in a hash table with linear probing
+///
+/// @param keys Keys of the table, 0 if the slot is free
+/// @param key Key to be found
+/// @return int Slot holding the key, or the free slot where it would be inserted
+int findSlot(const int64_t *keys, int64_t key) {
+  int slot = homeSlot(key);
+
+  while (keys[slot] != 0 && keys[slot] != key)
+    slot = slot + 1 < OCCUPANCY_SLOTS ? slot + 1 : 0;
+  return slot;
+}
+
+/// @brief Empties a slot of a hash table with linear probing. The entries that come after it are
+/// moved back if their search went through it, so there's no need for tombstones
+///
+/// @param keys Keys of the table
+/// @param values Values of the table
+/// @param slot Slot to be emptied
+void clearSlot(int64_t *keys, int *values, int slot) {
+  int hole = slot, next = slot, home;
+
+  keys[hole] = 0;
+  while (true) {
+    next = next + 1 < OCCUPANCY_SLOTS ? next + 1 : 0;
+    if (keys[next] == 0)
+      return;
+
+    // The entry can fill the hole unless its search starts after the hole (cyclically)
+    home = homeSlot(keys[next]);
+    if (next > hole ? (home <= hole || home > next) : (home <= hole && home > next)) {
+      keys[hole] = keys[next];
+      values[hole] = values[next];
+      keys[next] = 0;
+      hole = next;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//// Occupancy grid
+////////////////////////////////////////////////////////////////////////////////////
+
+void initOccupancyGrid(OccupancyGrid *grid) {
+  int size = gridSize();
+
+  free(grid->bits);
+  memset(grid, 0, sizeof(OccupancyGrid));
+
+  grid->side = size < OCCUPANCY_MAX_SIDE ? size : OCCUPANCY_MAX_SIDE;
+  grid->bits = calloc(((int64_t)grid->side * grid->side + 63) / 64, sizeof(uint64_t));
+  if (grid->bits == NULL)
+    g_error("Error allocating the occupancy grid");
+}
+
+void freeOccupancyGrid(OccupancyGrid *grid) {
+  free(grid->bits);
+  grid->bits = NULL;
+}
+
+/// @brief Gets the bit of a cell
+///
+/// @param grid Occupancy grid
+/// @param coord Cell
+/// @return int64_t Index of its bit
+int64_t cellBit(const OccupancyGrid *grid, Coordinate coord) {
+  int x = coord.x < grid->side ? coord.x : coord.x % grid->side;
+  int y = coord.y < grid->side ? coord.y : coord.y % grid->side;
+  return (int64_t)x * grid->side + y;
+}
+
+/// @brief Adds a taxi to a cell
+///
+/// @param grid Occupancy grid
+/// @param cell Bit of the cell
+void enterCell(OccupancyGrid *grid, int64_t cell) {
+  int slot;
+
+  if (!(grid->bits[cell / 64] >> (cell % 64) & 1)) {
+    grid->bits[cell / 64] |= (uint64_t)1 << (cell % 64);
+    return;
+  }
+
+  slot = findSlot(grid->sharedCells, cell + 1);
+  if (grid->sharedCells[slot] == 0) {
+    grid->sharedCells[slot] = cell + 1;
+    grid->sharedCounts[slot] = 0;
+  }
+  grid->sharedCounts[slot]++;
+}
+
+/// @brief Takes a taxi out of a cell
+///
+/// @param grid Occupancy grid
+/// @param cell Bit of the cell
+void leaveCell(OccupancyGrid *grid, int64_t cell) {
+  int slot = findSlot(grid->sharedCells, cell + 1);
+
+  if (grid->sharedCells[slot] == 0) {
+    grid->bits[cell / 64] &= ~((uint64_t)1 << (cell % 64));
+    return;
+  }
+
+  if (--grid->sharedCounts[slot] == 0)
+    clearSlot(grid->sharedCells, grid->sharedCounts, slot);
+}
+
+void occupancySet(OccupancyGrid *grid, int taxiId, Coordinate coord) {
+  int64_t cell = cellBit(grid, coord);
+
+  if (taxiId < 0 || taxiId >= MAX_TAXIS)
+    return;
+
+  if (grid->present[taxiId]) {
+    if (grid->cells[taxiId] == cell)
+      return;
+    leaveCell(grid, grid->cells[taxiId]);
+  }
+
+  enterCell(grid, cell);
+  grid->cells[taxiId] = cell;
+  grid->present[taxiId] = true;
+}
+
+void occupancyRemove(OccupancyGrid *grid, int taxiId) {
+  if (taxiId < 0 || taxiId >= MAX_TAXIS || !grid->present[taxiId])
+    return;
+
+  leaveCell(grid, grid->cells[taxiId]);
+  grid->present[taxiId] = false;
+}
+
+bool occupancyTaken(const OccupancyGrid *grid, Coordinate coord) {
+  int64_t cell = cellBit(grid, coord);
+  return grid->bits[cell / 64] >> (cell % 64) & 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//// Reservation table
+////////////////////////////////////////////////////////////////////////////////////
+
+/// @brief Gets the key of a cell in the reservation table
+///
+/// @param cell Cell
+/// @return int64_t Key, never 0
+int64_t reservationKey(Coordinate cell) { return ((int64_t)cell.x << 32 | (uint32_t)cell.y) + 1; }
+
+void initReservationTable(ReservationTable *table) {
+  memset(table, 0, sizeof(ReservationTable));
+  for (int i = 0; i < RESERVATION_HORIZON; i++)
+    table->ticks[i] = -1;
+}
+
+/// @brief Gets the table of a tick to add a reservation to it. If it was used by an older tick,
+/// it's emptied first
+///
+/// @param table Reservation table
+/// @param tick Tick
+/// @return int Row of the tick in the ring
+int tickRow(ReservationTable *table, long tick) {
+  int row = tick % RESERVATION_HORIZON;
+
+  if (table->ticks[row] != tick) {
+    memset(table->cells[row], 0, sizeof(table->cells[row]));
+    table->ticks[row] = tick;
+  }
+  return row;
+}
+
+void releaseCell(ReservationTable *table, int taxiId) {
+  int64_t key;
+  int row, slot;
+
+  if (taxiId < 0 || taxiId >= MAX_TAXIS || table->held[taxiId] == 0)
+    return;
+
+  key = table->held[taxiId];
+  for (long tick = table->heldFrom[taxiId]; tick <= table->heldTo[taxiId]; tick++) {
+    row = tick % RESERVATION_HORIZON;
+    if (table->ticks[row] != tick)
+      continue;
+
+    slot = findSlot(table->cells[row], key);
+    if (table->cells[row][slot] != 0 && table->owners[row][slot] == taxiId)
+      clearSlot(table->cells[row], table->owners[row], slot);
+  }
+
+  table->held[taxiId] = 0;
+}
+
+bool reserveCell(ReservationTable *table, int taxiId, Coordinate cell, long from, long to) {
+  int64_t key = reservationKey(cell);
+  int owner, row, slot;
+
+  if (taxiId < 0 || taxiId >= MAX_TAXIS || to < from || to - from >= RESERVATION_HORIZON)
+    return false;
+
+  releaseCell(table, taxiId);
+
+  for (long tick = from; tick <= to; tick++) {
+    owner = reservationOwner(table, cell, tick);
+    if (owner != -1 && owner != taxiId)
+      return false;
+  }
+
+  for (long tick = from; tick <= to; tick++) {
+    row = tickRow(table, tick);
+    slot = findSlot(table->cells[row], key);
+    table->cells[row][slot] = key;
+    table->owners[row][slot] = taxiId;
+  }
+
+  table->held[taxiId] = key;
+  table->heldFrom[taxiId] = from;
+  table->heldTo[taxiId] = to;
+  return true;
+}
+
+int reservationOwner(const ReservationTable *table, Coordinate cell, long tick) {
+  int row = tick % RESERVATION_HORIZON, slot;
+
+  if (table->ticks[row] != tick)
+    return -1;
+
+  slot = findSlot(table->cells[row], reservationKey(cell));
+  return table->cells[row][slot] != 0 ? table->owners[row][slot] : -1;
+}
+
+bool occupancyAdmits(const OccupancyGrid *grid, const ReservationTable *table, int taxiId,
+                     Coordinate cell, const Coordinate *objective, long tick) {
+  int owner = reservationOwner(table, cell, tick);
+  bool isObjective = objective != NULL && objective->x == cell.x && objective->y == cell.y;
+
+  return (owner == -1 || owner == taxiId) && (isObjective || !occupancyTaken(grid, cell));
+}
@@ -0,0 +1,119 @@
+#ifndef OCCUPANCY_MODULE_H
+#define OCCUPANCY_MODULE_H
+
+#include "common.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Side of the biggest map whose cells have a bit of their own. Bigger maps are folded onto it, so
+// distant cells may share a bit: a taxi may then be told to wait for a cell that is actually free,
+// but it's never let into one that is taken
+#define OCCUPANCY_MAX_SIDE 4096
+// Capacity of the hash tables of the module. Each one holds at most one entry per taxi, so there's
+// always a free slot and probes stay short
+#define OCCUPANCY_SLOTS (2 * MAX_TAXIS)
+// Number of ticks the reservation table keeps at once
+#define RESERVATION_HORIZON 4
+
+// Cells taken by the taxis. A bit per cell tells whether there's any taxi in it, which is all a
+// move needs to be checked. Cells shared by several taxis (e.g. the new ones, which all start at
+// [1, 1]) keep how many there are in a small hash table, so the bit is only cleared when the last
+// one leaves
+typedef struct {
+  uint64_t *bits;                       // side * side bits, one per cell
+  int side;                             // Side of the bitmap (see OCCUPANCY_MAX_SIDE)
+  int64_t sharedCells[OCCUPANCY_SLOTS]; // Index of each shared cell + 1, 0 if the slot is free
+  int sharedCounts[OCCUPANCY_SLOTS];    // Taxis in each shared cell besides the first one
+  int64_t cells[MAX_TAXIS];             // Index of the cell taken by each taxi
+  bool present[MAX_TAXIS];              // Whether each taxi takes a cell
+} OccupancyGrid;
+
+// Cells reserved by the taxis for the coming ticks, so no other taxi takes them meanwhile. Each
+// tick has its own hash table of reserved cells. The tables are reused in a ring, so only the
+// latest RESERVATION_HORIZON ticks are kept. A taxi holds one reservation at most
+typedef struct {
+  int64_t cells[RESERVATION_HORIZON][OCCUPANCY_SLOTS]; // Packed cell + 1, 0 if the slot is free
+  int owners[RESERVATION_HORIZON][OCCUPANCY_SLOTS];    // Taxi that has reserved each cell
+  long ticks[RESERVATION_HORIZON];                     // Tick of each table, -1 if unused
+  int64_t held[MAX_TAXIS];                             // Cell reserved by each taxi, 0 if none
+  long heldFrom[MAX_TAXIS], heldTo[MAX_TAXIS];         // Ticks it's reserved for
+} ReservationTable;
+
+/// @brief Initializes an empty occupancy grid for the current map size (see gridSize)
+///
+/// @param grid Grid to be initialized. It must be zeroed or freed with freeOccupancyGrid
+void initOccupancyGrid(OccupancyGrid *grid);
+
+/// @brief Frees the memory held by an occupancy grid
+///
+/// @param grid Grid to be freed
+void freeOccupancyGrid(OccupancyGrid *grid);
+
+/// @brief Puts a taxi in a cell, taking it out of the one it was in
+///
+/// @param grid Grid to be updated
+/// @param taxiId Taxi to be moved
+/// @param coord Cell the taxi is now in
+void occupancySet(OccupancyGrid *grid, int taxiId, Coordinate coord);
+
+/// @brief Takes a taxi out of the grid. Nothing happens if it wasn't in it
+///
+/// @param grid Grid to be updated
+/// @param taxiId Taxi to be removed
+void occupancyRemove(OccupancyGrid *grid, int taxiId);
+
+/// @brief Checks whether there's any taxi in a cell. It's a single bit test
+///
+/// @param grid Grid to be queried
+/// @param coord Cell to be checked
+/// @return true There's a taxi in it (or, in maps bigger than OCCUPANCY_MAX_SIDE, in a cell that
+/// shares its bit)
+/// @return false It's free
+bool occupancyTaken(const OccupancyGrid *grid, Coordinate coord);
+
+/// @brief Checks whether a taxi can enter a cell: it mustn't be taken by another taxi nor reserved
+/// by one in the tick. The taxi's objective is only checked against the reservations, since the
+/// taxis in it (e.g. an idle one, or another that has ended its trip there) may never leave
+///
+/// @param grid Cells taken by the taxis
+/// @param table Cells reserved by the taxis
+/// @param taxiId Taxi that wants to enter the cell
+/// @param cell Cell to be entered
+/// @param objective Cell the taxi is heading to, NULL if none
+/// @param tick Current tick of the reservations
+/// @return true The taxi can enter the cell
+/// @return false It must wait
+bool occupancyAdmits(const OccupancyGrid *grid, const ReservationTable *table, int taxiId,
+                     Coordinate cell, const Coordinate *objective, long tick);
+
+/// @brief Initializes a reservation table without any reservations
+///
+/// @param table Table to be initialized
+void initReservationTable(ReservationTable *table);
+
+/// @brief Reserves a cell for a taxi during some ticks, replacing the reservation it held
+///
+/// @param table Table to be updated
+/// @param taxiId Taxi that reserves the cell
+/// @param cell Cell to be reserved
+/// @param from First tick of the reservation
+/// @param to Last tick of the reservation. At most RESERVATION_HORIZON - 1 ticks after from
+/// @return true The cell has been reserved
+/// @return false Another taxi holds it in any of those ticks. The taxi is left without reservation
+bool reserveCell(ReservationTable *table, int taxiId, Coordinate cell, long from, long to);
+
+/// @brief Releases the reservation held by a taxi. Nothing happens if it hasn't got any
+///
+/// @param table Table to be updated
+/// @param taxiId Taxi whose reservation is released
+void releaseCell(ReservationTable *table, int taxiId);
+
+/// @brief Gets which taxi has reserved a cell in a tick
+///
+/// @param table Table to be queried
+/// @param cell Cell to be checked
+/// @param tick Tick to be checked
+/// @return int Taxi that has reserved it, -1 if none
+int reservationOwner(const ReservationTable *table, Coordinate cell, long tick);
+
+#endif
@@ -0,0 +1,162 @@
+#include "persistence_module.h"
+#include "common.h"
+#include "glib.h"
+#include "state_module.h"
+#include <mysql/mysql.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static MYSQL *conn;
+// Protects the connection
+static pthread_mutex_t conn_mut = PTHREAD_MUTEX_INITIALIZER;
+// Protects pending
+static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static bool pending = false;
+
+/// @brief Writes a char value of a query, or NULL if it's not set
+///
+/// @param dest Output argument. Buffer of at least 4 bytes
+/// @param value Value to be written
+/// @return char* dest
+char *sqlChar(char *dest, char value) {
+  if (value == NO_ID)
+    strcpy(dest, "NULL");
+  else
+    sprintf(dest, "'%c'", value);
+  return dest;
+}
+
+/// @brief Builds the query that stores an entity in the database
+///
+/// @param query Output argument. Buffer where the query will be written
+/// @param entity Entity to be stored
+void buildQuery(char *query, DirtyEntity *entity) {
+  char a[5], inQueue[40];
+
+  if (entity->type == ENTITY_TAXI) {
+    TaxiState *taxi = &entity->taxi;
+    sprintf(query,
+            "INSERT INTO taxis (id, connected, available, moving, can_move, carrying_customer, "
+            "customer, x, y, last_update) VALUES (%i, %i, %i, %i, %i, %i, %s, %i, %i, "
+            "FROM_UNIXTIME(%li)) ON DUPLICATE KEY UPDATE connected = VALUES(connected), "
+            "available = VALUES(available), moving = VALUES(moving), can_move = VALUES(can_move), "
+            "carrying_customer = VALUES(carrying_customer), customer = VALUES(customer), "
+            "x = VALUES(x), y = VALUES(y), last_update = VALUES(last_update)",
+            entity->id, taxi->connected, taxi->available, taxi->moving, taxi->canMove,
+            taxi->carryingCustomer, sqlChar(a, taxi->customer), taxi->coord.x, taxi->coord.y,
+            taxi->lastUpdate);
+  } else if (entity->customer.exists) {
+    CustomerState *customer = &entity->customer;
+    if (customer->inQueue)
+      sprintf(inQueue, "FROM_UNIXTIME(%li)", customer->inQueue);
+    else
+      strcpy(inQueue, "NULL");
+
+    sprintf(query,
+            "INSERT INTO customers (id, destination, x, y, in_queue, last_update) VALUES ('%c', "
+            "%s, %i, %i, %s, FROM_UNIXTIME(%li)) ON DUPLICATE KEY UPDATE "
+            "destination = VALUES(destination), x = VALUES(x), y = VALUES(y), "
+            "in_queue = VALUES(in_queue), last_update = VALUES(last_update)",
+            entity->id, sqlChar(a, customer->destination), customer->coord.x, customer->coord.y,
+            inQueue, customer->lastUpdate);
+  } else {
+    sprintf(query, "DELETE FROM customers WHERE id = '%c'", entity->id);
+  }
+}
+
+/// @brief Stores the entities that changed since the last call in a single transaction. If it
+/// fails, they're marked as changed again so they're stored in the next call
+void persist() {
+  DirtyEntity entities[MAX_TAXIS + MAX_CUSTOMERS];
+  char query[600];
+  int count;
+  bool failed = false;
+
+  pthread_mutex_lock(&conn_mut);
+  count = stateTakeDirty(entities, MAX_TAXIS + MAX_CUSTOMERS);
+
+  if (count == 0) {
+    pthread_mutex_unlock(&conn_mut);
+    return;
+  }
+
+  if (mysql_query(conn, "START TRANSACTION")) {
+    g_warning("Error starting transaction: %s", mysql_error(conn));
+    failed = true;
+  }
+
+  // Customers are inserted before the taxis that reference them and deleted after the taxis stop
+  // referencing them
+  for (int pass = 0; pass < 3 && !failed; pass++) {
+    for (int i = 0; i < count && !failed; i++) {
+      bool deleted = entities[i].type == ENTITY_CUSTOMER && !entities[i].customer.exists;
+      if ((pass == 0 && (entities[i].type != ENTITY_CUSTOMER || deleted)) ||
+          (pass == 1 && entities[i].type != ENTITY_TAXI) || (pass == 2 && !deleted))
+        continue;
+
+      buildQuery(query, &entities[i]);
+      g_debug("Query: %s", query);
+      if (mysql_query(conn, query)) {
+        g_warning("Error executing query %s: %s", query, mysql_error(conn));
+        failed = true;
+      }
+    }
+  }
+
+  if (failed || mysql_query(conn, "COMMIT")) {
+    mysql_query(conn, "ROLLBACK");
+    for (int i = 0; i < count; i++)
+      stateMarkDirty(entities[i].type, entities[i].id);
+    g_warning("Error storing %i changes in the database. Retrying later...", count);
+  } else {
+    g_debug("Stored %i changes in the database", count);
+  }
+
+  pthread_mutex_unlock(&conn_mut);
+}
+
+/// @brief Function intended to be executed by a separate thread. Stores the pending changes
+/// every PERSIST_INTERVAL milliseconds or when requested
+///
+/// @return void* Returns NULL always. It just exists to fill the required signature for a thread
+/// intended function
+void *persistenceLoop() {
+  struct timespec deadline;
+
+  while (true) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += PERSIST_INTERVAL * 1000 * 1000;
+    deadline.tv_sec += deadline.tv_nsec / (1000 * 1000 * 1000);
+    deadline.tv_nsec %= 1000 * 1000 * 1000;
+
+    pthread_mutex_lock(&mut);
+    while (!pending && pthread_cond_timedwait(&cond, &mut, &deadline) == 0)
+      ;
+    pending = false;
+    pthread_mutex_unlock(&mut);
+
+    persist();
+  }
+
+  return NULL;
+}
+
+void startPersistence(MYSQL *_conn) {
+  pthread_t thread;
+
+  conn = _conn;
+  pthread_create(&thread, NULL, persistenceLoop, NULL);
+  pthread_detach(thread);
+}
+
+void requestPersist() {
+  pthread_mutex_lock(&mut);
+  pending = true;
+  pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&mut);
+}
+
+void flushPersistence() { persist(); }
@@ -0,0 +1,23 @@
+#ifndef PERSISTENCE_MODULE_H
+#define PERSISTENCE_MODULE_H
+
+#include <mysql/mysql.h>
+
+/// @brief Entry point of the persistence module
+///
+/// This module stores in the database the changes made to the state of the central (see
+/// state_module.h) asynchronously. A separate thread periodically takes the entities that changed
+/// and writes their latest state in a single transaction, so several changes of the same entity
+/// result in a single write and the requests never wait for the database.
+///
+/// @param conn Connection to the database. The module takes ownership of it
+void startPersistence(MYSQL *conn);
+
+/// @brief Wakes the persistence thread so the pending changes are stored right away
+void requestPersist();
+
+/// @brief Stores the pending changes synchronously. Intended to be called when the program is
+/// exiting
+void flushPersistence();
+
+#endif
@@ -0,0 +1,132 @@
+#include "resume_module.h"
+#include "common.h"
+#include "glib.h"
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <time.h>
+
+#define RESUME_SECRET_SIZE 32
+#define RESUME_MAC_SIZE 32
+
+extern uuid_t session;
+
+// Snapshot guarded by a sequence lock: seq is odd while it's being written, so the readers retry.
+// The generation of the taxi's tokens is written by the socket process instead, so it's kept apart
+typedef struct {
+  atomic_uint seq;
+  ResumeSnapshot snapshot;
+  atomic_uint generation; // Only the tokens of this generation are valid
+} SharedSnapshot;
+
+// Everything shared with the socket process
+typedef struct {
+  atomic_bool ready; // Whether the state has been loaded and every taxi has its snapshot
+  SharedSnapshot taxis[MAX_TAXIS];
+} SharedMapping;
+
+static unsigned char secret[RESUME_SECRET_SIZE];
+
+// Mapped before forking, so it's shared by all the processes of the central
+static SharedMapping *mapping = NULL;
+
+/// @brief Computes the signature of a token
+///
+/// @param token Token whose id and expiration are signed
+/// @param mac Output argument. HMAC-SHA256 of the id, the generation, the expiration and the
+/// session
+void signToken(const unsigned char *token, unsigned char mac[RESUME_MAC_SIZE]) {
+  GHmac *hmac = g_hmac_new(G_CHECKSUM_SHA256, secret, RESUME_SECRET_SIZE);
+  gsize size = RESUME_MAC_SIZE;
+
+  g_hmac_update(hmac, token, RESUME_TOKEN_SIZE - RESUME_MAC_SIZE);
+  g_hmac_update(hmac, session, SESSION_LENGTH);
+  g_hmac_get_digest(hmac, mac, &size);
+  g_hmac_unref(hmac);
+}
+
+void initResume() {
+  if (getrandom(secret, RESUME_SECRET_SIZE, 0) != RESUME_SECRET_SIZE)
+    g_error("Error generating the secret of the resumption tokens");
+
+  mapping = mmap(NULL, sizeof(SharedMapping), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                 -1, 0);
+  if (mapping == MAP_FAILED)
+    g_error("Error mapping the taxi snapshots");
+}
+
+void markResumeReady() {
+  atomic_store(&mapping->ready, true);
+}
+
+bool resumeReady() {
+  return mapping != NULL && atomic_load(&mapping->ready);
+}
+
+unsigned int issueResumeToken(int taxiId, unsigned char token[RESUME_TOKEN_SIZE]) {
+  unsigned int generation = atomic_fetch_add(&mapping->taxis[taxiId].generation, 1) + 1;
+  unsigned char *p = putInt(token, taxiId, 4);
+
+  p = putInt(p, generation, 4);
+  p = putInt(p, time(NULL) + RESUME_TOKEN_TTL, 8);
+  signToken(token, p);
+  return generation;
+}
+
+bool verifyResumeToken(const unsigned char *token, int size, int *taxiId) {
+  unsigned char mac[RESUME_MAC_SIZE];
+  unsigned char diff = 0;
+  unsigned int generation;
+
+  if (size != RESUME_TOKEN_SIZE)
+    return false;
+
+  // Constant time, so the signature can't be guessed byte by byte
+  signToken(token, mac);
+  for (int i = 0; i < RESUME_MAC_SIZE; i++)
+    diff |= mac[i] ^ token[RESUME_TOKEN_SIZE - RESUME_MAC_SIZE + i];
+
+  if (diff != 0 || getInt(token + 8, 8) < time(NULL))
+    return false;
+
+  *taxiId = getInt(token, 4);
+  if (*taxiId < 0 || *taxiId >= MAX_TAXIS)
+    return false;
+
+  // Only the last token issued is valid, and only once. If two logins present it, one wins
+  generation = getInt(token + 4, 4);
+  return atomic_compare_exchange_strong(&mapping->taxis[*taxiId].generation, &generation,
+                                        generation + 1);
+}
+
+void publishResumeSnapshot(int taxiId, const ResumeSnapshot *snapshot) {
+  SharedSnapshot *shared;
+
+  if (mapping == NULL)
+    return;
+  shared = &mapping->taxis[taxiId];
+
+  atomic_fetch_add_explicit(&shared->seq, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  shared->snapshot = *snapshot;
+  atomic_fetch_add_explicit(&shared->seq, 1, memory_order_release);
+}
+
+bool readResumeSnapshot(int taxiId, ResumeSnapshot *dest) {
+  SharedSnapshot *shared;
+  unsigned int before, after;
+
+  if (mapping == NULL || taxiId < 0 || taxiId >= MAX_TAXIS)
+    return false;
+  shared = &mapping->taxis[taxiId];
+
+  do {
+    before = atomic_load_explicit(&shared->seq, memory_order_acquire);
+    *dest = shared->snapshot;
+    atomic_thread_fence(memory_order_acquire);
+    after = atomic_load_explicit(&shared->seq, memory_order_relaxed);
+  } while (before != after || before % 2 == 1);
+
+  return dest->exists;
+}
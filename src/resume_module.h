@@ -0,0 +1,77 @@
+#ifndef RESUME_MODULE_H
+#define RESUME_MODULE_H
+
+#include "common.h"
+#include <stdbool.h>
+
+// Seconds a resumption token is valid for. Tokens are also invalidated when the central restarts
+#define RESUME_TOKEN_TTL 3600
+
+// What a taxi needs to carry on after logging in again
+typedef struct {
+  bool exists;          // Whether the central knows the taxi
+  bool connected;       // Whether the central considers it connected
+  Coordinate coord;     // Position of the taxi
+  bool hasObjective;    // Whether it's going towards a customer or a destination
+  Coordinate objective; // Where it's going, if hasObjective
+} ResumeSnapshot;
+
+/// @brief Entry point of the resume module
+///
+/// This module lets the taxis log in again without going through the database. At login, the
+/// central gives each taxi a token signed with a secret that only lives in memory, so the tokens
+/// stop being valid when the central restarts. Each token also carries a generation of the taxi,
+/// kept along with its snapshot, so only the last token given to a taxi is valid. The state module
+/// publishes a snapshot of every taxi in memory shared between the processes of the central, which
+/// the socket module reads to tell a taxi where it was and where it was going in the reply to its
+/// token, and to refuse the ids of the taxis that are still connected. No login is accepted until
+/// the state has been loaded (see markResumeReady).
+///
+/// It must be called before forking the socket process.
+void initResume();
+
+/// @brief Tells the socket process that the state has been loaded and every taxi has its snapshot,
+/// so it can start accepting logins. Only the process that owns the state may call it
+void markResumeReady();
+
+/// @brief Checks whether the state has been loaded (see markResumeReady)
+///
+/// @return true The snapshots can be trusted
+/// @return false The logins must be refused for now
+bool resumeReady();
+
+/// @brief Creates a resumption token for a taxi. It carries the next generation of the taxi's
+/// tokens, so the ones issued before stop being valid
+///
+/// @param taxiId Taxi that has logged in
+/// @param token Output argument. Token of the taxi
+/// @return unsigned int Generation of the token. It tells this login apart from the other ones of
+/// the taxi
+unsigned int issueResumeToken(int taxiId, unsigned char token[RESUME_TOKEN_SIZE]);
+
+/// @brief Checks a resumption token and, if it's valid, uses it up: a taxi gets a new token every
+/// time it logs in, so a copy of an old one can't take over its session
+///
+/// @param token Token presented by a taxi
+/// @param size Size of the token
+/// @param taxiId Output argument. Taxi the token was given to
+/// @return true The token was issued by this central, hasn't expired, is the last one issued to the
+/// taxi and hadn't been used yet
+/// @return false Otherwise
+bool verifyResumeToken(const unsigned char *token, int size, int *taxiId);
+
+/// @brief Updates the snapshot of a taxi. Only the process that owns the state may call it
+///
+/// @param taxiId Taxi that has changed
+/// @param snapshot Current state of the taxi
+void publishResumeSnapshot(int taxiId, const ResumeSnapshot *snapshot);
+
+/// @brief Reads the snapshot of a taxi. It never blocks the writer
+///
+/// @param taxiId Taxi to be read
+/// @param dest Output argument. Last snapshot published
+/// @return true The taxi exists
+/// @return false Otherwise
+bool readResumeSnapshot(int taxiId, ResumeSnapshot *dest);
+
+#endif
@@ -0,0 +1,1041 @@
+#include "routing_module.h"
+#include "common.h"
+#include "glib.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Slots of the blocked cells hash set. Power of two, twice ROUTING_MAX_BLOCKED to keep it sparse
+#define BLOCKED_SLOTS (2 * ROUTING_MAX_BLOCKED)
+// Values of the slots that don't hold any cell. Cells are stored as packCell + 1, so never 0
+#define FREE_SLOT 0
+#define DELETED_SLOT (-1)
+
+#define WINDOW_CELLS (ROUTING_MAX_WINDOW * ROUTING_MAX_WINDOW)
+
+// The 8 moves a taxi can make. Their index is what cameFrom stores
+static const int moves[8][2] = {
+    {1, 1}, {1, 0}, {1, -1}, {0, -1}, {-1, -1}, {-1, 0}, {-1, 1}, {0, 1},
+};
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+// Next hop and distance of every offset between two positions, indexed by dy * size + dx being
+// both in [0, size). The hop is stored as (x + 1) | (y + 1) << 2. Empty if size is 0
+static int tableSize = 0;
+static uint8_t hopTable[WINDOW_CELLS];
+static uint16_t distanceTable[WINDOW_CELLS];
+
+// Blocked cells, as an open addressing hash set
+static int64_t blocked[BLOCKED_SLOTS];
+static atomic_int blockedCount = 0;
+static int deletedCount = 0;
+// Increased every time a cell is blocked or unblocked, so routes know when to plan again
+static atomic_uint version = 0;
+// Cell changed by each of the latest versions. The one that led to version v is at
+// (v - 1) % ROUTING_CHANGE_LOG
+static Coordinate changeLog[ROUTING_CHANGE_LOG];
+
+static RoutingStats stats;
+
+// A* state, indexed by cell of the window (y * side + x). Cells whose seen doesn't match searchId
+// haven't been reached by the current search, so nothing has to be cleared between searches
+static int costs[WINDOW_CELLS];
+static unsigned int seen[WINDOW_CELLS];
+static uint8_t cameFrom[WINDOW_CELLS];
+static int heapIndex[WINDOW_CELLS]; // -1 once the cell has been expanded
+static int heap[WINDOW_CELLS];
+static int heapSize;
+static unsigned int searchId = 0;
+
+// Area A* searches in: the whole map, which wraps around, or a window of it in bigger maps
+static struct {
+  int n;             // Side of the map
+  int side;          // Side of the window
+  bool wrap;         // Whether the window is the whole map
+  Coordinate origin; // Position of the map of the top left cell of the window
+  int goalX, goalY;  // Goal, in window coordinates
+} window;
+
+static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
+
+/// @brief Converts the offset between two positions into the shortest one in the map, taking into
+/// account that it wraps around
+///
+/// @param offset Offset in the range [0, n)
+/// @param n Side of the map
+/// @return int Offset in the range (-n / 2, n / 2]
+int wrapOffset(int offset, int n) { return offset <= n / 2 ? offset : offset - n; }
+
+/// @brief Fills the next hop and distance tables, if the map is small enough
+void buildTables() {
+  int n = gridSize(), x, y;
+
+  if (n > ROUTING_MAX_WINDOW) {
+    g_debug("Map of %ix%i too big to precompute its next hops. Computing them on the fly", n, n);
+    return;
+  }
+
+  for (int dy = 0; dy < n; dy++) {
+    for (int dx = 0; dx < n; dx++) {
+      x = wrapOffset(dx, n);
+      y = wrapOffset(dy, n);
+      hopTable[dy * n + dx] = ((x > 0) - (x < 0) + 1) | ((y > 0) - (y < 0) + 1) << 2;
+      distanceTable[dy * n + dx] = abs(x) > abs(y) ? abs(x) : abs(y);
+    }
+  }
+
+  tableSize = n;
+}
+
+void initRouting() { pthread_once(&once, buildTables); }
+
+/// @brief Gets the offset from a position to another, in the range [0, n) on each axis
+///
+/// @param from Origin
+/// @param to Destination
+/// @param n Side of the map
+/// @param dx Output argument. Offset on the x axis
+/// @param dy Output argument. Offset on the y axis
+void cellOffset(Coordinate from, Coordinate to, int n, int *dx, int *dy) {
+  *dx = to.x - from.x;
+  *dy = to.y - from.y;
+  if (*dx < 0)
+    *dx += n;
+  if (*dy < 0)
+    *dy += n;
+}
+
+Coordinate routingNextHop(Coordinate from, Coordinate to) {
+  int n = gridSize(), dx, dy, x, y, hop;
+
+  initRouting();
+  cellOffset(from, to, n, &dx, &dy);
+
+  if (tableSize == n) {
+    hop = hopTable[dy * n + dx];
+    x = (hop & 0x03) - 1;
+    y = (hop >> 2) - 1;
+  } else {
+    dx = wrapOffset(dx, n);
+    dy = wrapOffset(dy, n);
+    x = (dx > 0) - (dx < 0);
+    y = (dy > 0) - (dy < 0);
+  }
+
+  return (Coordinate){.x = (from.x + x + n) % n, .y = (from.y + y + n) % n};
+}
+
+int routingDistance(Coordinate from, Coordinate to) {
+  int n = gridSize(), dx, dy;
+
+  initRouting();
+  cellOffset(from, to, n, &dx, &dy);
+
+  if (tableSize == n)
+    return distanceTable[dy * n + dx];
+
+  dx = abs(wrapOffset(dx, n));
+  dy = abs(wrapOffset(dy, n));
+  return dx > dy ? dx : dy;
+}
+
+/// @brief Packs a cell into the value stored in the blocked cells hash set
+///
+/// @param cell Cell to be packed
+/// @return int64_t Packed cell. Never FREE_SLOT nor DELETED_SLOT
+int64_t packCell(Coordinate cell) { return ((int64_t)cell.x << 32 | (uint32_t)cell.y) + 1; }
+
+/// @brief Unpacks a cell packed with packCell
+///
+/// @param packed Packed cell
+/// @return Coordinate Cell
+Coordinate unpackCell(int64_t packed) {
+  packed--;
+  return (Coordinate){.x = packed >> 32, .y = (int32_t)(packed & 0xFFFFFFFF)};
+}
+
+/// @brief Finds a cell in a hash set of cells
+///
+/// @param set Hash set of BLOCKED_SLOTS slots
+/// @param cell Cell to be found
+/// @param insert Whether to return the slot where it should be inserted if it isn't found
+/// @return int Slot of the cell, the slot where it should be inserted or -1
+int cellSlot(const int64_t *set, Coordinate cell, bool insert) {
+  int64_t key = packCell(cell);
+  int slot = ((unsigned int)cell.x * 73856093u ^ (unsigned int)cell.y * 19349663u) &
+             (BLOCKED_SLOTS - 1);
+  int firstDeleted = -1;
+
+  for (int i = 0; i < BLOCKED_SLOTS; i++, slot = (slot + 1) & (BLOCKED_SLOTS - 1)) {
+    if (set[slot] == key)
+      return slot;
+    if (set[slot] == DELETED_SLOT && firstDeleted == -1)
+      firstDeleted = slot;
+    if (set[slot] == FREE_SLOT)
+      return !insert ? -1 : firstDeleted != -1 ? firstDeleted : slot;
+  }
+
+  return insert ? firstDeleted : -1;
+}
+
+/// @brief Checks whether a cell is blocked without taking the mutex. The mutex must be held
+///
+/// @param cell Cell to be checked
+/// @return true It's blocked
+/// @return false Otherwise
+bool isBlocked(Coordinate cell) { return blockedCount > 0 && cellSlot(blocked, cell, false) != -1; }
+
+/// @brief Blocks or unblocks a cell and records the change. The mutex must be held
+///
+/// @param cell Cell to be changed. It must be inside the map
+/// @param block Whether to block it or to unblock it
+/// @return int 1 if it has changed, 0 if it already was that way and -1 if it can't be blocked
+/// because there are already ROUTING_MAX_BLOCKED blocked cells
+int changeBlocked(Coordinate cell, bool block) {
+  int slot = cellSlot(blocked, cell, block);
+
+  if (slot == -1 || (block && blocked[slot] == packCell(cell)))
+    return 0;
+
+  if (block) {
+    if (blockedCount == ROUTING_MAX_BLOCKED)
+      return -1;
+    deletedCount -= blocked[slot] == DELETED_SLOT;
+    blocked[slot] = packCell(cell);
+    blockedCount++;
+  } else {
+    blocked[slot] = DELETED_SLOT;
+    blockedCount--;
+    deletedCount++;
+  }
+
+  changeLog[version % ROUTING_CHANGE_LOG] = cell;
+  version++;
+
+  // Deleted slots make the lookups longer, so they're dropped once the set is empty
+  if (blockedCount == 0 && deletedCount > 0) {
+    memset(blocked, 0, sizeof(blocked));
+    deletedCount = 0;
+  }
+
+  return 1;
+}
+
+bool routingSetBlocked(Coordinate cell, bool block) {
+  int changed;
+
+  if (!isInsideGrid(cell))
+    return false;
+
+  pthread_mutex_lock(&mut);
+  changed = changeBlocked(cell, block);
+  pthread_mutex_unlock(&mut);
+
+  if (changed == -1) {
+    g_warning("Can't block [%i, %i]: there are already %i blocked cells", cell.x + 1, cell.y + 1,
+              ROUTING_MAX_BLOCKED);
+    return false;
+  }
+
+  return true;
+}
+
+bool routingIsBlocked(Coordinate cell) {
+  bool res;
+
+  pthread_mutex_lock(&mut);
+  res = isBlocked(cell);
+  pthread_mutex_unlock(&mut);
+  return res;
+}
+
+void routingClearBlocked() {
+  pthread_mutex_lock(&mut);
+  memset(blocked, 0, sizeof(blocked));
+  // Jumping over the whole log makes every planner start from scratch
+  if (blockedCount > 0)
+    version += ROUTING_CHANGE_LOG + 1;
+  blockedCount = 0;
+  deletedCount = 0;
+  pthread_mutex_unlock(&mut);
+}
+
+int routingReplaceBlocked(const Coordinate *cells, int count) {
+  static int64_t incoming[BLOCKED_SLOTS];
+  Coordinate cell;
+  int changes = 0, slot;
+
+  if (count > ROUTING_MAX_BLOCKED)
+    count = ROUTING_MAX_BLOCKED;
+
+  pthread_mutex_lock(&mut);
+
+  memset(incoming, 0, sizeof(incoming));
+  for (int i = 0; i < count; i++) {
+    if (isInsideGrid(cells[i]) && (slot = cellSlot(incoming, cells[i], true)) != -1)
+      incoming[slot] = packCell(cells[i]);
+  }
+
+  // Unblocking first leaves room for the new cells
+  for (int i = 0; i < BLOCKED_SLOTS; i++) {
+    if (blocked[i] == FREE_SLOT || blocked[i] == DELETED_SLOT)
+      continue;
+    cell = unpackCell(blocked[i]);
+    if (cellSlot(incoming, cell, false) == -1)
+      changes += changeBlocked(cell, false);
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (isInsideGrid(cells[i]))
+      changes += changeBlocked(cells[i], true) == 1;
+  }
+
+  pthread_mutex_unlock(&mut);
+  return changes;
+}
+
+int routingGetBlocked(Coordinate *dest, int max) {
+  int count = 0;
+
+  pthread_mutex_lock(&mut);
+  for (int i = 0; i < BLOCKED_SLOTS && count < max; i++) {
+    if (blocked[i] != FREE_SLOT && blocked[i] != DELETED_SLOT)
+      dest[count++] = unpackCell(blocked[i]);
+  }
+  pthread_mutex_unlock(&mut);
+  return count;
+}
+
+/// @brief Converts a cell of the window into a position of the map
+///
+/// @param cell Cell of the window
+/// @return Coordinate Position of the map
+Coordinate windowToMap(int cell) {
+  return (Coordinate){.x = (window.origin.x + cell % window.side) % window.n,
+                      .y = (window.origin.y + cell / window.side) % window.n};
+}
+
+/// @brief Lower bound of the steps from a cell of the window to the goal
+///
+/// @param cell Cell of the window
+/// @return int Number of steps
+int heuristic(int cell) {
+  int dx = abs(cell % window.side - window.goalX), dy = abs(cell / window.side - window.goalY);
+
+  if (window.wrap) {
+    dx = dx < window.side - dx ? dx : window.side - dx;
+    dy = dy < window.side - dy ? dy : window.side - dy;
+  }
+
+  return dx > dy ? dx : dy;
+}
+
+/// @brief Checks whether a cell should be expanded before another one: lower estimated total
+/// cost, and the one closer to the goal on ties
+///
+/// @param a First cell
+/// @param b Second cell
+/// @return true a goes first
+/// @return false Otherwise
+bool goesFirst(int a, int b) {
+  int fa = costs[a] + heuristic(a), fb = costs[b] + heuristic(b);
+  return fa < fb || (fa == fb && costs[a] > costs[b]);
+}
+
+/// @brief Moves a cell of the heap up until its parent goes before it
+///
+/// @param i Position of the cell in the heap
+void heapUp(int i) {
+  int cell = heap[i], parent;
+
+  while (i > 0 && goesFirst(cell, heap[parent = (i - 1) / 2])) {
+    heap[i] = heap[parent];
+    heapIndex[heap[i]] = i;
+    i = parent;
+  }
+
+  heap[i] = cell;
+  heapIndex[cell] = i;
+}
+
+/// @brief Takes the cell that goes first out of the heap
+///
+/// @return int Cell taken
+int heapPop() {
+  int top = heap[0], cell = heap[--heapSize], i = 0, child;
+
+  while ((child = 2 * i + 1) < heapSize) {
+    if (child + 1 < heapSize && goesFirst(heap[child + 1], heap[child]))
+      child++;
+    if (!goesFirst(heap[child], cell))
+      break;
+    heap[i] = heap[child];
+    heapIndex[heap[i]] = i;
+    i = child;
+  }
+
+  if (heapSize > 0) {
+    heap[i] = cell;
+    heapIndex[cell] = i;
+  }
+  heapIndex[top] = -1;
+  return top;
+}
+
+/// @brief Sets the area to be searched and the goal inside it. In maps bigger than the window, the
+/// window is centered on from and, if to is outside of it, the goal is moved towards from until
+/// it's inside
+///
+/// @param from Start of the search
+/// @param to Destination
+/// @return int Cell of the window where the search starts
+int setWindow(Coordinate from, Coordinate to) {
+  int n = gridSize(), dx, dy, far, half;
+
+  window.n = n;
+  window.wrap = n <= ROUTING_MAX_WINDOW;
+
+  if (window.wrap) {
+    window.side = n;
+    window.origin = (Coordinate){.x = 0, .y = 0};
+    window.goalX = to.x;
+    window.goalY = to.y;
+    return from.y * n + from.x;
+  }
+
+  window.side = ROUTING_MAX_WINDOW;
+  half = window.side / 2;
+  window.origin = (Coordinate){.x = (from.x - half + n) % n, .y = (from.y - half + n) % n};
+
+  cellOffset(from, to, n, &dx, &dy);
+  dx = wrapOffset(dx, n);
+  dy = wrapOffset(dy, n);
+  far = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+  if (far >= half) {
+    dx = (long)dx * (half - 1) / far;
+    dy = (long)dy * (half - 1) / far;
+  }
+
+  window.goalX = half + dx;
+  window.goalY = half + dy;
+  return half * window.side + half;
+}
+
+/// @brief Plans a path with A*. The mutex must be held
+///
+/// @param from Current position
+/// @param to Destination
+/// @param avoid Cell to be avoided besides the blocked ones, or NULL if none
+/// @param steps Output argument. Cells of the path, excluding from. May be NULL if max is 0
+/// @param max Capacity of steps
+/// @param end Output argument. Last cell of the path. It's not to if the destination is outside of
+/// the window
+/// @return int Length of the whole path or -1 if it's unreachable
+int findPath(Coordinate from, Coordinate to, const Coordinate *avoid, Coordinate *steps, int max,
+             Coordinate *end) {
+  int start = setWindow(from, to), goal = window.goalY * window.side + window.goalX;
+  bool partial = !window.wrap && (to.x != windowToMap(goal).x || to.y != windowToMap(goal).y);
+  int cell, next, x, y, best = start, length = 0, expanded = 0;
+  Coordinate mapped;
+  bool found = false;
+
+  *end = from;
+  if (start == goal)
+    return 0;
+
+  searchId++;
+  heapSize = 0;
+  costs[start] = 0;
+  seen[start] = searchId;
+  heap[heapSize++] = start;
+  heapIndex[start] = 0;
+
+  while (heapSize > 0) {
+    cell = heapPop();
+    expanded++;
+    if (cell == goal) {
+      found = true;
+      break;
+    }
+    if (heuristic(cell) < heuristic(best))
+      best = cell;
+
+    for (int m = 0; m < 8; m++) {
+      x = cell % window.side + moves[m][0];
+      y = cell / window.side + moves[m][1];
+      if (window.wrap) {
+        x = (x + window.side) % window.side;
+        y = (y + window.side) % window.side;
+      } else if (x < 0 || y < 0 || x >= window.side || y >= window.side) {
+        continue;
+      }
+
+      next = y * window.side + x;
+      if (seen[next] == searchId && (heapIndex[next] == -1 || costs[next] <= costs[cell] + 1))
+        continue;
+      mapped = windowToMap(next);
+      if (isBlocked(mapped) || (avoid != NULL && mapped.x == avoid->x && mapped.y == avoid->y))
+        continue;
+
+      costs[next] = costs[cell] + 1;
+      cameFrom[next] = m;
+      if (seen[next] != searchId) {
+        seen[next] = searchId;
+        heap[heapSize] = next;
+        heapIndex[next] = heapSize++;
+      }
+      heapUp(heapIndex[next]);
+    }
+  }
+
+  stats.plans++;
+  stats.planExpanded += expanded;
+
+  // The goal of a partial search is only a waypoint, so the closest cell to it is good enough
+  if (!found && (!partial || best == start))
+    return -1;
+  if (!found)
+    goal = best;
+
+  length = costs[goal];
+  *end = windowToMap(goal);
+
+  cell = goal;
+  for (int i = length - 1; i >= 0; i--) {
+    if (i < max)
+      steps[i] = windowToMap(cell);
+    x = cell % window.side - moves[cameFrom[cell]][0];
+    y = cell / window.side - moves[cameFrom[cell]][1];
+    if (window.wrap) {
+      x = (x + window.side) % window.side;
+      y = (y + window.side) % window.side;
+    }
+    cell = y * window.side + x;
+  }
+
+  return length;
+}
+
+/// @brief Same as routingFindPath, but going around a cell besides the blocked ones
+///
+/// @param from Current position. It may be blocked
+/// @param to Destination
+/// @param avoid Cell to be avoided, or NULL if none
+/// @param steps Output argument. Cells of the path, excluding from. May be NULL if max is 0
+/// @param max Capacity of steps
+/// @return int Length of the whole path (it may be greater than max) or -1 if it's unreachable
+int findPathAvoiding(Coordinate from, Coordinate to, const Coordinate *avoid, Coordinate *steps,
+                     int max) {
+  Coordinate end;
+  int length;
+
+  if (!isInsideGrid(from) || !isInsideGrid(to))
+    return -1;
+
+  pthread_mutex_lock(&mut);
+  length = isBlocked(to) ? -1 : findPath(from, to, avoid, steps, max, &end);
+  pthread_mutex_unlock(&mut);
+  return length;
+}
+
+int routingFindPath(Coordinate from, Coordinate to, Coordinate *steps, int max) {
+  return findPathAvoiding(from, to, NULL, steps, max);
+}
+
+// Cost of the moves that can't be made
+#define INFINITE_COST (INT_MAX / 4)
+
+struct RoutePlanner {
+  int n;                // Side of the map the planner was created for
+  Coordinate goal;      // The search goes backwards, from the goal towards the taxi
+  Coordinate start;     // Position of the taxi
+  Coordinate last;      // Position of the taxi the last time km was updated
+  int km;               // Sum of the heuristics between the positions of the taxi at each repair
+  unsigned int version; // Version of the blocked cells the search has been repaired up to
+  int *g, *rhs;         // Steps to the goal and their one step lookahead, indexed by cell
+  int *key1, *key2;     // Keys of the cells in the queue
+  int *heapIndex;       // Position of each cell in the queue, -1 if it isn't in it
+  int *heap;
+  int heapSize;
+};
+
+/// @brief Adds two costs, keeping INFINITE_COST if any of them is infinite
+///
+/// @param a First cost
+/// @param b Second cost
+/// @return int Sum
+int addCost(int a, int b) {
+  return a >= INFINITE_COST || b >= INFINITE_COST ? INFINITE_COST : a + b;
+}
+
+/// @brief Gets the neighbour of a cell of the map in the direction of a move
+///
+/// @param n Side of the map
+/// @param cell Cell of the map (y * n + x)
+/// @param m Index of the move
+/// @return int Neighbour
+int neighbourCell(int n, int cell, int m) {
+  return (cell / n + moves[m][1] + n) % n * n + (cell % n + moves[m][0] + n) % n;
+}
+
+/// @brief Steps between two cells of the map, ignoring the blocked cells
+///
+/// @param n Side of the map
+/// @param a First cell (y * n + x)
+/// @param b Second cell
+/// @return int Number of steps
+int cellDistance(int n, int a, int b) {
+  int dx = abs(a % n - b % n), dy = abs(a / n - b / n);
+
+  dx = dx < n - dx ? dx : n - dx;
+  dy = dy < n - dy ? dy : n - dy;
+  return dx > dy ? dx : dy;
+}
+
+/// @brief Cost of moving into a cell. The mutex must be held
+///
+/// @param n Side of the map
+/// @param cell Cell the move ends at
+/// @return int 1 or INFINITE_COST if it's blocked
+int moveCost(int n, int cell) {
+  return isBlocked((Coordinate){.x = cell % n, .y = cell / n}) ? INFINITE_COST : 1;
+}
+
+/// @brief Calculates the key a cell should have in the queue of a planner
+///
+/// @param p Planner
+/// @param cell Cell
+/// @param k1 Output argument. Primary key
+/// @param k2 Output argument. Secondary key, used on ties
+void plannerKey(RoutePlanner *p, int cell, int *k1, int *k2) {
+  int m = p->g[cell] < p->rhs[cell] ? p->g[cell] : p->rhs[cell];
+  int start = p->start.y * p->n + p->start.x;
+
+  *k1 = addCost(addCost(m, cellDistance(p->n, start, cell)), p->km);
+  *k2 = m;
+}
+
+/// @brief Checks whether a cell of the queue of a planner goes before another one
+///
+/// @param p Planner
+/// @param a First cell
+/// @param b Second cell
+/// @return true a goes first
+/// @return false Otherwise
+bool plannerGoesFirst(RoutePlanner *p, int a, int b) {
+  return p->key1[a] < p->key1[b] || (p->key1[a] == p->key1[b] && p->key2[a] < p->key2[b]);
+}
+
+/// @brief Moves a cell of the queue of a planner to where its key belongs
+///
+/// @param p Planner
+/// @param i Position of the cell in the queue
+void plannerSift(RoutePlanner *p, int i) {
+  int cell = p->heap[i], parent, child;
+
+  while (i > 0 && plannerGoesFirst(p, cell, p->heap[parent = (i - 1) / 2])) {
+    p->heap[i] = p->heap[parent];
+    p->heapIndex[p->heap[i]] = i;
+    i = parent;
+  }
+
+  while ((child = 2 * i + 1) < p->heapSize) {
+    if (child + 1 < p->heapSize && plannerGoesFirst(p, p->heap[child + 1], p->heap[child]))
+      child++;
+    if (!plannerGoesFirst(p, p->heap[child], cell))
+      break;
+    p->heap[i] = p->heap[child];
+    p->heapIndex[p->heap[i]] = i;
+    i = child;
+  }
+
+  p->heap[i] = cell;
+  p->heapIndex[cell] = i;
+}
+
+/// @brief Takes a cell out of the queue of a planner
+///
+/// @param p Planner
+/// @param cell Cell to be removed. It must be in the queue
+void plannerRemove(RoutePlanner *p, int cell) {
+  int i = p->heapIndex[cell];
+
+  p->heapIndex[cell] = -1;
+  if (i == --p->heapSize)
+    return;
+
+  p->heap[i] = p->heap[p->heapSize];
+  p->heapIndex[p->heap[i]] = i;
+  plannerSift(p, i);
+}
+
+/// @brief Puts a cell in the queue of a planner if it's inconsistent (g != rhs), updating its key,
+/// or takes it out otherwise
+///
+/// @param p Planner
+/// @param cell Cell to be updated
+void plannerUpdateCell(RoutePlanner *p, int cell) {
+  if (p->g[cell] == p->rhs[cell]) {
+    if (p->heapIndex[cell] != -1)
+      plannerRemove(p, cell);
+    return;
+  }
+
+  plannerKey(p, cell, &p->key1[cell], &p->key2[cell]);
+  if (p->heapIndex[cell] == -1) {
+    p->heap[p->heapSize] = cell;
+    p->heapIndex[cell] = p->heapSize++;
+  }
+  plannerSift(p, p->heapIndex[cell]);
+}
+
+/// @brief Recalculates the one step lookahead of a cell: the cheapest of its neighbours. The mutex
+/// must be held
+///
+/// @param p Planner
+/// @param cell Cell. It mustn't be the goal
+void plannerLookahead(RoutePlanner *p, int cell) {
+  int best = INFINITE_COST, next, cost;
+
+  for (int m = 0; m < 8; m++) {
+    next = neighbourCell(p->n, cell, m);
+    cost = addCost(moveCost(p->n, next), p->g[next]);
+    if (cost < best)
+      best = cost;
+  }
+
+  p->rhs[cell] = best;
+}
+
+/// @brief Expands the cells of the queue of a planner until the position of the taxi has its
+/// shortest distance to the goal. The mutex must be held
+///
+/// @param p Planner
+/// @return int Number of cells expanded
+int plannerCompute(RoutePlanner *p) {
+  int n = p->n, start = p->start.y * n + p->start.x, goal = p->goal.y * n + p->goal.x;
+  int cell, next, k1, k2, sk1, sk2, old, expanded = 0;
+
+  while (p->heapSize > 0) {
+    cell = p->heap[0];
+    plannerKey(p, start, &sk1, &sk2);
+    if ((p->key1[cell] > sk1 || (p->key1[cell] == sk1 && p->key2[cell] >= sk2)) &&
+        p->rhs[start] <= p->g[start])
+      break;
+
+    expanded++;
+    plannerKey(p, cell, &k1, &k2);
+    if (p->key1[cell] < k1 || (p->key1[cell] == k1 && p->key2[cell] < k2)) {
+      // Its key was outdated by the moves of the taxi
+      p->key1[cell] = k1;
+      p->key2[cell] = k2;
+      plannerSift(p, 0);
+    } else if (p->g[cell] > p->rhs[cell]) {
+      p->g[cell] = p->rhs[cell];
+      plannerRemove(p, cell);
+      for (int m = 0; m < 8; m++) {
+        next = neighbourCell(n, cell, m);
+        if (next != goal && addCost(moveCost(n, cell), p->g[cell]) < p->rhs[next]) {
+          p->rhs[next] = addCost(moveCost(n, cell), p->g[cell]);
+          plannerUpdateCell(p, next);
+        }
+      }
+    } else {
+      old = p->g[cell];
+      p->g[cell] = INFINITE_COST;
+      for (int m = 0; m <= 8; m++) {
+        next = m < 8 ? neighbourCell(n, cell, m) : cell;
+        if (next != goal && (m == 8 || p->rhs[next] == addCost(moveCost(n, cell), old)))
+          plannerLookahead(p, next);
+        plannerUpdateCell(p, next);
+      }
+    }
+  }
+
+  return expanded;
+}
+
+/// @brief Starts the search of a planner from scratch. The mutex must be held
+///
+/// @param p Planner
+/// @param from Position of the taxi
+/// @param to Destination
+void plannerReset(RoutePlanner *p, Coordinate from, Coordinate to) {
+  int cells = p->n * p->n, goal = to.y * p->n + to.x, expanded;
+
+  for (int i = 0; i < cells; i++) {
+    p->g[i] = p->rhs[i] = INFINITE_COST;
+    p->heapIndex[i] = -1;
+  }
+
+  p->goal = to;
+  p->start = p->last = from;
+  p->km = 0;
+  p->version = version;
+  p->heapSize = 0;
+  p->rhs[goal] = 0;
+  plannerUpdateCell(p, goal);
+
+  expanded = plannerCompute(p);
+  stats.plans++;
+  stats.planExpanded += expanded;
+}
+
+/// @brief Brings the search of a planner up to date with the blocked cells and the position of the
+/// taxi, repairing only the cells affected by the changes. The mutex must be held
+///
+/// @param p Planner
+/// @param from Position of the taxi
+void plannerRepair(RoutePlanner *p, Coordinate from) {
+  int n = p->n, goal = p->goal.y * n + p->goal.x, changed, next, expanded;
+  unsigned int current = version;
+
+  p->km += cellDistance(n, p->last.y * n + p->last.x, from.y * n + from.x);
+  p->start = p->last = from;
+
+  // Blocking or unblocking a cell only changes the cost of the moves into it
+  for (unsigned int v = p->version; v != current; v++) {
+    changed = changeLog[v % ROUTING_CHANGE_LOG].y * n + changeLog[v % ROUTING_CHANGE_LOG].x;
+    for (int m = 0; m < 8; m++) {
+      next = neighbourCell(n, changed, m);
+      if (next != goal) {
+        plannerLookahead(p, next);
+        plannerUpdateCell(p, next);
+      }
+    }
+  }
+
+  expanded = plannerCompute(p);
+  if (p->version != current) {
+    stats.repairs++;
+    stats.repairExpanded += expanded;
+    stats.lastRepairExpanded = expanded;
+  }
+  p->version = current;
+}
+
+/// @brief Allocates a planner for the current map
+///
+/// @return RoutePlanner* Planner
+RoutePlanner *newPlanner() {
+  RoutePlanner *p = calloc(1, sizeof(RoutePlanner));
+  size_t cells = (size_t)gridSize() * gridSize();
+
+  if (p == NULL)
+    g_error("Error allocating memory for a route planner");
+
+  p->n = gridSize();
+  p->g = malloc(cells * sizeof(int));
+  p->rhs = malloc(cells * sizeof(int));
+  p->key1 = malloc(cells * sizeof(int));
+  p->key2 = malloc(cells * sizeof(int));
+  p->heapIndex = malloc(cells * sizeof(int));
+  p->heap = malloc(cells * sizeof(int));
+
+  if (!p->g || !p->rhs || !p->key1 || !p->key2 || !p->heapIndex || !p->heap)
+    g_error("Error allocating memory for a route planner of %zu cells", cells);
+
+  return p;
+}
+
+/// @brief Gets the neighbour of a cell that leads to the goal of a planner through the cheapest
+/// path. The mutex must be held
+///
+/// @param p Planner, already repaired
+/// @param n Side of the map
+/// @param cell Cell of the map
+/// @return int Best neighbour or -1 if the goal is unreachable
+int plannerBestNeighbour(RoutePlanner *p, int n, int cell) {
+  int next, best = -1, bestCost = INFINITE_COST, cost;
+
+  for (int m = 0; m < 8; m++) {
+    next = neighbourCell(n, cell, m);
+    cost = addCost(moveCost(n, next), p->g[next]);
+    if (cost < bestCost) {
+      bestCost = cost;
+      best = next;
+    }
+  }
+
+  return best;
+}
+
+/// @brief Gets the next step of a route kept by its planner, planning or repairing it as needed
+///
+/// @param route Route being followed
+/// @param from Current position
+/// @param to Destination
+/// @return Coordinate Next position, or from if it's unreachable
+Coordinate plannerNextStep(Route *route, Coordinate from, Coordinate to) {
+  RoutePlanner *p;
+  int n = gridSize(), best;
+
+  if (route->planner == NULL)
+    route->planner = newPlanner();
+  p = route->planner;
+
+  pthread_mutex_lock(&mut);
+
+  if (!route->valid || p->goal.x != to.x || p->goal.y != to.y ||
+      version - p->version > ROUTING_CHANGE_LOG) {
+    plannerReset(p, from, to);
+    route->valid = true;
+  } else if (p->version != version || p->start.x != from.x || p->start.y != from.y) {
+    plannerRepair(p, from);
+  }
+
+  best = plannerBestNeighbour(p, n, from.y * n + from.x);
+  pthread_mutex_unlock(&mut);
+
+  if (best == -1) {
+    g_debug("[%i, %i] is unreachable from [%i, %i]", to.x + 1, to.y + 1, from.x + 1, from.y + 1);
+    return from;
+  }
+
+  // The search stays valid as long as the taxi follows it, only the heuristic origin moves
+  p->start = (Coordinate){.x = best % n, .y = best / n};
+  return p->start;
+}
+
+bool routingAvoid(Route *route, Coordinate cell) {
+  if (!isInsideGrid(cell))
+    return false;
+
+  route->avoiding = true;
+  route->avoid = cell;
+  route->valid = false;
+  return true;
+}
+
+/// @brief Stops avoiding the cell of a route, so it's planned again around the blocked cells only
+///
+/// @param route Route avoiding a cell
+void stopAvoiding(Route *route) {
+  route->avoiding = false;
+  route->valid = false;
+}
+
+Coordinate routingNextStep(Route *route, Coordinate from, Coordinate to) {
+  unsigned int current = version;
+
+  // The cell is only avoided on the way to the goal it was avoided for
+  if (route->avoiding && route->valid && (route->goal.x != to.x || route->goal.y != to.y))
+    stopAvoiding(route);
+
+  if (from.x == to.x && from.y == to.y)
+    return from;
+
+  // Without blocked cells the table is enough, unless there's a search that may be repaired when
+  // cells are blocked again
+  if (blockedCount == 0 && !route->avoiding &&
+      (route->planner == NULL || !route->valid || route->planner->goal.x != to.x ||
+       route->planner->goal.y != to.y)) {
+    route->valid = false;
+    return routingNextHop(from, to);
+  }
+
+  if (gridSize() <= ROUTING_MAX_WINDOW && !route->lightweight && !route->avoiding)
+    return plannerNextStep(route, from, to);
+
+  if (!route->valid || route->version != current || route->goal.x != to.x ||
+      route->goal.y != to.y || route->at.x != from.x || route->at.y != from.y ||
+      (route->length >= 0 && route->next >= route->length)) {
+    route->valid = true;
+    route->version = current;
+    route->goal = to;
+    route->at = from;
+    route->next = 0;
+    route->length = findPathAvoiding(from, to, route->avoiding ? &route->avoid : NULL,
+                                     route->steps, MAX_ROUTE_LENGTH);
+    // Waiting for the avoided cell beats not reaching the goal at all
+    if (route->length == -1 && route->avoiding) {
+      route->avoiding = false;
+      route->length = routingFindPath(from, to, route->steps, MAX_ROUTE_LENGTH);
+    }
+    if (route->length > MAX_ROUTE_LENGTH)
+      route->length = MAX_ROUTE_LENGTH;
+    if (route->length == -1)
+      g_debug("[%i, %i] is unreachable from [%i, %i]", to.x + 1, to.y + 1, from.x + 1, from.y + 1);
+  }
+
+  if (route->next >= route->length)
+    return from;
+
+  route->at = route->steps[route->next++];
+  return route->at;
+}
+
+Coordinate routingPeekStep(Route *route, Coordinate from, Coordinate to) {
+  RoutePlanner *p = route->planner;
+  int n = gridSize(), best = -1;
+
+  if (from.x == to.x && from.y == to.y)
+    return from;
+
+  // Same cases as routingNextStep
+  if (blockedCount == 0 && !route->avoiding &&
+      (p == NULL || !route->valid || p->goal.x != to.x || p->goal.y != to.y))
+    return routingNextHop(from, to);
+
+  if (n <= ROUTING_MAX_WINDOW && !route->lightweight && !route->avoiding) {
+    pthread_mutex_lock(&mut);
+    if (p != NULL && route->valid && p->goal.x == to.x && p->goal.y == to.y &&
+        p->version == version && p->start.x == from.x && p->start.y == from.y)
+      best = plannerBestNeighbour(p, n, from.y * n + from.x);
+    pthread_mutex_unlock(&mut);
+
+    return best == -1 ? from : (Coordinate){.x = best % n, .y = best / n};
+  }
+
+  if (!route->valid || route->version != version || route->goal.x != to.x ||
+      route->goal.y != to.y || route->at.x != from.x || route->at.y != from.y ||
+      route->next >= route->length)
+    return from;
+
+  return route->steps[route->next];
+}
+
+void routingFreeRoute(Route *route) {
+  RoutePlanner *p = route->planner;
+  bool lightweight = route->lightweight;
+
+  if (p != NULL) {
+    free(p->g);
+    free(p->rhs);
+    free(p->key1);
+    free(p->key2);
+    free(p->heapIndex);
+    free(p->heap);
+    free(p);
+  }
+
+  memset(route, 0, sizeof(Route));
+  route->lightweight = lightweight;
+}
+
+void getRoutingStats(RoutingStats *dest) {
+  pthread_mutex_lock(&mut);
+  *dest = stats;
+  pthread_mutex_unlock(&mut);
+}
+
+int routingEta(Coordinate from, Coordinate to) {
+  Coordinate end;
+  int length;
+
+  if (blockedCount == 0)
+    return routingDistance(from, to);
+  if (!isInsideGrid(from) || !isInsideGrid(to))
+    return -1;
+
+  pthread_mutex_lock(&mut);
+  length = isBlocked(to) ? -1 : findPath(from, to, NULL, NULL, 0, &end);
+  pthread_mutex_unlock(&mut);
+
+  // Partial paths only reach the edge of the window. The rest is estimated without obstacles
+  return length == -1 ? -1 : length + routingDistance(end, to);
+}
@@ -0,0 +1,169 @@
+#ifndef ROUTING_MODULE_H
+#define ROUTING_MODULE_H
+
+#include "common.h"
+#include <stdbool.h>
+
+// Side of the biggest map whose next hops are precomputed, and of the window A* searches in. In
+// bigger maps the next hops are computed on the fly and routes are planned tile by tile
+#define ROUTING_MAX_WINDOW 1024
+// Maximum number of blocked cells at once
+#define ROUTING_MAX_BLOCKED MAX_CLOSED_CELLS
+// Maximum number of steps stored in a route. Longer routes are planned again when they run out
+#define MAX_ROUTE_LENGTH 4096
+// Number of the latest changes of the blocked cells that are remembered. Routes that have missed
+// more changes than these are planned again from scratch instead of being repaired
+#define ROUTING_CHANGE_LOG 4096
+
+// State of the incremental search of a route (see routingNextStep)
+typedef struct RoutePlanner RoutePlanner;
+
+// Route towards a goal planned around the blocked cells. In maps up to ROUTING_MAX_WINDOW it's
+// kept by an incremental planner, which is repaired when the blocked cells change. In bigger ones
+// the steps are planned with A* and planned again whenever the route is no longer valid (the
+// goal, the position or the blocked cells have changed). Lightweight routes are always planned the
+// latter way, so they don't hold a planner of their own (e.g. when there are thousands of them)
+typedef struct {
+  bool lightweight; // Set by the caller. Kept by routingFreeRoute
+  bool avoiding;    // Whether avoid is set (see routingAvoid)
+  Coordinate avoid; // Cell only this route goes around, besides the blocked ones
+  bool valid;
+  Coordinate goal;
+  Coordinate at;        // Position the route expects the taxi to be at
+  unsigned int version; // Version of the blocked cells it was planned with
+  int length, next;
+  Coordinate steps[MAX_ROUTE_LENGTH];
+  RoutePlanner *planner; // Only in maps up to ROUTING_MAX_WINDOW. Freed by routingFreeRoute
+} Route;
+
+// Work done by the planners since the program started
+typedef struct {
+  unsigned long plans;              // Routes planned from scratch
+  unsigned long planExpanded;       // Cells expanded by them
+  unsigned long repairs;            // Routes repaired after the blocked cells changed
+  unsigned long repairExpanded;     // Cells expanded by them
+  unsigned long lastRepairExpanded; // Cells expanded by the latest repair
+} RoutingStats;
+
+/// @brief Entry point of the routing module
+///
+/// Taxis move to any of their 8 neighbours, one cell per step, and the map wraps around, so
+/// without obstacles the next hop only depends on the offset between both positions. Those next
+/// hops and distances are precomputed for every offset, which makes each step and each ETA a
+/// lookup. When there are blocked cells, routes are planned with A* and followed step by step.
+///
+/// All the functions are thread safe. Calling this one is optional: the tables are built the
+/// first time they're needed
+void initRouting();
+
+/// @brief Gets the next cell towards a destination, ignoring the blocked cells
+///
+/// @param from Current position
+/// @param to Destination
+/// @return Coordinate Neighbour of from on a shortest path, or from if both are the same
+Coordinate routingNextHop(Coordinate from, Coordinate to);
+
+/// @brief Gets the number of steps between two positions, ignoring the blocked cells
+///
+/// @param from Current position
+/// @param to Destination
+/// @return int Number of steps
+int routingDistance(Coordinate from, Coordinate to);
+
+/// @brief Blocks or unblocks a cell, so routes avoid it
+///
+/// @param cell Cell to be changed
+/// @param block Whether to block it or to unblock it
+/// @return true The cell has been changed
+/// @return false It's outside the map or there are already ROUTING_MAX_BLOCKED blocked cells
+bool routingSetBlocked(Coordinate cell, bool block);
+
+/// @brief Checks whether a cell is blocked
+///
+/// @param cell Cell to be checked
+/// @return true It's blocked
+/// @return false Otherwise
+bool routingIsBlocked(Coordinate cell);
+
+/// @brief Unblocks every cell
+void routingClearBlocked();
+
+/// @brief Replaces the blocked cells with a new set, changing only the cells that differ, so the
+/// routes can be repaired instead of planned again
+///
+/// @param cells New blocked cells. Those outside the map are ignored
+/// @param count Number of cells. Only the first ROUTING_MAX_BLOCKED are taken
+/// @return int Number of cells that have been blocked or unblocked
+int routingReplaceBlocked(const Coordinate *cells, int count);
+
+/// @brief Gets the blocked cells
+///
+/// @param dest Output argument. Blocked cells, in no particular order
+/// @param max Capacity of dest
+/// @return int Number of cells copied
+int routingGetBlocked(Coordinate *dest, int max);
+
+/// @brief Plans a shortest path around the blocked cells with A*. In maps bigger than
+/// ROUTING_MAX_WINDOW the search is limited to a window centered on from, so if the destination
+/// is outside of it the path leads towards the edge of the window in its direction
+///
+/// @param from Current position. It may be blocked
+/// @param to Destination
+/// @param steps Output argument. Cells of the path, excluding from. May be NULL if max is 0
+/// @param max Capacity of steps. If the path is longer, only its first max steps are stored
+/// @return int Length of the whole path (it may be greater than max) or -1 if it's unreachable
+int routingFindPath(Coordinate from, Coordinate to, Coordinate *steps, int max);
+
+/// @brief Makes a route go around a cell besides the blocked ones, without blocking it for the
+/// rest of the routes (e.g. a cell taken by another taxi). It's avoided until the route is followed
+/// towards another goal, or until the goal can't be reached without going through it
+///
+/// @param route Route that must avoid the cell
+/// @param cell Cell to be avoided. It replaces the one avoided before, if any
+/// @return true The route is going around the cell
+/// @return false It's outside the map
+bool routingAvoid(Route *route, Coordinate cell);
+
+/// @brief Gets the next cell towards a destination avoiding the blocked cells. It's a table lookup
+/// if there aren't any blocked cells. Otherwise, it follows the route.
+///
+/// In maps up to ROUTING_MAX_WINDOW the route is kept with D* Lite: it's planned once per goal and,
+/// when cells are blocked or unblocked, only the part of the search affected by them is repaired.
+/// In bigger maps, for lightweight routes and while the route avoids a cell of its own (see
+/// routingAvoid), the route is planned again with A*
+///
+/// @param route Route being followed. It must be zeroed before the first call
+/// @param from Current position
+/// @param to Destination
+/// @return Coordinate Next position, or from if it's the destination or it's unreachable
+Coordinate routingNextStep(Route *route, Coordinate from, Coordinate to);
+
+/// @brief Gets the cell routingNextStep would move to from a position, without following the route.
+/// It doesn't plan nor repair anything, so if the route needs it the next step is unknown
+///
+/// @param route Route being followed
+/// @param from Position
+/// @param to Destination
+/// @return Coordinate Next position, or from if it's the destination, it's unreachable or unknown
+Coordinate routingPeekStep(Route *route, Coordinate from, Coordinate to);
+
+/// @brief Frees the memory held by a route. It can be used again afterwards, as if it was zeroed
+/// (except for lightweight, which is kept)
+///
+/// @param route Route to be freed
+void routingFreeRoute(Route *route);
+
+/// @brief Gets how many cells the planners have expanded
+///
+/// @param dest Output argument. Statistics
+void getRoutingStats(RoutingStats *dest);
+
+/// @brief Estimates the number of steps a taxi needs to reach a destination, the same way
+/// routingNextStep moves it
+///
+/// @param from Current position
+/// @param to Destination
+/// @return int Number of steps or -1 if it's unreachable
+int routingEta(Coordinate from, Coordinate to);
+
+#endif
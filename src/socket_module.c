@@ -1,188 +1,535 @@
 #include "socket_module.h"
 #include "common.h"
 #include "glib.h"
+#include "resume_module.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <librdkafka/rdkafka.h>
-#include <mysql/mysql.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <time.h>
 
-extern Address kafka, db;
+// Tags of the descriptors that aren't connections in the event loop. Connections are tagged with
+// their index in the connections array
+#define LISTEN_TAG MAX_AUTH_CONNECTIONS
+#define WAKE_TAG (MAX_AUTH_CONNECTIONS + 1)
+
+// Maximum number of events handled per iteration of the event loop
+#define AUTH_EVENTS_BATCH 64
+
+extern Address kafka;
 extern int gui_pipe[2];
+extern uuid_t session;
+
+// Shared by all the workers. librdkafka producers are thread safe
 static rd_kafka_t *producer;
-static Request request;
-extern char session[UUID_LENGTH];
 
-void listenSocket(int listenPort) {
-  int serverSocket = openSocket(listenPort);
-  int counter = 0;
+// Handshake in progress with a digital engine
+typedef struct {
+  bool inUse;
+  bool busy;    // A worker is handling its frames
+  bool closing; // It must be closed once the worker is done with it
+  int fd;
+  int counter;                         // Number of the request, used in the logs
+  AuthBuffer in;                       // Frames received and not handled yet
+  unsigned char out[AUTH_BUFFER_SIZE]; // Replies waiting to be sent together
+  int outSize;
+  time_t lastActivity;   // Last time something was received, to disconnect the idle ones
+  DeliveryNotice notice; // Replies to the digital engine once the central has been told
+  // Reply (STX or RESUME) that depends on the central being told about the taxi, and where it
+  // starts in out
+  char announcedType;
+  int announcedAt;
+  int announcedId;
+} AuthConnection;
+
+static AuthConnection connections[MAX_AUTH_CONNECTIONS];
+static int freeConnections[MAX_AUTH_CONNECTIONS];
+static int freeCount = 0;
+
+// Connections with a message waiting for a worker, and connections handled by a worker waiting for
+// the event loop. A connection is in at most one of them, so they can't overflow
+static int pending[MAX_AUTH_CONNECTIONS];
+static int pendingHead = 0, pendingCount = 0;
+static int handled[MAX_AUTH_CONNECTIONS];
+static int handledHead = 0, handledCount = 0;
+static pthread_mutex_t queueMut = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pendingCond = PTHREAD_COND_INITIALIZER;
+
+// Last time each id was given to a digital engine. The id isn't given again during AUTH_CLAIM_TIME,
+// while the central registers the taxi and publishes it as connected
+static time_t claims[MAX_TAXIS];
+static pthread_mutex_t claimsMut = PTHREAD_MUTEX_INITIALIZER;
+
+static int epollFd = -1;
+static int wakeFd = -1; // Used by the workers to wake up the event loop
+
+/// @brief Adds a descriptor to the event loop, or rearms it if it was already there. Connections
+/// are registered as one-shot, so they aren't reported again until they are rearmed
+///
+/// @param fd Descriptor to be watched
+/// @param tag Index of the connection, LISTEN_TAG or WAKE_TAG
+/// @param add Whether it's a new descriptor
+/// @return true Success
+/// @return false Otherwise
+bool watchDescriptor(int fd, uint32_t tag, bool add) {
+  struct epoll_event event = {.events = EPOLLIN, .data.u32 = tag};
+
+  if (tag < MAX_AUTH_CONNECTIONS)
+    event.events |= EPOLLONESHOT;
+
+  if (epoll_ctl(epollFd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &event) == -1) {
+    g_warning("Error watching descriptor %i: %s", fd, strerror(errno));
+    return false;
+  }
+  return true;
+}
 
-  struct sockaddr_in address;
-  socklen_t addrlen = sizeof(address);
+/// @brief Closes a connection and returns its slot to the pool
+///
+/// @param index Index of the connection
+void closeConnection(int index) {
+  AuthConnection *c = &connections[index];
+
+  g_message("[request %i] Closing connection", c->counter);
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  c->inUse = false;
+  freeConnections[freeCount++] = index;
+}
 
-  g_message("Listening on port %i", listenPort);
+/// @brief Adds a reply to the ones waiting to be sent to a connection
+///
+/// @param c Connection to reply to
+/// @param type Type of the reply
+/// @param payload Payload of the reply, NULL if size is 0
+/// @param size Size of the payload
+void queueReply(AuthConnection *c, char type, const void *payload, int size) {
+  c->outSize += putAuthFrame(c->out + c->outSize, type, payload, size);
+}
 
-  while (true) {
-    g_debug("Waiting connections");
-    int customerSocket = accept(serverSocket, (struct sockaddr *)&address, &addrlen);
+/// @brief Sends the replies queued for a connection in a single write. They are small enough to
+/// fit in the socket's buffer, so a short write means the digital engine isn't reading and the
+/// connection is dropped
+///
+/// @param c Connection to reply to
+void sendReply(AuthConnection *c) {
+  if (c->outSize > 0 && write(c->fd, c->out, c->outSize) != c->outSize) {
+    g_warning("[request %i] Error writing to the socket", c->counter);
+    c->closing = true;
+  }
+  c->outSize = 0;
+}
 
-    if (customerSocket == -1) {
-      g_warning("Error accepting connection");
-      continue;
+/// @brief Gives a connection handled by a worker back to the event loop
+///
+/// @param index Index of the connection
+void handBack(int index) {
+  pthread_mutex_lock(&queueMut);
+  handled[(handledHead + handledCount) % MAX_AUTH_CONNECTIONS] = index;
+  handledCount++;
+  pthread_mutex_unlock(&queueMut);
+  eventfd_write(wakeFd, 1);
+}
+
+/// @brief Lets an id be given again right away, because the digital engine it was given to has been
+/// refused after all
+///
+/// @param id Id given by checkId
+void releaseClaim(int id) {
+  pthread_mutex_lock(&claimsMut);
+  claims[id] = 0;
+  pthread_mutex_unlock(&claimsMut);
+}
+
+/// @brief Delivery notification of the request that tells the central about an authenticated taxi.
+/// The replies were already queued, they are only sent now so the taxi doesn't send requests before
+/// the central knows it. If the central couldn't be told, the taxi is refused instead
+///
+/// @param context Connection of the taxi
+/// @param err Result of the delivery. Failures are already logged by the delivery report
+void onTaxiAnnounced(void *context, rd_kafka_resp_err_t err) {
+  AuthConnection *c = context;
+  unsigned char reply[AUTH_STX_REPLY_SIZE] = {NACK};
+
+  if (err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+    g_warning("[request %i] The central couldn't be told about taxi %i, refusing it", c->counter,
+              c->announcedId);
+    c->outSize = c->announcedAt;
+
+    // Same as an id in use, without a resumption token
+    if (c->announcedType == STX) {
+      memcpy(reply + 1, session, SESSION_LENGTH);
+      queueReply(c, STX, reply, AUTH_STX_REPLY_SIZE);
+      releaseClaim(c->announcedId);
+    } else {
+      queueReply(c, RESUME, reply, 1);
     }
+  }
 
-    struct timeval timeout = {5, 0};
+  sendReply(c);
+  handBack(c - connections);
+}
 
-    if (setsockopt(customerSocket, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout)) <
-        0) {
-      g_warning("Error setting socket timeout");
-      close(customerSocket);
-      continue;
+/// @brief Queues the reply to an STX or a RESUME and sends the request that tells the central about
+/// the taxi. The replies are sent once it's delivered (see onTaxiAnnounced)
+///
+/// @param c Connection of the taxi
+/// @param type Type of the reply
+/// @param reply Payload of the reply. It starts with ACK
+/// @param size Size of the payload
+/// @param request Request to be sent to the central
+void announceTaxi(AuthConnection *c, char type, const unsigned char *reply, int size,
+                  Request *request) {
+  c->announcedType = type;
+  c->announcedAt = c->outSize;
+  c->announcedId = request->id;
+  queueReply(c, type, reply, size);
+
+  c->notice = (DeliveryNotice){onTaxiAnnounced, c};
+  sendRequestEventNotify(producer, request, &c->notice);
+}
+
+/// @brief Function intended to be executed by a separate thread. Serves the delivery reports of the
+/// producer, which reply to the authenticated taxis
+///
+/// @return void* Returns NULL always
+void *runDeliveryPoller() {
+  while (true)
+    rd_kafka_poll(producer, 100);
+
+  return NULL;
+}
+
+/// @brief Handles the frames received from a connection and replies to all of them at once. It's
+/// called by the workers
+///
+/// ENQ is answered with ACK, or NACK while the central is still loading its state. STX carries the
+/// id proposed by the digital engine and is answered with an STX frame holding ACK or NACK (see
+/// checkId), the session of the central and a resumption token. A digital engine can send both in
+/// the same write and get both replies back in another one.
+///
+/// RESUME carries a token given at a previous login. It's answered with the same as STX plus the
+/// position and objective of the taxi.
+///
+/// The central is told about the taxi with the generation of the new token, so it can tell this
+/// login apart if it has to refuse it (see TRESPONSE_LOG_IN_AGAIN).
+///
+/// @param c Connection whose frames are handled
+/// @return true The connection can be given back to the event loop
+/// @return false The replies are sent once the central has been told about the taxi (see
+/// onTaxiAnnounced), and the connection is given back then
+bool handleFrames(AuthConnection *c) {
+  unsigned char reply[AUTH_RESUME_REPLY_SIZE], *r;
+  ResumeSnapshot snapshot;
+  AuthFrame frame;
+  Request request;
+  int id, status, generation;
+  bool reconnected, idAvailable;
+
+  while ((status = nextAuthFrame(&c->in, &frame)) == 1) {
+    switch (frame.type) {
+    case ENQ:
+      g_debug("[request %i] Received ENQ", c->counter);
+      queueReply(c, resumeReady() ? ACK : NACK, NULL, 0);
+      break;
+
+    case STX:
+      g_debug("[request %i] Received STX", c->counter);
+      if (frame.size != sizeof(int32_t)) {
+        g_warning("[request %i] Invalid STX received", c->counter);
+        queueReply(c, NACK, NULL, 0);
+        break;
+      }
+      id = getInt(frame.payload, 4);
+      idAvailable = checkId(id, &reconnected);
+
+      reply[0] = idAvailable ? ACK : NACK;
+      memcpy(reply + 1, session, SESSION_LENGTH);
+      memset(reply + 1 + SESSION_LENGTH, 0, RESUME_TOKEN_SIZE);
+      if (!idAvailable) {
+        queueReply(c, STX, reply, AUTH_STX_REPLY_SIZE);
+        break;
+      }
+      generation = issueResumeToken(id, reply + 1 + SESSION_LENGTH);
+
+      g_message("[request %i] Assigned ID %i", c->counter, id);
+      request.subject = reconnected ? REQUEST_TAXI_RECONNECT : REQUEST_NEW_TAXI;
+      request.id = id;
+      memcpy(request.data, &generation, sizeof(int));
+      uuid_copy(request.session, session);
+      // The central must know the taxi before it's told it can start sending requests. The frames
+      // that came after this one are handled once the connection is given back
+      announceTaxi(c, STX, reply, AUTH_STX_REPLY_SIZE, &request);
+      return false;
+
+    case RESUME:
+      g_debug("[request %i] Received RESUME", c->counter);
+      if (!verifyResumeToken(frame.payload, frame.size, &id) ||
+          !readResumeSnapshot(id, &snapshot)) {
+        g_warning("[request %i] Invalid resumption token", c->counter);
+        queueReply(c, RESUME, (unsigned char[]){NACK}, 1);
+        break;
+      }
+
+      reply[0] = ACK;
+      memcpy(reply + 1, session, SESSION_LENGTH);
+      generation = issueResumeToken(id, reply + 1 + SESSION_LENGTH);
+      r = putInt(reply + AUTH_STX_REPLY_SIZE, snapshot.coord.x, 4);
+      r = putInt(r, snapshot.coord.y, 4);
+      *r++ = snapshot.hasObjective;
+      r = putInt(r, snapshot.objective.x, 4);
+      putInt(r, snapshot.objective.y, 4);
+
+      g_message("[request %i] Taxi %i resumed its session", c->counter, id);
+      request.subject = REQUEST_TAXI_RESUME;
+      request.id = id;
+      memcpy(request.data, &generation, sizeof(int));
+      uuid_copy(request.session, session);
+      announceTaxi(c, RESUME, reply, AUTH_RESUME_REPLY_SIZE, &request);
+      return false;
+
+    case EOT:
+      g_debug("[request %i] Received EOT", c->counter);
+      c->closing = true;
+      sendReply(c);
+      return true;
+
+    default:
+      g_warning("[request %i] Uknown message received: %i", c->counter, frame.type);
+      queueReply(c, NACK, NULL, 0);
     }
+  }
 
-    // pid_t pid = fork();
-    // if (pid == 0) {
-    //   close(serverSocket);
-    //   attend((int[]){customerSocket, counter});
-    //   exit(0);
-    // }
-    // close(customerSocket);
-    pthread_t thread;
-    pthread_create(&thread, NULL, attend, (int[]){customerSocket, counter});
-    pthread_detach(thread);
+  if (status == -1) {
+    g_warning("[request %i] Invalid frame received", c->counter);
+    queueReply(c, NACK, NULL, 0);
+    c->closing = true;
+  }
+
+  sendReply(c);
+  return true;
+}
+
+/// @brief Function intended to be executed by a separate thread. Takes the connections with frames
+/// received from the queue and handles them
+///
+/// @return void* Returns NULL always
+void *runAuthWorker() {
+  int index;
 
-    counter++;
+  while (true) {
+    pthread_mutex_lock(&queueMut);
+    while (pendingCount == 0)
+      pthread_cond_wait(&pendingCond, &queueMut);
+    index = pending[pendingHead];
+    pendingHead = (pendingHead + 1) % MAX_AUTH_CONNECTIONS;
+    pendingCount--;
+    pthread_mutex_unlock(&queueMut);
+
+    if (handleFrames(&connections[index]))
+      handBack(index);
   }
+
+  return NULL;
 }
 
-void *attend(void *args) {
-  int customerSocket = ((int *)args)[0];
-  int counter = ((int *)args)[1];
-  char buffer[BUFFER_SIZE];
-  char prefix[20];
-  bool continueLoop = true;
+/// @brief Accepts all the pending connections. The ones that don't fit in the pool are closed
+/// right away
+///
+/// @param serverSocket Listening socket
+/// @param counter Number of connections accepted so far. It's increased
+void acceptConnections(int serverSocket, int *counter) {
+  int fd, index;
 
-  mysql_library_init(0, NULL, NULL);
-  MYSQL *conn = mysql_init(NULL);
-  mysql_options(conn, MYSQL_OPT_CONNECT_TIMEOUT, (int[]){2});
+  while ((fd = accept(serverSocket, NULL, NULL)) != -1) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
 
-  sprintf(prefix, "[request %i] ", counter);
+    if (freeCount == 0) {
+      g_warning("Too many authentications in progress, rejecting connection");
+      close(fd);
+      continue;
+    }
 
-  g_message("Processing authentication request %i", counter);
+    index = freeConnections[--freeCount];
+    connections[index] = (AuthConnection){
+        .inUse = true, .fd = fd, .counter = (*counter)++, .lastActivity = time(NULL)};
 
-  while (continueLoop) {
-    if (read(customerSocket, buffer, BUFFER_SIZE) < 1) {
-      if (errno == EAGAIN || errno == EWOULDBLOCK) {
-        g_critical("%sTimeout reached on request %i", prefix, counter);
-        break;
-      } else {
-        g_warning("%sError reading from the socket", prefix);
-        g_debug("%sSending NACK", prefix);
-        buffer[0] = NACK;
-        write(customerSocket, buffer, BUFFER_SIZE);
-        continue;
-      }
+    if (!watchDescriptor(fd, index, true)) {
+      close(fd);
+      connections[index].inUse = false;
+      freeConnections[freeCount++] = index;
+      continue;
     }
 
-    switch (buffer[0]) {
-    case EOT:
-      g_debug("%sReceived EOT", prefix);
-      continueLoop = false;
-      break;
+    g_message("Processing authentication request %i", connections[index].counter);
+  }
 
-    case ENQ:
-      g_debug("%sReceived ENQ", prefix);
-      if (conn != NULL && mysql_ping(conn) &&
-          mysql_real_connect(conn, db.ip, "root", DB_PASSWORD, DB_NAME, db.port, NULL,
-                             CLIENT_MULTI_STATEMENTS)) {
-        g_debug("%sSent ACK", prefix);
-        buffer[0] = ACK;
-      } else {
-        g_warning("%sCouldn't connect to database", prefix);
-        g_debug("%sSent NACK", prefix);
-        buffer[0] = NACK;
-      }
-      write(customerSocket, buffer, BUFFER_SIZE);
-      break;
+  if (errno != EAGAIN && errno != EWOULDBLOCK)
+    g_warning("Error accepting connection: %s", strerror(errno));
+}
 
-    case STX:
-      g_debug("%sReceived STX", prefix);
-      int id;
-      bool reconnected;
-      memcpy(&id, buffer + 1, sizeof(id));
-
-      bool idAvailable = conn != NULL ? checkId(conn, id, &reconnected) : false;
-
-      if (idAvailable) {
-        g_message("%sAssigned ID %i", prefix, id);
-
-        char kafkaId[50];
-        sprintf(kafkaId, "authenticate-central-%i-producer", counter);
-        producer = createKafkaUser(&kafka, RD_KAFKA_PRODUCER, kafkaId);
-        request.subject = reconnected ? REQUEST_TAXI_RECONNECT : REQUEST_NEW_TAXI;
-        request.id = id;
-        memcpy(request.session, session, UUID_LENGTH);
-        sendEvent(producer, "requests", &request, sizeof(request));
-        g_message("Updated map");
-      }
+/// @brief Passes a connection to the workers if it has whole frames to be handled, or waits for
+/// more data otherwise
+///
+/// @param index Index of the connection
+void dispatchConnection(int index) {
+  AuthConnection *c = &connections[index];
 
-      buffer[0] = STX;
-      buffer[1] = idAvailable ? ACK : NACK;
-      memcpy(buffer + 2, session, UUID_LENGTH);
-      buffer[2 + UUID_LENGTH] = ETX;
+  if (peekAuthFrame(&c->in) == 0) {
+    watchDescriptor(c->fd, index, false);
+    return;
+  }
 
-      buffer[2 + UUID_LENGTH + 1] = 0;
-      // LRC
-      for (int i = 0; i < 2 + UUID_LENGTH + 1; i++) {
-        buffer[2 + UUID_LENGTH + 1] ^= buffer[i];
-      }
+  // It isn't rearmed until the worker is done with it. Invalid frames are answered by the worker
+  c->busy = true;
+  pthread_mutex_lock(&queueMut);
+  pending[(pendingHead + pendingCount) % MAX_AUTH_CONNECTIONS] = index;
+  pendingCount++;
+  pthread_cond_signal(&pendingCond);
+  pthread_mutex_unlock(&queueMut);
+}
 
-      write(customerSocket, buffer, BUFFER_SIZE);
-      break;
+/// @brief Reads what's available from a connection and dispatches the frames received
+///
+/// @param index Index of the connection
+void readConnection(int index) {
+  AuthConnection *c = &connections[index];
+  ssize_t n = readAuthBuffer(c->fd, &c->in);
+
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    g_warning("[request %i] Connection lost", c->counter);
+    closeConnection(index);
+    return;
+  }
 
-    default:
-      g_debug("Received: %i", buffer[0]);
-      g_warning("%sUknown message received", prefix);
-      buffer[0] = NACK;
-      write(customerSocket, buffer, BUFFER_SIZE);
+  if (n > 0)
+    c->lastActivity = time(NULL);
+
+  dispatchConnection(index);
+}
+
+/// @brief Takes back the connections the workers are done with
+void resumeHandled() {
+  eventfd_t value;
+  int index;
+
+  eventfd_read(wakeFd, &value);
+
+  while (true) {
+    pthread_mutex_lock(&queueMut);
+    if (handledCount == 0) {
+      pthread_mutex_unlock(&queueMut);
+      return;
     }
+    index = handled[handledHead];
+    handledHead = (handledHead + 1) % MAX_AUTH_CONNECTIONS;
+    handledCount--;
+    pthread_mutex_unlock(&queueMut);
+
+    connections[index].busy = false;
+    connections[index].lastActivity = time(NULL);
+    if (connections[index].closing)
+      closeConnection(index);
+    else
+      dispatchConnection(index);
   }
+}
 
-  g_message("%sClosing connection", prefix);
-  close(customerSocket);
-  mysql_close(conn);
-  mysql_library_end();
-  pthread_exit(NULL);
+/// @brief Closes the connections that haven't sent anything in AUTH_TIMEOUT seconds
+void closeIdle() {
+  time_t now = time(NULL);
 
-  return NULL;
+  for (int i = 0; i < MAX_AUTH_CONNECTIONS; i++) {
+    if (!connections[i].inUse || connections[i].busy ||
+        now - connections[i].lastActivity < AUTH_TIMEOUT)
+      continue;
+
+    g_critical("[request %i] Timeout reached on request %i", connections[i].counter,
+               connections[i].counter);
+    closeConnection(i);
+  }
 }
 
-bool checkId(MYSQL *conn, int id, bool *reconnected) {
-  MYSQL_RES *result = NULL;
-  MYSQL_ROW row;
-  char query[200];
+void listenSocket(int listenPort) {
+  // A whole fleet may connect at once, and the event loop accepts them as fast as they arrive
+  int serverSocket = openSocket(listenPort, SOMAXCONN);
+  struct epoll_event events[AUTH_EVENTS_BATCH];
+  time_t lastSweep = time(NULL);
+  int counter = 0, ready;
+  pthread_t thread;
+
+  epollFd = epoll_create1(0);
+  wakeFd = eventfd(0, EFD_NONBLOCK);
+  if (epollFd == -1 || wakeFd == -1)
+    g_error("Error creating the event loop: %s", strerror(errno));
+
+  fcntl(serverSocket, F_SETFL, fcntl(serverSocket, F_GETFL) | O_NONBLOCK);
+  if (!watchDescriptor(serverSocket, LISTEN_TAG, true) || !watchDescriptor(wakeFd, WAKE_TAG, true))
+    g_error("Error setting up the event loop");
+
+  producer = createKafkaUser(&kafka, RD_KAFKA_PRODUCER, "authenticate-central-producer");
+  pthread_create(&thread, NULL, runDeliveryPoller, NULL);
+  pthread_detach(thread);
+
+  for (int i = MAX_AUTH_CONNECTIONS - 1; i >= 0; i--)
+    freeConnections[freeCount++] = i;
+
+  for (int i = 0; i < AUTH_WORKERS; i++) {
+    pthread_create(&thread, NULL, runAuthWorker, NULL);
+    pthread_detach(thread);
+  }
 
-  sprintf(query, "CALL ConnectTaxi(%i)", id);
+  g_message("Listening on port %i", listenPort);
 
-  g_debug("Query: %s", query);
-  if (mysql_query(conn, query)) {
-    g_warning("Error executing query %s: %s", query, mysql_error(conn));
-    return false;
+  while (true) {
+    ready = epoll_wait(epollFd, events, AUTH_EVENTS_BATCH, 1000);
+    if (ready == -1 && errno != EINTR)
+      g_warning("Error waiting for events: %s", strerror(errno));
+
+    for (int i = 0; i < ready; i++) {
+      if (events[i].data.u32 == LISTEN_TAG)
+        acceptConnections(serverSocket, &counter);
+      else if (events[i].data.u32 == WAKE_TAG)
+        resumeHandled();
+      else
+        readConnection(events[i].data.u32);
+    }
+
+    if (time(NULL) != lastSweep) {
+      closeIdle();
+      lastSweep = time(NULL);
+    }
   }
+}
 
-  store_result_wrapper(result);
-  row = mysql_fetch_row(result);
-  if (row[0] == NULL) {
-    g_warning("Unexpected error connecting taxi %i", id);
+bool checkId(int id, bool *reconnected) {
+  ResumeSnapshot snapshot = {0};
+  bool available;
+
+  if (id < 0 || id >= MAX_TAXIS) {
+    g_warning("Error connecting taxi %i: Invalid taxi id", id);
     return false;
-  } else if (row[0][0] != '0' && row[0][0] != '1') {
-    g_warning("Error connecting taxi %i: %s", id, row[0]);
+  }
+
+  if (!resumeReady()) {
+    g_warning("Error connecting taxi %i: The state hasn't been loaded yet", id);
     return false;
-  } else if (row[0][0] == '1') {
-    *reconnected = false;
-  } else {
-    *reconnected = true;
   }
 
-  return true;
+  *reconnected = readResumeSnapshot(id, &snapshot);
+
+  pthread_mutex_lock(&claimsMut);
+  available = !snapshot.connected && time(NULL) - claims[id] >= AUTH_CLAIM_TIME;
+  if (available)
+    claims[id] = time(NULL);
+  pthread_mutex_unlock(&claimsMut);
+
+  if (!available)
+    g_warning("Error connecting taxi %i: Taxi already connected", id);
+  return available;
 }
@@ -1,31 +1,40 @@
 #ifndef SOCKET_MODULE_H
 #define SOCKET_MODULE_H
 
-#include <mysql/mysql.h>
 #include <stdbool.h>
 
+// Maximum number of authentications attended at the same time
+#define MAX_AUTH_CONNECTIONS 4096
+// Threads that handle the frames received
+#define AUTH_WORKERS 8
+// Seconds a digital engine can stay without sending anything before being disconnected
+#define AUTH_TIMEOUT 5
+// Seconds an id isn't given to another digital engine after being given to one, while the central
+// registers the taxi
+#define AUTH_CLAIM_TIME 5
+
 /// @brief Entry point of the socket module
 ///
 /// This module handles the authentications of the digital engines. It listens for petitions from
 /// the determined port and handles the petitions accordingly.
 ///
+/// All the connections are driven by a single epoll event loop, with up to MAX_AUTH_CONNECTIONS in
+/// progress at once. The messages received are handed to a pool of AUTH_WORKERS threads, which
+/// answer them from the snapshots published by the state (see resume_module.h), and the result (if
+/// successful) is communicated to the central. It never returns.
+///
 /// @param listenPort Port to be used to listen for petitions
 void listenSocket(int listenPort);
 
-/// @brief Function intended to be executed by a separate thread or process. Attends a petition of
-/// authentication from a digital engine and communicates the result (if successful) to the central
-///
-/// @return void* Returns NULL always. It just exists to fill the required signature for a thread
-/// intended function
-void *attend(void *args);
-
-/// @brief Checks whether an id proposed by a digital engine is valid or not
+/// @brief Checks whether an id proposed by a digital engine is valid or not. It's decided with the
+/// snapshot of the taxi published by the state of the central (see resume_module.h), not with the
+/// database, which may be behind it
 ///
-/// @param conn Database connection
 /// @param id Id proposed by the digital engine
 /// @param reconnected Whether the digital engine is reconnecting. It's an ouptut parameter
-/// @return true The id proposed is valid
-/// @return false The id proposed is not valid
-bool checkId(MYSQL *conn, int id, bool *reconnected);
+/// @return true The id proposed is valid. It isn't given again during AUTH_CLAIM_TIME
+/// @return false The id is out of range, the taxi is still connected or the state of the central
+/// hasn't been loaded yet
+bool checkId(int id, bool *reconnected);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,873 @@
+#include "state_module.h"
+#include "common.h"
+#include "data_structures.h"
+#include "matching_module.h"
+#include "occupancy_module.h"
+#include "resume_module.h"
+#include "routing_module.h"
+#include "glib.h"
+#include <mysql/mysql.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static TaxiState taxis[MAX_TAXIS];
+static CustomerState customers[MAX_CUSTOMERS];
+static LocationState locations[MAX_LOCATIONS];
+
+// Entities changed since the last time they were stored in the database
+static bool dirtyTaxis[MAX_TAXIS];
+static bool dirtyCustomers[MAX_CUSTOMERS];
+
+// Taxis that can take a service (connected and available), indexed by position
+static SpatialIndex availableTaxis;
+
+// Cells taken by the connected taxis and the ones reserved by the moving taxis for their next step
+static OccupancyGrid occupancy;
+static ReservationTable reservations;
+// Consecutive moves refused to each taxi
+static int waits[MAX_TAXIS];
+
+// Last position given in the queue. Customers enqueued at the highest priority get decreasing
+// negative positions, the rest get increasing positive ones
+static long lastQueueOrder = 0;
+static long lastPriorityQueueOrder = 0;
+
+static pthread_mutex_t mut;
+
+/// @brief Gets the state of a taxi
+///
+/// @param taxiId Id of the taxi
+/// @return TaxiState* State of the taxi or NULL if it doesn't exist
+TaxiState *getTaxi(int taxiId) {
+  if (taxiId < 0 || taxiId >= MAX_TAXIS || !taxis[taxiId].exists)
+    return NULL;
+  return &taxis[taxiId];
+}
+
+/// @brief Gets the state of a customer
+///
+/// @param customerId Id of the customer
+/// @return CustomerState* State of the customer or NULL if it doesn't exist
+CustomerState *getCustomer(char customerId) {
+  if (customerId < 'a' || customerId - 'a' >= MAX_CUSTOMERS || !customers[customerId - 'a'].exists)
+    return NULL;
+  return &customers[customerId - 'a'];
+}
+
+/// @brief Gets the state of a location
+///
+/// @param locationId Id of the location
+/// @return LocationState* State of the location or NULL if it doesn't exist
+LocationState *getLocation(char locationId) {
+  if (locationId < 'A' || locationId - 'A' >= MAX_LOCATIONS || !locations[locationId - 'A'].exists)
+    return NULL;
+  return &locations[locationId - 'A'];
+}
+
+/// @brief Checks whether a customer is being carried by any taxi
+///
+/// @param customerId Id of the customer
+/// @return true There's a taxi carrying the customer
+/// @return false Otherwise
+bool isInTaxi(char customerId) {
+  for (int i = 0; i < MAX_TAXIS; i++) {
+    if (taxis[i].exists && taxis[i].customer == customerId && taxis[i].carryingCustomer)
+      return true;
+  }
+  return false;
+}
+
+/// @brief Checks whether a customer is referenced by any taxi
+///
+/// @param customerId Id of the customer
+/// @return true There's a taxi serving the customer
+/// @return false Otherwise
+bool isServed(char customerId) {
+  for (int i = 0; i < MAX_TAXIS; i++) {
+    if (taxis[i].exists && taxis[i].customer == customerId)
+      return true;
+  }
+  return false;
+}
+
+/// @brief Resets a taxi to the default values of the taxis table
+///
+/// @param taxi Taxi to be reset
+void resetTaxi(TaxiState *taxi) {
+  taxi->connected = true;
+  taxi->available = true;
+  taxi->moving = false;
+  taxi->canMove = false;
+  taxi->carryingCustomer = false;
+  taxi->customer = NO_ID;
+  taxi->lastUpdate = time(NULL);
+}
+
+/// @brief Adds or removes a taxi from the index of available taxis depending on its state
+///
+/// @param taxiId Taxi to be indexed
+void indexTaxi(int taxiId) {
+  TaxiState *taxi = &taxis[taxiId];
+
+  if (taxi->exists && taxi->connected && taxi->available)
+    spatialSet(&availableTaxis, taxiId, taxi->coord);
+  else
+    spatialRemove(&availableTaxis, taxiId);
+}
+
+/// @brief Updates the cell taken by a taxi depending on its state. Only the connected taxis take
+/// a cell, and only the moving ones keep their reservation
+///
+/// @param taxiId Taxi to be updated
+void occupyCell(int taxiId) {
+  TaxiState *taxi = &taxis[taxiId];
+
+  if (taxi->exists && taxi->connected)
+    occupancySet(&occupancy, taxiId, taxi->coord);
+  else
+    occupancyRemove(&occupancy, taxiId);
+
+  if (!taxi->exists || !taxi->connected || !taxi->moving) {
+    releaseCell(&reservations, taxiId);
+    waits[taxiId] = 0;
+  }
+}
+
+/// @brief Gets the current tick of the reservations. Ticks last one second, the pace at which the
+/// sensors let the taxis move
+///
+/// @return long Current tick
+long reservationTick() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec;
+}
+
+/// @brief Gets where a taxi is heading to: its customer if it's picking it up or the destination
+/// of the customer if it's carrying it
+///
+/// @param taxi Taxi to be checked
+/// @param objective Output argument. Position the taxi is heading to
+/// @return true The taxi has got an objective
+/// @return false It hasn't got any customer (or its customer hasn't got a valid destination)
+bool taxiObjective(TaxiState *taxi, Coordinate *objective) {
+  CustomerState *customer = getCustomer(taxi->customer);
+  LocationState *location = customer ? getLocation(customer->destination) : NULL;
+
+  if (customer != NULL && !taxi->carryingCustomer) {
+    *objective = customer->coord;
+    return true;
+  } else if (location != NULL && taxi->carryingCustomer) {
+    *objective = location->coord;
+    return true;
+  }
+  return false;
+}
+
+/// @brief Publishes where a taxi is and where it's going, so it can be told if it logs in again
+/// with a resumption token (see resume_module.h)
+///
+/// @param taxiId Taxi to be published
+void snapshotTaxi(int taxiId) {
+  TaxiState *taxi = &taxis[taxiId];
+  ResumeSnapshot snapshot = {
+      .exists = taxi->exists, .connected = taxi->exists && taxi->connected, .coord = taxi->coord};
+
+  snapshot.hasObjective = taxiObjective(taxi, &snapshot.objective);
+  publishResumeSnapshot(taxiId, &snapshot);
+}
+
+/// @brief Marks a taxi as changed, so it's stored in the database, reindexed, its cell updated and
+/// its snapshot published
+///
+/// @param taxiId Taxi that has changed
+void taxiChanged(int taxiId) {
+  dirtyTaxis[taxiId] = true;
+  indexTaxi(taxiId);
+  occupyCell(taxiId);
+  snapshotTaxi(taxiId);
+}
+
+void lockState() { pthread_mutex_lock(&mut); }
+
+void unlockState() { pthread_mutex_unlock(&mut); }
+
+void stateMarkDirty(ENTITY_TYPE type, int id) {
+  lockState();
+  if (type == ENTITY_TAXI && id >= 0 && id < MAX_TAXIS)
+    dirtyTaxis[id] = true;
+  else if (type == ENTITY_CUSTOMER && id >= 'a' && id - 'a' < MAX_CUSTOMERS)
+    dirtyCustomers[id - 'a'] = true;
+  unlockState();
+}
+
+void loadState(MYSQL *conn) {
+  MYSQL_RES *r_locations = NULL;
+  MYSQL_RES *r_customers = NULL;
+  MYSQL_RES *r_taxis = NULL;
+  MYSQL_ROW row;
+  pthread_mutexattr_t attr;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&mut, &attr);
+  pthread_mutexattr_destroy(&attr);
+
+  g_debug("Query: CALL LoadState()");
+  if (mysql_query(conn, "CALL LoadState()")) {
+    g_error("Error loading state: %s", mysql_error(conn));
+  }
+
+  store_result_wrapper(r_locations);
+  store_result_wrapper(r_customers);
+  store_result_wrapper(r_taxis);
+
+  lockState();
+  initSpatialIndex(&availableTaxis);
+  initOccupancyGrid(&occupancy);
+  initReservationTable(&reservations);
+
+  while ((row = mysql_fetch_row(r_locations))) {
+    if (row[0][0] < 'A' || row[0][0] - 'A' >= MAX_LOCATIONS)
+      continue;
+    LocationState *location = &locations[row[0][0] - 'A'];
+    location->exists = true;
+    location->coord = (Coordinate){.x = atoi(row[1]), .y = atoi(row[2])};
+  }
+
+  // Customers come sorted by their position in the queue
+  while ((row = mysql_fetch_row(r_customers))) {
+    if (row[0][0] < 'a' || row[0][0] - 'a' >= MAX_CUSTOMERS)
+      continue;
+    CustomerState *customer = &customers[row[0][0] - 'a'];
+    customer->exists = true;
+    customer->coord = (Coordinate){.x = atoi(row[1]), .y = atoi(row[2])};
+    customer->destination = row[3] ? row[3][0] : NO_ID;
+    customer->inQueue = row[4] ? atol(row[4]) : 0;
+    customer->queueOrder = row[4] ? ++lastQueueOrder : 0;
+    customer->lastUpdate = atol(row[5]);
+  }
+
+  while ((row = mysql_fetch_row(r_taxis))) {
+    int id = atoi(row[0]);
+    if (id < 0 || id >= MAX_TAXIS)
+      continue;
+    TaxiState *taxi = &taxis[id];
+    taxi->exists = true;
+    taxi->coord = (Coordinate){.x = atoi(row[1]), .y = atoi(row[2])};
+    taxi->customer = row[3] ? row[3][0] : NO_ID;
+    taxi->moving = atoi(row[4]);
+    taxi->carryingCustomer = atoi(row[5]);
+    taxi->connected = atoi(row[6]);
+    taxi->canMove = atoi(row[7]);
+    taxi->available = atoi(row[8]);
+    taxi->lastUpdate = atol(row[9]);
+    indexTaxi(id);
+    occupyCell(id);
+    snapshotTaxi(id);
+  }
+
+  unlockState();
+  // Until now, the socket module couldn't tell which taxis are connected
+  markResumeReady();
+
+  mysql_free_result(r_locations);
+  mysql_free_result(r_customers);
+  mysql_free_result(r_taxis);
+
+  g_message("State loaded from the database");
+}
+
+void stateLoadMap(int64_t map[MAP_SIZE]) {
+  static Entity entities[MAP_SIZE];
+  bool present[MAP_SIZE] = {false};
+  int slot;
+
+  lockState();
+
+  for (int i = 0; i < MAX_LOCATIONS; i++) {
+    if (!locations[i].exists)
+      continue;
+    slot = mapSlot(ENTITY_LOCATION, 'A' + i);
+    entities[slot] = (Entity){.type = ENTITY_LOCATION, .id = 'A' + i, .coord = locations[i].coord};
+    present[slot] = true;
+  }
+
+  for (int i = 0; i < MAX_CUSTOMERS; i++) {
+    CustomerState *customer = &customers[i];
+    if (!customer->exists)
+      continue;
+    slot = mapSlot(ENTITY_CUSTOMER, 'a' + i);
+    entities[slot] = (Entity){.type = ENTITY_CUSTOMER, .id = 'a' + i, .coord = customer->coord};
+    entities[slot].obj = customer->destination;
+    entities[slot].status = (customer->destination == NO_ID ? STATUS_CUSTOMER_OTHER
+                             : customer->inQueue           ? STATUS_CUSTOMER_IN_QUEUE
+                             : isInTaxi('a' + i)           ? STATUS_CUSTOMER_IN_TAXI
+                                                           : STATUS_CUSTOMER_WAITING_TAXI);
+    present[slot] = true;
+  }
+
+  for (int i = 0; i < MAX_TAXIS; i++) {
+    TaxiState *taxi = &taxis[i];
+    if (!taxi->exists)
+      continue;
+    slot = mapSlot(ENTITY_TAXI, i);
+    entities[slot] = (Entity){.type = ENTITY_TAXI, .id = i, .coord = taxi->coord};
+    entities[slot].obj = taxi->customer;
+    entities[slot].status = (!taxi->connected ? STATUS_TAXI_DISCONNECTED
+                             : taxi->moving   ? STATUS_TAXI_MOVING
+                             : taxi->canMove  ? STATUS_TAXI_STOPPED
+                                              : STATUS_TAXI_CANT_MOVE);
+    entities[slot].carryingCustomer = taxi->carryingCustomer;
+    present[slot] = true;
+  }
+
+  serializeEntities(entities, map, MAP_SIZE);
+  unlockState();
+
+  for (int i = 0; i < MAP_SIZE; i++) {
+    if (!present[i])
+      map[i] = EMPTY_SLOT;
+  }
+}
+
+const char *stateConnectTaxi(int taxiId) {
+  if (taxiId < 0 || taxiId >= MAX_TAXIS)
+    return "Invalid taxi id";
+
+  lockState();
+  TaxiState *taxi = &taxis[taxiId];
+  if (taxi->exists && taxi->connected) {
+    unlockState();
+    return "Taxi already connected";
+  }
+
+  if (!taxi->exists) {
+    taxi->exists = true;
+    taxi->coord = (Coordinate){.x = 0, .y = 0};
+    resetTaxi(taxi);
+  }
+  taxi->connected = true;
+  taxi->lastUpdate = time(NULL);
+  taxiChanged(taxiId);
+  unlockState();
+
+  return NULL;
+}
+
+const char *stateResumeTaxi(int taxiId) {
+  lockState();
+  TaxiState *taxi = getTaxi(taxiId);
+  if (taxi == NULL) {
+    unlockState();
+    return "Taxi not found";
+  }
+
+  taxi->connected = true;
+  taxi->lastUpdate = time(NULL);
+  taxiChanged(taxiId);
+  unlockState();
+
+  return NULL;
+}
+
+const char *stateInsertCustomer(char customerId, Coordinate coord) {
+  if (customerId < 'a' || customerId - 'a' >= MAX_CUSTOMERS)
+    return "Invalid customer id";
+
+  lockState();
+  CustomerState *customer = &customers[customerId - 'a'];
+  if (customer->exists) {
+    unlockState();
+    return "customer already exists";
+  }
+
+  // No taxi could reach it
+  if (routingIsBlocked(coord)) {
+    unlockState();
+    return "the cell is closed";
+  }
+
+  *customer = (CustomerState){.exists = true, .destination = NO_ID, .coord = coord};
+  customer->lastUpdate = time(NULL);
+  dirtyCustomers[customerId - 'a'] = true;
+  unlockState();
+
+  return NULL;
+}
+
+const char *stateAssignTaxi(char customerId, char destination, int *taxiId,
+                            Coordinate *customerCoord) {
+  lockState();
+  CustomerState *customer = getCustomer(customerId);
+  if (customer == NULL) {
+    unlockState();
+    return "customer not found";
+  }
+
+  if (getLocation(destination) == NULL) {
+    unlockState();
+    return "Destination not found";
+  }
+
+  customer->destination = destination;
+  dirtyCustomers[customerId - 'a'] = true;
+  *customerCoord = customer->coord;
+  // Nearest available taxi to the customer
+  if (spatialNearest(&availableTaxis, customer->coord, 1, taxiId) == 0)
+    *taxiId = -1;
+
+  if (*taxiId != -1) {
+    TaxiState *taxi = &taxis[*taxiId];
+    taxi->available = false;
+    taxi->moving = true;
+    taxi->customer = customerId;
+    taxiChanged(*taxiId);
+  }
+
+  unlockState();
+  return NULL;
+}
+
+const char *stateAddToQueue(char customerId) {
+  lockState();
+  CustomerState *customer = getCustomer(customerId);
+  if (customer == NULL) {
+    unlockState();
+    return "customer not found";
+  }
+
+  customer->inQueue = time(NULL);
+  customer->queueOrder = ++lastQueueOrder;
+  dirtyCustomers[customerId - 'a'] = true;
+  unlockState();
+
+  return NULL;
+}
+
+int stateMatchQueue(Assignment *dest) {
+  static int cost[MAX_CUSTOMERS * MAX_TAXIS];
+  int queued[MAX_CUSTOMERS], idle[MAX_TAXIS], assignment[MAX_CUSTOMERS];
+  int queuedCount = 0, idleCount = 0, assigned = 0;
+
+  lockState();
+
+  idleCount = spatialIds(&availableTaxis, idle);
+
+  // Customers sorted by their position in the queue
+  for (int i = 0; i < MAX_CUSTOMERS; i++) {
+    CustomerState *customer = &customers[i];
+    if (!customer->exists || !customer->inQueue || getLocation(customer->destination) == NULL)
+      continue;
+
+    int j = queuedCount++;
+    while (j > 0 && customers[queued[j - 1]].queueOrder > customer->queueOrder) {
+      queued[j] = queued[j - 1];
+      j--;
+    }
+    queued[j] = i;
+  }
+
+  // If there are more customers than taxis, only the ones that have been longer in the queue are
+  // matched, so nobody is overtaken indefinitely by customers closer to the taxis
+  if (queuedCount > idleCount)
+    queuedCount = idleCount;
+
+  if (queuedCount == 0) {
+    unlockState();
+    return 0;
+  }
+
+  for (int c = 0; c < queuedCount; c++) {
+    for (int t = 0; t < idleCount; t++)
+      cost[c * idleCount + t] =
+          sphericalDistance(&customers[queued[c]].coord, &taxis[idle[t]].coord);
+  }
+
+  long total = solveAssignment(queuedCount, idleCount, cost, assignment);
+
+  for (int c = 0; c < queuedCount; c++) {
+    if (assignment[c] == -1)
+      continue;
+
+    int customerIndex = queued[c];
+    int taxiId = idle[assignment[c]];
+    CustomerState *customer = &customers[customerIndex];
+    TaxiState *taxi = &taxis[taxiId];
+
+    customer->inQueue = 0;
+    dirtyCustomers[customerIndex] = true;
+
+    taxi->available = false;
+    taxi->moving = true;
+    taxi->customer = 'a' + customerIndex;
+    taxiChanged(taxiId);
+
+    dest[assigned++] = (Assignment){
+        .taxiId = taxiId, .customerId = 'a' + customerIndex, .customerCoord = customer->coord};
+  }
+
+  unlockState();
+
+  g_debug("Matched %i customers with %i idle taxis. Total pickup distance: %li", assigned,
+          idleCount, total);
+  return assigned;
+}
+
+const char *stateGetTaxiStatus(int taxiId, TAXI_STATUS *status, Coordinate *coord) {
+  lockState();
+  TaxiState *taxi = getTaxi(taxiId);
+  if (taxi == NULL) {
+    unlockState();
+    return "Taxi not found";
+  }
+
+  if (taxi->customer == NO_ID) {
+    *status = TAXI_STATUS_FREE;
+    *coord = taxi->coord;
+    taxi->moving = false;
+    taxiChanged(taxiId);
+  } else if (!taxi->carryingCustomer) {
+    *status = TAXI_STATUS_PICKING_UP;
+  } else {
+    CustomerState *customer = getCustomer(taxi->customer);
+    LocationState *location = customer ? getLocation(customer->destination) : NULL;
+    if (location == NULL) {
+      unlockState();
+      return "Destination of the customer not found";
+    }
+
+    *coord = location->coord;
+    *status = (taxi->coord.x == coord->x && taxi->coord.y == coord->y) ? TAXI_STATUS_ARRIVED
+                                                                         : TAXI_STATUS_IN_SERVICE;
+  }
+
+  unlockState();
+  return NULL;
+}
+
+const char *statePickUpCustomer(int taxiId, char *customerId, char *destination,
+                                Coordinate *destinationCoord) {
+  lockState();
+  TaxiState *taxi = getTaxi(taxiId);
+  if (taxi == NULL) {
+    unlockState();
+    return "Taxi not found";
+  }
+
+  CustomerState *customer = getCustomer(taxi->customer);
+  LocationState *location = customer ? getLocation(customer->destination) : NULL;
+  if (location == NULL) {
+    unlockState();
+    return "Taxi hasn't got any customer with a valid destination";
+  }
+
+  *customerId = taxi->customer;
+  *destination = customer->destination;
+  *destinationCoord = location->coord;
+  taxi->carryingCustomer = true;
+  taxiChanged(taxiId);
+
+  unlockState();
+  return NULL;
+}
+
+const char *stateCompleteService(int taxiId, char *customerId, char *destination,
+                                 Coordinate *coord) {
+  lockState();
+  TaxiState *taxi = getTaxi(taxiId);
+  if (taxi == NULL) {
+    unlockState();
+    return "Taxi not found";
+  }
+
+  CustomerState *customer = getCustomer(taxi->customer);
+  if (customer == NULL) {
+    unlockState();
+    return "Taxi hasn't got any customer";
+  }
+
+  *customerId = taxi->customer;
+  *destination = customer->destination;
+  *coord = taxi->coord;
+
+  customer->destination = NO_ID;
+  customer->coord = taxi->coord;
+  dirtyCustomers[*customerId - 'a'] = true;
+
+  taxi->available = true;
+  taxi->moving = false;
+  taxi->customer = NO_ID;
+  taxi->carryingCustomer = false;
+  taxiChanged(taxiId);
+
+  unlockState();
+  return NULL;
+}
+
+const char *stateMoveTaxi(int taxiId, Coordinate coord, Coordinate next, MOVE_RESULT *result,
+                          Coordinate *current) {
+  long tick = reservationTick();
+  Coordinate objective;
+
+  lockState();
+  TaxiState *taxi = getTaxi(taxiId);
+  if (taxi == NULL) {
+    unlockState();
+    return "Taxi not found";
+  }
+
+  if (!taxi->connected || !taxi->moving) {
+    unlockState();
+    return taxi->connected ? "Taxi tried to move but it is supposed to be stopped"
+                           : "Taxi tried to move but it is considered as disconnected";
+  }
+
+  *current = taxi->coord;
+  if (coord.x != taxi->coord.x || coord.y != taxi->coord.y) {
+    // The closures may not have reached the digital engine yet. Waiting wouldn't open the cell
+    if (routingIsBlocked(coord)) {
+      *result = MOVE_CLOSED;
+      waits[taxiId] = 0;
+      unlockState();
+      return NULL;
+    }
+
+    if (!occupancyAdmits(&occupancy, &reservations, taxiId, coord,
+                         taxiObjective(taxi, &objective) ? &objective : NULL, tick)) {
+      // Waiting is enough if the other taxi is passing by. If it stays, the taxi goes around it
+      *result = ++waits[taxiId] > MAX_MOVE_WAITS ? MOVE_REROUTE : MOVE_WAIT;
+      if (*result == MOVE_REROUTE)
+        waits[taxiId] = 0;
+      unlockState();
+      return NULL;
+    }
+  }
+
+  *result = MOVE_ACCEPTED;
+  waits[taxiId] = 0;
+  taxi->coord = coord;
+  *current = coord;
+
+  if (next.x != coord.x || next.y != coord.y)
+    reserveCell(&reservations, taxiId, next, tick, tick + RESERVATION_TICKS - 1);
+  else
+    releaseCell(&reservations, taxiId);
+  taxiChanged(taxiId);
+
+  unlockState();
+  return NULL;
+}
+
+const char *stateChangeMotion(int taxiId, bool moving) {
+  lockState();
+  TaxiState *taxi = getTaxi(taxiId);
+  if (taxi == NULL) {
+    unlockState();
+    return "Taxi not found";
+  }
+
+  taxi->moving = moving;
+  taxiChanged(taxiId);
+
+  unlockState();
+  return NULL;
+}
+
+const char *stateSetTaxiAvailable(int taxiId, bool available) {
+  lockState();
+  TaxiState *taxi = getTaxi(taxiId);
+  if (taxi == NULL) {
+    unlockState();
+    return "Taxi not found";
+  }
+
+  taxi->available = available;
+  taxiChanged(taxiId);
+
+  unlockState();
+  return NULL;
+}
+
+const char *stateSetTaxiCanMove(int taxiId, bool canMove, char *customerId) {
+  lockState();
+  TaxiState *taxi = getTaxi(taxiId);
+  if (taxi == NULL) {
+    unlockState();
+    return "Taxi not found";
+  }
+
+  taxi->canMove = canMove;
+  *customerId = taxi->customer;
+  taxiChanged(taxiId);
+
+  unlockState();
+  return NULL;
+}
+
+const char *stateDisconnectTaxi(int taxiId, char *customerId, Coordinate *coord) {
+  lockState();
+  TaxiState *taxi = getTaxi(taxiId);
+  if (taxi == NULL) {
+    unlockState();
+    return "Taxi not found";
+  }
+
+  *customerId = NO_ID;
+  CustomerState *customer = getCustomer(taxi->customer);
+
+  if (customer != NULL) {
+    // Enqueue it at the highest priority
+    customer->inQueue = 1;
+    customer->queueOrder = --lastPriorityQueueOrder;
+
+    if (taxi->carryingCustomer) {
+      *customerId = taxi->customer;
+      *coord = taxi->coord;
+      customer->coord = taxi->coord;
+    }
+
+    dirtyCustomers[taxi->customer - 'a'] = true;
+  }
+
+  // Reset to default values besides disconnecting
+  resetTaxi(taxi);
+  taxi->connected = false;
+  taxiChanged(taxiId);
+
+  unlockState();
+  return NULL;
+}
+
+const char *stateCheckClosure(Coordinate cell) {
+  Coordinate objective;
+  const char *error = NULL;
+
+  lockState();
+  for (int i = 0; i < MAX_LOCATIONS && error == NULL; i++) {
+    if (locations[i].exists && locations[i].coord.x == cell.x && locations[i].coord.y == cell.y)
+      error = "There's a location in the cell";
+  }
+
+  for (int i = 0; i < MAX_CUSTOMERS && error == NULL; i++) {
+    if (customers[i].exists && customers[i].coord.x == cell.x && customers[i].coord.y == cell.y)
+      error = "There's a customer in the cell";
+  }
+
+  for (int i = 0; i < MAX_TAXIS && error == NULL; i++) {
+    if (taxis[i].exists && taxiObjective(&taxis[i], &objective) && objective.x == cell.x &&
+        objective.y == cell.y)
+      error = "A taxi is heading to the cell";
+  }
+  unlockState();
+
+  return error;
+}
+
+const char *stateDisconnectCustomer(char customerId) {
+  lockState();
+  CustomerState *customer = getCustomer(customerId);
+  if (customer == NULL) {
+    unlockState();
+    return "Customer not found";
+  }
+
+  if (isServed(customerId)) {
+    unlockState();
+    return "Customer is being served by a taxi";
+  }
+
+  customer->exists = false;
+  dirtyCustomers[customerId - 'a'] = true;
+
+  unlockState();
+  return NULL;
+}
+
+const char *stateGetTaxiPosition(int taxiId, Coordinate *coord) {
+  lockState();
+  TaxiState *taxi = getTaxi(taxiId);
+  if (taxi == NULL) {
+    unlockState();
+    return "Taxi not found";
+  }
+
+  *coord = taxi->coord;
+
+  unlockState();
+  return NULL;
+}
+
+const char *stateGetTaxiCustomer(int taxiId, char *customerId) {
+  lockState();
+  TaxiState *taxi = getTaxi(taxiId);
+  if (taxi == NULL) {
+    unlockState();
+    return "Taxi not found";
+  }
+
+  *customerId = taxi->customer;
+
+  unlockState();
+  return NULL;
+}
+
+bool stateIsCustomerServed(char customerId) {
+  lockState();
+  bool served = isServed(customerId);
+  unlockState();
+  return served;
+}
+
+void stateGetConnected(int *taxiIds, int *taxiCount, char *customerIds, int *customerCount) {
+  *taxiCount = 0;
+  *customerCount = 0;
+
+  lockState();
+  for (int i = 0; i < MAX_TAXIS; i++) {
+    if (taxis[i].exists && taxis[i].connected)
+      taxiIds[(*taxiCount)++] = i;
+  }
+
+  for (int i = 0; i < MAX_CUSTOMERS; i++) {
+    if (customers[i].exists)
+      customerIds[(*customerCount)++] = 'a' + i;
+  }
+  unlockState();
+}
+
+void stateRefreshLastUpdate(ENTITY_TYPE type, int id) {
+  lockState();
+  if (type == ENTITY_TAXI && getTaxi(id) != NULL) {
+    taxis[id].lastUpdate = time(NULL);
+    dirtyTaxis[id] = true;
+  } else if (type == ENTITY_CUSTOMER && getCustomer(id) != NULL) {
+    customers[id - 'a'].lastUpdate = time(NULL);
+    dirtyCustomers[id - 'a'] = true;
+  }
+  unlockState();
+}
+
+int stateTakeDirty(DirtyEntity *dest, int max) {
+  int count = 0;
+
+  lockState();
+  for (int i = 0; i < MAX_CUSTOMERS && count < max; i++) {
+    if (!dirtyCustomers[i])
+      continue;
+    dest[count++] = (DirtyEntity){.type = ENTITY_CUSTOMER, .id = 'a' + i, .customer = customers[i]};
+    dirtyCustomers[i] = false;
+  }
+
+  for (int i = 0; i < MAX_TAXIS && count < max; i++) {
+    if (!dirtyTaxis[i])
+      continue;
+    dest[count++] = (DirtyEntity){.type = ENTITY_TAXI, .id = i, .taxi = taxis[i]};
+    dirtyTaxis[i] = false;
+  }
+  unlockState();
+
+  return count;
+}
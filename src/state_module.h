@@ -0,0 +1,292 @@
+#ifndef STATE_MODULE_H
+#define STATE_MODULE_H
+
+#include "common.h"
+#include <mysql/mysql.h>
+#include <stdbool.h>
+#include <time.h>
+
+// Value of the char fields that don't reference any customer or location
+#define NO_ID (-1)
+
+// Consecutive moves refused to a taxi before it's told to go around the cell instead of waiting
+#define MAX_MOVE_WAITS 3
+// Ticks (seconds) a taxi keeps the next cell of its route reserved, counting the current one. The
+// sensors let the taxis move once per second, the rest is slack for the delay of the messages
+#define RESERVATION_TICKS 3
+
+// Possible results of stateGetTaxiStatus
+typedef enum {
+  TAXI_STATUS_FREE,        // It hasn't got any customer
+  TAXI_STATUS_PICKING_UP,  // It's going towards its customer
+  TAXI_STATUS_ARRIVED,     // It has arrived to its customer's destination
+  TAXI_STATUS_IN_SERVICE,  // It's carrying its customer towards its destination
+} TAXI_STATUS;
+
+// Possible results of stateMoveTaxi
+typedef enum {
+  MOVE_ACCEPTED, // The taxi is now in the cell
+  MOVE_WAIT,     // The cell is taken or reserved by another taxi. The taxi must stay where it was
+  MOVE_REROUTE,  // Same, but the taxi has already waited MAX_MOVE_WAITS times, so it must go around
+  MOVE_CLOSED,   // The cell is closed. The taxi must stay where it was and go around it
+} MOVE_RESULT;
+
+// State of a taxi. Mirrors a row of the taxis table
+typedef struct {
+  bool exists;           // Whether the taxi has ever been registered
+  bool connected;        // Whether its applications hasn't got stuck or disconnected abruptly
+  bool available;        // Whether it isn't doing a service
+  bool moving;           // Whether it's supposed to be moving
+  bool canMove;          // Whether it can move (e.g. sensor connected)
+  bool carryingCustomer; // Whether it's carrying a customer
+  char customer;         // Who's the taxi carrying or moving towards, NO_ID if none
+  Coordinate coord;      // Position in the map
+  time_t lastUpdate;     // Last time the taxi showed signs of life
+} TaxiState;
+
+// State of a customer. Mirrors a row of the customers table
+typedef struct {
+  bool exists;
+  char destination;  // NO_ID if the customer isn't asking for any service
+  Coordinate coord;  // Position in the map
+  time_t lastUpdate; // Last time the customer showed signs of life
+  time_t inQueue;    // Moment the customer was enqueued, 0 if it's not in the queue
+  long queueOrder;   // Position in the queue. The lowest goes first
+} CustomerState;
+
+// State of a location. Mirrors a row of the locations table
+typedef struct {
+  bool exists;
+  Coordinate coord;
+} LocationState;
+
+// Snapshot of an entity that has changed and still has to be stored in the database
+typedef struct {
+  ENTITY_TYPE type;
+  int id;
+  TaxiState taxi;         // Only for taxis
+  CustomerState customer; // Only for customers. If it doesn't exist, it has been deleted
+} DirtyEntity;
+
+// Taxi assigned to a customer by stateMatchQueue
+typedef struct {
+  int taxiId;
+  char customerId;
+  Coordinate customerCoord;
+} Assignment;
+
+/// @brief Entry point of the state module
+///
+/// This module keeps the authoritative state of the system (taxis, customers, locations and the
+/// queue) in memory, indexed by id, so the central can answer the requests without querying the
+/// database. Every function returns an error message, or NULL if there weren't any errors. Every
+/// change marks the affected entities as dirty so the persistence module can store them in the
+/// database asynchronously.
+///
+/// All the functions are thread safe. lockState and unlockState can be used to perform several
+/// operations atomically.
+///
+/// The socket module refuses the logins until the state has been loaded.
+///
+/// @param conn Database connection used to rebuild the state
+void loadState(MYSQL *conn);
+
+/// @brief Acquires the lock of the state. It's recursive, so the functions of this module can be
+/// called while holding it
+void lockState();
+
+/// @brief Releases the lock of the state
+void unlockState();
+
+/// @brief Builds the map from the state
+///
+/// @param map Output argument. Each entity is stored in its slot (see mapSlot), the rest of the
+/// slots are set to EMPTY_SLOT
+void stateLoadMap(int64_t map[MAP_SIZE]);
+
+/// @brief Registers a taxi that has been authenticated, or marks it as connected again if it
+/// already existed. This is what decides whether an id is in use, the database isn't checked
+///
+/// @param taxiId Taxi to be connected
+/// @return const char* Error message or NULL. The taxi mustn't be connected already
+const char *stateConnectTaxi(int taxiId);
+
+/// @brief Marks a taxi that has logged in again with a resumption token as connected. Unlike
+/// stateConnectTaxi, the taxi may still be considered connected: it may come back before being
+/// caught as a stray
+///
+/// @param taxiId Taxi to be connected
+/// @return const char* Error message or NULL
+const char *stateResumeTaxi(int taxiId);
+
+/// @brief Introduces a new customer into the system. It can't be in a closed cell
+///
+/// @param customerId Customer to be inserted
+/// @param coord Position of the customer
+/// @return const char* Error message or NULL
+const char *stateInsertCustomer(char customerId, Coordinate coord);
+
+/// @brief Stores the destination of a customer and assigns it the nearest available taxi, if any
+///
+/// @param customerId Customer asking for the service
+/// @param destination Location the customer wants to go to
+/// @param taxiId Output argument. Assigned taxi or -1 if there weren't any available
+/// @param customerCoord Output argument. Position of the customer
+/// @return const char* Error message or NULL
+const char *stateAssignTaxi(char customerId, char destination, int *taxiId,
+                            Coordinate *customerCoord);
+
+/// @brief Adds a customer to the end of the queue
+///
+/// @param customerId Customer to be enqueued
+/// @return const char* Error message or NULL
+const char *stateAddToQueue(char customerId);
+
+/// @brief Assigns the queued customers to the available taxis at once, minimizing the total
+/// distance the taxis have to travel to pick them up. If there are more customers than taxis, the
+/// ones that have been longer in the queue go first
+///
+/// @param dest Output argument. Assignments made. Capacity of MAX_CUSTOMERS
+/// @return int Number of assignments made
+int stateMatchQueue(Assignment *dest);
+
+/// @brief Gets what a taxi should do next. If it's free, it's also marked as not moving
+///
+/// @param taxiId Taxi to be checked
+/// @param status Output argument. Status of the taxi
+/// @param coord Output argument. Position of the taxi if it's free or the destination of its
+/// customer if it's in service
+/// @return const char* Error message or NULL
+const char *stateGetTaxiStatus(int taxiId, TAXI_STATUS *status, Coordinate *coord);
+
+/// @brief Marks the customer of a taxi as picked up
+///
+/// @param taxiId Taxi that picks up its customer
+/// @param customerId Output argument. Customer picked up
+/// @param destination Output argument. Destination of the customer
+/// @param destinationCoord Output argument. Position of the destination
+/// @return const char* Error message or NULL
+const char *statePickUpCustomer(int taxiId, char *customerId, char *destination,
+                                Coordinate *destinationCoord);
+
+/// @brief Leaves the customer of a taxi in its current position and makes the taxi available
+///
+/// @param taxiId Taxi that completes the service
+/// @param customerId Output argument. Customer served
+/// @param destination Output argument. Location the customer has been left at
+/// @param coord Output argument. Position the customer has been left at
+/// @return const char* Error message or NULL
+const char *stateCompleteService(int taxiId, char *customerId, char *destination,
+                                 Coordinate *coord);
+
+/// @brief Moves a taxi, if it's connected and supposed to be moving, the cell isn't closed (see
+/// closure_module.h) and it isn't taken by another taxi nor reserved by one. The check takes
+/// constant time: a bit of the occupancy grid and a lookup in the table of reservations of the
+/// current tick. The cell the taxi is heading to
+/// is let in even if other taxis stand in it (see occupancyAdmits). If the move is accepted, the
+/// next cell of the taxi's route is reserved for it during RESERVATION_TICKS
+///
+/// @param taxiId Taxi to be moved
+/// @param coord New position of the taxi
+/// @param next Next cell of the taxi's route. Nothing is reserved if it's the same as coord
+/// @param result Output argument. Whether the move has been accepted or the taxi must wait or
+/// reroute, and why
+/// @param current Output argument. Position of the taxi after the call
+/// @return const char* Error message or NULL
+const char *stateMoveTaxi(int taxiId, Coordinate coord, Coordinate next, MOVE_RESULT *result,
+                          Coordinate *current);
+
+/// @brief Changes whether a taxi is supposed to be moving or not
+///
+/// @param taxiId Taxi to be updated
+/// @param moving Whether the taxi should be moving
+/// @return const char* Error message or NULL
+const char *stateChangeMotion(int taxiId, bool moving);
+
+/// @brief Changes whether a taxi is available to take a service or not
+///
+/// @param taxiId Taxi to be updated
+/// @param available Whether the taxi is available
+/// @return const char* Error message or NULL
+const char *stateSetTaxiAvailable(int taxiId, bool available);
+
+/// @brief Changes whether a taxi can move or not
+///
+/// @param taxiId Taxi to be updated
+/// @param canMove Whether the taxi can move
+/// @param customerId Output argument. Customer of the taxi, NO_ID if none
+/// @return const char* Error message or NULL
+const char *stateSetTaxiCanMove(int taxiId, bool canMove, char *customerId);
+
+/// @brief Disconnects a taxi, resetting its state. Its customer (if any) is enqueued at the highest
+/// priority
+///
+/// @param taxiId Taxi to be disconnected
+/// @param customerId Output argument. Customer that the taxi was carrying, NO_ID if none
+/// @param coord Output argument. Position the customer has been left at
+/// @return const char* Error message or NULL
+const char *stateDisconnectTaxi(int taxiId, char *customerId, Coordinate *coord);
+
+/// @brief Checks whether a cell can be closed. The taxis must be able to reach every location,
+/// every customer and their objectives, so the cells holding them can't be. The state must stay
+/// locked until the cell is closed, so nothing takes it meanwhile
+///
+/// @param cell Cell to be closed
+/// @return const char* Why it can't be closed, or NULL if it can
+const char *stateCheckClosure(Coordinate cell);
+
+/// @brief Removes a customer from the system
+///
+/// @param customerId Customer to be removed
+/// @return const char* Error message or NULL
+const char *stateDisconnectCustomer(char customerId);
+
+/// @brief Gets the position of a taxi
+///
+/// @param taxiId Taxi to be checked
+/// @param coord Output argument. Position of the taxi
+/// @return const char* Error message or NULL
+const char *stateGetTaxiPosition(int taxiId, Coordinate *coord);
+
+/// @brief Gets the customer a taxi is carrying or moving towards
+///
+/// @param taxiId Taxi to be checked
+/// @param customerId Output argument. Customer of the taxi, NO_ID if none
+/// @return const char* Error message or NULL
+const char *stateGetTaxiCustomer(int taxiId, char *customerId);
+
+/// @brief Checks whether a taxi is carrying or going towards a customer
+///
+/// @param customerId Customer to be checked
+/// @return true There's a taxi serving the customer
+/// @return false Otherwise
+bool stateIsCustomerServed(char customerId);
+
+/// @brief Gets the taxis that are connected and the customers that are in the system
+///
+/// @param taxiIds Output argument. Connected taxis. Capacity of MAX_TAXIS
+/// @param taxiCount Output argument. Number of connected taxis
+/// @param customerIds Output argument. Customers. Capacity of MAX_CUSTOMERS
+/// @param customerCount Output argument. Number of customers
+void stateGetConnected(int *taxiIds, int *taxiCount, char *customerIds, int *customerCount);
+
+/// @brief Updates the last time a taxi or a customer showed signs of life
+///
+/// @param type Type of the entity
+/// @param id Id of the entity
+void stateRefreshLastUpdate(ENTITY_TYPE type, int id);
+
+/// @brief Copies the entities that have changed since the last call and marks them as clean
+///
+/// @param dest Output argument. Array where the entities will be copied
+/// @param max Capacity of dest
+/// @return int Number of entities copied
+int stateTakeDirty(DirtyEntity *dest, int max);
+
+/// @brief Marks an entity as changed, so it's stored again in the database
+///
+/// @param type Type of the entity
+/// @param id Id of the entity
+void stateMarkDirty(ENTITY_TYPE type, int id);
+
+#endif
@@ -0,0 +1,251 @@
+#include "taxi_module.h"
+#include "glib.h"
+#include <errno.h>
+#include <string.h>
+
+void initTaxi(Taxi *taxi, int id) {
+  Route route = taxi->route;
+
+  routingFreeRoute(&route);
+  memset(taxi, 0, sizeof(Taxi));
+  taxi->route = route;
+
+  taxi->id = id;
+  taxi->orderedToStop = true;
+  taxi->service = -1;
+  taxi->lastOrder = -1;
+}
+
+/// @brief Ends an authentication, telling the central with EOT and closing the socket
+///
+/// @param socket Socket connected to the central
+void endAuthentication(int socket) {
+  unsigned char buffer[MAX_AUTH_FRAME_SIZE];
+  int size = putAuthFrame(buffer, EOT, NULL, 0);
+
+  write(socket, buffer, size);
+  close(socket);
+}
+
+/// @brief Checks whether the last read or write of an authentication socket failed because the
+/// central took longer than AUTH_IO_TIMEOUT. errno must be cleared before it
+///
+/// @return true It timed out
+/// @return false It failed for another reason, or it didn't fail
+bool timedOut() {
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+/// @brief Logs in again with the token given by the central at a previous login
+///
+/// @param taxi Taxi to be logged in
+/// @param socket Socket connected to the central
+/// @param in Buffer used for the socket
+/// @param token Token of the previous login
+/// @param newToken Output argument. Token to resume this login. May be NULL
+/// @return true The token was accepted. The session, position and objective have been restored
+/// @return false It was rejected, so the full handshake is needed
+bool resumeTaxi(Taxi *taxi, int socket, AuthBuffer *in, const unsigned char *token,
+                unsigned char *newToken) {
+  unsigned char buffer[MAX_AUTH_FRAME_SIZE];
+  const unsigned char *p;
+  AuthFrame frame;
+  int size;
+
+  g_debug("Sending RESUME");
+  size = putAuthFrame(buffer, RESUME, token, RESUME_TOKEN_SIZE);
+  if (write(socket, buffer, size) != size || !readAuthFrame(socket, in, &frame) ||
+      frame.type != RESUME || frame.size != AUTH_RESUME_REPLY_SIZE || frame.payload[0] != ACK) {
+    g_message("Couldn't resume the previous session of taxi %i. Logging in again...", taxi->id);
+    return false;
+  }
+
+  memcpy(taxi->session, frame.payload + 1, SESSION_LENGTH);
+  if (newToken != NULL)
+    memcpy(newToken, frame.payload + 1 + SESSION_LENGTH, RESUME_TOKEN_SIZE);
+  taxi->login = getInt(frame.payload + 1 + SESSION_LENGTH + 4, 4);
+  p = frame.payload + AUTH_STX_REPLY_SIZE;
+
+  taxi->pos = (Coordinate){.x = getInt(p, 4), .y = getInt(p + 4, 4)};
+  if (p[8]) {
+    taxi->lastOrderCompleted = false;
+    taxi->orderedToStop = false;
+    taxi->objective = (Coordinate){.x = getInt(p + 9, 4), .y = getInt(p + 13, 4)};
+    taxi->lastOrderCoord = taxi->objective;
+    taxi->lastOrder = TRESPONSE_GOTO;
+  }
+
+  return true;
+}
+
+const char *authenticateTaxi(Taxi *taxi, Address *central, const unsigned char *token,
+                             unsigned char *newToken, bool *resumed) {
+  unsigned char buffer[2 * MAX_AUTH_FRAME_SIZE];
+  unsigned char proposal[4] = {taxi->id, taxi->id >> 8, taxi->id >> 16, taxi->id >> 24};
+  AuthBuffer in = {0};
+  AuthFrame frame;
+  bool centralReady, received;
+  int size;
+  int socket = tryConnect(central, AUTH_IO_TIMEOUT);
+
+  if (resumed != NULL)
+    *resumed = false;
+
+  if (socket == -1)
+    return "Error connecting to central";
+
+  if (token != NULL) {
+    bool accepted = resumeTaxi(taxi, socket, &in, token, newToken);
+
+    // If the RESUME timed out its answer may still arrive, so the handshake uses a new connection
+    endAuthentication(socket);
+    socket = -1;
+    if (accepted) {
+      if (resumed != NULL)
+        *resumed = true;
+      return NULL;
+    }
+  }
+
+  for (int i = 0; i < AUTH_TRIES; i++) {
+    if (socket == -1) {
+      in.start = in.end = 0;
+      if ((socket = tryConnect(central, AUTH_IO_TIMEOUT)) == -1)
+        return "Error connecting to central";
+    }
+
+    // ENQ and STX are pipelined, the central answers both in the same write
+    size = putAuthFrame(buffer, ENQ, NULL, 0);
+    size += putAuthFrame(buffer + size, STX, proposal, sizeof(proposal));
+
+    g_debug("Sending ENQ and STX");
+    if (write(socket, buffer, size) != size) {
+      endAuthentication(socket);
+      return "Error writing to central";
+    }
+
+    g_debug("Waiting for response");
+    errno = 0;
+    received = readAuthFrame(socket, &in, &frame);
+    if (received && frame.type != ACK && frame.type != NACK) {
+      endAuthentication(socket);
+      return "Invalid message received";
+    }
+    centralReady = received && frame.type == ACK;
+    received = received && readAuthFrame(socket, &in, &frame);
+
+    if (!received && !timedOut()) {
+      endAuthentication(socket);
+      return "Invalid message received";
+    }
+
+    if (!received) {
+      // A late answer would be taken for the one of the next try, so it uses a new connection
+      g_debug("The central didn't answer in time");
+      close(socket);
+      socket = -1;
+    } else {
+      if (frame.type != STX || frame.size != AUTH_STX_REPLY_SIZE ||
+          (frame.payload[0] != ACK && frame.payload[0] != NACK)) {
+        endAuthentication(socket);
+        return "Invalid message received";
+      }
+
+      if (frame.payload[0] == ACK) {
+        g_debug("Received ACK");
+        memcpy(taxi->session, frame.payload + 1, SESSION_LENGTH);
+        if (newToken != NULL)
+          memcpy(newToken, frame.payload + 1 + SESSION_LENGTH, RESUME_TOKEN_SIZE);
+        taxi->login = getInt(frame.payload + 1 + SESSION_LENGTH + 4, 4);
+        endAuthentication(socket);
+        return NULL;
+      }
+
+      g_debug("Received NACK");
+      if (centralReady) {
+        endAuthentication(socket);
+        return "The id is already in use";
+      }
+    }
+
+    if (i < AUTH_TRIES - 1) {
+      g_warning("Connection refused. Retrying...");
+      usleep(AUTH_RETRY_DELAY * 1000 << i);
+    }
+  }
+
+  if (socket != -1)
+    endAuthentication(socket);
+  return "Connection refused. Try limit reached";
+}
+
+bool loginRefused(const Taxi *taxi, const MessageView *response) {
+  return response->subject == TRESPONSE_LOG_IN_AGAIN && viewInt(response) == taxi->login;
+}
+
+bool followOrder(Taxi *taxi, const MessageView *order) {
+  switch (order->subject) {
+  case TRESPONSE_START_SERVICE:
+    taxi->service = viewChar(order);
+    // Fallthrough intended
+  case TRESPONSE_GOTO:
+    taxi->lastOrderCompleted = false;
+    taxi->orderedToStop = false;
+    taxi->objective = viewCoord(order);
+    taxi->lastOrderCoord = taxi->objective;
+    taxi->lastOrder = TRESPONSE_GOTO;
+    return !taxi->canMove;
+
+  case TRESPONSE_STOP:
+    taxi->orderedToStop = true;
+    taxi->lastOrder = TRESPONSE_STOP;
+    return false;
+
+  case TRESPONSE_CONTINUE:
+    taxi->lastOrder = TRESPONSE_CONTINUE;
+    taxi->orderedToStop = false;
+    return !taxi->canMove;
+
+  case TRESPONSE_CHANGE_POSITION:
+    taxi->pos = viewCoord(order);
+    taxi->lastOrder = TRESPONSE_CHANGE_POSITION;
+    taxi->lastOrderCoord = taxi->pos;
+    return false;
+
+  case TRESPONSE_SERVICE_COMPLETED:
+    taxi->service = -1;
+    return false;
+
+  default:
+    return false;
+  }
+}
+
+bool refuseMove(Taxi *taxi, Coordinate current, bool reroute) {
+  Coordinate refused = taxi->pos;
+
+  taxi->pos = current;
+
+  // The objective can't be avoided. The central only refuses it while another taxi is passing
+  // through it, so waiting is enough
+  return reroute && (refused.x != taxi->objective.x || refused.y != taxi->objective.y) &&
+         (refused.x != current.x || refused.y != current.y) && routingAvoid(&taxi->route, refused);
+}
+
+bool stepTaxi(Taxi *taxi, Request *request) {
+  Coordinate next;
+
+  taxi->pos = routingNextStep(&taxi->route, taxi->pos, taxi->objective);
+  request->subject = REQUEST_TAXI_MOVE;
+  request->coord = taxi->pos;
+  // The central reserves the following cell, so no other taxi takes it meanwhile
+  next = routingPeekStep(&taxi->route, taxi->pos, taxi->objective);
+  memcpy(request->data, &next, sizeof(Coordinate));
+
+  if (taxi->pos.x != taxi->objective.x || taxi->pos.y != taxi->objective.y)
+    return false;
+
+  taxi->orderedToStop = true;
+  taxi->lastOrderCompleted = true;
+  return true;
+}
@@ -0,0 +1,99 @@
+#ifndef TAXI_MODULE_H
+#define TAXI_MODULE_H
+
+#include "common.h"
+#include "routing_module.h"
+#include <stdbool.h>
+
+// Delay (ms) before retrying the authentication if the central is still loading its state or
+// doesn't answer in time. It's doubled after each try
+#define AUTH_RETRY_DELAY 200
+// Number of times the authentication is tried while the central is still loading its state or
+// doesn't answer in time
+#define AUTH_TRIES 3
+// Maximum time (ms) connecting to the central, or each read or write of the authentication, can
+// take
+#define AUTH_IO_TIMEOUT 2000
+
+// State of a taxi as its digital engine knows it. It's shared by EC_DE, which drives a single
+// taxi, and EC_Fleet, which drives thousands of them in the same process
+typedef struct {
+  int id;
+  uuid_t session;            // Session of the central the taxi is logged in
+  Coordinate pos;            // Where's the taxi
+  Coordinate objective;      // Where the taxi is going towards
+  Route route;               // Route towards objective, if there are blocked cells
+  bool orderedToStop;        // Doesn't include when stopped because of sensor
+  bool canMove;              // Whether it's possible to move (e.g. sensor connected)
+  char service;              // Customer the taxi is serving, -1 if none
+  SUBJECT lastOrder;         // Last order sent from the central. START_SERVICE is considered a GOTO
+  Coordinate lastOrderCoord; // Coordinate of the last order (if it's a GOTO or a CHANGE_POSITION)
+  bool lastOrderCompleted;   // Whether the last order has been completed or not
+  int login;                 // Generation of the token given at the last login
+} Taxi;
+
+/// @brief Initializes a taxi that hasn't logged in yet: at [1, 1], stopped and without orders
+///
+/// @param taxi Taxi to be initialized. Its route must be zeroed or in use: it's freed, but it stays
+/// lightweight if it was
+/// @param id Id of the taxi
+void initTaxi(Taxi *taxi, int id);
+
+/// @brief Logs a taxi in the central via socket. If there's a resumption token, the previous
+/// session is resumed with it; otherwise (or if the central rejects it) the id is proposed with
+/// the full handshake, which is tried AUTH_TRIES times while the central is still loading its state
+/// or doesn't answer within AUTH_IO_TIMEOUT
+///
+/// @param taxi Taxi to be logged in. Its session is set and, if the previous session is resumed,
+/// its position and objective are restored
+/// @param central Address of the central
+/// @param token Token of a previous login, or NULL to log in from scratch
+/// @param newToken Output argument. Token given by the central to resume this login. May be NULL
+/// @param resumed Output argument. Whether the previous session has been resumed. May be NULL
+/// @return const char* NULL if the taxi is logged in, the reason why it couldn't otherwise
+const char *authenticateTaxi(Taxi *taxi, Address *central, const unsigned char *token,
+                             unsigned char *newToken, bool *resumed);
+
+/// @brief Checks whether the central has refused the last login of a taxi, even though the socket
+/// accepted it (e.g. another digital engine logged in with the same id meanwhile). The taxi must
+/// log in again, the central ignores it until then
+///
+/// @param taxi Taxi the response is addressed to
+/// @param response Response of the central. It must have been checked to be addressed to the taxi
+/// @return true It's a TRESPONSE_LOG_IN_AGAIN for the last login of the taxi
+/// @return false Otherwise. Refusals of older logins or of other digital engines are ignored
+bool loginRefused(const Taxi *taxi, const MessageView *response);
+
+/// @brief Carries out an order of the central. TRESPONSE_WAIT and TRESPONSE_REROUTE are answers
+/// to a move rather than orders, so they're left to refuseMove
+///
+/// @param taxi Taxi the order is addressed to
+/// @param order Order. It must have been checked to be addressed to the taxi
+/// @return true The taxi has been told to move, but it can't. The central must be reminded with
+/// REQUEST_TAXI_CANT_MOVE_REMINDER
+/// @return false Otherwise
+bool followOrder(Taxi *taxi, const MessageView *order);
+
+/// @brief Goes back to where the central says the taxi is after it has refused a move because
+/// there was another taxi in the cell
+///
+/// @param taxi Taxi whose move has been refused
+/// @param current Position of the taxi according to the central
+/// @param reroute Whether to go around the cell instead of waiting for it to be free. Only the
+/// route of this taxi avoids it (see routingAvoid), the blocked cells stay the same
+/// @return true The taxi is going around the cell
+/// @return false It's waiting for it. The objective and the cell the taxi is in are never avoided
+bool refuseMove(Taxi *taxi, Coordinate current, bool reroute);
+
+/// @brief Moves a taxi one step towards its objective, around the blocked cells (see
+/// routingNextStep). If it arrives, its order is completed and it stops
+///
+/// @param taxi Taxi to be moved. It must be able to move and not be ordered to stop
+/// @param request Output argument. Its subject, coordinate and data are set to the
+/// REQUEST_TAXI_MOVE to be sent to the central, which carries the following step too
+/// @return true The taxi has reached its objective. REQUEST_DESTINATION_REACHED must be sent
+/// after the move
+/// @return false Otherwise
+bool stepTaxi(Taxi *taxi, Request *request);
+
+#endif